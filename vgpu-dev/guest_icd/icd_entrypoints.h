@@ -0,0 +1,93 @@
+// icd_entrypoints.h
+// 由 tools/gen_dispatch.py 生成，不要手改。
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vulkan/vulkan.h>
+
+typedef enum {
+    VKVGPU_EP_GLOBAL = 0,
+    VKVGPU_EP_INSTANCE = 1,
+    VKVGPU_EP_PHYSICAL_DEVICE = 2,
+    VKVGPU_EP_DEVICE = 3,
+} VkvgpuEntrypointLevel;
+
+typedef struct {
+    const char*        name;
+    PFN_vkVoidFunction fn;
+    uint32_t           level;
+} VkvgpuEntrypoint;
+
+#define VKVGPU_EP_COUNT      47u
+#define VKVGPU_EP_HASH_SEED  0x000016e2u
+#define VKVGPU_EP_TABLE_MASK 0x7fu
+
+static inline uint32_t vkvgpu_ep_hash(const char* s)
+{
+    uint32_t h = 0x811C9DC5u ^ VKVGPU_EP_HASH_SEED;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 0x01000193u;
+    }
+    return h ^ (h >> 16);
+}
+
+static const VkvgpuEntrypoint vkvgpu_ep_table[VKVGPU_EP_TABLE_MASK + 1] = {
+    [  1] = { "vkCreateSemaphore", (PFN_vkVoidFunction)vkCreateSemaphore, VKVGPU_EP_DEVICE },
+    [  5] = { "vkQueueSubmit", (PFN_vkVoidFunction)vkQueueSubmit, VKVGPU_EP_DEVICE },
+    [  9] = { "vkGetInstanceProcAddr", (PFN_vkVoidFunction)vkGetInstanceProcAddr, VKVGPU_EP_GLOBAL },
+    [ 12] = { "vkDestroyInstance", (PFN_vkVoidFunction)vkDestroyInstance, VKVGPU_EP_INSTANCE },
+    [ 15] = { "vkGetDeviceQueue", (PFN_vkVoidFunction)vkGetDeviceQueue, VKVGPU_EP_DEVICE },
+    [ 16] = { "vkEnumerateInstanceExtensionProperties", (PFN_vkVoidFunction)vkEnumerateInstanceExtensionProperties, VKVGPU_EP_GLOBAL },
+    [ 24] = { "vkQueueDispatchTemplateVGPU", (PFN_vkVoidFunction)vkQueueDispatchTemplateVGPU, VKVGPU_EP_DEVICE },
+    [ 27] = { "vkGetSemaphoreCounterValue", (PFN_vkVoidFunction)vkGetSemaphoreCounterValue, VKVGPU_EP_DEVICE },
+    [ 30] = { "vkGetPhysicalDeviceQueueFamilyProperties", (PFN_vkVoidFunction)vkGetPhysicalDeviceQueueFamilyProperties, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 31] = { "vkGetPhysicalDeviceSurfaceFormatsKHR", (PFN_vkVoidFunction)vkGetPhysicalDeviceSurfaceFormatsKHR, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 32] = { "vkQueuePresentKHR", (PFN_vkVoidFunction)vkQueuePresentKHR, VKVGPU_EP_DEVICE },
+    [ 33] = { "vkEnumeratePhysicalDevices", (PFN_vkVoidFunction)vkEnumeratePhysicalDevices, VKVGPU_EP_INSTANCE },
+    [ 35] = { "vkWaitSemaphores", (PFN_vkVoidFunction)vkWaitSemaphores, VKVGPU_EP_DEVICE },
+    [ 41] = { "vkGetPhysicalDeviceSurfacePresentModesKHR", (PFN_vkVoidFunction)vkGetPhysicalDeviceSurfacePresentModesKHR, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 42] = { "vkSignalSemaphore", (PFN_vkVoidFunction)vkSignalSemaphore, VKVGPU_EP_DEVICE },
+    [ 48] = { "vkMapMemory", (PFN_vkVoidFunction)vkMapMemory, VKVGPU_EP_DEVICE },
+    [ 52] = { "vkAllocateMemory", (PFN_vkVoidFunction)vkAllocateMemory, VKVGPU_EP_DEVICE },
+    [ 53] = { "vkFlushMappedMemoryRanges", (PFN_vkVoidFunction)vkFlushMappedMemoryRanges, VKVGPU_EP_DEVICE },
+    [ 56] = { "vkGetFenceStatus", (PFN_vkVoidFunction)vkGetFenceStatus, VKVGPU_EP_DEVICE },
+    [ 58] = { "vkGetPhysicalDeviceMemoryProperties", (PFN_vkVoidFunction)vkGetPhysicalDeviceMemoryProperties, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 63] = { "vkGetPhysicalDeviceSurfaceCapabilitiesKHR", (PFN_vkVoidFunction)vkGetPhysicalDeviceSurfaceCapabilitiesKHR, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 67] = { "vkUnmapMemory", (PFN_vkVoidFunction)vkUnmapMemory, VKVGPU_EP_DEVICE },
+    [ 70] = { "vkWaitSemaphoresKHR", (PFN_vkVoidFunction)vkWaitSemaphoresKHR, VKVGPU_EP_DEVICE },
+    [ 71] = { "vkGetDeviceProcAddr", (PFN_vkVoidFunction)vkGetDeviceProcAddr, VKVGPU_EP_DEVICE },
+    [ 73] = { "vkInvalidateMappedMemoryRanges", (PFN_vkVoidFunction)vkInvalidateMappedMemoryRanges, VKVGPU_EP_DEVICE },
+    [ 74] = { "vkCreateInstance", (PFN_vkVoidFunction)vkCreateInstance, VKVGPU_EP_GLOBAL },
+    [ 76] = { "vkDeviceWaitIdle", (PFN_vkVoidFunction)vkDeviceWaitIdle, VKVGPU_EP_DEVICE },
+    [ 81] = { "vkAcquireNextImageKHR", (PFN_vkVoidFunction)vkAcquireNextImageKHR, VKVGPU_EP_DEVICE },
+    [ 84] = { "vkWaitForFences", (PFN_vkVoidFunction)vkWaitForFences, VKVGPU_EP_DEVICE },
+    [ 85] = { "vkGetPhysicalDeviceSurfaceSupportKHR", (PFN_vkVoidFunction)vkGetPhysicalDeviceSurfaceSupportKHR, VKVGPU_EP_PHYSICAL_DEVICE },
+    [ 86] = { "vkGetSemaphoreCounterValueKHR", (PFN_vkVoidFunction)vkGetSemaphoreCounterValueKHR, VKVGPU_EP_DEVICE },
+    [ 90] = { "vkFreeMemory", (PFN_vkVoidFunction)vkFreeMemory, VKVGPU_EP_DEVICE },
+    [ 98] = { "vkCreateDevice", (PFN_vkVoidFunction)vkCreateDevice, VKVGPU_EP_PHYSICAL_DEVICE },
+    [101] = { "vkCreateSwapchainKHR", (PFN_vkVoidFunction)vkCreateSwapchainKHR, VKVGPU_EP_DEVICE },
+    [103] = { "vkCreateFence", (PFN_vkVoidFunction)vkCreateFence, VKVGPU_EP_DEVICE },
+    [105] = { "vkCreateDispatchTemplateVGPU", (PFN_vkVoidFunction)vkCreateDispatchTemplateVGPU, VKVGPU_EP_DEVICE },
+    [106] = { "vkResetFences", (PFN_vkVoidFunction)vkResetFences, VKVGPU_EP_DEVICE },
+    [107] = { "vkSignalSemaphoreKHR", (PFN_vkVoidFunction)vkSignalSemaphoreKHR, VKVGPU_EP_DEVICE },
+    [109] = { "vkEnumerateDeviceExtensionProperties", (PFN_vkVoidFunction)vkEnumerateDeviceExtensionProperties, VKVGPU_EP_PHYSICAL_DEVICE },
+    [110] = { "vkEnumerateInstanceLayerProperties", (PFN_vkVoidFunction)vkEnumerateInstanceLayerProperties, VKVGPU_EP_GLOBAL },
+    [113] = { "vkDestroyDispatchTemplateVGPU", (PFN_vkVoidFunction)vkDestroyDispatchTemplateVGPU, VKVGPU_EP_DEVICE },
+    [115] = { "vkQueueWaitIdle", (PFN_vkVoidFunction)vkQueueWaitIdle, VKVGPU_EP_DEVICE },
+    [117] = { "vkDestroySwapchainKHR", (PFN_vkVoidFunction)vkDestroySwapchainKHR, VKVGPU_EP_DEVICE },
+    [120] = { "vkGetSwapchainImagesKHR", (PFN_vkVoidFunction)vkGetSwapchainImagesKHR, VKVGPU_EP_DEVICE },
+    [121] = { "vkDestroySemaphore", (PFN_vkVoidFunction)vkDestroySemaphore, VKVGPU_EP_DEVICE },
+    [125] = { "vkDestroyFence", (PFN_vkVoidFunction)vkDestroyFence, VKVGPU_EP_DEVICE },
+    [126] = { "vkDestroyDevice", (PFN_vkVoidFunction)vkDestroyDevice, VKVGPU_EP_DEVICE },
+};
+
+/* 一次哈希 + 一次 strcmp */
+static inline const VkvgpuEntrypoint* vkvgpu_ep_lookup(const char* name)
+{
+    const VkvgpuEntrypoint* ep = &vkvgpu_ep_table[vkvgpu_ep_hash(name) & VKVGPU_EP_TABLE_MASK];
+    if (!ep->name || strcmp(ep->name, name) != 0) return NULL;
+    return ep;
+}
@@ -0,0 +1,968 @@
+// icd_memory.c
+// 设备内存：host-visible 内存在 guest 里用一份影子页承载应用的读写。
+// 影子页平时写保护，第一次写某页时记下脏页并解除该页的保护；flush / unmap 时只把脏页
+// 发给 daemon，再重新写保护。写保护优先用 userfaultfd：有权限时内核替应用写（read()/recv()
+// 进影子页）也走 fault 线程。只拿到 UFFD_USER_MODE_ONLY 或退到 mprotect + SIGSEGV 时，
+// 内核往还没写过的影子页里写会返回 EFAULT。
+// 影子页是一个 memfd 映射两次：应用用的那份带写保护，ICD 自己从 host 读回时写另一份，
+// 不解除保护也不算脏。GPU 写过的 coherent 范围在 guest 看到对应队列序号
+// （fence / semaphore / 队列空闲）时读回，只覆盖这些范围。
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "icd_private.h"
+#include "icd_pool.h"
+
+#define MEM_MAX_TRACKED 1024   // 同时处于写跟踪的影子映射上限，超出的退化为整段 flush
+
+/* 老头文件里没有的定义 */
+#ifndef UFFD_FEATURE_WP_HUGETLBFS_SHMEM
+#define UFFD_FEATURE_WP_HUGETLBFS_SHMEM (1 << 12)
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef USERFAULTFD_IOC_NEW
+#define USERFAULTFD_IOC_NEW _IO(0xAA, 0x00)
+#endif
+
+struct VirtioDeviceMemory_T {
+    VirtioDevice_T*       device;
+    VkvgpuHandle          memory_id;
+    VkDeviceSize          size;
+    VkMemoryPropertyFlags flags;
+
+    uint8_t*              shadow;       // 第一次 map 时创建，free 时释放
+    uint8_t*              alias;        // 同一份影子页的第二个映射，不做写跟踪，读回时写这里
+    size_t                shadow_size;  // 按页对齐
+    uint64_t*             dirty;        // 每页一位，fault 线程里原子置位
+    int                   track_slot;   // g_tracked 下标，-1 = 没有写跟踪
+    int                   mapped;
+    VirtioDeviceMemory_T* next_mapped;  // dev->mapped_mems（只挂 coherent 内存）
+};
+
+static VkvgpuPool g_memory_pool = VKVGPU_POOL_INIT(VirtioDeviceMemory_T, "memory");
+
+static VirtioDeviceMemory_T* to_memory(VkDeviceMemory memory)
+{
+    return (VirtioDeviceMemory_T*)(uintptr_t)memory;
+}
+
+/* ===========================================================
+ *           写跟踪：userfaultfd 写保护 / mprotect
+ * ===========================================================*/
+
+enum { TRACK_NONE, TRACK_UFFD, TRACK_MPROTECT };
+
+/* 依次尝试的 userfaultfd 打开方式 */
+enum { UFFD_SYSCALL, UFFD_DEVICE, UFFD_USER_ONLY };
+
+static size_t                g_page_size;
+static pthread_once_t        g_uffd_once = PTHREAD_ONCE_INIT;
+static int                   g_track = TRACK_NONE;
+static int                   g_uffd = -1;
+static int                   g_uffd_quit = -1;      // eventfd，卸载时叫 fault 线程退出
+static int                   g_uffd_populate = 0;   // 内核不支持给没分配的页写保护，影子页要预先填好
+static pthread_t             g_uffd_thread;
+static struct sigaction      g_old_segv;            // mprotect 模式下不是影子页的 SIGSEGV 交还给它
+
+static pthread_mutex_t       g_track_lock = PTHREAD_MUTEX_INITIALIZER;
+static VirtioDeviceMemory_T* g_tracked[MEM_MAX_TRACKED];
+static int                   g_tracked_hi = 0;   // fault 线程扫描的上界
+
+static int page_test(const VirtioDeviceMemory_T* m, size_t page)
+{
+    return (__atomic_load_n(&m->dirty[page / 64], __ATOMIC_RELAXED) >> (page % 64)) & 1;
+}
+
+static void page_clear(VirtioDeviceMemory_T* m, size_t page)
+{
+    __atomic_fetch_and(&m->dirty[page / 64], ~(1ull << (page % 64)), __ATOMIC_RELAXED);
+}
+
+static int uffd_wp(const uint8_t* addr, size_t len, __u64 mode)
+{
+    struct uffdio_writeprotect wp;
+    wp.range.start = (uintptr_t)addr;
+    wp.range.len   = len;
+    wp.mode        = mode;
+    return ioctl(g_uffd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+/* protect 非 0 = 写保护，0 = 放开 */
+static int wp_range(const uint8_t* addr, size_t len, int protect)
+{
+    if (g_track == TRACK_MPROTECT)
+        return mprotect((void*)addr, len, protect ? PROT_READ : PROT_READ | PROT_WRITE);
+    if (g_track == TRACK_UFFD)
+        return uffd_wp(addr, len, protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0);
+    return -1;
+}
+
+/* 找到地址所属的跟踪内存；在 SIGSEGV 处理函数里也会调用，只用原子操作 */
+static VirtioDeviceMemory_T* track_find(uintptr_t addr)
+{
+    int hi = __atomic_load_n(&g_tracked_hi, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < hi; i++) {
+        VirtioDeviceMemory_T* m = __atomic_load_n(&g_tracked[i], __ATOMIC_ACQUIRE);
+        if (!m) continue;
+        uintptr_t base = (uintptr_t)m->shadow;
+        if (addr >= base && addr < base + m->shadow_size)
+            return m;
+    }
+    return NULL;
+}
+
+static void page_mark(VirtioDeviceMemory_T* m, uintptr_t addr)
+{
+    size_t page = (addr - (uintptr_t)m->shadow) / g_page_size;
+    __atomic_fetch_or(&m->dirty[page / 64], 1ull << (page % 64), __ATOMIC_RELAXED);
+}
+
+/*
+ * 先解除写保护再置脏位，最后才唤醒写的线程：flush 端是先清位、再写保护、最后拷数据，
+ * 两边任意交错都不会出现“页可写但脏位是 0”的状态。找不到所属内存（正在释放）也要放行。
+ */
+static void* uffd_thread(void* arg)
+{
+    (void)arg;
+    struct pollfd fds[2] = { { g_uffd, POLLIN, 0 }, { g_uffd_quit, POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+
+        struct uffd_msg msg;
+        ssize_t n = read(g_uffd, &msg, sizeof(msg));
+        if (n != (ssize_t)sizeof(msg)) {
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            break;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT ||
+            !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP))
+            continue;
+
+        uintptr_t page = (uintptr_t)msg.arg.pagefault.address & ~(uintptr_t)(g_page_size - 1);
+        uffd_wp((const uint8_t*)page, g_page_size, UFFDIO_WRITEPROTECT_MODE_DONTWAKE);
+        VirtioDeviceMemory_T* m = track_find(page);
+        if (m) page_mark(m, page);
+        struct uffdio_range range = { page, g_page_size };
+        ioctl(g_uffd, UFFDIO_WAKE, &range);
+    }
+    return NULL;
+}
+
+/*
+ * 不带 UFFD_USER_MODE_ONLY 的 userfaultfd 也能接住内核替应用写的 fault，但默认
+ * vm.unprivileged_userfaultfd=0 时普通进程只能通过 /dev/userfaultfd 拿到；都不行才退到
+ * UFFD_USER_MODE_ONLY。
+ */
+static int uffd_create(int how)
+{
+    int flags = O_CLOEXEC | O_NONBLOCK;
+    if (how == UFFD_DEVICE) {
+        int dev = open("/dev/userfaultfd", O_RDWR | O_CLOEXEC);
+        if (dev < 0) return -1;
+        int fd = ioctl(dev, USERFAULTFD_IOC_NEW, flags);
+        close(dev);
+        return fd;
+    }
+    if (how == UFFD_USER_ONLY)
+        flags |= UFFD_USER_MODE_ONLY;
+    return (int)syscall(SYS_userfaultfd, flags);
+}
+
+static int uffd_open(int how, __u64 features)
+{
+    int fd = uffd_create(how);
+    if (fd < 0) return -1;
+    struct uffdio_api api;
+    memset(&api, 0, sizeof(api));
+    api.api      = UFFD_API;
+    api.features = features;
+    if (ioctl(fd, UFFDIO_API, &api) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 影子页是 memfd，要内核支持给 shmem 写保护（5.19+），不支持的走 mprotect */
+static int uffd_start(void)
+{
+    static const int hows[] = { UFFD_SYSCALL, UFFD_DEVICE, UFFD_USER_ONLY };
+    const __u64 wp = UFFD_FEATURE_PAGEFAULT_FLAG_WP | UFFD_FEATURE_WP_HUGETLBFS_SHMEM;
+    for (size_t i = 0; i < sizeof(hows) / sizeof(hows[0]) && g_uffd < 0; i++) {
+        g_uffd = uffd_open(hows[i], wp | UFFD_FEATURE_WP_UNPOPULATED);
+        if (g_uffd < 0) {
+            g_uffd = uffd_open(hows[i], wp);
+            g_uffd_populate = g_uffd >= 0;
+        }
+        if (g_uffd >= 0 && hows[i] == UFFD_USER_ONLY)
+            LOG("userfaultfd limited to user-mode faults, kernel writes into clean mapped pages fail");
+    }
+    if (g_uffd < 0) {
+        LOG("userfaultfd write-protect unavailable (errno %d)", errno);
+        return -1;
+    }
+    g_uffd_quit = eventfd(0, EFD_CLOEXEC);
+    if (g_uffd_quit < 0 || pthread_create(&g_uffd_thread, NULL, uffd_thread, NULL) != 0) {
+        LOG("cannot start userfaultfd thread");
+        if (g_uffd_quit >= 0) close(g_uffd_quit);
+        close(g_uffd);
+        g_uffd = g_uffd_quit = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * mprotect 退路：写到只读影子页触发 SIGSEGV，在处理函数里放开该页再置脏位，顺序同 uffd_thread。
+ * 不是影子页的交还给之前的处理函数；之前是默认处理时恢复默认，返回后重新触发。
+ */
+static void segv_handler(int sig, siginfo_t* info, void* ctx)
+{
+    uintptr_t page = (uintptr_t)info->si_addr & ~(uintptr_t)(g_page_size - 1);
+    VirtioDeviceMemory_T* m = info->si_code == SEGV_ACCERR ? track_find(page) : NULL;
+    if (m) {
+        mprotect((void*)page, g_page_size, PROT_READ | PROT_WRITE);
+        page_mark(m, page);
+        return;
+    }
+    if (g_old_segv.sa_flags & SA_SIGINFO)
+        g_old_segv.sa_sigaction(sig, info, ctx);
+    else if (g_old_segv.sa_handler != SIG_DFL && g_old_segv.sa_handler != SIG_IGN)
+        g_old_segv.sa_handler(sig);
+    else
+        signal(SIGSEGV, SIG_DFL);
+}
+
+static int segv_start(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv_handler;
+    sa.sa_flags     = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, &g_old_segv) != 0) {
+        LOG("cannot install SIGSEGV handler, mapped memory will be flushed whole");
+        return -1;
+    }
+    LOG("tracking mapped memory with mprotect, kernel writes into clean mapped pages fail");
+    return 0;
+}
+
+static void uffd_init(void)
+{
+    g_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (uffd_start() == 0)
+        g_track = TRACK_UFFD;
+    else if (segv_start() == 0)
+        g_track = TRACK_MPROTECT;
+}
+
+/*
+ * ICD 被 dlclose 前停掉写跟踪：关掉 userfaultfd 后还留着的影子页自动解除注册；
+ * mprotect 模式下先放开所有影子页再交还 SIGSEGV，再写也不会卡住或崩溃。
+ */
+__attribute__((destructor))
+static void uffd_shutdown(void)
+{
+    int track = g_track;
+    g_track = TRACK_NONE;
+    if (track == TRACK_MPROTECT) {
+        pthread_mutex_lock(&g_track_lock);
+        for (int i = 0; i < g_tracked_hi; i++) {
+            if (g_tracked[i])
+                mprotect(g_tracked[i]->shadow, g_tracked[i]->shadow_size, PROT_READ | PROT_WRITE);
+        }
+        pthread_mutex_unlock(&g_track_lock);
+        sigaction(SIGSEGV, &g_old_segv, NULL);
+        return;
+    }
+    if (g_uffd < 0) return;
+    uint64_t one = 1;
+    if (write(g_uffd_quit, &one, sizeof(one)) == (ssize_t)sizeof(one))
+        pthread_join(g_uffd_thread, NULL);
+    close(g_uffd_quit);
+    close(g_uffd);
+    g_uffd = g_uffd_quit = -1;
+}
+
+static int track_register(VirtioDeviceMemory_T* m)
+{
+    if (g_track == TRACK_NONE) return -1;
+
+    int slot = -1;
+    pthread_mutex_lock(&g_track_lock);
+    for (int i = 0; i < MEM_MAX_TRACKED; i++) {
+        if (!g_tracked[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        __atomic_store_n(&g_tracked[slot], m, __ATOMIC_RELEASE);
+        if (slot >= g_tracked_hi)
+            __atomic_store_n(&g_tracked_hi, slot + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_track_lock);
+    return slot;
+}
+
+static void track_unregister(VirtioDeviceMemory_T* m)
+{
+    if (m->track_slot < 0) return;
+    pthread_mutex_lock(&g_track_lock);
+    __atomic_store_n(&g_tracked[m->track_slot], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_track_lock);
+    m->track_slot = -1;
+}
+
+/* ===========================================================
+ *                       影子页
+ * ===========================================================*/
+
+/* 注册写保护并整段保护起来；失败时退化为没有写跟踪 */
+static int track_start(VirtioDeviceMemory_T* m)
+{
+    m->track_slot = track_register(m);
+    if (m->track_slot < 0) return -1;
+
+    if (g_track == TRACK_MPROTECT) {
+        if (wp_range(m->shadow, m->shadow_size, 1) == 0)
+            return 0;
+        track_unregister(m);
+        return -1;
+    }
+
+    struct uffdio_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = (uintptr_t)m->shadow;
+    reg.range.len   = m->shadow_size;
+    reg.mode        = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(g_uffd, UFFDIO_REGISTER, &reg) == 0) {
+        if ((reg.ioctls & (1ull << _UFFDIO_WRITEPROTECT)) &&
+            wp_range(m->shadow, m->shadow_size, 1) == 0)
+            return 0;
+        struct uffdio_range range = { reg.range.start, reg.range.len };
+        ioctl(g_uffd, UFFDIO_UNREGISTER, &range);
+    }
+    track_unregister(m);
+    return -1;
+}
+
+static VkResult mem_create_shadow(VirtioDeviceMemory_T* m)
+{
+    pthread_once(&g_uffd_once, uffd_init);
+
+    size_t sz = ((size_t)m->size + g_page_size - 1) & ~(g_page_size - 1);
+    int fd = memfd_create("vkvgpu-shadow", MFD_CLOEXEC);
+    if (fd < 0)
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    if (ftruncate(fd, (off_t)sz) != 0) {
+        close(fd);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    /* 老内核只能给已经有页表项的页写保护，先把整段填上 */
+    int populate = g_track == TRACK_UFFD && g_uffd_populate ? MAP_POPULATE : 0;
+    void* p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED | populate, fd, 0);
+    void* a = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED || a == MAP_FAILED) {
+        if (p != MAP_FAILED) munmap(p, sz);
+        if (a != MAP_FAILED) munmap(a, sz);
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+
+    size_t pages = sz / g_page_size;
+    m->dirty = (uint64_t*)calloc((pages + 63) / 64, sizeof(uint64_t));
+    if (!m->dirty) {
+        munmap(p, sz);
+        munmap(a, sz);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    m->shadow      = (uint8_t*)p;
+    m->alias       = (uint8_t*)a;
+    m->shadow_size = sz;
+
+    if (track_start(m) != 0)
+        LOG("memory %llu: no write tracking, flushes send whole ranges",
+            (unsigned long long)m->memory_id);
+    return VK_SUCCESS;
+}
+
+static void mem_destroy_shadow(VirtioDeviceMemory_T* m)
+{
+    if (!m->shadow) return;
+    if (m->track_slot >= 0) {
+        track_unregister(m);
+        if (g_track == TRACK_UFFD) {
+            struct uffdio_range range = { (uintptr_t)m->shadow, m->shadow_size };
+            ioctl(g_uffd, UFFDIO_UNREGISTER, &range);
+        }
+    }
+    munmap(m->shadow, m->shadow_size);
+    munmap(m->alias, m->shadow_size);
+    free(m->dirty);
+    m->shadow = NULL;
+    m->alias  = NULL;
+    m->dirty  = NULL;
+}
+
+/* 影子页 [offset, offset+size) 发给 daemon，按传输上限拆分 */
+static int mem_send(VirtioDeviceMemory_T* m, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t ctx_id = m->device->instance->ctx_id;
+    while (size > 0) {
+        uint32_t n = size < VKVGPU_MAX_TRANSFER_CHUNK ? (uint32_t)size : VKVGPU_MAX_TRANSFER_CHUNK;
+
+        VkvgpuMemoryRangePayload req;
+        req.memory_id = m->memory_id;
+        req.offset    = offset;
+        req.size      = n;
+        if (vkvgpu_send_async_data(ctx_id, VKVGPU_CMD_WRITE_MEMORY, &req, sizeof(req),
+                                   m->shadow + offset, n) != 0)
+            return -1;
+
+        offset += n;
+        size   -= n;
+    }
+    return 0;
+}
+
+/* VK_WHOLE_SIZE / 越界的 size 收敛到分配末尾，返回结束偏移 */
+static VkDeviceSize mem_range_end(const VirtioDeviceMemory_T* m,
+                                  VkDeviceSize offset, VkDeviceSize size)
+{
+    if (size == VK_WHOLE_SIZE || offset + size > m->size)
+        return m->size;
+    return offset + size;
+}
+
+/*
+ * 只发送 [offset, end) 里的脏页。被范围完全覆盖的页清脏位并重新写保护；
+ * 首尾只覆盖一部分的页只发交集，脏位保留，范围外的那部分下次 flush 还会发。
+ */
+static int mem_flush_range(VirtioDeviceMemory_T* m, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (!m->shadow) return 0;
+    VkDeviceSize end = mem_range_end(m, offset, size);
+    if (offset >= end) return 0;
+
+    if (m->track_slot < 0)
+        return mem_send(m, offset, end - offset);
+
+    size_t pg         = g_page_size;
+    size_t first      = offset / pg;
+    size_t last       = (end - 1) / pg;
+    size_t full_first = (offset + pg - 1) / pg;
+    size_t full_end   = end == m->size ? last + 1 : end / pg;
+
+    size_t p = first;
+    while (p <= last) {
+        if (!page_test(m, p)) {
+            p++;
+            continue;
+        }
+        size_t run = p;
+        while (run <= last && page_test(m, run))
+            run++;
+
+        /* 清位 -> 写保护 -> 拷数据，顺序见 uffd_thread */
+        size_t lo = p > full_first ? p : full_first;
+        size_t hi = run < full_end ? run : full_end;
+        if (lo < hi) {
+            for (size_t i = lo; i < hi; i++)
+                page_clear(m, i);
+            wp_range(m->shadow + lo * pg, (hi - lo) * pg, 1);
+        }
+
+        VkDeviceSize send_lo = (VkDeviceSize)p * pg;
+        VkDeviceSize send_hi = (VkDeviceSize)run * pg;
+        if (send_lo < offset) send_lo = offset;
+        if (send_hi > end)    send_hi = end;
+        if (mem_send(m, send_lo, send_hi - send_lo) != 0)
+            return -1;
+
+        p = run;
+    }
+    return 0;
+}
+
+/* ===========================================================
+ *                         读回
+ * ===========================================================*/
+
+#define READBACK_STREAM_MIN (64u * 1024u)   // 更小的读回一个 socket 回复就够了
+#define READBACK_POLL_MS    10
+
+/* 退路：READ_MEMORY 按传输上限分块，数据在回复 payload 里 */
+static int readback_socket(VirtioInstance_T* inst, VkvgpuHandle memory_id,
+                           uint64_t offset, uint64_t size, uint8_t* dst)
+{
+    int rc = 0;
+    while (size > 0 && rc == 0) {
+        uint32_t n = size < VKVGPU_MAX_TRANSFER_CHUNK ? (uint32_t)size : VKVGPU_MAX_TRANSFER_CHUNK;
+        VkvgpuMemoryRangePayload req;
+        req.memory_id = memory_id;
+        req.offset    = offset;
+        req.size      = n;
+        rc = vkvgpu_call(inst->ctx_id, VKVGPU_CMD_READ_MEMORY, &req, sizeof(req), dst, n);
+        offset += n;
+        size   -= n;
+        dst    += n;
+    }
+    return rc;
+}
+
+/* 调用者持有 readback_lock */
+static uint8_t* readback_region(VirtioInstance_T* inst)
+{
+    if (inst->readback_state == 0) {
+        inst->readback_id  = vkvgpu_alloc_object_id(inst);
+        inst->readback_map = (uint8_t*)vkvgpu_shared_region_create(
+            inst, inst->readback_id, VKVGPU_READBACK_REGION_SIZE);
+        inst->readback_state = inst->readback_map ? 1 : -1;
+        if (!inst->readback_map)
+            LOG("no shared readback region, reading back through the socket");
+    }
+    return inst->readback_state > 0 ? inst->readback_map : NULL;
+}
+
+/*
+ * daemon 把数据分块写进共享区的槽里，guest 在等回复的同时边收边拷；
+ * 回复只带 status。调用者持有 readback_lock。
+ */
+static int readback_stream(VirtioInstance_T* inst, uint8_t* region, VkvgpuHandle memory_id,
+                           uint64_t offset, uint64_t size, uint8_t* dst)
+{
+    VkvgpuReadbackCtl* ctl   = (VkvgpuReadbackCtl*)region;
+    uint8_t*           slots = region + VKVGPU_READBACK_CTL_SIZE;
+
+    VkvgpuReadbackRequestPayload req;
+    req.region_id = inst->readback_id;
+    req.memory_id = memory_id;
+    req.offset    = offset;
+    req.size      = size;
+    if (vkvgpu_call_begin(inst->ctx_id, VKVGPU_CMD_READBACK_MEMORY, &req, sizeof(req)) != 0)
+        return -1;
+
+    uint32_t consumed = __atomic_load_n(&ctl->consumed, __ATOMIC_RELAXED);
+    uint64_t left = size;
+    while (left > 0) {
+        uint32_t produced = __atomic_load_n(&ctl->produced, __ATOMIC_ACQUIRE);
+        if (produced != consumed) {
+            uint64_t n = left < VKVGPU_MAX_TRANSFER_CHUNK ? left : VKVGPU_MAX_TRANSFER_CHUNK;
+            memcpy(dst, slots + (size_t)(consumed % VKVGPU_READBACK_SLOTS) * VKVGPU_MAX_TRANSFER_CHUNK, n);
+            consumed++;
+            __atomic_store_n(&ctl->consumed, consumed, __ATOMIC_RELEASE);
+            vkvgpu_futex_wake(&ctl->consumed);
+            dst  += n;
+            left -= n;
+            continue;
+        }
+        if (__atomic_load_n(&ctl->error, __ATOMIC_ACQUIRE) != 0)
+            break;
+        /* 超时后看一眼回复是否已经到了：到了且没有新分块，说明 daemon 提前结束 */
+        if (vkvgpu_futex_wait(&ctl->produced, produced, READBACK_POLL_MS) != 0 &&
+            vkvgpu_reply_pending() &&
+            __atomic_load_n(&ctl->produced, __ATOMIC_ACQUIRE) == consumed)
+            break;
+    }
+
+    int rc = vkvgpu_call_end(inst->ctx_id, VKVGPU_CMD_READBACK_MEMORY, NULL, 0);
+    /* 出错时 daemon 可能多写了几块：对齐计数器，下一次从同一起点开始 */
+    __atomic_store_n(&ctl->consumed, __atomic_load_n(&ctl->produced, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+    if (rc == 0 && left > 0) rc = -1;
+    return rc;
+}
+
+static int mem_readback(VirtioDeviceMemory_T* m, VkDeviceSize offset, VkDeviceSize size,
+                        uint8_t* dst)
+{
+    VirtioInstance_T* inst = m->device->instance;
+    if (size >= READBACK_STREAM_MIN) {
+        pthread_mutex_lock(&inst->readback_lock);
+        uint8_t* region = readback_region(inst);
+        int rc = region ? readback_stream(inst, region, m->memory_id, offset, size, dst) : 0;
+        pthread_mutex_unlock(&inst->readback_lock);
+        if (region) return rc;
+    }
+    return readback_socket(inst, m->memory_id, offset, size, dst);
+}
+
+void vkvgpu_readback_release(VirtioInstance_T* inst)
+{
+    /* daemon 侧的共享区随上下文一起回收 */
+    vkvgpu_shared_region_unmap(inst->readback_map, VKVGPU_READBACK_REGION_SIZE);
+    inst->readback_map   = NULL;
+    inst->readback_state = 0;
+}
+
+/*
+ * 从 daemon 读回 [offset, end) 覆盖影子页，经 alias 写入，应用那份的写保护不动。
+ * 规范里没 flush 就 invalidate 的主机写内容未定义，所以完全覆盖的页直接算干净；
+ * 首尾只覆盖一部分的页范围外可能有应用的写，脏位保留。
+ */
+static int mem_invalidate_range(VirtioDeviceMemory_T* m, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (!m->shadow) return 0;
+    VkDeviceSize end = mem_range_end(m, offset, size);
+    if (offset >= end) return 0;
+
+    int rc = mem_readback(m, offset, end - offset, m->alias + offset);
+    if (rc != 0 || m->track_slot < 0) return rc;
+
+    /* 清位 -> 写保护，顺序同 mem_flush_range */
+    size_t pg         = g_page_size;
+    size_t full_first = (offset + pg - 1) / pg;
+    size_t full_end   = end == m->size ? (end + pg - 1) / pg : end / pg;
+    for (size_t p = full_first; p < full_end; p++) {
+        if (!page_test(m, p)) continue;
+        page_clear(m, p);
+        wp_range(m->shadow + p * pg, pg, 1);
+    }
+    return 0;
+}
+
+/* ===========================================================
+ *                    内存属性（缓存）
+ * ===========================================================*/
+
+int vkvgpu_get_memory_properties(VirtioPhysicalDevice_T* pd)
+{
+    if (__atomic_load_n(&pd->mem_props_valid, __ATOMIC_ACQUIRE))
+        return 0;
+
+    VkvgpuGetMemoryPropertiesRequestPayload req;
+    memset(&req, 0, sizeof(req));
+    req.instance_id = pd->instance->instance_id;
+    req.phys_index  = pd->id;
+
+    VkvgpuMemoryPropertiesPayload reply;
+    if (vkvgpu_call(pd->instance->ctx_id, VKVGPU_CMD_GET_MEMORY_PROPERTIES,
+                    &req, sizeof(req), &reply, sizeof(reply)) != 0)
+        return -1;
+
+    /* 多个线程同时第一次查询时各自填一遍，内容相同 */
+    VkPhysicalDeviceMemoryProperties* props = &pd->mem_props;
+    memset(props, 0, sizeof(*props));
+    props->memoryTypeCount = reply.type_count < VK_MAX_MEMORY_TYPES
+                           ? reply.type_count : VK_MAX_MEMORY_TYPES;
+    props->memoryHeapCount = reply.heap_count < VK_MAX_MEMORY_HEAPS
+                           ? reply.heap_count : VK_MAX_MEMORY_HEAPS;
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        props->memoryTypes[i].propertyFlags = reply.types[i].property_flags;
+        props->memoryTypes[i].heapIndex     = reply.types[i].heap_index;
+    }
+    for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+        props->memoryHeaps[i].size  = reply.heaps[i].size;
+        props->memoryHeaps[i].flags = reply.heaps[i].flags;
+    }
+    __atomic_store_n(&pd->mem_props_valid, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+VkResult vkvgpu_memory_flush_coherent(VirtioDevice_T* dev)
+{
+    VkResult r = VK_SUCCESS;
+    pthread_mutex_lock(&dev->mem_lock);
+    for (VirtioDeviceMemory_T* m = dev->mapped_mems; m; m = m->next_mapped) {
+        if (mem_flush_range(m, 0, VK_WHOLE_SIZE) != 0) {
+            r = VK_ERROR_DEVICE_LOST;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->mem_lock);
+    return r;
+}
+
+VkResult vkvgpu_memory_gpu_write_reserve(VirtioDevice_T* dev, uint32_t count)
+{
+    pthread_mutex_lock(&dev->mem_lock);
+    if (dev->gpu_write_cap - dev->gpu_write_count < count) {
+        uint32_t cap = dev->gpu_write_cap ? dev->gpu_write_cap : 16;
+        while (cap - dev->gpu_write_count < count)
+            cap *= 2;
+        VkvgpuGpuWrite* p = (VkvgpuGpuWrite*)realloc(dev->gpu_writes, cap * sizeof(*p));
+        if (!p) {
+            pthread_mutex_unlock(&dev->mem_lock);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        dev->gpu_writes    = p;
+        dev->gpu_write_cap = cap;
+    }
+    return VK_SUCCESS;
+}
+
+/* 同一段反复被写（循环调用同一个模板）只留一条，按最后一次的序号读回 */
+void vkvgpu_memory_gpu_write_commit(VirtioDevice_T* dev, const VkvgpuGpuWrite* writes,
+                                    uint32_t count, uint64_t serial)
+{
+    for (uint32_t k = 0; k < count; k++) {
+        const VkvgpuGpuWrite* src = &writes[k];
+        if (!(to_memory(src->memory)->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+            continue;
+        uint32_t i = 0;
+        while (i < dev->gpu_write_count) {
+            const VkvgpuGpuWrite* w = &dev->gpu_writes[i];
+            if (w->memory == src->memory && w->offset == src->offset && w->size == src->size)
+                break;
+            i++;
+        }
+        dev->gpu_writes[i] = *src;
+        dev->gpu_writes[i].serial = serial;
+        if (i == dev->gpu_write_count)
+            dev->gpu_write_count++;
+    }
+    pthread_mutex_unlock(&dev->mem_lock);
+}
+
+/* 内存释放时丢掉它还没读回的范围 */
+static void gpu_writes_drop(VirtioDevice_T* dev, VkDeviceMemory memory)
+{
+    pthread_mutex_lock(&dev->mem_lock);
+    for (uint32_t i = 0; i < dev->gpu_write_count;) {
+        if (dev->gpu_writes[i].memory == memory)
+            dev->gpu_writes[i] = dev->gpu_writes[--dev->gpu_write_count];
+        else
+            i++;
+    }
+    pthread_mutex_unlock(&dev->mem_lock);
+}
+
+/*
+ * 只读回 GPU 写的那段，经 alias 写入：影子页一直保持写保护，同一页里范围外应用并发的写
+ * 不会被覆盖，也不会因为读回变成脏页再发回 host。没有写跟踪的内存也一样只写这一段。
+ * 还没 map 过（没有影子页）的不用读，第一次 map 时影子页才建。
+ */
+VkResult vkvgpu_memory_refresh_coherent(VirtioDevice_T* dev, uint64_t completed)
+{
+    if (__atomic_load_n(&dev->coherent_serial, __ATOMIC_ACQUIRE) >= completed)
+        return VK_SUCCESS;
+
+    int rc = 0;
+    pthread_mutex_lock(&dev->mem_lock);
+    if (dev->coherent_serial < completed) {
+        for (uint32_t i = 0; i < dev->gpu_write_count && rc == 0;) {
+            VkvgpuGpuWrite* w = &dev->gpu_writes[i];
+            if (w->serial > completed) {
+                i++;
+                continue;
+            }
+            VirtioDeviceMemory_T* m = to_memory(w->memory);
+            if (m->shadow) {
+                VkDeviceSize end = mem_range_end(m, w->offset, w->size);
+                if (w->offset < end)
+                    rc = mem_readback(m, w->offset, end - w->offset, m->alias + w->offset);
+            }
+            if (rc == 0)
+                dev->gpu_writes[i] = dev->gpu_writes[--dev->gpu_write_count];
+        }
+        if (rc == 0)
+            __atomic_store_n(&dev->coherent_serial, completed, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&dev->mem_lock);
+    return rc == 0 ? VK_SUCCESS : vkvgpu_result(rc, VK_ERROR_DEVICE_LOST);
+}
+
+VkvgpuHandle vkvgpu_memory_id(VkDeviceMemory memory)
+{
+    return to_memory(memory)->memory_id;
+}
+
+static void mapped_list_remove(VirtioDevice_T* dev, VirtioDeviceMemory_T* m)
+{
+    pthread_mutex_lock(&dev->mem_lock);
+    for (VirtioDeviceMemory_T** pp = &dev->mapped_mems; *pp; pp = &(*pp)->next_mapped) {
+        if (*pp == m) {
+            *pp = m->next_mapped;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->mem_lock);
+    m->next_mapped = NULL;
+}
+
+/* ===========================================================
+ *                     Vulkan ICD 实现
+ * ===========================================================*/
+
+VKAPI_ATTR void VKAPI_CALL
+vkGetPhysicalDeviceMemoryProperties(
+    VkPhysicalDevice                  physicalDevice,
+    VkPhysicalDeviceMemoryProperties* pMemoryProperties)
+{
+    VirtioPhysicalDevice_T* pd = (VirtioPhysicalDevice_T*)physicalDevice;
+    if (vkvgpu_get_memory_properties(pd) != 0) {
+        LOG("GET_MEMORY_PROPERTIES failed");
+        memset(pMemoryProperties, 0, sizeof(*pMemoryProperties));
+        return;
+    }
+    *pMemoryProperties = pd->mem_props;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkAllocateMemory(
+    VkDevice                     device,
+    const VkMemoryAllocateInfo*  pAllocateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDeviceMemory*              pMemory)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    if (vkvgpu_get_memory_properties(dev->phys) != 0)
+        return VK_ERROR_DEVICE_LOST;
+    if (pAllocateInfo->memoryTypeIndex >= dev->phys->mem_props.memoryTypeCount)
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    VirtioDeviceMemory_T* mem = (VirtioDeviceMemory_T*)
+        vkvgpu_obj_alloc(&g_memory_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (!mem) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    mem->device     = dev;
+    mem->memory_id  = vkvgpu_alloc_object_id(dev->instance);
+    mem->size       = pAllocateInfo->allocationSize;
+    mem->flags      = dev->phys->mem_props.memoryTypes[pAllocateInfo->memoryTypeIndex].propertyFlags;
+    mem->track_slot = -1;
+
+    VkvgpuAllocateMemoryRequestPayload req;
+    memset(&req, 0, sizeof(req));
+    req.device_id  = dev->device_id;
+    req.memory_id  = mem->memory_id;
+    req.size       = pAllocateInfo->allocationSize;
+    req.type_index = pAllocateInfo->memoryTypeIndex;
+    if (vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_ALLOCATE_MEMORY,
+                          &req, sizeof(req)) != 0) {
+        vkvgpu_obj_free(&g_memory_pool, pAllocator, mem);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    *pMemory = (VkDeviceMemory)(uintptr_t)mem;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkFreeMemory(
+    VkDevice                     device,
+    VkDeviceMemory               memory,
+    const VkAllocationCallbacks* pAllocator)
+{
+    VirtioDevice_T*       dev = (VirtioDevice_T*)device;
+    VirtioDeviceMemory_T* mem = to_memory(memory);
+    if (!mem) return;
+
+    /* 映射着就释放是合法的，脏数据直接丢掉 */
+    if (mem->mapped && (mem->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        mapped_list_remove(dev, mem);
+    if (mem->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        gpu_writes_drop(dev, memory);
+    mem_destroy_shadow(mem);
+
+    VkvgpuFreeMemoryRequestPayload req;
+    req.memory_id = mem->memory_id;
+    vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_FREE_MEMORY, &req, sizeof(req));
+    vkvgpu_obj_free(&g_memory_pool, pAllocator, mem);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkMapMemory(
+    VkDevice         device,
+    VkDeviceMemory   memory,
+    VkDeviceSize     offset,
+    VkDeviceSize     size,
+    VkMemoryMapFlags flags,
+    void**           ppData)
+{
+    (void)size;
+    (void)flags;
+    VirtioDevice_T*       dev = (VirtioDevice_T*)device;
+    VirtioDeviceMemory_T* mem = to_memory(memory);
+
+    if (!(mem->flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+        return VK_ERROR_MEMORY_MAP_FAILED;
+
+    /* 影子页在 unmap 后保留，再次 map 时内容不变 */
+    if (!mem->shadow) {
+        VkResult r = mem_create_shadow(mem);
+        if (r != VK_SUCCESS) return r;
+    }
+
+    if (!mem->mapped && (mem->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        pthread_mutex_lock(&dev->mem_lock);
+        mem->next_mapped = dev->mapped_mems;
+        dev->mapped_mems = mem;
+        pthread_mutex_unlock(&dev->mem_lock);
+    }
+    mem->mapped = 1;
+
+    *ppData = mem->shadow + offset;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkUnmapMemory(
+    VkDevice       device,
+    VkDeviceMemory memory)
+{
+    VirtioDevice_T*       dev = (VirtioDevice_T*)device;
+    VirtioDeviceMemory_T* mem = to_memory(memory);
+    if (!mem->mapped) return;
+
+    /* coherent 内存不会有显式 flush，解除映射时把脏页带走 */
+    if (mem->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        mapped_list_remove(dev, mem);
+        if (mem_flush_range(mem, 0, VK_WHOLE_SIZE) != 0)
+            LOG("flush on unmap failed for memory %llu", (unsigned long long)mem->memory_id);
+    }
+    mem->mapped = 0;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkFlushMappedMemoryRanges(
+    VkDevice                   device,
+    uint32_t                   memoryRangeCount,
+    const VkMappedMemoryRange* pMemoryRanges)
+{
+    (void)device;
+    for (uint32_t i = 0; i < memoryRangeCount; i++) {
+        const VkMappedMemoryRange* r = &pMemoryRanges[i];
+        if (mem_flush_range(to_memory(r->memory), r->offset, r->size) != 0)
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkInvalidateMappedMemoryRanges(
+    VkDevice                   device,
+    uint32_t                   memoryRangeCount,
+    const VkMappedMemoryRange* pMemoryRanges)
+{
+    (void)device;
+    for (uint32_t i = 0; i < memoryRangeCount; i++) {
+        const VkMappedMemoryRange* r = &pMemoryRanges[i];
+        int rc = mem_invalidate_range(to_memory(r->memory), r->offset, r->size);
+        if (rc != 0)
+            return vkvgpu_result(rc, VK_ERROR_OUT_OF_HOST_MEMORY);
+    }
+    return VK_SUCCESS;
+}
@@ -0,0 +1,226 @@
+// icd_pool.c
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+
+#include "icd_pool.h"
+#include "icd_private.h"
+
+#define POOL_ALIGN       16
+#define POOL_SLAB_BYTES  (64 * 1024)
+#define POOL_MAX_TYPES   32
+#define POOL_MAG_SIZE    32     // 每线程每种对象最多缓存的个数
+
+/* slab 头，后面紧跟对象 */
+typedef struct PoolSlab {
+    struct PoolSlab* next;
+    uint8_t          pad[POOL_ALIGN - sizeof(void*)];
+} PoolSlab;
+
+typedef struct {
+    uint32_t count;
+    void*    objs[POOL_MAG_SIZE];
+} PoolMagazine;
+
+static pthread_mutex_t g_pool_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static VkvgpuPool*     g_pool_list = NULL;
+static VkvgpuPool*     g_pool_by_index[POOL_MAX_TYPES];
+static int             g_pool_count = 0;
+
+static pthread_once_t  g_mag_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   g_mag_key;
+static int             g_mag_key_valid = 0;
+
+static __thread PoolMagazine t_mags[POOL_MAX_TYPES];
+
+static size_t pool_obj_size(const VkvgpuPool* pool)
+{
+    size_t sz = pool->obj_size < sizeof(void*) ? sizeof(void*) : pool->obj_size;
+    return (sz + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+/* ===========================================================
+ *                   全局空闲链表（加锁）
+ * ===========================================================*/
+
+/* 调用者持有 pool->lock */
+static int pool_grow(VkvgpuPool* pool)
+{
+    size_t sz  = pool_obj_size(pool);
+    size_t cnt = (POOL_SLAB_BYTES - sizeof(PoolSlab)) / sz;
+    if (cnt < 8) cnt = 8;
+
+    PoolSlab* slab = (PoolSlab*)malloc(sizeof(PoolSlab) + cnt * sz);
+    if (!slab) return -1;
+    slab->next  = (PoolSlab*)pool->slabs;
+    pool->slabs = slab;
+
+    uint8_t* base = (uint8_t*)(slab + 1);
+    for (size_t i = cnt; i > 0; i--) {
+        void* obj = base + (i - 1) * sz;
+        *(void**)obj    = pool->free_list;
+        pool->free_list = obj;
+    }
+    return 0;
+}
+
+/* 调用者持有 pool->lock */
+static void* pool_pop_locked(VkvgpuPool* pool)
+{
+    if (!pool->free_list && pool_grow(pool) != 0)
+        return NULL;
+    void* obj = pool->free_list;
+    pool->free_list = *(void**)obj;
+    return obj;
+}
+
+/* ===========================================================
+ *                      每线程缓存
+ * ===========================================================*/
+
+/* 线程退出时把缓存的对象还给全局链表 */
+static void mag_flush_all(void* unused)
+{
+    (void)unused;
+    for (int i = 0; i < POOL_MAX_TYPES; i++) {
+        PoolMagazine* mag  = &t_mags[i];
+        VkvgpuPool*   pool = g_pool_by_index[i];
+        if (!pool || mag->count == 0) continue;
+
+        pthread_mutex_lock(&pool->lock);
+        while (mag->count > 0) {
+            void* obj = mag->objs[--mag->count];
+            *(void**)obj    = pool->free_list;
+            pool->free_list = obj;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void mag_key_init(void)
+{
+    g_mag_key_valid = pthread_key_create(&g_mag_key, mag_flush_all) == 0;
+}
+
+static PoolMagazine* pool_magazine(VkvgpuPool* pool)
+{
+    int idx = __atomic_load_n(&pool->index, __ATOMIC_ACQUIRE);
+    if (idx < 0) {
+        pthread_mutex_lock(&g_pool_reg_lock);
+        if (pool->index < 0 && g_pool_count < POOL_MAX_TYPES) {
+            g_pool_by_index[g_pool_count] = pool;
+            pool->next  = g_pool_list;
+            g_pool_list = pool;
+            __atomic_store_n(&pool->index, g_pool_count++, __ATOMIC_RELEASE);
+        }
+        idx = pool->index;
+        pthread_mutex_unlock(&g_pool_reg_lock);
+        if (idx < 0) return NULL;   // 池类型太多，退化为只用全局链表
+    }
+
+    pthread_once(&g_mag_once, mag_key_init);
+    if (g_mag_key_valid && !pthread_getspecific(g_mag_key))
+        pthread_setspecific(g_mag_key, (void*)1);   // 只为了线程退出时触发 flush
+    return &t_mags[idx];
+}
+
+void* vkvgpu_pool_alloc(VkvgpuPool* pool)
+{
+    PoolMagazine* mag = pool_magazine(pool);
+    void* obj = NULL;
+
+    if (mag && mag->count > 0) {
+        obj = mag->objs[--mag->count];
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        obj = pool_pop_locked(pool);
+        /* 顺便给本线程缓存补一半，后续几次分配不再加锁 */
+        while (obj && mag && mag->count < POOL_MAG_SIZE / 2) {
+            void* extra = pool_pop_locked(pool);
+            if (!extra) break;
+            mag->objs[mag->count++] = extra;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (!obj) return NULL;
+    __atomic_add_fetch(&pool->live, 1, __ATOMIC_RELAXED);
+    memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+void vkvgpu_pool_free(VkvgpuPool* pool, void* obj)
+{
+    if (!obj) return;
+    __atomic_sub_fetch(&pool->live, 1, __ATOMIC_RELAXED);
+
+    PoolMagazine* mag = pool_magazine(pool);
+    if (mag && mag->count < POOL_MAG_SIZE) {
+        mag->objs[mag->count++] = obj;
+        return;
+    }
+
+    /* 缓存满了：连同一半缓存一起还回全局链表 */
+    pthread_mutex_lock(&pool->lock);
+    *(void**)obj    = pool->free_list;
+    pool->free_list = obj;
+    while (mag && mag->count > POOL_MAG_SIZE / 2) {
+        void* o = mag->objs[--mag->count];
+        *(void**)o      = pool->free_list;
+        pool->free_list = o;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* ===========================================================
+ *                  pAllocator / 池 二选一
+ * ===========================================================*/
+
+void* vkvgpu_obj_alloc(VkvgpuPool* pool, const VkAllocationCallbacks* pAllocator,
+                       VkSystemAllocationScope scope)
+{
+    if (!pAllocator)
+        return vkvgpu_pool_alloc(pool);
+
+    void* obj = pAllocator->pfnAllocation(pAllocator->pUserData, pool->obj_size,
+                                          POOL_ALIGN, scope);
+    if (obj) memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+void vkvgpu_obj_free(VkvgpuPool* pool, const VkAllocationCallbacks* pAllocator,
+                     void* obj)
+{
+    if (!obj) return;
+    if (pAllocator) {
+        pAllocator->pfnFree(pAllocator->pUserData, obj);
+        return;
+    }
+    vkvgpu_pool_free(pool, obj);
+}
+
+/* loader 在最后一个 instance 销毁后会 dlclose 我们，
+ * 先删掉 TLS key，避免别的线程退出时回调到已卸载的代码 */
+__attribute__((destructor))
+static void pool_release_all(void)
+{
+    if (g_mag_key_valid) {
+        pthread_key_delete(g_mag_key);
+        g_mag_key_valid = 0;
+    }
+
+    pthread_mutex_lock(&g_pool_reg_lock);
+    for (VkvgpuPool* pool = g_pool_list; pool; pool = pool->next) {
+        if (pool->live)
+            LOG("pool %s: %u objects still alive at unload", pool->name, pool->live);
+        PoolSlab* slab = (PoolSlab*)pool->slabs;
+        while (slab) {
+            PoolSlab* next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        pool->slabs     = NULL;
+        pool->free_list = NULL;
+    }
+    pthread_mutex_unlock(&g_pool_reg_lock);
+}
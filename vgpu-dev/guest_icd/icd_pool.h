@@ -0,0 +1,39 @@
+// icd_pool.h
+// ICD 对象包装的类型化 slab 池：每种对象一个池，每线程一个小缓存，
+// 创建/销毁对象的常见路径不进 malloc，也不抢锁。
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+typedef struct VkvgpuPool {
+    const char*        name;
+    size_t             obj_size;
+    int                index;      // 每线程缓存的下标，首次使用时分配
+    pthread_mutex_t    lock;
+    void*              free_list;
+    void*              slabs;
+    uint32_t           live;
+    struct VkvgpuPool* next;       // 所有池，卸载时统一释放
+} VkvgpuPool;
+
+#define VKVGPU_POOL_INIT(type, pool_name) \
+    { (pool_name), sizeof(type), -1, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, NULL }
+
+/* 返回清零的对象，失败返回 NULL */
+void* vkvgpu_pool_alloc(VkvgpuPool* pool);
+void  vkvgpu_pool_free(VkvgpuPool* pool, void* obj);
+
+/*
+ * 应用给了 pAllocator 时走应用的分配器，否则走池。
+ * 按规范销毁时传入的 pAllocator 与创建时兼容，所以可以据此选择释放路径。
+ * 可分发对象（VkInstance/VkPhysicalDevice/VkDevice/...）的第一个成员必须是
+ * VK_LOADER_DATA，由调用者在拿到对象后 set_loader_magic_value()。
+ */
+void* vkvgpu_obj_alloc(VkvgpuPool* pool, const VkAllocationCallbacks* pAllocator,
+                       VkSystemAllocationScope scope);
+void  vkvgpu_obj_free(VkvgpuPool* pool, const VkAllocationCallbacks* pAllocator,
+                      void* obj);
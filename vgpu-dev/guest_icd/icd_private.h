@@ -0,0 +1,237 @@
+// icd_private.h
+// guest ICD 内部共享的声明（不对 loader 导出）
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vk_icd.h>
+#include "vk_virtio_proto.h"
+
+#define LOG(fmt, ...) fprintf(stderr, "[virtio-icd] " fmt "\n", ##__VA_ARGS__)
+
+/* ===========================================================
+ *           句柄包装：Instance / Device / PhysDev
+ * ===========================================================*/
+
+#define VIRTIO_MAX_PHYS_DEVS 8
+
+typedef struct VirtioInstance_T     VirtioInstance_T;
+typedef struct VirtioDeviceMemory_T VirtioDeviceMemory_T;
+
+/* 可分发句柄的第一个成员留给 loader 放分发表指针 */
+
+typedef struct VirtioPhysicalDevice_T {
+    VK_LOADER_DATA    loader_data;
+    uint32_t          id;        // host 侧物理设备序号
+    VirtioInstance_T* instance;  // 创建 device 时要用 instance 的上下文
+
+    int                              mem_props_valid;  // 第一次查询后缓存
+    VkPhysicalDeviceMemoryProperties mem_props;
+} VirtioPhysicalDevice_T;
+
+struct VirtioInstance_T {
+    VK_LOADER_DATA         loader_data;
+    uint32_t               ctx_id;
+    VkvgpuHandle           instance_id;
+    VkvgpuHandle           next_object_id;  // 本上下文的对象 ID 分配器
+    uint32_t               phys_count;
+    VirtioPhysicalDevice_T phys[VIRTIO_MAX_PHYS_DEVS];
+
+    /* 流式读回用的共享区，第一次大块读回时建立，读回之间互斥 */
+    pthread_mutex_t        readback_lock;
+    int                    readback_state;  // 0 = 未建立，1 = 可用，-1 = 退回 socket
+    VkvgpuHandle           readback_id;
+    uint8_t*               readback_map;
+};
+
+typedef struct VirtioDevice_T VirtioDevice_T;
+
+/* 一次提交里 GPU 会写的一段内存，队列序号到了 serial 之后从 host 读回 */
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize   offset;
+    VkDeviceSize   size;
+    uint64_t       serial;
+} VkvgpuGpuWrite;
+
+/* daemon 每个 device 只建一个队列（family 0 的第 0 个），guest 也只暴露这一个 */
+typedef struct VirtioQueue_T {
+    VK_LOADER_DATA  loader_data;
+    VirtioDevice_T* device;
+} VirtioQueue_T;
+
+struct VirtioDevice_T {
+    VK_LOADER_DATA          loader_data;
+    VirtioInstance_T*       instance;
+    VirtioPhysicalDevice_T* phys;
+    VkvgpuHandle            device_id;
+    VirtioQueue_T           queue;
+
+    pthread_mutex_t         mem_lock;     // 保护 mapped_mems 和 gpu_writes
+    VirtioDeviceMemory_T*   mapped_mems;  // 当前映射着的 coherent 内存
+    uint64_t                coherent_serial;  // coherent 影子页已按这个队列序号从 host 刷新过
+    VkvgpuGpuWrite*         gpu_writes;   // 还没读回的 GPU 写入范围
+    uint32_t                gpu_write_count;
+    uint32_t                gpu_write_cap;
+
+    /* 完成通知页（icd_sync.c）：fence / timeline semaphore 的状态都在本地读 */
+    VkvgpuHandle            sync_page_id;
+    VkvgpuSyncPage*         sync;
+    pthread_mutex_t         sync_lock;    // 保护 sync_used
+    uint64_t                sync_used[VKVGPU_SYNC_SLOTS / 64];
+    uint64_t                submit_serial;  // 最近一次提交的序号，完成后写到队列 slot
+};
+
+/* 在上下文命名空间里分配对象 ID，多线程创建对象时无锁 */
+static inline VkvgpuHandle vkvgpu_alloc_object_id(VirtioInstance_T* inst)
+{
+    return __atomic_fetch_add(&inst->next_object_id, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t vkvgpu_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* ===========================================================
+ *            传输通道（icd_transport.c）
+ * ===========================================================*/
+
+/*
+ * 每个应用线程第一次调用时从进程级通道池里取一条到 daemon 的连接，
+ * 之后该线程的所有命令都走这条连接，线程之间互不加锁。
+ * 线程退出时通道还回池里，供后来的线程复用。
+ */
+typedef struct VkvgpuChannel VkvgpuChannel;
+
+VkvgpuChannel* vkvgpu_channel_get(void);
+
+/*
+ * 上下文的命令序号（见 vk_virtio_proto.h）：CREATE_CONTEXT 拿到 ID 后 open，
+ * 发出 DESTROY_CONTEXT 后 close。没 open 的上下文命令不带序号，daemon 按到达顺序执行。
+ */
+void vkvgpu_ctx_seq_open(uint32_t ctx_id);
+void vkvgpu_ctx_seq_close(uint32_t ctx_id);
+
+/*
+ * 同步调用：在上下文 ctx_id 里发送 cmd + 请求 payload，等待回复。
+ * 返回 daemon 的 status（0 = OK），传输错误返回 -1。
+ * reply_payload 为 NULL 时要求回复不带 payload。
+ */
+int vkvgpu_call(uint32_t ctx_id, uint32_t cmd,
+                const void* req, uint32_t req_size,
+                void* reply_payload, uint32_t reply_size);
+
+/*
+ * 异步发送：不等回复。失败由 daemon 记在上下文里，
+ * 在下一次 vkvgpu_call 时作为返回值带回。传输错误返回 -1。
+ */
+int vkvgpu_send_async(uint32_t ctx_id, uint32_t cmd,
+                      const void* req, uint32_t req_size);
+
+/* 同 vkvgpu_call，回复里带的 fd（SCM_RIGHTS）放进 *out_fd，没有则为 -1 */
+int vkvgpu_call_fd(uint32_t ctx_id, uint32_t cmd,
+                   const void* req, uint32_t req_size,
+                   void* reply_payload, uint32_t reply_size, int* out_fd);
+
+/*
+ * 拆成两半的同步调用：begin 发出请求后立即返回，调用者可以在等回复期间
+ * 处理共享内存里的数据，最后用 end 收回复。两次调用之间本线程不能发别的命令。
+ */
+int vkvgpu_call_begin(uint32_t ctx_id, uint32_t cmd,
+                      const void* req, uint32_t req_size);
+int vkvgpu_call_end(uint32_t ctx_id, uint32_t cmd,
+                    void* reply_payload, uint32_t reply_size);
+
+/* begin 之后：回复已经到达（或连接已断）时返回非 0 */
+int vkvgpu_reply_pending(void);
+
+/* 同上，请求结构后面再跟一段数据（WRITE_MEMORY），两段一起发出不额外拷贝 */
+int vkvgpu_send_async_data(uint32_t ctx_id, uint32_t cmd,
+                           const void* req, uint32_t req_size,
+                           const void* data, uint32_t data_size);
+
+/* daemon status 转 VkResult：-1 是传输/协议错误，用调用点给的 fallback */
+static inline VkResult vkvgpu_result(int rc, VkResult fallback)
+{
+    if (rc == 0)  return VK_SUCCESS;
+    if (rc == -1) return fallback;
+    return (VkResult)rc;
+}
+
+/* ===========================================================
+ *            共享内存区（icd_shm.c）
+ * ===========================================================*/
+
+/* 让 daemon 建一块 size 字节的共享区并映射进来，失败返回 NULL */
+void* vkvgpu_shared_region_create(VirtioInstance_T* inst, VkvgpuHandle region_id, size_t size);
+/* 映射 daemon 交过来的 fd，映射后 fd 即关闭（成功失败都关） */
+void* vkvgpu_shared_map_fd(int fd, size_t size);
+void  vkvgpu_shared_region_unmap(void* ptr, size_t size);
+
+/* *addr == val 时睡眠，最多 timeout_ms；返回 0 = 被唤醒或值已变，-1 = 超时 */
+int  vkvgpu_futex_wait(uint32_t* addr, uint32_t val, int timeout_ms);
+void vkvgpu_futex_wake(uint32_t* addr);
+
+/* ===========================================================
+ *            设备内存（icd_memory.c）
+ * ===========================================================*/
+
+/* 物理设备内存属性，第一次向 daemon 查询后缓存；失败返回 -1 */
+int vkvgpu_get_memory_properties(VirtioPhysicalDevice_T* pd);
+
+/*
+ * 把设备上所有映射着的 HOST_COHERENT 内存的脏页发给 daemon。
+ * coherent 内存不需要应用显式 flush，所以提交到队列前要调一次。
+ */
+VkResult vkvgpu_memory_flush_coherent(VirtioDevice_T* dev);
+
+/*
+ * 登记一次提交里 GPU 会写的范围，分两步：reserve 先留出 count 条的位置，失败时什么也没占；
+ * 成功后持有 mem_lock，调用者分配队列序号再 commit（不会失败，释放锁）。
+ * 只记 HOST_COHERENT 内存：应用不会 invalidate 它，完成后要主动读回。
+ */
+VkResult vkvgpu_memory_gpu_write_reserve(VirtioDevice_T* dev, uint32_t count);
+void     vkvgpu_memory_gpu_write_commit(VirtioDevice_T* dev, const VkvgpuGpuWrite* writes,
+                                        uint32_t count, uint64_t serial);
+
+/*
+ * 队列序号 completed 之前的提交都已完成：把这些提交登记过的 GPU 写入范围从 host 读回
+ * 影子页，范围外应用写的内容不动。序号没前进时直接返回。
+ */
+VkResult vkvgpu_memory_refresh_coherent(VirtioDevice_T* dev, uint64_t completed);
+
+/* VkDeviceMemory 在 daemon 那边的对象 ID */
+VkvgpuHandle vkvgpu_memory_id(VkDeviceMemory memory);
+
+/* vkDestroyInstance 时释放读回共享区 */
+void vkvgpu_readback_release(VirtioInstance_T* inst);
+
+/* ===========================================================
+ *            同步对象（icd_sync.c）
+ * ===========================================================*/
+
+/* vkCreateDevice / vkDestroyDevice 时建立、释放 device 的完成通知页 */
+VkResult vkvgpu_sync_init(VirtioDevice_T* dev);
+void     vkvgpu_sync_release(VirtioDevice_T* dev);
+
+/* guest 自己就能确定完成的 fence（比如 acquire 时图像已经可用），直接置为 signaled */
+void     vkvgpu_fence_signal_local(VkFence fence);
+
+/*
+ * 提交的公共尾部：fence 的 signal 值、把 coherent 脏页送到、登记 GPU 会写的 writes
+ * （serial 不用填），最后是队列序号。signals 里已有 *n 项，后面至少要留 2 个空位。
+ */
+VkResult vkvgpu_submit_prepare(VirtioDevice_T* dev, VkFence fence,
+                               const VkvgpuGpuWrite* writes, uint32_t write_count,
+                               VkvgpuSyncSignal* signals, uint32_t* n);
+
+/* 等队列上已提交的工作全部完成 */
+VkResult vkvgpu_queue_wait_idle(VirtioDevice_T* dev);
@@ -0,0 +1,119 @@
+// icd_shm.c
+// 与 daemon 共享的内存区：daemon 创建 memfd，随回复用 SCM_RIGHTS 交过来，guest 映射。
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "icd_private.h"
+
+void* vkvgpu_shared_region_create(VirtioInstance_T* inst, VkvgpuHandle region_id, size_t size)
+{
+    VkvgpuCreateSharedRegionRequestPayload req;
+    req.region_id = region_id;
+    req.size      = size;
+
+    int fd = -1;
+    int rc = vkvgpu_call_fd(inst->ctx_id, VKVGPU_CMD_CREATE_SHARED_REGION,
+                            &req, sizeof(req), NULL, 0, &fd);
+    if (rc != 0 || fd < 0) {
+        LOG("CREATE_SHARED_REGION failed rc=%d", rc);
+        return NULL;
+    }
+
+    return vkvgpu_shared_map_fd(fd, size);
+}
+
+/*
+ * daemon 可能用 hugetlb 建区：映射长度要取整到大页，解除映射时也得用同样的长度，
+ * 这种映射记在这里。数量很少（读回区、帧缓冲），链表就够。
+ */
+typedef struct HugeMap {
+    void*           ptr;
+    size_t          len;
+    struct HugeMap* next;
+} HugeMap;
+
+static pthread_mutex_t g_huge_lock = PTHREAD_MUTEX_INITIALIZER;
+static HugeMap*        g_huge_maps = NULL;
+
+#define SHM_HUGE_MIN (2u * 1024u * 1024u)
+
+void* vkvgpu_shared_map_fd(int fd, size_t size)
+{
+    /* hugetlbfs 的 st_blksize 是大页大小 */
+    struct stat st;
+    size_t len = size;
+    int huge = fstat(fd, &st) == 0 && (long)st.st_blksize > sysconf(_SC_PAGESIZE);
+    if (huge)
+        len = (size + (size_t)st.st_blksize - 1) / (size_t)st.st_blksize * (size_t)st.st_blksize;
+
+    HugeMap* hm = huge ? (HugeMap*)malloc(sizeof(*hm)) : NULL;
+    if (huge && !hm) {
+        close(fd);
+        return NULL;
+    }
+
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("[virtio-icd] mmap shared region");
+        free(hm);
+        return NULL;
+    }
+
+    if (hm) {
+        hm->ptr = p;
+        hm->len = len;
+        pthread_mutex_lock(&g_huge_lock);
+        hm->next    = g_huge_maps;
+        g_huge_maps = hm;
+        pthread_mutex_unlock(&g_huge_lock);
+    } else if (size >= SHM_HUGE_MIN) {
+        /* daemon 退回了普通页：shmem 透明大页开着时也能合并 */
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+    return p;
+}
+
+void vkvgpu_shared_region_unmap(void* ptr, size_t size)
+{
+    if (!ptr) return;
+
+    pthread_mutex_lock(&g_huge_lock);
+    for (HugeMap** pp = &g_huge_maps; *pp; pp = &(*pp)->next) {
+        if ((*pp)->ptr == ptr) {
+            HugeMap* hm = *pp;
+            *pp  = hm->next;
+            size = hm->len;
+            free(hm);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_huge_lock);
+    munmap(ptr, size);
+}
+
+/* 共享映射跨进程，不能用 FUTEX_PRIVATE_FLAG */
+int vkvgpu_futex_wait(uint32_t* addr, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = (long)(timeout_ms % 1000) * 1000000L,
+    };
+    long rc = syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+    if (rc == 0 || errno == EAGAIN || errno == EINTR) return 0;
+    return -1;
+}
+
+void vkvgpu_futex_wake(uint32_t* addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
@@ -0,0 +1,556 @@
+// icd_sync.c
+// fence / semaphore 与队列提交。
+// 完成状态不向 daemon 查询：daemon 的等待线程在 host fence 完成后把值写进
+// device 的 sync page（见 VkvgpuSyncPage）并唤醒，这里的查询和等待都只读本地共享页。
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "icd_private.h"
+#include "icd_pool.h"
+#include "vk_virtio_spin.h"
+
+#define NO_SLOT UINT32_MAX
+
+/* fence 在 slot 值 >= target 时为 signaled；reset 把 target 推到当前值之后 */
+typedef struct {
+    VirtioDevice_T* device;
+    uint32_t        slot;
+    uint64_t        target;
+} VirtioFence_T;
+
+/*
+ * 只有一个队列，daemon 按提交顺序执行，binary semaphore 的等待天然满足，
+ * 不占 slot；timeline semaphore 的计数值放在 slot 里。
+ */
+typedef struct {
+    VirtioDevice_T* device;
+    uint32_t        slot;
+} VirtioSemaphore_T;
+
+static VkvgpuPool g_fence_pool     = VKVGPU_POOL_INIT(VirtioFence_T, "fence");
+static VkvgpuPool g_semaphore_pool = VKVGPU_POOL_INIT(VirtioSemaphore_T, "semaphore");
+
+static VirtioFence_T* to_fence(VkFence fence)
+{
+    return (VirtioFence_T*)(uintptr_t)fence;
+}
+
+static VirtioSemaphore_T* to_semaphore(VkSemaphore semaphore)
+{
+    return (VirtioSemaphore_T*)(uintptr_t)semaphore;
+}
+
+/* ===========================================================
+ *                    sync page 与 slot
+ * ===========================================================*/
+
+VkResult vkvgpu_sync_init(VirtioDevice_T* dev)
+{
+    pthread_mutex_init(&dev->sync_lock, NULL);
+    memset(dev->sync_used, 0, sizeof(dev->sync_used));
+    dev->sync_used[0] = 1ull << VKVGPU_SYNC_QUEUE_SLOT;
+    dev->submit_serial = 0;
+
+    VkvgpuCreateSyncPageRequestPayload req;
+    req.device_id = dev->device_id;
+    req.page_id   = vkvgpu_alloc_object_id(dev->instance);
+
+    int fd = -1;
+    int rc = vkvgpu_call_fd(dev->instance->ctx_id, VKVGPU_CMD_CREATE_SYNC_PAGE,
+                            &req, sizeof(req), NULL, 0, &fd);
+    if (rc != 0 || fd < 0) {
+        LOG("CREATE_SYNC_PAGE failed rc=%d", rc);
+        pthread_mutex_destroy(&dev->sync_lock);
+        return vkvgpu_result(rc, VK_ERROR_INITIALIZATION_FAILED);
+    }
+    dev->sync = (VkvgpuSyncPage*)vkvgpu_shared_map_fd(fd, sizeof(VkvgpuSyncPage));
+    if (!dev->sync) {
+        VkvgpuDestroySyncPageRequestPayload dreq = { req.page_id };
+        vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_DESTROY_SYNC_PAGE,
+                          &dreq, sizeof(dreq));
+        pthread_mutex_destroy(&dev->sync_lock);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    dev->sync_page_id = req.page_id;
+    return VK_SUCCESS;
+}
+
+/* 必须在 DESTROY_DEVICE 之前发：daemon 的等待线程还在用 host device */
+void vkvgpu_sync_release(VirtioDevice_T* dev)
+{
+    VkvgpuDestroySyncPageRequestPayload req = { dev->sync_page_id };
+    vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_DESTROY_SYNC_PAGE, &req, sizeof(req));
+    vkvgpu_shared_region_unmap(dev->sync, sizeof(VkvgpuSyncPage));
+    dev->sync = NULL;
+    pthread_mutex_destroy(&dev->sync_lock);
+}
+
+static uint32_t slot_alloc(VirtioDevice_T* dev)
+{
+    uint32_t slot = NO_SLOT;
+    pthread_mutex_lock(&dev->sync_lock);
+    for (uint32_t w = 0; w < VKVGPU_SYNC_SLOTS / 64; w++) {
+        if (~dev->sync_used[w]) {
+            uint32_t bit = (uint32_t)__builtin_ctzll(~dev->sync_used[w]);
+            dev->sync_used[w] |= 1ull << bit;
+            slot = w * 64 + bit;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->sync_lock);
+    return slot;
+}
+
+static void slot_free(VirtioDevice_T* dev, uint32_t slot)
+{
+    if (slot == NO_SLOT) return;
+    pthread_mutex_lock(&dev->sync_lock);
+    dev->sync_used[slot / 64] &= ~(1ull << (slot % 64));
+    pthread_mutex_unlock(&dev->sync_lock);
+}
+
+static uint64_t slot_value(VirtioDevice_T* dev, uint32_t slot)
+{
+    return __atomic_load_n(&dev->sync->values[slot], __ATOMIC_ACQUIRE);
+}
+
+/* guest 自己写 slot 也和 daemon 一样只增不减，写完唤醒本进程里其他等待者 */
+static void slot_publish(VirtioDevice_T* dev, uint32_t slot, uint64_t value)
+{
+    VkvgpuSyncPage* page = dev->sync;
+    uint64_t old = __atomic_load_n(&page->values[slot], __ATOMIC_RELAXED);
+    while (old < value &&
+           !__atomic_compare_exchange_n(&page->values[slot], &old, value, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&page->seq, 1, __ATOMIC_RELEASE);
+    vkvgpu_futex_wake(&page->seq);
+}
+
+/*
+ * 本地等待：ready() 为真返回 VK_SUCCESS。每次 daemon 推送都会让 seq 变化，
+ * 在 seq 上 futex 等；分段等，超时很长时也能定期重新检查 status。
+ */
+typedef int (*SyncReadyFn)(VirtioDevice_T* dev, const void* arg);
+
+/* 每个线程自己的等待统计：GPU 上的小活几十微秒就完，先自旋等一下，省掉一次 futex 睡眠 */
+static __thread VkvgpuSpin t_sync_spin;
+static __thread int        t_sync_spin_init;
+
+static VkResult sync_wait(VirtioDevice_T* dev, uint64_t timeout, SyncReadyFn ready, const void* arg)
+{
+    VkvgpuSyncPage* page = dev->sync;
+    uint64_t start = vkvgpu_monotonic_ns();
+    uint64_t deadline = timeout == UINT64_MAX ? UINT64_MAX : start + timeout;
+
+    if (!t_sync_spin_init) {
+        vkvgpu_spin_init(&t_sync_spin, "VKVGPU_SPIN_US");
+        t_sync_spin_init = 1;
+    }
+    VkvgpuSpin* spin = &t_sync_spin;
+    uint64_t spin_end = start + spin->spin_ns, spun = 0;
+    int waited = 0, blocked = 0;
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        int32_t status = __atomic_load_n(&page->status, __ATOMIC_ACQUIRE);
+        if (status != 0) return (VkResult)status;
+        if (ready(dev, arg)) {
+            if (waited)
+                vkvgpu_spin_record(spin, vkvgpu_monotonic_ns() - start, spun, !blocked);
+            return VK_SUCCESS;
+        }
+        if (timeout == 0) return VK_TIMEOUT;
+        waited = 1;
+
+        uint64_t now = vkvgpu_monotonic_ns();
+        if (now >= deadline) return VK_TIMEOUT;
+
+        /* 自旋窗口内只盯着 seq，daemon 每次完成都会加一 */
+        if (now < spin_end && !blocked) {
+            while (__atomic_load_n(&page->seq, __ATOMIC_ACQUIRE) == seq &&
+                   now < spin_end && now < deadline) {
+                vkvgpu_cpu_relax();
+                now = vkvgpu_monotonic_ns();
+            }
+            spun = now - start;
+            continue;
+        }
+        blocked = 1;
+
+        int wait_ms = 100;
+        if (deadline != UINT64_MAX) {
+            uint64_t left_ms = (deadline - now + 999999) / 1000000;
+            if (left_ms < (uint64_t)wait_ms) wait_ms = (int)left_ms;
+        }
+        vkvgpu_futex_wait(&page->seq, seq, wait_ms);
+    }
+}
+
+/* 等到了完成：GPU 可能写了 coherent 内存，按已完成的队列序号刷新影子页 */
+static VkResult sync_completed(VirtioDevice_T* dev, VkResult r)
+{
+    if (r != VK_SUCCESS) return r;
+    return vkvgpu_memory_refresh_coherent(dev, slot_value(dev, VKVGPU_SYNC_QUEUE_SLOT));
+}
+
+static int queue_idle_ready(VirtioDevice_T* dev, const void* arg)
+{
+    return slot_value(dev, VKVGPU_SYNC_QUEUE_SLOT) >= *(const uint64_t*)arg;
+}
+
+VkResult vkvgpu_queue_wait_idle(VirtioDevice_T* dev)
+{
+    uint64_t serial = __atomic_load_n(&dev->submit_serial, __ATOMIC_ACQUIRE);
+    return sync_completed(dev, sync_wait(dev, UINT64_MAX, queue_idle_ready, &serial));
+}
+
+/* ===========================================================
+ *                          Fence
+ * ===========================================================*/
+
+static int fence_signaled(const VirtioFence_T* f)
+{
+    return slot_value(f->device, f->slot) >= f->target;
+}
+
+void vkvgpu_fence_signal_local(VkFence fence)
+{
+    VirtioFence_T* f = to_fence(fence);
+    if (f) slot_publish(f->device, f->slot, f->target);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkCreateFence(
+    VkDevice                     device,
+    const VkFenceCreateInfo*     pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkFence*                     pFence)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    VirtioFence_T* f = (VirtioFence_T*)
+        vkvgpu_obj_alloc(&g_fence_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (!f) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    f->device = dev;
+    f->slot   = slot_alloc(dev);
+    if (f->slot == NO_SLOT) {
+        vkvgpu_obj_free(&g_fence_pool, pAllocator, f);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    /* slot 可能是刚释放的，值从头开始 */
+    f->target = 1;
+    __atomic_store_n(&dev->sync->values[f->slot],
+                     (pCreateInfo->flags & VK_FENCE_CREATE_SIGNALED_BIT) ? 1 : 0,
+                     __ATOMIC_RELEASE);
+
+    *pFence = (VkFence)(uintptr_t)f;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkDestroyFence(
+    VkDevice                     device,
+    VkFence                      fence,
+    const VkAllocationCallbacks* pAllocator)
+{
+    (void)device;
+    VirtioFence_T* f = to_fence(fence);
+    if (!f) return;
+    slot_free(f->device, f->slot);
+    vkvgpu_obj_free(&g_fence_pool, pAllocator, f);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkResetFences(
+    VkDevice       device,
+    uint32_t       fenceCount,
+    const VkFence* pFences)
+{
+    (void)device;
+    for (uint32_t i = 0; i < fenceCount; i++) {
+        VirtioFence_T* f = to_fence(pFences[i]);
+        f->target = slot_value(f->device, f->slot) + 1;
+    }
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetFenceStatus(
+    VkDevice device,
+    VkFence  fence)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    int32_t status = __atomic_load_n(&dev->sync->status, __ATOMIC_ACQUIRE);
+    if (status != 0) return (VkResult)status;
+    return fence_signaled(to_fence(fence)) ? sync_completed(dev, VK_SUCCESS) : VK_NOT_READY;
+}
+
+typedef struct {
+    uint32_t       count;
+    const VkFence* fences;
+    VkBool32       wait_all;
+} FenceWait;
+
+static int fences_ready(VirtioDevice_T* dev, const void* arg)
+{
+    (void)dev;
+    const FenceWait* w = arg;
+    for (uint32_t i = 0; i < w->count; i++) {
+        int done = fence_signaled(to_fence(w->fences[i]));
+        if (done && !w->wait_all) return 1;
+        if (!done && w->wait_all) return 0;
+    }
+    return w->wait_all;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkWaitForFences(
+    VkDevice       device,
+    uint32_t       fenceCount,
+    const VkFence* pFences,
+    VkBool32       waitAll,
+    uint64_t       timeout)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    FenceWait w = { fenceCount, pFences, waitAll };
+    return sync_completed(dev, sync_wait(dev, timeout, fences_ready, &w));
+}
+
+/* ===========================================================
+ *                        Semaphore
+ * ===========================================================*/
+
+static const void* find_chain(const void* pNext, VkStructureType sType)
+{
+    for (const VkBaseInStructure* s = pNext; s; s = s->pNext)
+        if (s->sType == sType) return s;
+    return NULL;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkCreateSemaphore(
+    VkDevice                     device,
+    const VkSemaphoreCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkSemaphore*                 pSemaphore)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    const VkSemaphoreTypeCreateInfo* type =
+        find_chain(pCreateInfo->pNext, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO);
+
+    VirtioSemaphore_T* s = (VirtioSemaphore_T*)
+        vkvgpu_obj_alloc(&g_semaphore_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (!s) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    s->device = dev;
+    s->slot   = NO_SLOT;
+
+    if (type && type->semaphoreType == VK_SEMAPHORE_TYPE_TIMELINE) {
+        s->slot = slot_alloc(dev);
+        if (s->slot == NO_SLOT) {
+            vkvgpu_obj_free(&g_semaphore_pool, pAllocator, s);
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+        __atomic_store_n(&dev->sync->values[s->slot], type->initialValue, __ATOMIC_RELEASE);
+    }
+
+    *pSemaphore = (VkSemaphore)(uintptr_t)s;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkDestroySemaphore(
+    VkDevice                     device,
+    VkSemaphore                  semaphore,
+    const VkAllocationCallbacks* pAllocator)
+{
+    (void)device;
+    VirtioSemaphore_T* s = to_semaphore(semaphore);
+    if (!s) return;
+    slot_free(s->device, s->slot);
+    vkvgpu_obj_free(&g_semaphore_pool, pAllocator, s);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetSemaphoreCounterValue(
+    VkDevice    device,
+    VkSemaphore semaphore,
+    uint64_t*   pValue)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    VirtioSemaphore_T* s = to_semaphore(semaphore);
+    if (s->slot == NO_SLOT) return VK_ERROR_FEATURE_NOT_PRESENT;
+    int32_t status = __atomic_load_n(&dev->sync->status, __ATOMIC_ACQUIRE);
+    if (status != 0) return (VkResult)status;
+    *pValue = slot_value(dev, s->slot);
+    return sync_completed(dev, VK_SUCCESS);
+}
+
+static int semaphores_ready(VirtioDevice_T* dev, const void* arg)
+{
+    const VkSemaphoreWaitInfo* w = arg;
+    int wait_all = !(w->flags & VK_SEMAPHORE_WAIT_ANY_BIT);
+    for (uint32_t i = 0; i < w->semaphoreCount; i++) {
+        const VirtioSemaphore_T* s = to_semaphore(w->pSemaphores[i]);
+        int done = s->slot == NO_SLOT || slot_value(dev, s->slot) >= w->pValues[i];
+        if (done && !wait_all) return 1;
+        if (!done && wait_all) return 0;
+    }
+    return wait_all;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkWaitSemaphores(
+    VkDevice                   device,
+    const VkSemaphoreWaitInfo* pWaitInfo,
+    uint64_t                   timeout)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    return sync_completed(dev, sync_wait(dev, timeout, semaphores_ready, pWaitInfo));
+}
+
+/* host 端 signal：daemon 不需要知道，写本地 slot 就够了 */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkSignalSemaphore(
+    VkDevice                     device,
+    const VkSemaphoreSignalInfo* pSignalInfo)
+{
+    VirtioSemaphore_T* s = to_semaphore(pSignalInfo->semaphore);
+    if (s->slot == NO_SLOT) return VK_ERROR_FEATURE_NOT_PRESENT;
+    slot_publish((VirtioDevice_T*)device, s->slot, pSignalInfo->value);
+    return VK_SUCCESS;
+}
+
+/* VK_KHR_timeline_semaphore 的别名 */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetSemaphoreCounterValueKHR(
+    VkDevice    device,
+    VkSemaphore semaphore,
+    uint64_t*   pValue)
+{
+    return vkGetSemaphoreCounterValue(device, semaphore, pValue);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkWaitSemaphoresKHR(
+    VkDevice                   device,
+    const VkSemaphoreWaitInfo* pWaitInfo,
+    uint64_t                   timeout)
+{
+    return vkWaitSemaphores(device, pWaitInfo, timeout);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkSignalSemaphoreKHR(
+    VkDevice                     device,
+    const VkSemaphoreSignalInfo* pSignalInfo)
+{
+    return vkSignalSemaphore(device, pSignalInfo);
+}
+
+/* ===========================================================
+ *                         队列提交
+ * ===========================================================*/
+
+VkResult vkvgpu_submit_prepare(VirtioDevice_T* dev, VkFence fence,
+                               const VkvgpuGpuWrite* writes, uint32_t write_count,
+                               VkvgpuSyncSignal* signals, uint32_t* n)
+{
+    if (fence) {
+        const VirtioFence_T* f = to_fence(fence);
+        signals[*n].slot     = f->slot;
+        signals[*n].reserved = 0;
+        signals[*n].value    = f->target;
+        (*n)++;
+    }
+
+    /* coherent 内存不需要应用 flush，GPU 开始执行前要把脏页送到 */
+    VkResult r = vkvgpu_memory_flush_coherent(dev);
+    if (r != VK_SUCCESS) return r;
+
+    /* 序号一旦分出去就必须发出，可能失败的事都在这之前做完 */
+    if (write_count) {
+        r = vkvgpu_memory_gpu_write_reserve(dev, write_count);
+        if (r != VK_SUCCESS) return r;
+    }
+    uint64_t serial = __atomic_add_fetch(&dev->submit_serial, 1, __ATOMIC_ACQ_REL);
+    if (write_count)
+        vkvgpu_memory_gpu_write_commit(dev, writes, write_count, serial);
+
+    signals[*n].slot     = VKVGPU_SYNC_QUEUE_SLOT;
+    signals[*n].reserved = 0;
+    signals[*n].value    = serial;
+    (*n)++;
+    return VK_SUCCESS;
+}
+
+/*
+ * 一次 vkQueueSubmit 一条异步 QUEUE_SUBMIT：带上这次提交完成时要写的
+ * (slot, value)——timeline semaphore 的 signal 值、fence 的 target 和队列序号，
+ * 以及开始前要等的 timeline semaphore 值（本地已经满足的不带）。
+ * 命令缓冲还没实现，提交里目前只有同步操作。
+ */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkQueueSubmit(
+    VkQueue             queue,
+    uint32_t            submitCount,
+    const VkSubmitInfo* pSubmits,
+    VkFence             fence)
+{
+    VirtioDevice_T* dev = ((VirtioQueue_T*)queue)->device;
+    /* 后面留出 wait 的位置，发送前拼上 */
+    VkvgpuSyncSignal signals[VKVGPU_MAX_SUBMIT_SIGNALS + VKVGPU_MAX_SUBMIT_WAITS];
+    VkvgpuSyncSignal waits[VKVGPU_MAX_SUBMIT_WAITS];
+    uint32_t n = 0, nwait = 0;
+
+    for (uint32_t i = 0; i < submitCount; i++) {
+        const VkSubmitInfo* si = &pSubmits[i];
+        const VkTimelineSemaphoreSubmitInfo* tl =
+            find_chain(si->pNext, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO);
+
+        for (uint32_t j = 0; j < si->waitSemaphoreCount; j++) {
+            const VirtioSemaphore_T* s = to_semaphore(si->pWaitSemaphores[j]);
+            if (s->slot == NO_SLOT) continue;
+            if (!tl || j >= tl->waitSemaphoreValueCount) return VK_ERROR_INITIALIZATION_FAILED;
+            uint64_t value = tl->pWaitSemaphoreValues[j];
+            if (slot_value(dev, s->slot) >= value) continue;
+            if (nwait >= VKVGPU_MAX_SUBMIT_WAITS) return VK_ERROR_OUT_OF_HOST_MEMORY;
+            waits[nwait].slot     = s->slot;
+            waits[nwait].reserved = 0;
+            waits[nwait].value    = value;
+            nwait++;
+        }
+
+        for (uint32_t j = 0; j < si->signalSemaphoreCount; j++) {
+            const VirtioSemaphore_T* s = to_semaphore(si->pSignalSemaphores[j]);
+            if (s->slot == NO_SLOT) continue;
+            if (!tl || j >= tl->signalSemaphoreValueCount) return VK_ERROR_INITIALIZATION_FAILED;
+            if (n + 2 >= VKVGPU_MAX_SUBMIT_SIGNALS) return VK_ERROR_OUT_OF_HOST_MEMORY;
+            signals[n].slot     = s->slot;
+            signals[n].reserved = 0;
+            signals[n].value    = tl->pSignalSemaphoreValues[j];
+            n++;
+        }
+    }
+    VkResult r = vkvgpu_submit_prepare(dev, fence, NULL, 0, signals, &n);
+    if (r != VK_SUCCESS) return r;
+
+    /* signal 和 wait 在 payload 里紧挨着，拼到一起一次发出 */
+    if (nwait) memcpy(&signals[n], waits, nwait * sizeof(waits[0]));
+
+    VkvgpuQueueSubmitRequestPayload req;
+    req.page_id      = dev->sync_page_id;
+    req.signal_count = n;
+    req.wait_count   = nwait;
+    if (vkvgpu_send_async_data(dev->instance->ctx_id, VKVGPU_CMD_QUEUE_SUBMIT, &req, sizeof(req),
+                               signals, (n + nwait) * (uint32_t)sizeof(signals[0])) != 0)
+        return VK_ERROR_DEVICE_LOST;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkQueueWaitIdle(
+    VkQueue queue)
+{
+    return vkvgpu_queue_wait_idle(((VirtioQueue_T*)queue)->device);
+}
@@ -0,0 +1,189 @@
+// icd_template.c
+// VK_VGPU_dispatch_template：compute 调度模板。
+// pipeline、descriptor set 和录好的命令缓冲都在 daemon 那边，这里只记模板 ID；
+// 每次调用把相对上一次的变化（绑定、push constant、组数）和完成时的 signal 一起异步发出。
+// 绑定在这边也留一份，shader 会写的那些登记给 icd_memory.c，完成后读回 coherent 影子页。
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+
+#include "icd_private.h"
+#include "icd_pool.h"
+#include "vk_vgpu_dispatch_template.h"
+
+typedef struct {
+    VirtioDevice_T*               device;
+    VkvgpuHandle                  template_id;
+    uint32_t                      binding_count;
+    uint32_t                      push_size;
+    uint32_t                      writable;   // shader 会写的 binding 位掩码，daemon 建模板时给出
+    VkDispatchTemplateBindingVGPU bindings[VKVGPU_TEMPLATE_MAX_BINDINGS];  // 按 binding 号，当前值
+} VirtioDispatchTemplate_T;
+
+static VkvgpuPool g_template_pool = VKVGPU_POOL_INIT(VirtioDispatchTemplate_T, "dispatch template");
+
+static VirtioDispatchTemplate_T* to_template(VkDispatchTemplateVGPU t)
+{
+    return (VirtioDispatchTemplate_T*)(uintptr_t)t;
+}
+
+static void binding_to_wire(const VkDispatchTemplateBindingVGPU* b, VkvgpuTemplateBinding* w)
+{
+    w->binding   = b->binding;
+    w->reserved  = 0;
+    w->memory_id = vkvgpu_memory_id(b->memory);
+    w->offset    = b->offset;
+    w->range     = b->range;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkCreateDispatchTemplateVGPU(
+    VkDevice                                device,
+    const VkDispatchTemplateCreateInfoVGPU* pCreateInfo,
+    const VkAllocationCallbacks*            pAllocator,
+    VkDispatchTemplateVGPU*                 pTemplate)
+{
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    if (pCreateInfo->bindingCount > VKVGPU_TEMPLATE_MAX_BINDINGS ||
+        pCreateInfo->pushConstantSize > VKVGPU_TEMPLATE_MAX_PUSH ||
+        pCreateInfo->codeSize == 0 || pCreateInfo->codeSize % 4 != 0 ||
+        pCreateInfo->codeSize > VKVGPU_TEMPLATE_MAX_CODE)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    /* 请求 + 绑定 + SPIR-V 拼成一段，一次同步调用 */
+    size_t bsize = pCreateInfo->bindingCount * sizeof(VkvgpuTemplateBinding);
+    size_t size  = sizeof(VkvgpuCreateTemplateRequestPayload) + bsize + pCreateInfo->codeSize;
+    uint8_t* buf = malloc(size);
+    if (!buf) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    VirtioDispatchTemplate_T* t = (VirtioDispatchTemplate_T*)
+        vkvgpu_obj_alloc(&g_template_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (!t) {
+        free(buf);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    t->device        = dev;
+    t->template_id   = vkvgpu_alloc_object_id(dev->instance);
+    t->binding_count = pCreateInfo->bindingCount;
+    t->push_size     = pCreateInfo->pushConstantSize;
+
+    VkvgpuCreateTemplateRequestPayload* req = (VkvgpuCreateTemplateRequestPayload*)buf;
+    req->device_id      = dev->device_id;
+    req->template_id    = t->template_id;
+    req->code_size      = (uint32_t)pCreateInfo->codeSize;
+    req->push_size      = pCreateInfo->pushConstantSize;
+    req->binding_count  = pCreateInfo->bindingCount;
+    req->group_count[0] = pCreateInfo->groupCountX;
+    req->group_count[1] = pCreateInfo->groupCountY;
+    req->group_count[2] = pCreateInfo->groupCountZ;
+    VkvgpuTemplateBinding* wb = (VkvgpuTemplateBinding*)(req + 1);
+    for (uint32_t i = 0; i < pCreateInfo->bindingCount; i++) {
+        const VkDispatchTemplateBindingVGPU* b = &pCreateInfo->pBindings[i];
+        binding_to_wire(b, &wb[i]);
+        if (b->binding < pCreateInfo->bindingCount)
+            t->bindings[b->binding] = *b;
+    }
+    memcpy(buf + sizeof(*req) + bsize, pCreateInfo->pCode, pCreateInfo->codeSize);
+
+    VkvgpuCreateTemplateReplyPayload reply;
+    int rc = vkvgpu_call(dev->instance->ctx_id, VKVGPU_CMD_CREATE_DISPATCH_TEMPLATE,
+                         buf, (uint32_t)size, &reply, sizeof(reply));
+    free(buf);
+    if (rc != 0) {
+        LOG("CREATE_DISPATCH_TEMPLATE failed rc=%d", rc);
+        vkvgpu_obj_free(&g_template_pool, pAllocator, t);
+        return vkvgpu_result(rc, VK_ERROR_INITIALIZATION_FAILED);
+    }
+
+    t->writable = reply.writable;
+
+    *pTemplate = (VkDispatchTemplateVGPU)(uintptr_t)t;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkDestroyDispatchTemplateVGPU(
+    VkDevice                     device,
+    VkDispatchTemplateVGPU       dispatchTemplate,
+    const VkAllocationCallbacks* pAllocator)
+{
+    VirtioDevice_T*           dev = (VirtioDevice_T*)device;
+    VirtioDispatchTemplate_T* t   = to_template(dispatchTemplate);
+    if (!t) return;
+
+    VkvgpuDestroyTemplateRequestPayload req = { t->template_id };
+    vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_DESTROY_DISPATCH_TEMPLATE, &req, sizeof(req));
+    vkvgpu_obj_free(&g_template_pool, pAllocator, t);
+}
+
+/* 按 signal、改了的绑定、push constant 的顺序拼在请求后面，一条异步命令发出 */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkQueueDispatchTemplateVGPU(
+    VkQueue                                 queue,
+    VkDispatchTemplateVGPU                  dispatchTemplate,
+    const VkDispatchTemplateInvokeInfoVGPU* pInvokeInfo,
+    VkFence                                 fence)
+{
+    VirtioDevice_T*           dev = ((VirtioQueue_T*)queue)->device;
+    VirtioDispatchTemplate_T* t   = to_template(dispatchTemplate);
+    const VkDispatchTemplateInvokeInfoVGPU* ii = pInvokeInfo;
+    if (ii->bindingCount > t->binding_count ||
+        ii->pushOffset > t->push_size || ii->pushSize > t->push_size - ii->pushOffset)
+        return VK_ERROR_INITIALIZATION_FAILED;
+    for (uint32_t i = 0; i < ii->bindingCount; i++)
+        if (ii->pBindings[i].binding >= t->binding_count) return VK_ERROR_INITIALIZATION_FAILED;
+
+    struct {
+        VkvgpuSyncSignal      signals[2];
+        VkvgpuTemplateBinding bindings[VKVGPU_TEMPLATE_MAX_BINDINGS];
+        uint8_t               push[VKVGPU_TEMPLATE_MAX_PUSH];
+    } tail;
+    /* 这次调用之后的绑定里 shader 会写的那些，完成后读回；提交失败时模板保持原样 */
+    VkDispatchTemplateBindingVGPU bindings[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    memcpy(bindings, t->bindings, t->binding_count * sizeof(bindings[0]));
+    for (uint32_t i = 0; i < ii->bindingCount; i++)
+        bindings[ii->pBindings[i].binding] = ii->pBindings[i];
+    VkvgpuGpuWrite writes[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    uint32_t nwrite = 0;
+    for (uint32_t i = 0; i < t->binding_count; i++) {
+        if (!(t->writable & (1u << i))) continue;
+        writes[nwrite].memory = bindings[i].memory;
+        writes[nwrite].offset = bindings[i].offset;
+        writes[nwrite].size   = bindings[i].range;
+        nwrite++;
+    }
+
+    uint32_t n = 0;
+    VkResult r = vkvgpu_submit_prepare(dev, fence, writes, nwrite, tail.signals, &n);
+    if (r != VK_SUCCESS) return r;
+    memcpy(t->bindings, bindings, t->binding_count * sizeof(bindings[0]));
+
+    /* signal 只有 n 个，后两段往前挪紧跟着 */
+    uint8_t* p = (uint8_t*)&tail.signals[n];
+    VkvgpuTemplateBinding wb;
+    for (uint32_t i = 0; i < ii->bindingCount; i++) {
+        binding_to_wire(&ii->pBindings[i], &wb);
+        memcpy(p, &wb, sizeof(wb));
+        p += sizeof(wb);
+    }
+    if (ii->pushSize) {
+        memcpy(p, ii->pPushData, ii->pushSize);
+        p += ii->pushSize;
+    }
+
+    VkvgpuDispatchTemplateRequestPayload req;
+    req.template_id    = t->template_id;
+    req.page_id        = dev->sync_page_id;
+    req.group_count[0] = ii->groupCountX;
+    req.group_count[1] = ii->groupCountY;
+    req.group_count[2] = ii->groupCountZ;
+    req.push_offset    = ii->pushOffset;
+    req.push_size      = ii->pushSize;
+    req.binding_count  = ii->bindingCount;
+    req.signal_count   = n;
+    req.reserved       = 0;
+    if (vkvgpu_send_async_data(dev->instance->ctx_id, VKVGPU_CMD_DISPATCH_TEMPLATE, &req, sizeof(req),
+                               &tail, (uint32_t)(p - (uint8_t*)&tail)) != 0)
+        return VK_ERROR_DEVICE_LOST;
+    return VK_SUCCESS;
+}
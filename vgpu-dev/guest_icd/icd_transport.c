@@ -0,0 +1,589 @@
+// icd_transport.c
+// guest ICD 到 daemon 的传输层：每线程一条通道，线程之间不共享 socket。
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "icd_private.h"
+#include "vk_virtio_spin.h"
+
+struct VkvgpuChannel {
+    int fd;
+    /* 信用流控（见 vk_virtio_proto.h），累计值，连接重建时归零 */
+    uint64_t sent_bytes;
+    uint64_t sent_cmds;
+    uint64_t credit_bytes;
+    uint64_t credit_cmds;
+    uint64_t credit_waits;     // 因信用不够等 daemon 的次数
+    VkvgpuSpin spin;           // 等回复：先自旋再阻塞（VKVGPU_SPIN_US 设上限，0 关闭）
+    VkvgpuChannel* next_free;  // 空闲池链表
+    VkvgpuChannel* next_all;   // 所有通道，卸载时统一关闭
+};
+
+/* ===========================================================
+ *                      通道池
+ * ===========================================================*/
+
+static pthread_mutex_t g_chan_lock  = PTHREAD_MUTEX_INITIALIZER;
+static VkvgpuChannel*  g_free_chans = NULL;
+static VkvgpuChannel*  g_all_chans  = NULL;
+
+static pthread_once_t  g_chan_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   g_chan_key;
+static int             g_chan_key_valid = 0;
+
+static __thread VkvgpuChannel* t_chan = NULL;
+
+/* 线程退出：通道（连同已建立的连接）还回池里 */
+static void channel_release(void* p)
+{
+    VkvgpuChannel* ch = (VkvgpuChannel*)p;
+    if (!ch) return;
+
+    pthread_mutex_lock(&g_chan_lock);
+    ch->next_free = g_free_chans;
+    g_free_chans  = ch;
+    pthread_mutex_unlock(&g_chan_lock);
+}
+
+static void channel_key_init(void)
+{
+    g_chan_key_valid = pthread_key_create(&g_chan_key, channel_release) == 0;
+}
+
+VkvgpuChannel* vkvgpu_channel_get(void)
+{
+    if (t_chan) return t_chan;
+
+    pthread_once(&g_chan_once, channel_key_init);
+
+    pthread_mutex_lock(&g_chan_lock);
+    VkvgpuChannel* ch = g_free_chans;
+    if (ch) {
+        g_free_chans = ch->next_free;
+    } else {
+        ch = (VkvgpuChannel*)calloc(1, sizeof(*ch));
+        if (ch) {
+            ch->fd       = -1;
+            vkvgpu_spin_init(&ch->spin, "VKVGPU_SPIN_US");
+            ch->next_all = g_all_chans;
+            g_all_chans  = ch;
+        }
+    }
+    pthread_mutex_unlock(&g_chan_lock);
+
+    if (!ch) return NULL;
+    ch->next_free = NULL;
+
+    t_chan = ch;
+    if (g_chan_key_valid)
+        pthread_setspecific(g_chan_key, ch);
+    return ch;
+}
+
+/* ===========================================================
+ *                      上下文序号
+ * ===========================================================*/
+
+/*
+ * 一个进程的上下文（VkInstance）很少，定长表线性探测；删除只清 ctx_id，
+ * 查找不在空槽处停下，最坏扫一遍整表。
+ */
+#define VKVGPU_SEQ_SLOTS 64
+
+typedef struct {
+    uint32_t ctx_id;     // 0 = 空
+    uint32_t seq;        // 最后发出的序号
+} VkvgpuCtxSeq;
+
+static VkvgpuCtxSeq g_ctx_seq[VKVGPU_SEQ_SLOTS];
+
+void vkvgpu_ctx_seq_open(uint32_t ctx_id)
+{
+    pthread_mutex_lock(&g_chan_lock);
+    for (uint32_t i = 0; i < VKVGPU_SEQ_SLOTS; i++) {
+        VkvgpuCtxSeq* e = &g_ctx_seq[(ctx_id + i) % VKVGPU_SEQ_SLOTS];
+        if (e->ctx_id) continue;
+        e->seq = 0;
+        __atomic_store_n(&e->ctx_id, ctx_id, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_chan_lock);
+        return;
+    }
+    pthread_mutex_unlock(&g_chan_lock);
+    LOG("ctx %u: sequence table full, commands unordered across threads", ctx_id);
+}
+
+void vkvgpu_ctx_seq_close(uint32_t ctx_id)
+{
+    pthread_mutex_lock(&g_chan_lock);
+    for (uint32_t i = 0; i < VKVGPU_SEQ_SLOTS; i++) {
+        VkvgpuCtxSeq* e = &g_ctx_seq[(ctx_id + i) % VKVGPU_SEQ_SLOTS];
+        if (e->ctx_id == ctx_id) {
+            __atomic_store_n(&e->ctx_id, 0, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_chan_lock);
+}
+
+/* 取下一个序号；上下文没登记返回 0（不排序） */
+static uint32_t ctx_seq_next(uint32_t ctx_id)
+{
+    for (uint32_t i = 0; i < VKVGPU_SEQ_SLOTS; i++) {
+        VkvgpuCtxSeq* e = &g_ctx_seq[(ctx_id + i) % VKVGPU_SEQ_SLOTS];
+        if (__atomic_load_n(&e->ctx_id, __ATOMIC_ACQUIRE) != ctx_id) continue;
+        uint32_t seq = __atomic_add_fetch(&e->seq, 1, __ATOMIC_ACQ_REL);
+        if (seq == 0) seq = __atomic_add_fetch(&e->seq, 1, __ATOMIC_ACQ_REL);   // 回绕，跳过 0
+        return seq;
+    }
+    return 0;
+}
+
+static void channel_log_spin(VkvgpuChannel* ch)
+{
+    VkvgpuSpin* s = &ch->spin;
+    if (!s->waits) return;
+    LOG("channel %p: %llu waits, %llu spin hits, %llu blocks, avg %llu us, spun %llu us total",
+        (void*)ch, (unsigned long long)s->waits, (unsigned long long)s->spin_hits,
+        (unsigned long long)s->blocks, (unsigned long long)(s->avg_ns / 1000),
+        (unsigned long long)(s->spin_total_ns / 1000));
+    s->waits = s->spin_hits = s->blocks = s->spin_total_ns = 0;
+}
+
+/* ICD 被 dlclose 时：先删 TLS key，别让其它线程退出时回调到已卸载的代码 */
+__attribute__((destructor))
+static void channel_close_all(void)
+{
+    if (g_chan_key_valid) {
+        pthread_key_delete(g_chan_key);
+        g_chan_key_valid = 0;
+    }
+
+    pthread_mutex_lock(&g_chan_lock);
+    for (VkvgpuChannel* ch = g_all_chans; ch; ch = ch->next_all) {
+        channel_log_spin(ch);
+        if (ch->fd >= 0) {
+            close(ch->fd);
+            ch->fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&g_chan_lock);
+}
+
+/* ===========================================================
+ *                  Socket / Protocol Helpers
+ * ===========================================================*/
+
+static int channel_connect(VkvgpuChannel* ch)
+{
+    if (ch->fd >= 0) return 0;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[virtio-icd] socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, VKVGPU_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("[virtio-icd] connect");
+        close(fd);
+        return -1;
+    }
+
+    ch->fd = fd;
+    ch->sent_bytes   = 0;
+    ch->sent_cmds    = 0;
+    ch->credit_bytes = VKVGPU_CREDIT_INIT_BYTES;
+    ch->credit_cmds  = VKVGPU_CREDIT_INIT_CMDS;
+    LOG("channel %p connected to daemon at %s", (void*)ch, VKVGPU_SOCKET_PATH);
+    return 0;
+}
+
+/* 连接出错后直接丢弃，下次调用重新连接 */
+static void channel_reset(VkvgpuChannel* ch)
+{
+    if (ch->fd >= 0) {
+        close(ch->fd);
+        ch->fd = -1;
+    }
+    if (ch->credit_waits) {
+        LOG("channel %p: waited for credits %llu times", (void*)ch,
+            (unsigned long long)ch->credit_waits);
+        ch->credit_waits = 0;
+    }
+    channel_log_spin(ch);
+}
+
+static int read_full(int fd, void* buf, size_t size)
+{
+    size_t off = 0;
+    while (off < size) {
+        ssize_t n = recv(fd, (char*)buf + off, size - off, 0);
+        if (n == 0) {
+            LOG("daemon closed connection");
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[virtio-icd] recv");
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    return 0;
+}
+
+/* 读回复头；out_fd 非空时顺带收 SCM_RIGHTS 传来的 fd（随回复的第一个字节到达） */
+static int read_reply_header(int fd, VkvgpuReply* reply, int* out_fd)
+{
+    if (!out_fd)
+        return read_full(fd, reply, sizeof(*reply));
+
+    *out_fd = -1;
+    union {
+        char           buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = { .iov_base = reply, .iov_len = sizeof(*reply) };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = ctrl.buf;
+    mh.msg_controllen = sizeof(ctrl.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (n == 0) LOG("daemon closed connection");
+        else        perror("[virtio-icd] recvmsg");
+        return -1;
+    }
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(out_fd, CMSG_DATA(cm), sizeof(int));
+    }
+
+    if ((size_t)n < sizeof(*reply) &&
+        read_full(fd, (char*)reply + n, sizeof(*reply) - (size_t)n) != 0) {
+        if (*out_fd >= 0) close(*out_fd);
+        *out_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* header + payload (+ data) 一次 sendmsg 发出，处理部分写 */
+static int write_msg(int fd, const VkvgpuHeader* hdr,
+                     const void* payload, uint32_t payload_size,
+                     const void* data, uint32_t data_size)
+{
+    struct iovec iov[3];
+    int n_iov = 0;
+    iov[n_iov].iov_base = (void*)hdr;
+    iov[n_iov].iov_len  = sizeof(*hdr);
+    n_iov++;
+    if (payload_size) {
+        iov[n_iov].iov_base = (void*)payload;
+        iov[n_iov].iov_len  = payload_size;
+        n_iov++;
+    }
+    if (data_size) {
+        iov[n_iov].iov_base = (void*)data;
+        iov[n_iov].iov_len  = data_size;
+        n_iov++;
+    }
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov    = iov;
+    mh.msg_iovlen = n_iov;
+
+    while (mh.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[virtio-icd] send");
+            return -1;
+        }
+        while (n > 0 && mh.msg_iovlen > 0) {
+            if ((size_t)n >= mh.msg_iov->iov_len) {
+                n -= (ssize_t)mh.msg_iov->iov_len;
+                mh.msg_iov++;
+                mh.msg_iovlen--;
+            } else {
+                mh.msg_iov->iov_base = (char*)mh.msg_iov->iov_base + n;
+                mh.msg_iov->iov_len -= (size_t)n;
+                n = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+/* 丢弃不认识的回复 payload，保持流对齐 */
+static int discard_payload(int fd, uint32_t size)
+{
+    char tmp[256];
+    while (size > 0) {
+        uint32_t chunk = size < sizeof(tmp) ? size : (uint32_t)sizeof(tmp);
+        if (read_full(fd, tmp, chunk) != 0) return -1;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int recv_reply(VkvgpuChannel* ch, uint32_t ctx_id, uint32_t cmd,
+                      void* reply_payload, uint32_t reply_size, int* out_fd);
+
+static int credit_ok(const VkvgpuChannel* ch, uint64_t cost)
+{
+    return ch->sent_bytes + cost <= ch->credit_bytes && ch->sent_cmds < ch->credit_cmds;
+}
+
+/*
+ * 信用不够：同步问 daemon 要，daemon 执行完足够多的命令才回复，本线程就此阻塞，
+ * 不会在 daemon 里堆积无限多的命令。
+ */
+static int credit_acquire(VkvgpuChannel* ch, uint64_t cost)
+{
+    while (!credit_ok(ch, cost)) {
+        ch->credit_waits++;
+
+        VkvgpuCreditRequestPayload req;
+        memset(&req, 0, sizeof(req));
+        req.bytes = cost;
+        req.cmds  = 1;
+
+        VkvgpuHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic        = VKVGPU_MAGIC;
+        hdr.cmd          = VKVGPU_CMD_CREDIT;
+        hdr.payload_size = sizeof(req);
+        hdr.ctx_id       = VKVGPU_CTX_NONE;
+
+        if (write_msg(ch->fd, &hdr, &req, sizeof(req), NULL, 0) != 0) {
+            channel_reset(ch);
+            return -1;
+        }
+        if (recv_reply(ch, VKVGPU_CTX_NONE, VKVGPU_CMD_CREDIT, NULL, 0, NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * 带序号的命令没发出去：重连补一条空的异步 SYNC 占住这个序号，
+ * 否则 daemon 会一直扣着这个上下文后面的命令。
+ */
+static void seq_fill(VkvgpuChannel* ch, uint32_t ctx_id, uint32_t seq)
+{
+    if (channel_connect(ch) != 0) return;
+
+    VkvgpuHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic  = VKVGPU_MAGIC;
+    hdr.cmd    = VKVGPU_CMD_SYNC | VKVGPU_CMD_FLAG_ASYNC;
+    hdr.ctx_id = ctx_id;
+    hdr.seq    = seq;
+    if (write_msg(ch->fd, &hdr, NULL, 0, NULL, 0) != 0) {
+        channel_reset(ch);
+        return;
+    }
+    ch->sent_bytes += sizeof(hdr);
+    ch->sent_cmds++;
+}
+
+static VkvgpuChannel* send_request(uint32_t ctx_id, uint32_t cmd,
+                                   const void* req, uint32_t req_size,
+                                   const void* data, uint32_t data_size)
+{
+    VkvgpuChannel* ch = vkvgpu_channel_get();
+    if (!ch) return NULL;
+    if (channel_connect(ch) != 0) return NULL;
+
+    uint64_t cost = sizeof(VkvgpuHeader) + (uint64_t)req_size + data_size;
+    if (ctx_id != VKVGPU_CTX_NONE && credit_acquire(ch, cost) != 0)
+        return NULL;
+
+    VkvgpuHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic        = VKVGPU_MAGIC;
+    hdr.cmd          = cmd;
+    hdr.payload_size = req_size + data_size;
+    hdr.ctx_id       = ctx_id;
+    /* 信用拿到之后才取序号：取到的序号之后不会再被阻塞，daemon 不会为它久等 */
+    if (ctx_id != VKVGPU_CTX_NONE)
+        hdr.seq = ctx_seq_next(ctx_id);
+
+    if (write_msg(ch->fd, &hdr, req, req_size, data, data_size) != 0) {
+        channel_reset(ch);
+        if (hdr.seq) seq_fill(ch, ctx_id, hdr.seq);
+        return NULL;
+    }
+    if (ctx_id != VKVGPU_CTX_NONE) {
+        ch->sent_bytes += cost;
+        ch->sent_cmds++;
+    }
+    return ch;
+}
+
+int vkvgpu_send_async(uint32_t ctx_id, uint32_t cmd,
+                      const void* req, uint32_t req_size)
+{
+    return send_request(ctx_id, cmd | VKVGPU_CMD_FLAG_ASYNC, req, req_size,
+                        NULL, 0) ? 0 : -1;
+}
+
+int vkvgpu_send_async_data(uint32_t ctx_id, uint32_t cmd,
+                           const void* req, uint32_t req_size,
+                           const void* data, uint32_t data_size)
+{
+    return send_request(ctx_id, cmd | VKVGPU_CMD_FLAG_ASYNC, req, req_size,
+                        data, data_size) ? 0 : -1;
+}
+
+/*
+ * 等回复的第一个字节。短命令 daemon 几微秒就回了，这时睡下去再被唤醒比命令本身还慢：
+ * 先按最近的回复时长忙等一小段，没等到再阻塞。
+ */
+static int reply_wait(VkvgpuChannel* ch)
+{
+    struct pollfd pfd = { .fd = ch->fd, .events = POLLIN };
+    uint64_t start = vkvgpu_monotonic_ns(), now = start;
+    uint64_t spun = 0;
+    int hit = 0;
+
+    if (ch->spin.spin_ns) {
+        uint64_t end = start + ch->spin.spin_ns;
+        do {
+            if (poll(&pfd, 1, 0) != 0) {
+                hit = 1;
+                break;
+            }
+            vkvgpu_cpu_relax();
+            now = vkvgpu_monotonic_ns();
+        } while (now < end);
+        spun = now - start;
+    }
+    if (!hit) {
+        while (poll(&pfd, 1, -1) < 0) {
+            if (errno != EINTR) return -1;
+        }
+        now = vkvgpu_monotonic_ns();
+    }
+    vkvgpu_spin_record(&ch->spin, now - start, spun, hit);
+    return 0;
+}
+
+static int recv_reply(VkvgpuChannel* ch, uint32_t ctx_id, uint32_t cmd,
+                      void* reply_payload, uint32_t reply_size, int* out_fd)
+{
+    VkvgpuReply reply;
+    if (reply_wait(ch) != 0 || read_reply_header(ch->fd, &reply, out_fd) != 0) {
+        channel_reset(ch);
+        return -1;
+    }
+
+    if (reply.ctx_id != ctx_id) {
+        /* 本线程同一时刻只有一个请求在途，回错上下文说明流已经乱了 */
+        LOG("reply ctx_id=%u does not match request ctx_id=%u", reply.ctx_id, ctx_id);
+        channel_reset(ch);
+        return -1;
+    }
+
+    /* 上限是累计值，daemon 给出的只会变大 */
+    if (reply.credit_bytes > ch->credit_bytes) ch->credit_bytes = reply.credit_bytes;
+    if (reply.credit_cmds  > ch->credit_cmds)  ch->credit_cmds  = reply.credit_cmds;
+
+    uint32_t expect = reply_payload ? reply_size : 0;
+    if (reply.status == 0 && reply.payload_size != expect) {
+        LOG("unexpected payload_size=%u (expect %u) for cmd=%u",
+            reply.payload_size, expect, cmd);
+        if (discard_payload(ch->fd, reply.payload_size) != 0)
+            channel_reset(ch);
+        return -1;
+    }
+
+    if (reply.status != 0) {
+        LOG("daemon returned error status=%d for cmd=%u", reply.status, cmd);
+        if (discard_payload(ch->fd, reply.payload_size) != 0)
+            channel_reset(ch);
+        /* 更早失败的异步命令优先报告 */
+        return reply.deferred_status ? reply.deferred_status : reply.status;
+    }
+
+    if (expect && read_full(ch->fd, reply_payload, expect) != 0) {
+        channel_reset(ch);
+        return -1;
+    }
+
+    if (reply.deferred_status != 0) {
+        LOG("deferred error status=%d reported at cmd=%u", reply.deferred_status, cmd);
+        return reply.deferred_status;
+    }
+    return 0;
+}
+
+int vkvgpu_call(uint32_t ctx_id, uint32_t cmd,
+                const void* req, uint32_t req_size,
+                void* reply_payload, uint32_t reply_size)
+{
+    VkvgpuChannel* ch = send_request(ctx_id, cmd, req, req_size, NULL, 0);
+    if (!ch) return -1;
+    return recv_reply(ch, ctx_id, cmd, reply_payload, reply_size, NULL);
+}
+
+int vkvgpu_call_fd(uint32_t ctx_id, uint32_t cmd,
+                   const void* req, uint32_t req_size,
+                   void* reply_payload, uint32_t reply_size, int* out_fd)
+{
+    *out_fd = -1;
+    VkvgpuChannel* ch = send_request(ctx_id, cmd, req, req_size, NULL, 0);
+    if (!ch) return -1;
+
+    int rc = recv_reply(ch, ctx_id, cmd, reply_payload, reply_size, out_fd);
+    if (rc != 0 && *out_fd >= 0) {
+        close(*out_fd);
+        *out_fd = -1;
+    }
+    return rc;
+}
+
+int vkvgpu_call_begin(uint32_t ctx_id, uint32_t cmd,
+                      const void* req, uint32_t req_size)
+{
+    return send_request(ctx_id, cmd, req, req_size, NULL, 0) ? 0 : -1;
+}
+
+int vkvgpu_call_end(uint32_t ctx_id, uint32_t cmd,
+                    void* reply_payload, uint32_t reply_size)
+{
+    VkvgpuChannel* ch = t_chan;
+    if (!ch || ch->fd < 0) return -1;
+    return recv_reply(ch, ctx_id, cmd, reply_payload, reply_size, NULL);
+}
+
+int vkvgpu_reply_pending(void)
+{
+    VkvgpuChannel* ch = t_chan;
+    if (!ch || ch->fd < 0) return 1;
+
+    struct pollfd pfd = { .fd = ch->fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) != 0;
+}
@@ -0,0 +1,384 @@
+// icd_wsi.c
+// 无头 WSI：VK_EXT_headless_surface + VK_KHR_swapchain。
+// surface 由 loader 创建（VkIcdSurfaceHeadless），swapchain 图像是 daemon 上的 VkImage；
+// present 后 daemon 只把变了的 tile 写进共享帧缓冲（见 VkvgpuFrameHeader）。
+#define _GNU_SOURCE
+#include <string.h>
+#include <time.h>
+
+#include "icd_private.h"
+#include "icd_pool.h"
+
+typedef struct VirtioSwapchain_T VirtioSwapchain_T;
+
+/* VkImage 句柄指向这里；独立的 VkImage 还没实现 */
+typedef struct {
+    VirtioSwapchain_T* swapchain;
+    uint32_t           index;
+} VirtioSwapchainImage_T;
+
+struct VirtioSwapchain_T {
+    VirtioDevice_T*        device;
+    VkvgpuHandle           swapchain_id;
+    VkExtent2D             extent;
+    VkFormat               format;
+    uint32_t               image_count;
+    uint32_t               next_image;  // acquire 从这里开始找，轮转使用各图像
+    VirtioSwapchainImage_T images[VKVGPU_MAX_SWAPCHAIN_IMAGES];
+
+    uint8_t*               frame;       // 共享帧缓冲：VkvgpuFrameHeader + 像素
+    size_t                 frame_size;
+};
+
+static VkvgpuPool g_swapchain_pool = VKVGPU_POOL_INIT(VirtioSwapchain_T, "swapchain");
+
+static const VkSurfaceFormatKHR g_surface_formats[] = {
+    { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_B8G8R8A8_SRGB,  VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_R8G8B8A8_SRGB,  VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    /* 以下 host 上由 daemon 模拟，present 时转换 */
+    { VK_FORMAT_A8B8G8R8_UNORM_PACK32, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_A8B8G8R8_SRGB_PACK32,  VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_B8G8R8_UNORM,          VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_B8G8R8_SRGB,           VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_R8G8B8_UNORM,          VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_R8G8B8_SRGB,           VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_R5G6B5_UNORM_PACK16,   VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+    { VK_FORMAT_B5G6R5_UNORM_PACK16,   VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+};
+#define SURFACE_FORMAT_COUNT (sizeof(g_surface_formats) / sizeof(g_surface_formats[0]))
+
+/* 两种模式都由 daemon 的 present 线程按模拟刷新率调度 */
+static const VkPresentModeKHR g_present_modes[] = {
+    VK_PRESENT_MODE_FIFO_KHR,
+    VK_PRESENT_MODE_MAILBOX_KHR,
+};
+#define PRESENT_MODE_COUNT (sizeof(g_present_modes) / sizeof(g_present_modes[0]))
+
+#define SWAPCHAIN_USAGE (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | \
+                         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+
+static VirtioSwapchain_T* to_swapchain(VkSwapchainKHR swapchain)
+{
+    return (VirtioSwapchain_T*)(uintptr_t)swapchain;
+}
+
+static int surface_is_headless(VkSurfaceKHR surface)
+{
+    const VkIcdSurfaceBase* base = (const VkIcdSurfaceBase*)(uintptr_t)surface;
+    return base && base->platform == VK_ICD_WSI_PLATFORM_HEADLESS;
+}
+
+static int present_mode_supported(VkPresentModeKHR mode)
+{
+    for (uint32_t i = 0; i < PRESENT_MODE_COUNT; i++) {
+        if (g_present_modes[i] == mode)
+            return 1;
+    }
+    return 0;
+}
+
+static int format_supported(VkFormat format, VkColorSpaceKHR color_space)
+{
+    for (uint32_t i = 0; i < SURFACE_FORMAT_COUNT; i++) {
+        if (g_surface_formats[i].format == format && g_surface_formats[i].colorSpace == color_space)
+            return 1;
+    }
+    return 0;
+}
+
+/* ===========================================================
+ *                        surface 查询
+ * ===========================================================*/
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetPhysicalDeviceSurfaceSupportKHR(
+    VkPhysicalDevice physicalDevice,
+    uint32_t         queueFamilyIndex,
+    VkSurfaceKHR     surface,
+    VkBool32*        pSupported)
+{
+    (void)physicalDevice;
+    *pSupported = (queueFamilyIndex == 0 && surface_is_headless(surface)) ? VK_TRUE : VK_FALSE;
+    return VK_SUCCESS;
+}
+
+/* 无头 surface 没有自己的大小，currentExtent 为 0xFFFFFFFF，由 swapchain 决定 */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+    VkPhysicalDevice          physicalDevice,
+    VkSurfaceKHR              surface,
+    VkSurfaceCapabilitiesKHR* pSurfaceCapabilities)
+{
+    (void)physicalDevice;
+    if (!surface_is_headless(surface)) return VK_ERROR_SURFACE_LOST_KHR;
+
+    VkSurfaceCapabilitiesKHR* caps = pSurfaceCapabilities;
+    memset(caps, 0, sizeof(*caps));
+    caps->minImageCount           = 2;
+    caps->maxImageCount           = VKVGPU_MAX_SWAPCHAIN_IMAGES;
+    caps->currentExtent.width     = 0xFFFFFFFFu;
+    caps->currentExtent.height    = 0xFFFFFFFFu;
+    caps->minImageExtent.width    = 1;
+    caps->minImageExtent.height   = 1;
+    caps->maxImageExtent.width    = VKVGPU_MAX_SWAPCHAIN_EXTENT;
+    caps->maxImageExtent.height   = VKVGPU_MAX_SWAPCHAIN_EXTENT;
+    caps->maxImageArrayLayers     = 1;
+    caps->supportedTransforms     = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    caps->currentTransform        = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    caps->supportedCompositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    caps->supportedUsageFlags     = SWAPCHAIN_USAGE;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetPhysicalDeviceSurfaceFormatsKHR(
+    VkPhysicalDevice    physicalDevice,
+    VkSurfaceKHR        surface,
+    uint32_t*           pSurfaceFormatCount,
+    VkSurfaceFormatKHR* pSurfaceFormats)
+{
+    (void)physicalDevice;
+    if (!surface_is_headless(surface)) return VK_ERROR_SURFACE_LOST_KHR;
+    if (!pSurfaceFormats) {
+        *pSurfaceFormatCount = SURFACE_FORMAT_COUNT;
+        return VK_SUCCESS;
+    }
+    uint32_t n = *pSurfaceFormatCount < SURFACE_FORMAT_COUNT ? *pSurfaceFormatCount
+                                                             : (uint32_t)SURFACE_FORMAT_COUNT;
+    memcpy(pSurfaceFormats, g_surface_formats, n * sizeof(*pSurfaceFormats));
+    *pSurfaceFormatCount = n;
+    return n < SURFACE_FORMAT_COUNT ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetPhysicalDeviceSurfacePresentModesKHR(
+    VkPhysicalDevice  physicalDevice,
+    VkSurfaceKHR      surface,
+    uint32_t*         pPresentModeCount,
+    VkPresentModeKHR* pPresentModes)
+{
+    (void)physicalDevice;
+    if (!surface_is_headless(surface)) return VK_ERROR_SURFACE_LOST_KHR;
+    if (!pPresentModes) {
+        *pPresentModeCount = PRESENT_MODE_COUNT;
+        return VK_SUCCESS;
+    }
+    uint32_t n = *pPresentModeCount < PRESENT_MODE_COUNT ? *pPresentModeCount
+                                                         : (uint32_t)PRESENT_MODE_COUNT;
+    memcpy(pPresentModes, g_present_modes, n * sizeof(*pPresentModes));
+    *pPresentModeCount = n;
+    return n < PRESENT_MODE_COUNT ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+/* ===========================================================
+ *                          swapchain
+ * ===========================================================*/
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkCreateSwapchainKHR(
+    VkDevice                        device,
+    const VkSwapchainCreateInfoKHR* pCreateInfo,
+    const VkAllocationCallbacks*    pAllocator,
+    VkSwapchainKHR*                 pSwapchain)
+{
+    VirtioDevice_T*   dev  = (VirtioDevice_T*)device;
+    VirtioInstance_T* inst = dev->instance;
+    const VkSwapchainCreateInfoKHR* ci = pCreateInfo;
+
+    if (!surface_is_headless(ci->surface)) return VK_ERROR_SURFACE_LOST_KHR;
+    if (!format_supported(ci->imageFormat, ci->imageColorSpace) ||
+        !present_mode_supported(ci->presentMode) ||
+        (ci->imageUsage & ~SWAPCHAIN_USAGE) ||
+        ci->imageExtent.width == 0 || ci->imageExtent.height == 0 ||
+        ci->imageExtent.width > VKVGPU_MAX_SWAPCHAIN_EXTENT ||
+        ci->imageExtent.height > VKVGPU_MAX_SWAPCHAIN_EXTENT)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    /* 旧 swapchain 由应用自己销毁；这里没有要从它继承的东西 */
+    uint32_t count = ci->minImageCount < 2 ? 2 : ci->minImageCount;
+    if (count > VKVGPU_MAX_SWAPCHAIN_IMAGES) count = VKVGPU_MAX_SWAPCHAIN_IMAGES;
+
+    VirtioSwapchain_T* sc = (VirtioSwapchain_T*)
+        vkvgpu_obj_alloc(&g_swapchain_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    if (!sc) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    sc->device       = dev;
+    sc->swapchain_id = vkvgpu_alloc_object_id(inst);
+    sc->extent       = ci->imageExtent;
+    sc->format       = ci->imageFormat;
+    sc->image_count  = count;
+    for (uint32_t i = 0; i < count; i++) {
+        sc->images[i].swapchain = sc;
+        sc->images[i].index     = i;
+    }
+
+    VkvgpuCreateSwapchainRequestPayload req;
+    memset(&req, 0, sizeof(req));
+    req.device_id    = dev->device_id;
+    req.swapchain_id = sc->swapchain_id;
+    req.width        = ci->imageExtent.width;
+    req.height       = ci->imageExtent.height;
+    req.format       = (uint32_t)ci->imageFormat;
+    req.usage        = ci->imageUsage;
+    req.image_count  = count;
+    req.present_mode = (uint32_t)ci->presentMode;
+
+    int fd = -1;
+    int rc = vkvgpu_call_fd(inst->ctx_id, VKVGPU_CMD_CREATE_SWAPCHAIN, &req, sizeof(req),
+                            NULL, 0, &fd);
+    if (rc != 0 || fd < 0) {
+        LOG("CREATE_SWAPCHAIN failed rc=%d", rc);
+        vkvgpu_obj_free(&g_swapchain_pool, pAllocator, sc);
+        return vkvgpu_result(rc, VK_ERROR_INITIALIZATION_FAILED);
+    }
+
+    sc->frame_size = VKVGPU_FRAME_HEADER_SIZE + (size_t)ci->imageExtent.width *
+                     vkvgpu_frame_bpp((uint32_t)ci->imageFormat) * ci->imageExtent.height;
+    sc->frame = (uint8_t*)vkvgpu_shared_map_fd(fd, sc->frame_size);
+    if (!sc->frame) {
+        VkvgpuDestroySwapchainRequestPayload dreq = { sc->swapchain_id };
+        vkvgpu_send_async(inst->ctx_id, VKVGPU_CMD_DESTROY_SWAPCHAIN, &dreq, sizeof(dreq));
+        vkvgpu_obj_free(&g_swapchain_pool, pAllocator, sc);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    LOG("swapchain %llu: %ux%u x%u", (unsigned long long)sc->swapchain_id,
+        ci->imageExtent.width, ci->imageExtent.height, count);
+    *pSwapchain = (VkSwapchainKHR)(uintptr_t)sc;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+vkDestroySwapchainKHR(
+    VkDevice                     device,
+    VkSwapchainKHR               swapchain,
+    const VkAllocationCallbacks* pAllocator)
+{
+    (void)device;
+    VirtioSwapchain_T* sc = to_swapchain(swapchain);
+    if (!sc) return;
+
+    VkvgpuDestroySwapchainRequestPayload req = { sc->swapchain_id };
+    vkvgpu_send_async(sc->device->instance->ctx_id, VKVGPU_CMD_DESTROY_SWAPCHAIN,
+                      &req, sizeof(req));
+    vkvgpu_shared_region_unmap(sc->frame, sc->frame_size);
+    vkvgpu_obj_free(&g_swapchain_pool, pAllocator, sc);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+vkGetSwapchainImagesKHR(
+    VkDevice       device,
+    VkSwapchainKHR swapchain,
+    uint32_t*      pSwapchainImageCount,
+    VkImage*       pSwapchainImages)
+{
+    (void)device;
+    VirtioSwapchain_T* sc = to_swapchain(swapchain);
+    if (!pSwapchainImages) {
+        *pSwapchainImageCount = sc->image_count;
+        return VK_SUCCESS;
+    }
+    uint32_t n = *pSwapchainImageCount < sc->image_count ? *pSwapchainImageCount
+                                                          : sc->image_count;
+    for (uint32_t i = 0; i < n; i++)
+        pSwapchainImages[i] = (VkImage)(uintptr_t)&sc->images[i];
+    *pSwapchainImageCount = n;
+    return n < sc->image_count ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+/* 从 avail_mask 里认领一张图像，从 next_image 开始找；没有返回 -1 */
+static int claim_image(VirtioSwapchain_T* sc, VkvgpuFrameHeader* hdr)
+{
+    uint32_t mask = __atomic_load_n(&hdr->avail_mask, __ATOMIC_ACQUIRE);
+    for (uint32_t k = 0; k < sc->image_count && mask; k++) {
+        uint32_t i   = (sc->next_image + k) % sc->image_count;
+        uint32_t bit = 1u << i;
+        if ((mask & bit) &&
+            (__atomic_fetch_and(&hdr->avail_mask, ~bit, __ATOMIC_ACQUIRE) & bit)) {
+            sc->next_image = i + 1;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 图像可用性直接看共享帧缓冲头，不经过 daemon：present 线程用完一张就置回可用位
+ * 并在 release_seq 上唤醒。图像交回时它的读回已经完成，所以 fence 直接在本地置位；
+ * 只有一个队列且按顺序执行，binary semaphore 不需要做什么。
+ */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkAcquireNextImageKHR(
+    VkDevice       device,
+    VkSwapchainKHR swapchain,
+    uint64_t       timeout,
+    VkSemaphore    semaphore,
+    VkFence        fence,
+    uint32_t*      pImageIndex)
+{
+    (void)device;
+    (void)semaphore;
+    VirtioSwapchain_T* sc  = to_swapchain(swapchain);
+    VkvgpuFrameHeader* hdr = (VkvgpuFrameHeader*)sc->frame;
+    uint64_t deadline = timeout == UINT64_MAX ? UINT64_MAX : vkvgpu_monotonic_ns() + timeout;
+
+    for (;;) {
+        int32_t status = __atomic_load_n(&hdr->status, __ATOMIC_ACQUIRE);
+        if (status != 0) return (VkResult)status;
+
+        uint32_t seq = __atomic_load_n(&hdr->release_seq, __ATOMIC_ACQUIRE);
+        int index = claim_image(sc, hdr);
+        if (index >= 0) {
+            *pImageIndex = (uint32_t)index;
+            if (fence) vkvgpu_fence_signal_local(fence);
+            return VK_SUCCESS;
+        }
+        if (timeout == 0) return VK_NOT_READY;
+
+        /* 分段等，超时很长时也能定期重新检查 status */
+        int wait_ms = 100;
+        if (deadline != UINT64_MAX) {
+            uint64_t now = vkvgpu_monotonic_ns();
+            if (now >= deadline) return VK_TIMEOUT;
+            uint64_t left_ms = (deadline - now + 999999) / 1000000;
+            if (left_ms < (uint64_t)wait_ms) wait_ms = (int)left_ms;
+        }
+        vkvgpu_futex_wait(&hdr->release_seq, seq, wait_ms);
+    }
+}
+
+/*
+ * 每个 swapchain 一条异步 QUEUE_PRESENT，daemon 只是把图像排进 present 队列，
+ * 读回、damage 检测和刷新率节拍都在它的 present 线程里，guest 不等帧传输。
+ */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkQueuePresentKHR(
+    VkQueue                 queue,
+    const VkPresentInfoKHR* pPresentInfo)
+{
+    VirtioQueue_T* q = (VirtioQueue_T*)queue;
+    uint32_t ctx_id = q->device->instance->ctx_id;
+    VkResult result = VK_SUCCESS;
+
+    for (uint32_t i = 0; i < pPresentInfo->swapchainCount; i++) {
+        VirtioSwapchain_T* sc = to_swapchain(pPresentInfo->pSwapchains[i]);
+
+        VkvgpuQueuePresentRequestPayload req;
+        memset(&req, 0, sizeof(req));
+        req.swapchain_id = sc->swapchain_id;
+        req.image_index  = pPresentInfo->pImageIndices[i];
+
+        VkResult r = VK_SUCCESS;
+        if (req.image_index >= sc->image_count)
+            r = VK_ERROR_OUT_OF_DATE_KHR;
+        else if (vkvgpu_send_async(ctx_id, VKVGPU_CMD_QUEUE_PRESENT, &req, sizeof(req)) != 0)
+            r = VK_ERROR_DEVICE_LOST;
+
+        if (pPresentInfo->pResults)
+            pPresentInfo->pResults[i] = r;
+        if (r != VK_SUCCESS && result == VK_SUCCESS)
+            result = r;
+    }
+    return result;
+}
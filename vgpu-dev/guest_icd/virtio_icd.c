@@ -1,248 +1,99 @@
 // virtio_icd.c
 #define _GNU_SOURCE
-#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <stdint.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 
 #include <vulkan/vulkan.h>
-#include "vk_virtio_proto.h"
-
-#define LOG(fmt, ...) fprintf(stderr, "[virtio-icd] " fmt "\n", ##__VA_ARGS__)
+#include <vulkan/vk_icd.h>
+#include "icd_private.h"
+#include "icd_pool.h"
+#include "vk_vgpu_dispatch_template.h"
 
 /* ===========================================================
- *            Socket / Protocol Helpers
+ *            Protocol Helpers（传输见 icd_transport.c）
  * ===========================================================*/
 
-static int g_sock_fd = -1;
-
-static int ensure_connection(void) {
-    if (g_sock_fd >= 0) return 0;
-
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0) {
-        perror("[virtio-icd] socket");
-        return -1;
-    }
-
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, VKVGPU_SOCKET_PATH, sizeof(addr.sun_path) - 1);
-
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("[virtio-icd] connect");
-        close(fd);
+/* CREATE_CONTEXT：每个 VkInstance 一个上下文，共享本线程的传输通道 */
+static int send_create_context(uint32_t *out_ctx_id) {
+    VkvgpuCreateContextReplyPayload payload;
+    if (vkvgpu_call(VKVGPU_CTX_NONE, VKVGPU_CMD_CREATE_CONTEXT, NULL, 0,
+                    &payload, sizeof(payload)) != 0)
         return -1;
-    }
 
-    g_sock_fd = fd;
-    LOG("connected to daemon at %s", VKVGPU_SOCKET_PATH);
+    LOG("daemon gave ctx_id=%u", payload.ctx_id);
+    *out_ctx_id = payload.ctx_id;
     return 0;
 }
 
-/* 简单命令：无 payload / 无返回 payload，仅检查 status */
-static int send_simple_cmd(VkvgpuCommandType cmd) {
-    if (ensure_connection() != 0)
-        return -1;
-
-    VkvgpuMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.header.magic        = VKVGPU_MAGIC;
-    msg.header.cmd          = cmd;
-    msg.header.payload_size = 0;
-
-    ssize_t n = send(g_sock_fd, &msg, sizeof(msg), 0);
-    if (n < (ssize_t)sizeof(VkvgpuHeader)) {
-        perror("[virtio-icd] send");
-        return -1;
-    }
-
-    VkvgpuReply reply;
-    n = recv(g_sock_fd, &reply, sizeof(reply), 0);
-    if (n < (ssize_t)sizeof(reply)) {
-        perror("[virtio-icd] recv");
-        return -1;
-    }
-
-    LOG("daemon replied status=%d", reply.status);
-    return reply.status;
-}
-
-/* 枚举物理设备：daemon 返回 GPU 个数 payload */
-static int send_enum_physdevs(uint32_t *out_count) {
-    if (ensure_connection() != 0)
-        return -1;
-
-    VkvgpuMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.header.magic        = VKVGPU_MAGIC;
-    msg.header.cmd          = VKVGPU_CMD_ENUM_PHYSICAL_DEVICES;
-    msg.header.payload_size = 0;
-
-    ssize_t n = send(g_sock_fd, &msg, sizeof(msg), 0);
-    if (n < (ssize_t)sizeof(VkvgpuHeader)) {
-        perror("[virtio-icd] send enum");
-        return -1;
-    }
-
-    VkvgpuReply reply;
-    n = recv(g_sock_fd, &reply, sizeof(reply), 0);
-    if (n < (ssize_t)sizeof(reply)) {
-        perror("[virtio-icd] recv reply");
-        return -1;
-    }
-
-    if (reply.status != 0) {
-        LOG("daemon returned error status=%d", reply.status);
-        return -1;
-    }
-
-    if (reply.payload_size != sizeof(VkvgpuEnumPhysDevsPayload)) {
-        LOG("unexpected payload_size=%u in ENUM_PHYSICAL_DEVICES", reply.payload_size);
-        return -1;
-    }
+/* 枚举物理设备：daemon 返回 GPU 个数 payload（同步点） */
+static int send_enum_physdevs(uint32_t ctx_id, VkvgpuHandle instance_id,
+                              uint32_t *out_count) {
+    VkvgpuEnumPhysDevsRequestPayload req;
+    req.instance_id = instance_id;
 
     VkvgpuEnumPhysDevsPayload payload;
-    n = recv(g_sock_fd, &payload, sizeof(payload), 0);
-    if (n < (ssize_t)sizeof(payload)) {
-        perror("[virtio-icd] recv payload");
-        return -1;
-    }
+    int rc = vkvgpu_call(ctx_id, VKVGPU_CMD_ENUM_PHYSICAL_DEVICES, &req, sizeof(req),
+                         &payload, sizeof(payload));
+    if (rc != 0)
+        return rc;
 
     LOG("daemon says phys dev count = %u", payload.count);
     *out_count = payload.count;
     return 0;
 }
 
-/* CREATE_INSTANCE：daemon 返回 host-side instance handle */
-static int send_create_instance(VkvgpuHandle *out_handle) {
-    if (ensure_connection() != 0)
-        return -1;
-
-    VkvgpuMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.header.magic        = VKVGPU_MAGIC;
-    msg.header.cmd          = VKVGPU_CMD_CREATE_INSTANCE;
-    msg.header.payload_size = 0;
-
-    ssize_t n = send(g_sock_fd, &msg, sizeof(msg), 0);
-    if (n < (ssize_t)sizeof(VkvgpuHeader)) {
-        perror("[virtio-icd] send create_instance");
-        return -1;
-    }
-
-    VkvgpuReply reply;
-    n = recv(g_sock_fd, &reply, sizeof(reply), 0);
-    if (n < (ssize_t)sizeof(reply)) {
-        perror("[virtio-icd] recv reply");
-        return -1;
-    }
-
-    if (reply.status != 0) {
-        LOG("daemon returned error status=%d", reply.status);
-        return -1;
-    }
-
-    if (reply.payload_size != sizeof(VkvgpuCreateInstanceReplyPayload)) {
-        LOG("unexpected payload_size=%u in CREATE_INSTANCE", reply.payload_size);
-        return -1;
-    }
-
-    VkvgpuCreateInstanceReplyPayload payload;
-    n = recv(g_sock_fd, &payload, sizeof(payload), 0);
-    if (n < (ssize_t)sizeof(payload)) {
-        perror("[virtio-icd] recv payload");
-        return -1;
-    }
-
-    LOG("daemon gave instance handle=%lu", (unsigned long)payload.instance_handle);
-    *out_handle = payload.instance_handle;
-    return 0;
+/* CREATE_INSTANCE：ID 由 guest 分配，不等 daemon 回复 */
+static int send_create_instance(uint32_t ctx_id, VkvgpuHandle instance_id) {
+    VkvgpuCreateInstanceRequestPayload req;
+    req.instance_id = instance_id;
+    return vkvgpu_send_async(ctx_id, VKVGPU_CMD_CREATE_INSTANCE, &req, sizeof(req));
 }
 
-/* CREATE_DEVICE：发送 instance_handle，返回 device_handle */
-static int send_create_device(VkvgpuHandle instance_handle,
-                              VkvgpuHandle *out_device_handle)
+/* CREATE_DEVICE：同样异步，失败在下一个同步点报告 */
+static int send_create_device(uint32_t ctx_id, VkvgpuHandle instance_id,
+                              uint32_t phys_index, VkvgpuHandle device_id)
 {
-    if (ensure_connection() != 0)
-        return -1;
-
     VkvgpuCreateDeviceRequestPayload req;
-    req.instance_handle = instance_handle;
-
-    VkvgpuMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.header.magic        = VKVGPU_MAGIC;
-    msg.header.cmd          = VKVGPU_CMD_CREATE_DEVICE;
-    msg.header.payload_size = sizeof(req);
-
-    ssize_t n = send(g_sock_fd, &msg, sizeof(msg), 0);
-    if (n < (ssize_t)sizeof(VkvgpuHeader)) {
-        perror("[virtio-icd] send create_device header");
-        return -1;
-    }
-    n = send(g_sock_fd, &req, sizeof(req), 0);
-    if (n < (ssize_t)sizeof(req)) {
-        perror("[virtio-icd] send create_device payload");
-        return -1;
-    }
-
-    VkvgpuReply reply;
-    n = recv(g_sock_fd, &reply, sizeof(reply), 0);
-    if (n < (ssize_t)sizeof(reply)) {
-        perror("[virtio-icd] recv create_device reply");
-        return -1;
-    }
-    if (reply.status != 0) {
-        LOG("daemon returned error status=%d in CREATE_DEVICE", reply.status);
-        return -1;
-    }
-    if (reply.payload_size != sizeof(VkvgpuCreateDeviceReplyPayload)) {
-        LOG("unexpected payload_size=%u in CREATE_DEVICE", reply.payload_size);
-        return -1;
-    }
-
-    VkvgpuCreateDeviceReplyPayload payload;
-    n = recv(g_sock_fd, &payload, sizeof(payload), 0);
-    if (n < (ssize_t)sizeof(payload)) {
-        perror("[virtio-icd] recv create_device payload");
-        return -1;
-    }
-
-    LOG("daemon gave device handle=%lu", (unsigned long)payload.device_handle);
-    *out_device_handle = payload.device_handle;
-    return 0;
+    memset(&req, 0, sizeof(req));
+    req.instance_id = instance_id;
+    req.device_id   = device_id;
+    req.phys_index  = phys_index;
+    return vkvgpu_send_async(ctx_id, VKVGPU_CMD_CREATE_DEVICE, &req, sizeof(req));
 }
 
+static VkvgpuPool g_instance_pool = VKVGPU_POOL_INIT(VirtioInstance_T, "instance");
+static VkvgpuPool g_device_pool   = VKVGPU_POOL_INIT(VirtioDevice_T, "device");
+
 /* ===========================================================
- *           句柄包装：Instance / Device / PhysDev
+ *                     Vulkan ICD 实现
  * ===========================================================*/
 
-typedef struct VirtioInstance_T {
-    VkvgpuHandle host_instance;
-} VirtioInstance_T;
-
-typedef struct VirtioDevice_T {
-    VkvgpuHandle host_device;
-} VirtioDevice_T;
-
-typedef struct VirtioPhysicalDevice_T {
-    uint32_t id;
-} VirtioPhysicalDevice_T;
+/* 只有无头 WSI：surface 由 loader 创建（VkIcdSurfaceHeadless），实现见 icd_wsi.c */
+static const VkExtensionProperties g_instance_extensions[] = {
+    { VK_KHR_SURFACE_EXTENSION_NAME,          VK_KHR_SURFACE_SPEC_VERSION },
+    { VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME, VK_EXT_HEADLESS_SURFACE_SPEC_VERSION },
+};
 
-/* 先假设只有 1 个物理设备 */
-static VirtioPhysicalDevice_T g_phys_dev_data = { .id = 0 };
-static VkPhysicalDevice       g_phys_dev_array[1] = {
-    (VkPhysicalDevice)&g_phys_dev_data
+static const VkExtensionProperties g_device_extensions[] = {
+    { VK_KHR_SWAPCHAIN_EXTENSION_NAME,          VK_KHR_SWAPCHAIN_SPEC_VERSION },
+    { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_SPEC_VERSION },
+    { VK_VGPU_DISPATCH_TEMPLATE_EXTENSION_NAME, VK_VGPU_DISPATCH_TEMPLATE_SPEC_VERSION },
 };
 
-/* ===========================================================
- *                     Vulkan ICD 实现
- * ===========================================================*/
+static VkResult copy_extensions(const VkExtensionProperties* exts, uint32_t count,
+                                uint32_t* pPropertyCount, VkExtensionProperties* pProperties)
+{
+    if (!pPropertyCount) return VK_ERROR_INITIALIZATION_FAILED;
+    if (!pProperties) {
+        *pPropertyCount = count;
+        return VK_SUCCESS;
+    }
+    uint32_t n = *pPropertyCount < count ? *pPropertyCount : count;
+    memcpy(pProperties, exts, n * sizeof(*exts));
+    *pPropertyCount = n;
+    return n < count ? VK_INCOMPLETE : VK_SUCCESS;
+}
 
 VKAPI_ATTR VkResult VKAPI_CALL
 vkEnumerateInstanceExtensionProperties(
@@ -250,14 +101,10 @@ vkEnumerateInstanceExtensionProperties(
     uint32_t*             pPropertyCount,
     VkExtensionProperties* pProperties)
 {
-    (void)pLayerName;
-    if (!pPropertyCount) return VK_ERROR_INITIALIZATION_FAILED;
-    if (!pProperties) {
-        *pPropertyCount = 0;
-        return VK_SUCCESS;
-    }
-    *pPropertyCount = 0;
-    return VK_SUCCESS;
+    if (pLayerName) return VK_ERROR_LAYER_NOT_PRESENT;
+    return copy_extensions(g_instance_extensions,
+                           sizeof(g_instance_extensions) / sizeof(g_instance_extensions[0]),
+                           pPropertyCount, pProperties);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL
@@ -281,19 +128,37 @@ vkCreateInstance(
     VkInstance*                  pInstance)
 {
     (void)pCreateInfo;
-    (void)pAllocator;
 
     LOG("vkCreateInstance");
 
-    VkvgpuHandle host_inst = 0;
-    if (send_create_instance(&host_inst) != 0) {
-        LOG("send_create_instance failed");
+    uint32_t ctx_id = VKVGPU_CTX_NONE;
+    if (send_create_context(&ctx_id) != 0) {
+        LOG("send_create_context failed");
         return VK_ERROR_INITIALIZATION_FAILED;
     }
+    vkvgpu_ctx_seq_open(ctx_id);
+
+    VirtioInstance_T* inst = (VirtioInstance_T*)
+        vkvgpu_obj_alloc(&g_instance_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE);
+    if (!inst) {
+        vkvgpu_send_async(ctx_id, VKVGPU_CMD_DESTROY_CONTEXT, NULL, 0);
+        vkvgpu_ctx_seq_close(ctx_id);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    set_loader_magic_value(inst);
+    pthread_mutex_init(&inst->readback_lock, NULL);
+    inst->ctx_id         = ctx_id;
+    inst->next_object_id = 1;
+    inst->instance_id    = vkvgpu_alloc_object_id(inst);
 
-    VirtioInstance_T* inst = (VirtioInstance_T*)malloc(sizeof(VirtioInstance_T));
-    if (!inst) return VK_ERROR_OUT_OF_HOST_MEMORY;
-    inst->host_instance = host_inst;
+    if (send_create_instance(ctx_id, inst->instance_id) != 0) {
+        LOG("send_create_instance failed");
+        vkvgpu_send_async(ctx_id, VKVGPU_CMD_DESTROY_CONTEXT, NULL, 0);
+        vkvgpu_ctx_seq_close(ctx_id);
+        pthread_mutex_destroy(&inst->readback_lock);
+        vkvgpu_obj_free(&g_instance_pool, pAllocator, inst);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
 
     *pInstance = (VkInstance)inst;
     return VK_SUCCESS;
@@ -304,11 +169,15 @@ vkDestroyInstance(
     VkInstance                   instance,
     const VkAllocationCallbacks* pAllocator)
 {
-    (void)pAllocator;
     LOG("vkDestroyInstance");
     if (!instance) return;
     VirtioInstance_T* inst = (VirtioInstance_T*)instance;
-    free(inst);
+    /* 上下文销毁时 daemon 会回收其中所有 host 对象 */
+    vkvgpu_send_async(inst->ctx_id, VKVGPU_CMD_DESTROY_CONTEXT, NULL, 0);
+    vkvgpu_ctx_seq_close(inst->ctx_id);
+    vkvgpu_readback_release(inst);
+    pthread_mutex_destroy(&inst->readback_lock);
+    vkvgpu_obj_free(&g_instance_pool, pAllocator, inst);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL
@@ -317,14 +186,25 @@ vkEnumeratePhysicalDevices(
     uint32_t*         pPhysicalDeviceCount,
     VkPhysicalDevice* pPhysicalDevices)
 {
-    (void)instance;
     LOG("vkEnumeratePhysicalDevices");
+    if (!instance) return VK_ERROR_INITIALIZATION_FAILED;
+    VirtioInstance_T* inst = (VirtioInstance_T*)instance;
 
     uint32_t count_from_daemon = 0;
-    if (send_enum_physdevs(&count_from_daemon) != 0) {
+    int rc = send_enum_physdevs(inst->ctx_id, inst->instance_id, &count_from_daemon);
+    if (rc != 0) {
         LOG("send_enum_physdevs failed");
-        return VK_ERROR_INITIALIZATION_FAILED;
+        return vkvgpu_result(rc, VK_ERROR_INITIALIZATION_FAILED);
+    }
+    if (count_from_daemon > VIRTIO_MAX_PHYS_DEVS)
+        count_from_daemon = VIRTIO_MAX_PHYS_DEVS;
+
+    for (uint32_t i = 0; i < count_from_daemon; i++) {
+        set_loader_magic_value(&inst->phys[i]);
+        inst->phys[i].id       = i;
+        inst->phys[i].instance = inst;
     }
+    inst->phys_count = count_from_daemon;
 
     if (!pPhysicalDevices) {
         *pPhysicalDeviceCount = count_from_daemon;
@@ -333,11 +213,11 @@ vkEnumeratePhysicalDevices(
 
     uint32_t to_copy = (*pPhysicalDeviceCount < count_from_daemon)
                        ? *pPhysicalDeviceCount : count_from_daemon;
-    if (to_copy > 0) {
-        pPhysicalDevices[0] = g_phys_dev_array[0];
+    for (uint32_t i = 0; i < to_copy; i++) {
+        pPhysicalDevices[i] = (VkPhysicalDevice)&inst->phys[i];
     }
     *pPhysicalDeviceCount = to_copy;
-    return VK_SUCCESS;
+    return (to_copy < count_from_daemon) ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL
@@ -347,23 +227,42 @@ vkCreateDevice(
     const VkAllocationCallbacks* pAllocator,
     VkDevice*                    pDevice)
 {
-    (void)physicalDevice;
     (void)pCreateInfo;
-    (void)pAllocator;
 
     LOG("vkCreateDevice");
+    if (!physicalDevice) return VK_ERROR_INITIALIZATION_FAILED;
 
-    /* 简单起见：从任意实例创建 device，这里不追踪 phys→inst 关系 */
-    VkvgpuHandle host_device = 0;
-    /* 随便给一个 instance_handle 0，真正实现可以从 instance 里取 */
-    if (send_create_device(0, &host_device) != 0) {
+    VirtioPhysicalDevice_T* pd   = (VirtioPhysicalDevice_T*)physicalDevice;
+    VirtioInstance_T*       inst = pd->instance;
+
+    VirtioDevice_T* dev = (VirtioDevice_T*)
+        vkvgpu_obj_alloc(&g_device_pool, pAllocator, VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+    if (!dev) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    set_loader_magic_value(dev);
+    dev->instance  = inst;
+    dev->phys      = pd;
+    dev->device_id = vkvgpu_alloc_object_id(inst);
+    set_loader_magic_value(&dev->queue);
+    dev->queue.device = dev;
+    pthread_mutex_init(&dev->mem_lock, NULL);
+
+    if (send_create_device(inst->ctx_id, inst->instance_id, pd->id,
+                           dev->device_id) != 0) {
         LOG("send_create_device failed");
+        pthread_mutex_destroy(&dev->mem_lock);
+        vkvgpu_obj_free(&g_device_pool, pAllocator, dev);
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    VirtioDevice_T* dev = (VirtioDevice_T*)malloc(sizeof(VirtioDevice_T));
-    if (!dev) return VK_ERROR_OUT_OF_HOST_MEMORY;
-    dev->host_device = host_device;
+    /* 同步调用，顺带取回异步 CREATE_DEVICE 的结果 */
+    VkResult r = vkvgpu_sync_init(dev);
+    if (r != VK_SUCCESS) {
+        VkvgpuDestroyDeviceRequestPayload dreq = { dev->device_id };
+        vkvgpu_send_async(inst->ctx_id, VKVGPU_CMD_DESTROY_DEVICE, &dreq, sizeof(dreq));
+        pthread_mutex_destroy(&dev->mem_lock);
+        vkvgpu_obj_free(&g_device_pool, pAllocator, dev);
+        return r;
+    }
 
     *pDevice = (VkDevice)dev;
     return VK_SUCCESS;
@@ -374,14 +273,31 @@ vkDestroyDevice(
     VkDevice                     device,
     const VkAllocationCallbacks* pAllocator)
 {
-    (void)pAllocator;
     LOG("vkDestroyDevice");
     if (!device) return;
     VirtioDevice_T* dev = (VirtioDevice_T*)device;
-    free(dev);
+
+    vkvgpu_sync_release(dev);
+
+    VkvgpuDestroyDeviceRequestPayload req;
+    req.device_id = dev->device_id;
+    vkvgpu_send_async(dev->instance->ctx_id, VKVGPU_CMD_DESTROY_DEVICE, &req, sizeof(req));
+    pthread_mutex_destroy(&dev->mem_lock);
+    free(dev->gpu_writes);
+    vkvgpu_obj_free(&g_device_pool, pAllocator, dev);
 }
 
-/* 这些函数目前用不到，给 stub，避免 loader 报错 */
+/* 同步点：取回之前异步创建/销毁命令的错误，再在本地等队列上的提交完成 */
+VKAPI_ATTR VkResult VKAPI_CALL
+vkDeviceWaitIdle(
+    VkDevice device)
+{
+    if (!device) return VK_ERROR_DEVICE_LOST;
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    int rc = vkvgpu_call(dev->instance->ctx_id, VKVGPU_CMD_SYNC, NULL, 0, NULL, 0);
+    if (rc != 0) return vkvgpu_result(rc, VK_ERROR_DEVICE_LOST);
+    return vkvgpu_queue_wait_idle(dev);
+}
 
 VKAPI_ATTR VkResult VKAPI_CALL
 vkEnumerateDeviceExtensionProperties(
@@ -391,65 +307,82 @@ vkEnumerateDeviceExtensionProperties(
     VkExtensionProperties* pProperties)
 {
     (void)physicalDevice;
-    (void)pLayerName;
-    if (!pPropertyCount) return VK_ERROR_INITIALIZATION_FAILED;
-    if (!pProperties) {
-        *pPropertyCount = 0;
-        return VK_SUCCESS;
+    if (pLayerName) return VK_ERROR_LAYER_NOT_PRESENT;
+    return copy_extensions(g_device_extensions,
+                           sizeof(g_device_extensions) / sizeof(g_device_extensions[0]),
+                           pPropertyCount, pProperties);
+}
+
+/* 与 daemon 一致：一个 family，一个队列 */
+VKAPI_ATTR void VKAPI_CALL
+vkGetPhysicalDeviceQueueFamilyProperties(
+    VkPhysicalDevice         physicalDevice,
+    uint32_t*                pQueueFamilyPropertyCount,
+    VkQueueFamilyProperties* pQueueFamilyProperties)
+{
+    (void)physicalDevice;
+    if (!pQueueFamilyProperties) {
+        *pQueueFamilyPropertyCount = 1;
+        return;
     }
-    *pPropertyCount = 0;
-    return VK_SUCCESS;
+    if (*pQueueFamilyPropertyCount == 0) return;
+
+    memset(pQueueFamilyProperties, 0, sizeof(*pQueueFamilyProperties));
+    pQueueFamilyProperties->queueFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT |
+                                         VK_QUEUE_TRANSFER_BIT;
+    pQueueFamilyProperties->queueCount = 1;
+    pQueueFamilyProperties->minImageTransferGranularity.width  = 1;
+    pQueueFamilyProperties->minImageTransferGranularity.height = 1;
+    pQueueFamilyProperties->minImageTransferGranularity.depth  = 1;
+    *pQueueFamilyPropertyCount = 1;
 }
 
-VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
-vkGetDeviceProcAddr(
-    VkDevice    device,
-    const char* pName)
+VKAPI_ATTR void VKAPI_CALL
+vkGetDeviceQueue(
+    VkDevice device,
+    uint32_t queueFamilyIndex,
+    uint32_t queueIndex,
+    VkQueue* pQueue)
 {
-    (void)device;
-    (void)pName;
-    return NULL;
+    VirtioDevice_T* dev = (VirtioDevice_T*)device;
+    *pQueue = (queueFamilyIndex == 0 && queueIndex == 0) ? (VkQueue)&dev->queue : VK_NULL_HANDLE;
 }
 
 /* ===========================================================
- *             vkGetInstanceProcAddr / ICD 入口
+ *         GetProcAddr（入口点表由 tools/gen_dispatch.py 生成）
  * ===========================================================*/
 
-static PFN_vkVoidFunction resolve_instance_proc(const char* name)
+#include "icd_entrypoints.h"
+
+/* 按级别过滤：max_level 以下（含）的函数都可以返回 */
+static PFN_vkVoidFunction lookup_proc(const char* name, uint32_t min_level,
+                                      uint32_t max_level)
 {
     if (!name) return NULL;
+    const VkvgpuEntrypoint* ep = vkvgpu_ep_lookup(name);
+    if (!ep || ep->level < min_level || ep->level > max_level) return NULL;
+    return ep->fn;
+}
 
-    if (strcmp(name, "vkCreateInstance") == 0)
-        return (PFN_vkVoidFunction)vkCreateInstance;
-    if (strcmp(name, "vkDestroyInstance") == 0)
-        return (PFN_vkVoidFunction)vkDestroyInstance;
-    if (strcmp(name, "vkEnumerateInstanceExtensionProperties") == 0)
-        return (PFN_vkVoidFunction)vkEnumerateInstanceExtensionProperties;
-    if (strcmp(name, "vkEnumerateInstanceLayerProperties") == 0)
-        return (PFN_vkVoidFunction)vkEnumerateInstanceLayerProperties;
-    if (strcmp(name, "vkEnumeratePhysicalDevices") == 0)
-        return (PFN_vkVoidFunction)vkEnumeratePhysicalDevices;
-    if (strcmp(name, "vkCreateDevice") == 0)
-        return (PFN_vkVoidFunction)vkCreateDevice;
-    if (strcmp(name, "vkDestroyDevice") == 0)
-        return (PFN_vkVoidFunction)vkDestroyDevice;
-    if (strcmp(name, "vkEnumerateDeviceExtensionProperties") == 0)
-        return (PFN_vkVoidFunction)vkEnumerateDeviceExtensionProperties;
-    if (strcmp(name, "vkGetDeviceProcAddr") == 0)
-        return (PFN_vkVoidFunction)vkGetDeviceProcAddr;
-
-    return NULL;
+/* 规范要求只返回设备级函数，实例级的名字返回 NULL */
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+vkGetDeviceProcAddr(
+    VkDevice    device,
+    const char* pName)
+{
+    (void)device;
+    return lookup_proc(pName, VKVGPU_EP_DEVICE, VKVGPU_EP_DEVICE);
 }
 
+/* instance 为 NULL 时只能拿到全局函数（vkCreateInstance 等） */
 VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
 vkGetInstanceProcAddr(
     VkInstance  instance,
     const char* pName)
 {
-    (void)instance;
-    PFN_vkVoidFunction f = resolve_instance_proc(pName);
-    if (f) return f;
-    return NULL;
+    if (!instance)
+        return lookup_proc(pName, VKVGPU_EP_GLOBAL, VKVGPU_EP_GLOBAL);
+    return lookup_proc(pName, VKVGPU_EP_GLOBAL, VKVGPU_EP_DEVICE);
 }
 
 /* loader 用的 ICD 入口 */
@@ -461,14 +394,12 @@ vk_icdGetInstanceProcAddr(
     return vkGetInstanceProcAddr(instance, pName);
 }
 
-/* 对于物理设备级函数，目前没实现，直接返回 NULL 即可 */
+/* loader 不认识的物理设备级函数会来这里查，其它级别一律 NULL */
 VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
 vk_icdGetPhysicalDeviceProcAddr(
     VkInstance      instance,
     const char*     pName)
 {
     (void)instance;
-    (void)pName;
-    return NULL;
+    return lookup_proc(pName, VKVGPU_EP_PHYSICAL_DEVICE, VKVGPU_EP_PHYSICAL_DEVICE);
 }
-
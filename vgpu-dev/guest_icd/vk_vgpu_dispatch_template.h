@@ -0,0 +1,80 @@
+// vk_vgpu_dispatch_template.h
+// VK_VGPU_dispatch_template：本 ICD 的厂商扩展，给应用用的头文件。
+//
+// 反复以同样的 pipeline、几乎同样的参数发 compute dispatch 时，不必每次重新录制、
+// 重新提交整个命令缓冲：建一次模板（SPIR-V + storage buffer 绑定 + push constant + 组数），
+// 之后每次调用只带变了的绑定和 push constant 区间，其余沿用上一次。
+// 建模板马上返回，pipeline 在 host 上后台编译，第一次调用时才等它编完；
+// 编译失败由之后的同步调用（等 fence、vkQueueWaitIdle 等）报出。
+// 入口点用 vkGetDeviceProcAddr 取。
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#define VK_VGPU_dispatch_template 1
+#define VK_VGPU_DISPATCH_TEMPLATE_SPEC_VERSION   1
+#define VK_VGPU_DISPATCH_TEMPLATE_EXTENSION_NAME "VK_VGPU_dispatch_template"
+
+VK_DEFINE_NON_DISPATCHABLE_HANDLE(VkDispatchTemplateVGPU)
+
+/* set 0 的 binding 号上绑 memory 的 [offset, offset + range)，类型固定为 storage buffer */
+typedef struct VkDispatchTemplateBindingVGPU {
+    uint32_t       binding;
+    VkDeviceMemory memory;
+    VkDeviceSize   offset;  // minStorageBufferOffsetAlignment 的倍数
+    VkDeviceSize   range;
+} VkDispatchTemplateBindingVGPU;
+
+/* 入口点固定为 "main"；binding 0..bindingCount-1 每个都要给出 */
+typedef struct VkDispatchTemplateCreateInfoVGPU {
+    size_t                               codeSize;
+    const uint32_t*                      pCode;
+    uint32_t                             pushConstantSize;  // <= 128
+    uint32_t                             bindingCount;      // <= 16
+    const VkDispatchTemplateBindingVGPU* pBindings;
+    uint32_t                             groupCountX;
+    uint32_t                             groupCountY;
+    uint32_t                             groupCountZ;
+} VkDispatchTemplateCreateInfoVGPU;
+
+/*
+ * 一次调用相对上一次的变化：pPushData 写到 push constant 的 pushOffset 处，
+ * pBindings 换掉对应 binding，组数为 0 的维度沿用上一次。变化留在模板里。
+ */
+typedef struct VkDispatchTemplateInvokeInfoVGPU {
+    uint32_t                             pushOffset;
+    uint32_t                             pushSize;
+    const void*                          pPushData;
+    uint32_t                             bindingCount;
+    const VkDispatchTemplateBindingVGPU* pBindings;
+    uint32_t                             groupCountX;
+    uint32_t                             groupCountY;
+    uint32_t                             groupCountZ;
+} VkDispatchTemplateInvokeInfoVGPU;
+
+typedef VkResult (VKAPI_PTR *PFN_vkCreateDispatchTemplateVGPU)(
+    VkDevice, const VkDispatchTemplateCreateInfoVGPU*, const VkAllocationCallbacks*, VkDispatchTemplateVGPU*);
+typedef void (VKAPI_PTR *PFN_vkDestroyDispatchTemplateVGPU)(
+    VkDevice, VkDispatchTemplateVGPU, const VkAllocationCallbacks*);
+/* 和 vkQueueSubmit 一样排在队列上，完成时 signal fence（可以为空） */
+typedef VkResult (VKAPI_PTR *PFN_vkQueueDispatchTemplateVGPU)(
+    VkQueue, VkDispatchTemplateVGPU, const VkDispatchTemplateInvokeInfoVGPU*, VkFence);
+
+#ifndef VK_NO_PROTOTYPES
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateDispatchTemplateVGPU(
+    VkDevice                                device,
+    const VkDispatchTemplateCreateInfoVGPU* pCreateInfo,
+    const VkAllocationCallbacks*            pAllocator,
+    VkDispatchTemplateVGPU*                 pTemplate);
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyDispatchTemplateVGPU(
+    VkDevice                     device,
+    VkDispatchTemplateVGPU       dispatchTemplate,
+    const VkAllocationCallbacks* pAllocator);
+
+VKAPI_ATTR VkResult VKAPI_CALL vkQueueDispatchTemplateVGPU(
+    VkQueue                                 queue,
+    VkDispatchTemplateVGPU                  dispatchTemplate,
+    const VkDispatchTemplateInvokeInfoVGPU* pInvokeInfo,
+    VkFence                                 fence);
+#endif
@@ -5,19 +5,66 @@
 #define VKVGPU_SOCKET_PATH "/tmp/vgpu.sock"
 #define VKVGPU_MAGIC 0x56564b50u  // 随便的 magic
 
+/*
+ * guest 侧对象 ID：由 guest 在各自上下文的命名空间里分配，
+ * 随创建命令一起发给 daemon，daemon 负责映射到 host 对象。
+ */
 typedef uint64_t VkvgpuHandle;
 
+/* ctx_id = 0 表示不属于任何上下文的全局命令（PING / CREATE_CONTEXT） */
+#define VKVGPU_CTX_NONE 0u
+
+/*
+ * daemon 的分发表由 tools/gen_dispatch.py 按这个枚举生成：
+ * VKVGPU_CMD_FOO 对应 vgpu_daemon.c 里的 cmd_foo()，
+ * 标了“全局命令”的在读线程里直接处理，不进上下文分发表。
+ */
 typedef enum {
-    VKVGPU_CMD_PING                = 1,
+    VKVGPU_CMD_PING                = 1,   // 全局命令
     VKVGPU_CMD_CREATE_INSTANCE     = 2,
     VKVGPU_CMD_ENUM_PHYSICAL_DEVICES = 3,
     VKVGPU_CMD_CREATE_DEVICE       = 4,
+    VKVGPU_CMD_CREATE_CONTEXT      = 5,   // 全局命令
+    VKVGPU_CMD_DESTROY_CONTEXT     = 6,
+    VKVGPU_CMD_DESTROY_DEVICE      = 7,
+    VKVGPU_CMD_SYNC                = 8,
+    VKVGPU_CMD_GET_MEMORY_PROPERTIES = 9,
+    VKVGPU_CMD_ALLOCATE_MEMORY     = 10,
+    VKVGPU_CMD_FREE_MEMORY         = 11,
+    VKVGPU_CMD_WRITE_MEMORY        = 12,
+    VKVGPU_CMD_READ_MEMORY         = 13,
+    VKVGPU_CMD_CREATE_SHARED_REGION = 14,
+    VKVGPU_CMD_READBACK_MEMORY     = 15,
+    VKVGPU_CMD_CREATE_SWAPCHAIN    = 16,
+    VKVGPU_CMD_DESTROY_SWAPCHAIN   = 17,
+    VKVGPU_CMD_QUEUE_PRESENT       = 18,
+    VKVGPU_CMD_CREATE_SYNC_PAGE    = 19,
+    VKVGPU_CMD_DESTROY_SYNC_PAGE   = 20,
+    VKVGPU_CMD_QUEUE_SUBMIT        = 21,
+    VKVGPU_CMD_CREDIT              = 22,  // 全局命令
+    VKVGPU_CMD_CREATE_DISPATCH_TEMPLATE  = 23,
+    VKVGPU_CMD_DESTROY_DISPATCH_TEMPLATE = 24,
+    VKVGPU_CMD_DISPATCH_TEMPLATE   = 25,
 } VkvgpuCommandType;
 
+/*
+ * cmd 最高位：异步命令，daemon 不回包。
+ * 异步命令失败时错误记在上下文里，在下一次同步回复的 deferred_status 里带回。
+ */
+#define VKVGPU_CMD_FLAG_ASYNC 0x80000000u
+#define VKVGPU_CMD_ID(cmd)    ((cmd) & ~VKVGPU_CMD_FLAG_ASYNC)
+
+/*
+ * 同一上下文的命令可能从 guest 不同线程的通道到达，各通道在 daemon 里由各自的读线程收，
+ * 到达顺序不等于发出顺序。上下文命令带一个上下文内从 1 递增的序号（跳过 0），
+ * daemon 按序号执行，缺号之前到的先扣下。seq = 0 表示不排序（全局命令）。
+ */
 typedef struct {
     uint32_t magic;
     uint32_t cmd;          // VkvgpuCommandType
     uint32_t payload_size; // payload 大小（字节）
+    uint32_t ctx_id;       // 所属上下文，daemon 按它分队列
+    uint32_t seq;          // 上下文内的发出顺序，见上
     uint32_t reserved;
 } VkvgpuHeader;
 
@@ -30,26 +77,358 @@ typedef struct {
 typedef struct {
     int32_t  status;       // 0 = OK
     uint32_t payload_size; // 后面的 payload 大小
+    uint32_t ctx_id;       // 回显请求的 ctx_id
+    int32_t  deferred_status; // 上次同步点以来第一个失败的异步命令，0 = 无
+    uint64_t credit_bytes; // 本连接的信用上限（累计值，见下）
+    uint64_t credit_cmds;
 } VkvgpuReply;
 
+/*
+ * 信用流控：每条连接上，上下文命令（ctx_id != 0）按 header + payload 字节和条数累计计数，
+ * guest 发出的累计量不能超过 daemon 在回复里给的累计上限。上限 = daemon 已执行完的量 +
+ * 窗口，窗口按这条连接实测的服务速率调整；连接建立时的上限是下面的初始值。
+ * 信用不够时 guest 发 CREDIT（同步），daemon 等腾出这么多信用后才回复。
+ * 全局命令不占信用。不守规矩的 guest 超额发送时 daemon 停止读它的连接。
+ */
+#define VKVGPU_CREDIT_INIT_BYTES (4u * 1024u * 1024u)
+#define VKVGPU_CREDIT_INIT_CMDS  256u
+
+/* CREDIT 请求 payload：还需要多少信用 */
+typedef struct {
+    uint64_t bytes;
+    uint32_t cmds;
+    uint32_t reserved;
+} VkvgpuCreditRequestPayload;
+
+/* CREATE_CONTEXT 返回 payload：daemon 分配的上下文 ID */
+typedef struct {
+    uint32_t ctx_id;
+    uint32_t reserved;
+} VkvgpuCreateContextReplyPayload;
+
+/* ENUM_PHYSICAL_DEVICES 请求 payload：guest instance ID */
+typedef struct {
+    VkvgpuHandle instance_id;
+} VkvgpuEnumPhysDevsRequestPayload;
+
 /* ENUM_PHYSICAL_DEVICES 的返回 payload */
 typedef struct {
     uint32_t count;
     uint32_t reserved;
 } VkvgpuEnumPhysDevsPayload;
 
-/* CREATE_INSTANCE 的返回 payload：host 侧 instance handle */
+/* CREATE_INSTANCE 请求 payload（异步） */
 typedef struct {
-    VkvgpuHandle instance_handle;
-} VkvgpuCreateInstanceReplyPayload;
+    VkvgpuHandle instance_id;
+} VkvgpuCreateInstanceRequestPayload;
 
-/* CREATE_DEVICE 请求 payload（简单版，只传 instance handle） */
+/* CREATE_DEVICE 请求 payload（异步）：所属 instance + 第几个物理设备 */
 typedef struct {
-    VkvgpuHandle instance_handle;
+    VkvgpuHandle instance_id;
+    VkvgpuHandle device_id;
+    uint32_t     phys_index;
+    uint32_t     reserved;
 } VkvgpuCreateDeviceRequestPayload;
 
-/* CREATE_DEVICE 返回 payload：host 侧 device handle */
+/* DESTROY_DEVICE 请求 payload（异步） */
+typedef struct {
+    VkvgpuHandle device_id;
+} VkvgpuDestroyDeviceRequestPayload;
+
+/* ------------------------------------------------------------
+ * 设备内存
+ * guest 对 host-visible 内存的写在本地影子页里进行，
+ * 只把脏页用 WRITE_MEMORY 传给 daemon；READ_MEMORY 用于 invalidate。
+ * ------------------------------------------------------------ */
+
+/* 单条 WRITE_MEMORY / READ_MEMORY 携带的数据上限，更大的范围由 guest 拆分 */
+#define VKVGPU_MAX_TRANSFER_CHUNK (512u * 1024u)
+
+#define VKVGPU_MAX_MEMORY_TYPES 32
+#define VKVGPU_MAX_MEMORY_HEAPS 16
+
+/* GET_MEMORY_PROPERTIES 请求 payload（同步） */
+typedef struct {
+    VkvgpuHandle instance_id;
+    uint32_t     phys_index;
+    uint32_t     reserved;
+} VkvgpuGetMemoryPropertiesRequestPayload;
+
+/* GET_MEMORY_PROPERTIES 返回 payload：VkPhysicalDeviceMemoryProperties 的定长版本 */
 typedef struct {
-    VkvgpuHandle device_handle;
-} VkvgpuCreateDeviceReplyPayload;
+    uint32_t type_count;
+    uint32_t heap_count;
+    struct {
+        uint32_t property_flags;
+        uint32_t heap_index;
+    } types[VKVGPU_MAX_MEMORY_TYPES];
+    struct {
+        uint64_t size;
+        uint32_t flags;
+        uint32_t reserved;
+    } heaps[VKVGPU_MAX_MEMORY_HEAPS];
+} VkvgpuMemoryPropertiesPayload;
+
+/* ALLOCATE_MEMORY 请求 payload（异步） */
+typedef struct {
+    VkvgpuHandle device_id;
+    VkvgpuHandle memory_id;
+    uint64_t     size;
+    uint32_t     type_index;
+    uint32_t     reserved;
+} VkvgpuAllocateMemoryRequestPayload;
+
+/* FREE_MEMORY 请求 payload（异步） */
+typedef struct {
+    VkvgpuHandle memory_id;
+} VkvgpuFreeMemoryRequestPayload;
+
+/*
+ * WRITE_MEMORY 请求 payload（异步），后面紧跟 size 字节数据；
+ * READ_MEMORY 请求 payload（同步），回复 payload 就是 size 字节数据。
+ */
+typedef struct {
+    VkvgpuHandle memory_id;
+    uint64_t     offset;
+    uint64_t     size;
+} VkvgpuMemoryRangePayload;
+
+/* ------------------------------------------------------------
+ * 共享内存区
+ * daemon 创建 memfd，在 CREATE_SHARED_REGION 的回复里用 SCM_RIGHTS 带给 guest，
+ * 两边各自 mmap。区域是上下文里的对象，ID 由 guest 分配。
+ * ------------------------------------------------------------ */
+
+#define VKVGPU_MAX_SHARED_REGION (256u * 1024u * 1024u)
+
+/* CREATE_SHARED_REGION 请求 payload（同步，回复不带 payload，带一个 fd） */
+typedef struct {
+    VkvgpuHandle region_id;
+    uint64_t     size;
+} VkvgpuCreateSharedRegionRequestPayload;
+
+/*
+ * 流式读回：区域开头是控制块，后面是 VKVGPU_READBACK_SLOTS 个分块槽。
+ * daemon 每写好一块 produced++，guest 每取走一块 consumed++，
+ * 两个计数器都单调递增（回绕无妨），第 n 块放在槽 n % SLOTS。
+ * 双方都在对方的计数器上 futex 等待，槽满时 daemon 等 guest（反压）。
+ */
+#define VKVGPU_READBACK_SLOTS       8
+#define VKVGPU_READBACK_CTL_SIZE    4096u
+#define VKVGPU_READBACK_REGION_SIZE \
+    (VKVGPU_READBACK_CTL_SIZE + VKVGPU_READBACK_SLOTS * VKVGPU_MAX_TRANSFER_CHUNK)
+
+typedef struct {
+    uint32_t produced;
+    uint32_t consumed;
+    int32_t  error;        // daemon 中途失败时置上，guest 据此提前结束
+    uint32_t reserved;
+} VkvgpuReadbackCtl;
+
+/* READBACK_MEMORY 请求 payload（同步）：数据走共享区，回复只带 status */
+typedef struct {
+    VkvgpuHandle region_id;
+    VkvgpuHandle memory_id;
+    uint64_t     offset;
+    uint64_t     size;
+} VkvgpuReadbackRequestPayload;
+
+/* ------------------------------------------------------------
+ * 无头 swapchain
+ * swapchain 图像是 host 上的 VkImage。present 时 daemon 把图像读回，按 tile 算哈希，
+ * 只把变了的 tile 写进共享帧缓冲，并在 damage 位图里标出来。
+ * 帧缓冲在 CREATE_SWAPCHAIN 的回复里用 SCM_RIGHTS 交给 guest，
+ * 同一个 fd 也可以转给外部消费者（显示 / 编码进程）。
+ * ------------------------------------------------------------ */
+
+#define VKVGPU_MAX_SWAPCHAIN_IMAGES 8
+#define VKVGPU_MAX_SWAPCHAIN_EXTENT 8192u
+#define VKVGPU_FRAME_TILE           64u
+#define VKVGPU_FRAME_MAX_TILES \
+    ((VKVGPU_MAX_SWAPCHAIN_EXTENT / VKVGPU_FRAME_TILE) * (VKVGPU_MAX_SWAPCHAIN_EXTENT / VKVGPU_FRAME_TILE))
+#define VKVGPU_FRAME_HEADER_SIZE    4096u   // 像素从这里开始，按 swapchain 的格式，行间紧密排列
 
+/*
+ * 帧缓冲里每像素字节数。host 不直接支持的格式（24 位 RGB、16 位 565 等）
+ * 由 daemon 在 host 上用相近的 4 字节格式建图像，读回时转换成这里的格式。
+ * 数值是 VkFormat，协议头不依赖 vulkan.h。
+ */
+static inline uint32_t vkvgpu_frame_bpp(uint32_t format)
+{
+    switch (format) {
+    case 4:  /* R5G6B5_UNORM_PACK16 */
+    case 5:  /* B5G6R5_UNORM_PACK16 */
+        return 2;
+    case 23: /* R8G8B8_UNORM */
+    case 29: /* R8G8B8_SRGB */
+    case 30: /* B8G8R8_UNORM */
+    case 36: /* B8G8R8_SRGB */
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+/*
+ * 帧缓冲头。damage 位图累积“消费者上次取走以来变过的 tile”：
+ * daemon 原子或上新位，消费者用原子交换取走；像素在 seq 递增之前写好。
+ *
+ * 图像可用性也在这里：guest acquire 时从 avail_mask 里原子清掉一位，
+ * daemon 的 present 线程用完（显示了或在 mailbox 里被顶掉）再置回去，
+ * 同时 release_seq++ 并唤醒等在上面的 acquire。
+ */
+typedef struct {
+    uint32_t seq;          // 每 present 一帧 +1，消费者在上面 futex 等待
+    uint32_t image_index;  // 最近一次 present 的图像
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;       // 每行字节数 = width * vkvgpu_frame_bpp(format)
+    uint32_t format;       // VkFormat
+    uint32_t tile_size;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint32_t damaged;      // 最近一帧变了的 tile 数
+    uint32_t avail_mask;   // 第 i 位 = 图像 i 可以被 acquire
+    uint32_t release_seq;
+    int32_t  status;       // present 线程出错时置上（VkResult），acquire 直接返回它
+    uint32_t reserved[3];
+    uint64_t damage[VKVGPU_FRAME_MAX_TILES / 64];   // tile (x, y) 是第 y * tiles_x + x 位
+} VkvgpuFrameHeader;
+
+/* CREATE_SWAPCHAIN 请求 payload（同步，回复带帧缓冲的 fd） */
+typedef struct {
+    VkvgpuHandle device_id;
+    VkvgpuHandle swapchain_id;
+    uint32_t     width;
+    uint32_t     height;
+    uint32_t     format;       // VkFormat，帧缓冲按这个格式；host 没有的由 daemon 转换
+    uint32_t     usage;        // VkImageUsageFlags
+    uint32_t     image_count;
+    uint32_t     present_mode; // VkPresentModeKHR：FIFO 或 MAILBOX
+} VkvgpuCreateSwapchainRequestPayload;
+
+/* DESTROY_SWAPCHAIN 请求 payload（异步） */
+typedef struct {
+    VkvgpuHandle swapchain_id;
+} VkvgpuDestroySwapchainRequestPayload;
+
+/* QUEUE_PRESENT 请求 payload（异步）：每个 swapchain 一条，daemon 只是把图像排进 present 队列 */
+typedef struct {
+    VkvgpuHandle swapchain_id;
+    uint32_t     image_index;
+    uint32_t     reserved;
+} VkvgpuQueuePresentRequestPayload;
+
+/* ------------------------------------------------------------
+ * 同步：fence / timeline semaphore 的完成值由 daemon 推给 guest
+ * 每个 device 一页共享的 sync page，fence 和 timeline semaphore 各占一个 slot。
+ * daemon 的等待线程按提交顺序等 host fence，完成后把这次提交要 signal 的
+ * (slot, value) 写进去（只增不减），seq++ 并唤醒；guest 的查询和等待都在本地完成。
+ * ------------------------------------------------------------ */
+
+#define VKVGPU_SYNC_SLOTS      4096
+#define VKVGPU_SYNC_QUEUE_SLOT 0      // 队列已完成的提交序号，vkQueueWaitIdle 等它
+
+typedef struct {
+    uint32_t seq;          // 每写完一批 slot +1，guest 在上面 futex 等待
+    int32_t  status;       // host 设备出错时置上（VkResult）
+    uint32_t reserved[14];
+    uint64_t values[VKVGPU_SYNC_SLOTS];
+} VkvgpuSyncPage;
+
+/* CREATE_SYNC_PAGE 请求 payload（同步，回复带 fd） */
+typedef struct {
+    VkvgpuHandle device_id;
+    VkvgpuHandle page_id;
+} VkvgpuCreateSyncPageRequestPayload;
+
+/* DESTROY_SYNC_PAGE 请求 payload（异步），必须在 DESTROY_DEVICE 之前 */
+typedef struct {
+    VkvgpuHandle page_id;
+} VkvgpuDestroySyncPageRequestPayload;
+
+typedef struct {
+    uint32_t slot;
+    uint32_t reserved;
+    uint64_t value;
+} VkvgpuSyncSignal;
+
+/* 单次提交最多带的 signal 数（fence + timeline semaphore + 队列序号） */
+#define VKVGPU_MAX_SUBMIT_SIGNALS 256
+/* 单次提交最多等的 timeline semaphore 数 */
+#define VKVGPU_MAX_SUBMIT_WAITS   256
+
+/*
+ * QUEUE_SUBMIT 请求 payload（异步），后面紧跟 signal_count 个 VkvgpuSyncSignal，
+ * 再跟 wait_count 个同样格式的等待：daemon 等 sync page 上每个 slot 都 >= value
+ * 才把这次提交交给 GPU（值可能由 guest 的 vkSignalSemaphore 直接写进页里）。
+ */
+typedef struct {
+    VkvgpuHandle page_id;
+    uint32_t     signal_count;
+    uint32_t     wait_count;
+} VkvgpuQueueSubmitRequestPayload;
+
+/* ------------------------------------------------------------
+ * compute 调度模板（VK_VGPU_dispatch_template）
+ * 一个模板 = 一个 compute pipeline + 一组 storage buffer 绑定 + push constant + 组数。
+ * daemon 建好 pipeline 和几个预录的命令缓冲；之后每次调用只带变了的绑定和
+ * push constant 区间，daemon 改掉这几项，没变的槽原样再提交。
+ * 调用与 QUEUE_SUBMIT 一样走 sync page 通知完成。
+ * ------------------------------------------------------------ */
+
+#define VKVGPU_TEMPLATE_MAX_BINDINGS 16
+#define VKVGPU_TEMPLATE_MAX_PUSH     128u          // Vulkan 保证的 push constant 下限
+#define VKVGPU_TEMPLATE_MAX_CODE     (1u << 19)    // SPIR-V 字节数上限，整条消息不能超过 daemon 的 1MB
+
+/* 绑定 binding 号上的 storage buffer：memory_id 的 [offset, offset + range) */
+typedef struct {
+    uint32_t     binding;
+    uint32_t     reserved;
+    VkvgpuHandle memory_id;
+    uint64_t     offset;
+    uint64_t     range;
+} VkvgpuTemplateBinding;
+
+/*
+ * CREATE_DISPATCH_TEMPLATE 请求 payload（同步，SPIR-V 不合法马上报错；pipeline 在 daemon
+ * 后台编译，编译失败在第一次 DISPATCH_TEMPLATE 时作为异步错误报出），
+ * 后面跟 binding_count 个 VkvgpuTemplateBinding（binding 号 0..binding_count-1 各一个），
+ * 再跟 code_size 字节 SPIR-V，入口点固定为 "main"。
+ */
+typedef struct {
+    VkvgpuHandle device_id;
+    VkvgpuHandle template_id;
+    uint32_t     code_size;
+    uint32_t     push_size;        // push constant 字节数，<= VKVGPU_TEMPLATE_MAX_PUSH
+    uint32_t     binding_count;
+    uint32_t     group_count[3];
+} VkvgpuCreateTemplateRequestPayload;
+
+/* CREATE_DISPATCH_TEMPLATE 返回 payload：shader 会写的 binding 位掩码，guest 据此只读回这些绑定 */
+typedef struct {
+    uint32_t writable;
+    uint32_t reserved;
+} VkvgpuCreateTemplateReplyPayload;
+
+/* DESTROY_DISPATCH_TEMPLATE 请求 payload（异步），在途的调用照常完成 */
+typedef struct {
+    VkvgpuHandle template_id;
+} VkvgpuDestroyTemplateRequestPayload;
+
+/*
+ * DISPATCH_TEMPLATE 请求 payload（异步），后面依次跟 signal_count 个 VkvgpuSyncSignal、
+ * binding_count 个改了的 VkvgpuTemplateBinding、push_size 字节 push constant
+ * （写到模板 push constant 的 push_offset 处）。group_count 为 0 的维度沿用上一次。
+ * 改动留在模板里，下次调用只需再带新的变化。
+ */
+typedef struct {
+    VkvgpuHandle template_id;
+    VkvgpuHandle page_id;
+    uint32_t     group_count[3];
+    uint32_t     push_offset;
+    uint32_t     push_size;
+    uint32_t     binding_count;
+    uint32_t     signal_count;
+    uint32_t     reserved;
+} VkvgpuDispatchTemplateRequestPayload;
@@ -0,0 +1,56 @@
+#pragma once
+// 自适应的先自旋后阻塞等待，guest ICD 和 daemon 共用。
+// 每个等待点一个 VkvgpuSpin：记录最近几次等了多久（EWMA），
+// 通常很快就等到的，先忙等一个略大于平均值的窗口，省掉一次睡眠/唤醒；
+// 通常要等很久的，自旋没有意义，直接阻塞。窗口有上限，空闲时不会占着 CPU。
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define VKVGPU_SPIN_DEFAULT_MAX_NS 50000ull   // 50us
+
+typedef struct {
+    uint64_t max_ns;        // 自旋窗口上限，0 = 不自旋
+    uint64_t avg_ns;        // 最近等待时长的 EWMA
+    uint64_t spin_ns;       // 当前窗口
+    /* 统计 */
+    uint64_t waits;
+    uint64_t spin_hits;     // 自旋期间等到的
+    uint64_t blocks;        // 自旋没等到、转去阻塞的
+    uint64_t spin_total_ns; // 花在自旋上的时间
+} VkvgpuSpin;
+
+/* max_us 从环境变量 env 读（微秒），没设用默认值 */
+static inline void vkvgpu_spin_init(VkvgpuSpin* s, const char* env)
+{
+    const char* v = env ? getenv(env) : NULL;
+    s->max_ns  = v ? strtoull(v, NULL, 10) * 1000ull : VKVGPU_SPIN_DEFAULT_MAX_NS;
+    s->avg_ns  = 0;
+    s->spin_ns = s->max_ns;   // 一开始不知道，先按上限试
+    s->waits = s->spin_hits = s->blocks = s->spin_total_ns = 0;
+}
+
+static inline void vkvgpu_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * 一次等待结束后调用：waited_ns 是从开始等到等到为止的总时长，
+ * spun_ns 是其中自旋的部分，hit 表示在自旋窗口内等到。
+ * 窗口取平均等待时长的两倍；平均值已经超过上限的一半时不再自旋。
+ */
+static inline void vkvgpu_spin_record(VkvgpuSpin* s, uint64_t waited_ns, uint64_t spun_ns, int hit)
+{
+    s->waits++;
+    s->spin_total_ns += spun_ns;
+    if (hit) s->spin_hits++;
+    else     s->blocks++;
+
+    s->avg_ns  = s->avg_ns ? (s->avg_ns * 7 + waited_ns) / 8 : waited_ns;
+    s->spin_ns = s->avg_ns * 2 <= s->max_ns ? s->avg_ns * 2 : 0;
+}
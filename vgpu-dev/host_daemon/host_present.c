@@ -0,0 +1,336 @@
+// host_present.c
+// 无头 swapchain 的 host 部分：图像是普通的 device-local VkImage，
+// present 时整张拷进一块常驻映射的读回 buffer，damage 检测在 vgpu_frame.c 里做。
+#include "host_vulkan.h"
+#include "../guest_icd/vk_virtio_proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) printf("[present] " __VA_ARGS__)
+
+struct HVkSwapchain {
+    HVkDevice*      dev;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        image_count;
+    VkImage         images[VKVGPU_MAX_SWAPCHAIN_IMAGES];
+    VkDeviceMemory  image_mem[VKVGPU_MAX_SWAPCHAIN_IMAGES];
+    VkImageLayout   layouts[VKVGPU_MAX_SWAPCHAIN_IMAGES];
+
+    VkBuffer        readback;
+    VkDeviceMemory  readback_mem;
+    uint8_t*        readback_ptr;
+    int             readback_coherent;
+    VkCommandPool   pool;
+    VkCommandBuffer cb;
+    VkFence         fence;
+
+    PFN_vkCreateImage                  CreateImage;
+    PFN_vkDestroyImage                 DestroyImage;
+    PFN_vkGetImageMemoryRequirements   GetImageMemoryRequirements;
+    PFN_vkBindImageMemory              BindImageMemory;
+    PFN_vkCreateBuffer                 CreateBuffer;
+    PFN_vkDestroyBuffer                DestroyBuffer;
+    PFN_vkGetBufferMemoryRequirements  GetBufferMemoryRequirements;
+    PFN_vkBindBufferMemory             BindBufferMemory;
+    PFN_vkAllocateMemory               AllocateMemory;
+    PFN_vkFreeMemory                   FreeMemory;
+    PFN_vkMapMemory                    MapMemory;
+    PFN_vkInvalidateMappedMemoryRanges InvalidateMappedMemoryRanges;
+    PFN_vkCreateCommandPool            CreateCommandPool;
+    PFN_vkDestroyCommandPool           DestroyCommandPool;
+    PFN_vkAllocateCommandBuffers       AllocateCommandBuffers;
+    PFN_vkBeginCommandBuffer           BeginCommandBuffer;
+    PFN_vkEndCommandBuffer             EndCommandBuffer;
+    PFN_vkCmdPipelineBarrier           CmdPipelineBarrier;
+    PFN_vkCmdCopyImageToBuffer         CmdCopyImageToBuffer;
+    PFN_vkCreateFence                  CreateFence;
+    PFN_vkDestroyFence                 DestroyFence;
+    PFN_vkWaitForFences                WaitForFences;
+    PFN_vkResetFences                  ResetFences;
+    PFN_vkQueueSubmit                  QueueSubmit;
+};
+
+#define PRESENT_PROC(sc, hi, name) \
+    ((sc)->name = (PFN_vk##name)hostvk_instance_proc((hi), "vk" #name))
+
+/* 先找 want | prefer 都满足的类型，没有再退到只满足 want 的 */
+static int find_memory_type(HVkDevice* hd, uint32_t bits, VkMemoryPropertyFlags want,
+                            VkMemoryPropertyFlags prefer)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        VkMemoryPropertyFlags need = pass == 0 ? want | prefer : want;
+        for (uint32_t i = 0; i < hd->mem_props.memoryTypeCount; i++) {
+            if ((bits & (1u << i)) &&
+                (hd->mem_props.memoryTypes[i].propertyFlags & need) == need)
+                return (int)i;
+        }
+    }
+    return -1;
+}
+
+int hostvk_swapchain_format_supported(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static VkResult image_init(HVkSwapchain* sc, uint32_t i, VkFormat format, VkImageUsageFlags usage)
+{
+    HVkDevice* hd = sc->dev;
+    VkImageCreateInfo ici = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { sc->width, sc->height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        /* present 要从图像拷出来 */
+        .usage = usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VkResult r = sc->CreateImage(hd->device, &ici, NULL, &sc->images[i]);
+    if (r != VK_SUCCESS) return r;
+
+    VkMemoryRequirements req;
+    sc->GetImageMemoryRequirements(hd->device, sc->images[i], &req);
+    int type = find_memory_type(hd, req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    if (type < 0) type = find_memory_type(hd, req.memoryTypeBits, 0, 0);
+    if (type < 0) return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    VkMemoryAllocateInfo ai = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = req.size,
+        .memoryTypeIndex = (uint32_t)type,
+    };
+    r = sc->AllocateMemory(hd->device, &ai, NULL, &sc->image_mem[i]);
+    if (r != VK_SUCCESS) return r;
+    sc->layouts[i] = VK_IMAGE_LAYOUT_UNDEFINED;
+    return sc->BindImageMemory(hd->device, sc->images[i], sc->image_mem[i], 0);
+}
+
+/* damage 检测要把整帧读一遍：尽量用 host-cached 的内存 */
+static VkResult readback_init(HVkSwapchain* sc)
+{
+    HVkDevice* hd = sc->dev;
+    VkBufferCreateInfo bci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = (VkDeviceSize)sc->width * 4 * sc->height,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult r = sc->CreateBuffer(hd->device, &bci, NULL, &sc->readback);
+    if (r != VK_SUCCESS) return r;
+
+    VkMemoryRequirements req;
+    sc->GetBufferMemoryRequirements(hd->device, sc->readback, &req);
+    int type = find_memory_type(hd, req.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    if (type < 0) return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    sc->readback_coherent = (hd->mem_props.memoryTypes[type].propertyFlags &
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    VkMemoryAllocateInfo ai = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = req.size,
+        .memoryTypeIndex = (uint32_t)type,
+    };
+    r = sc->AllocateMemory(hd->device, &ai, NULL, &sc->readback_mem);
+    if (r != VK_SUCCESS) return r;
+    r = sc->BindBufferMemory(hd->device, sc->readback, sc->readback_mem, 0);
+    if (r != VK_SUCCESS) return r;
+
+    void* p = NULL;
+    r = sc->MapMemory(hd->device, sc->readback_mem, 0, VK_WHOLE_SIZE, 0, &p);
+    if (r != VK_SUCCESS) return r;
+    sc->readback_ptr = p;
+
+    VkCommandPoolCreateInfo pci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = hd->queue_family,
+    };
+    r = sc->CreateCommandPool(hd->device, &pci, NULL, &sc->pool);
+    if (r != VK_SUCCESS) return r;
+
+    VkCommandBufferAllocateInfo cai = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = sc->pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    r = sc->AllocateCommandBuffers(hd->device, &cai, &sc->cb);
+    if (r != VK_SUCCESS) return r;
+
+    VkFenceCreateInfo fci = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    return sc->CreateFence(hd->device, &fci, NULL, &sc->fence);
+}
+
+VkResult hostvk_create_swapchain(HVkDevice* hd, uint32_t width, uint32_t height, VkFormat format,
+                                 VkImageUsageFlags usage, uint32_t image_count, HVkSwapchain** out)
+{
+    if (!hostvk_swapchain_format_supported(format) ||
+        image_count == 0 || image_count > VKVGPU_MAX_SWAPCHAIN_IMAGES ||
+        width == 0 || height == 0 ||
+        width > VKVGPU_MAX_SWAPCHAIN_EXTENT || height > VKVGPU_MAX_SWAPCHAIN_EXTENT)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    HVkSwapchain* sc = calloc(1, sizeof(*sc));
+    if (!sc) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    sc->dev         = hd;
+    sc->width       = width;
+    sc->height      = height;
+    sc->image_count = image_count;
+
+    HVkInstance* hi = hd->inst;
+    PRESENT_PROC(sc, hi, CreateImage);
+    PRESENT_PROC(sc, hi, DestroyImage);
+    PRESENT_PROC(sc, hi, GetImageMemoryRequirements);
+    PRESENT_PROC(sc, hi, BindImageMemory);
+    PRESENT_PROC(sc, hi, CreateBuffer);
+    PRESENT_PROC(sc, hi, DestroyBuffer);
+    PRESENT_PROC(sc, hi, GetBufferMemoryRequirements);
+    PRESENT_PROC(sc, hi, BindBufferMemory);
+    PRESENT_PROC(sc, hi, AllocateMemory);
+    PRESENT_PROC(sc, hi, FreeMemory);
+    PRESENT_PROC(sc, hi, MapMemory);
+    PRESENT_PROC(sc, hi, InvalidateMappedMemoryRanges);
+    PRESENT_PROC(sc, hi, CreateCommandPool);
+    PRESENT_PROC(sc, hi, DestroyCommandPool);
+    PRESENT_PROC(sc, hi, AllocateCommandBuffers);
+    PRESENT_PROC(sc, hi, BeginCommandBuffer);
+    PRESENT_PROC(sc, hi, EndCommandBuffer);
+    PRESENT_PROC(sc, hi, CmdPipelineBarrier);
+    PRESENT_PROC(sc, hi, CmdCopyImageToBuffer);
+    PRESENT_PROC(sc, hi, CreateFence);
+    PRESENT_PROC(sc, hi, DestroyFence);
+    PRESENT_PROC(sc, hi, WaitForFences);
+    PRESENT_PROC(sc, hi, ResetFences);
+    PRESENT_PROC(sc, hi, QueueSubmit);
+
+    VkResult r = VK_SUCCESS;
+    for (uint32_t i = 0; r == VK_SUCCESS && i < image_count; i++)
+        r = image_init(sc, i, format, usage);
+    if (r == VK_SUCCESS)
+        r = readback_init(sc);
+
+    if (r != VK_SUCCESS) {
+        LOG("创建 swapchain 失败: %d\n", r);
+        hostvk_destroy_swapchain(sc);
+        return r;
+    }
+
+    LOG("swapchain %ux%u x%u, format %d\n", width, height, image_count, (int)format);
+    *out = sc;
+    return VK_SUCCESS;
+}
+
+void hostvk_destroy_swapchain(HVkSwapchain* sc)
+{
+    if (!sc) return;
+    VkDevice dev = sc->dev->device;
+
+    /* present 里的拷贝都是同步等完的，present 线程退出后这里没有在途工作 */
+    if (sc->fence)        sc->DestroyFence(dev, sc->fence, NULL);
+    if (sc->pool)         sc->DestroyCommandPool(dev, sc->pool, NULL);
+    if (sc->readback)     sc->DestroyBuffer(dev, sc->readback, NULL);
+    if (sc->readback_mem) sc->FreeMemory(dev, sc->readback_mem, NULL);
+    for (uint32_t i = 0; i < sc->image_count; i++) {
+        if (sc->images[i])    sc->DestroyImage(dev, sc->images[i], NULL);
+        if (sc->image_mem[i]) sc->FreeMemory(dev, sc->image_mem[i], NULL);
+    }
+    free(sc);
+}
+
+/*
+ * guest 交上来的图像处在 PRESENT_SRC_KHR。host 设备没开 VK_KHR_swapchain，
+ * 命令翻译时这个布局映射成 GENERAL，所以这里从 GENERAL 拷，拷完留在 GENERAL。
+ * 从没写过的图像（UNDEFINED）内容无意义，照样拷，结果是一帧垃圾而不是报错。
+ */
+VkResult hostvk_swapchain_readback(HVkSwapchain* sc, uint32_t index, const uint8_t** out_pixels)
+{
+    if (index >= sc->image_count) return VK_ERROR_OUT_OF_DATE_KHR;
+    HVkDevice* hd = sc->dev;
+
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VkResult r = sc->BeginCommandBuffer(sc->cb, &bi);
+    if (r != VK_SUCCESS) return r;
+
+    VkImageMemoryBarrier ib = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = sc->layouts[index],
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = sc->images[index],
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    sc->CmdPipelineBarrier(sc->cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &ib);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .imageOffset = { 0, 0, 0 },
+        .imageExtent = { sc->width, sc->height, 1 },
+    };
+    sc->CmdCopyImageToBuffer(sc->cb, sc->images[index], VK_IMAGE_LAYOUT_GENERAL,
+                             sc->readback, 1, &region);
+
+    VkMemoryBarrier mb = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    sc->CmdPipelineBarrier(sc->cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                           0, 1, &mb, 0, NULL, 0, NULL);
+
+    r = sc->EndCommandBuffer(sc->cb);
+    if (r != VK_SUCCESS) return r;
+
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &sc->cb,
+    };
+    pthread_mutex_lock(&hd->queue_lock);
+    r = sc->QueueSubmit(hd->queue, 1, &si, sc->fence);
+    pthread_mutex_unlock(&hd->queue_lock);
+    if (r != VK_SUCCESS) return r;
+    r = sc->WaitForFences(hd->device, 1, &sc->fence, VK_TRUE, UINT64_MAX);
+    if (r != VK_SUCCESS) return r;
+    r = sc->ResetFences(hd->device, 1, &sc->fence);
+    if (r != VK_SUCCESS) return r;
+    sc->layouts[index] = VK_IMAGE_LAYOUT_GENERAL;
+
+    if (!sc->readback_coherent) {
+        VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = sc->readback_mem,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        r = sc->InvalidateMappedMemoryRanges(hd->device, 1, &range);
+        if (r != VK_SUCCESS) return r;
+    }
+    *out_pixels = sc->readback_ptr;
+    return VK_SUCCESS;
+}
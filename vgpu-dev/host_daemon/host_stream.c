@@ -0,0 +1,456 @@
+// host_stream.c
+// 分块流式上传/读回：guest 眼里 host-visible、host 上却不可映射的 device-local 内存，
+// 每个 WRITE_MEMORY 分块先拷进 staging 环的一个槽，马上提交一次 vkCmdCopyBuffer，
+// 读线程同时在收后面的分块；环上的槽都在途时等最旧的那个 fence（反压）。
+// 对外接口都持有 hd->stream_lock：超分换出会从别的 VM 的 worker 读回这台 device 的内存。
+#include "host_vulkan.h"
+#include "vgpu_numa.h"
+#include "../guest_icd/vk_virtio_proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) printf("[stream] " __VA_ARGS__)
+
+#define STREAM_SLOTS     8
+#define STREAM_SLOT_SIZE VKVGPU_MAX_TRANSFER_CHUNK   // 一个分块正好一个槽
+
+typedef struct {
+    VkBuffer        buf;
+    VkDeviceMemory  mem;
+    uint8_t*        ptr;
+    VkCommandBuffer cb;
+    VkFence         fence;
+    int             busy;
+} HVkStreamSlot;
+
+struct HVkStream {
+    VkCommandPool pool;
+    HVkStreamSlot slots[STREAM_SLOTS];
+    uint32_t      next;
+    int           filled;      // 槽都建好了；休眠时释放，下次用到再建
+
+    /* 热路径上用到的设备函数，创建时解析一次 */
+    PFN_vkCreateBuffer                 CreateBuffer;
+    PFN_vkDestroyBuffer                DestroyBuffer;
+    PFN_vkGetBufferMemoryRequirements  GetBufferMemoryRequirements;
+    PFN_vkBindBufferMemory             BindBufferMemory;
+    PFN_vkAllocateMemory               AllocateMemory;
+    PFN_vkFreeMemory                   FreeMemory;
+    PFN_vkMapMemory                    MapMemory;
+    PFN_vkCreateCommandPool            CreateCommandPool;
+    PFN_vkDestroyCommandPool           DestroyCommandPool;
+    PFN_vkAllocateCommandBuffers       AllocateCommandBuffers;
+    PFN_vkBeginCommandBuffer           BeginCommandBuffer;
+    PFN_vkEndCommandBuffer             EndCommandBuffer;
+    PFN_vkCmdCopyBuffer                CmdCopyBuffer;
+    PFN_vkCmdPipelineBarrier           CmdPipelineBarrier;
+    PFN_vkCreateFence                  CreateFence;
+    PFN_vkDestroyFence                 DestroyFence;
+    PFN_vkWaitForFences                WaitForFences;
+    PFN_vkResetFences                  ResetFences;
+    PFN_vkQueueSubmit                  QueueSubmit;
+};
+
+#define STREAM_PROC(s, hi, name) \
+    ((s)->name = (PFN_vk##name)hostvk_instance_proc((hi), "vk" #name))
+
+static int find_memory_type(HVkDevice* hd, uint32_t bits, VkMemoryPropertyFlags want)
+{
+    for (uint32_t i = 0; i < hd->mem_props.memoryTypeCount; i++) {
+        if ((bits & (1u << i)) &&
+            (hd->mem_props.memoryTypes[i].propertyFlags & want) == want)
+            return (int)i;
+    }
+    return -1;
+}
+
+/* ----------------------------------------------
+ * staging 环
+ * ---------------------------------------------- */
+
+/* 命令缓冲留着，它随 pool 一起释放 */
+static void slots_free(HVkDevice* hd, HVkStream* s)
+{
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        HVkStreamSlot* slot = &s->slots[i];
+        if (slot->fence) s->DestroyFence(hd->device, slot->fence, NULL);
+        if (slot->buf)   s->DestroyBuffer(hd->device, slot->buf, NULL);
+        if (slot->mem)   s->FreeMemory(hd->device, slot->mem, NULL);
+        slot->fence = VK_NULL_HANDLE;
+        slot->buf   = VK_NULL_HANDLE;
+        slot->mem   = VK_NULL_HANDLE;
+        slot->ptr   = NULL;
+        slot->busy  = 0;
+    }
+    s->next   = 0;
+    s->filled = 0;
+}
+
+static void stream_free(HVkDevice* hd, HVkStream* s)
+{
+    slots_free(hd, s);
+    if (s->pool) s->DestroyCommandPool(hd->device, s->pool, NULL);
+    free(s);
+}
+
+static VkResult slot_init(HVkDevice* hd, HVkStream* s, HVkStreamSlot* slot)
+{
+    VkBufferCreateInfo bci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = STREAM_SLOT_SIZE,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult r = s->CreateBuffer(hd->device, &bci, NULL, &slot->buf);
+    if (r != VK_SUCCESS) return r;
+
+    VkMemoryRequirements req;
+    s->GetBufferMemoryRequirements(hd->device, slot->buf, &req);
+    int type = find_memory_type(hd, req.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (type < 0) return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    VkMemoryAllocateInfo ai = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = req.size,
+        .memoryTypeIndex = (uint32_t)type,
+    };
+    r = s->AllocateMemory(hd->device, &ai, NULL, &slot->mem);
+    if (r != VK_SUCCESS) return r;
+    r = s->BindBufferMemory(hd->device, slot->buf, slot->mem, 0);
+    if (r != VK_SUCCESS) return r;
+
+    void* p = NULL;
+    r = s->MapMemory(hd->device, slot->mem, 0, VK_WHOLE_SIZE, 0, &p);
+    if (r != VK_SUCCESS) return r;
+    slot->ptr = p;
+    /* 驱动多半按需分配系统内存页：趁内存策略还指着 GPU 的节点先碰一遍 */
+    memset(slot->ptr, 0, STREAM_SLOT_SIZE);
+
+    VkFenceCreateInfo fci = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    return s->CreateFence(hd->device, &fci, NULL, &slot->fence);
+}
+
+static VkResult slots_fill(HVkDevice* hd, HVkStream* s)
+{
+    VkResult r = VK_SUCCESS;
+    /* staging 环放在 GPU 所在的节点，拷贝引擎读写它不跨 socket */
+    vgpu_numa_prefer(hd->numa_node);
+    for (int i = 0; r == VK_SUCCESS && i < STREAM_SLOTS; i++)
+        r = slot_init(hd, s, &s->slots[i]);
+    vgpu_numa_prefer(VGPU_NUMA_ANY);
+    s->filled = r == VK_SUCCESS;
+    return r;
+}
+
+static HVkStream* stream_get(HVkDevice* hd)
+{
+    HVkStream* s = hd->stream;
+    if (s && s->filled) return s;
+    if (s) {
+        VkResult r = slots_fill(hd, s);
+        if (r == VK_SUCCESS) return s;
+        LOG("重建 staging 环失败: %d\n", r);
+        slots_free(hd, s);
+        return NULL;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+
+    HVkInstance* hi = hd->inst;
+    STREAM_PROC(s, hi, CreateBuffer);
+    STREAM_PROC(s, hi, DestroyBuffer);
+    STREAM_PROC(s, hi, GetBufferMemoryRequirements);
+    STREAM_PROC(s, hi, BindBufferMemory);
+    STREAM_PROC(s, hi, AllocateMemory);
+    STREAM_PROC(s, hi, FreeMemory);
+    STREAM_PROC(s, hi, MapMemory);
+    STREAM_PROC(s, hi, CreateCommandPool);
+    STREAM_PROC(s, hi, DestroyCommandPool);
+    STREAM_PROC(s, hi, AllocateCommandBuffers);
+    STREAM_PROC(s, hi, BeginCommandBuffer);
+    STREAM_PROC(s, hi, EndCommandBuffer);
+    STREAM_PROC(s, hi, CmdCopyBuffer);
+    STREAM_PROC(s, hi, CmdPipelineBarrier);
+    STREAM_PROC(s, hi, CreateFence);
+    STREAM_PROC(s, hi, DestroyFence);
+    STREAM_PROC(s, hi, WaitForFences);
+    STREAM_PROC(s, hi, ResetFences);
+    STREAM_PROC(s, hi, QueueSubmit);
+
+    VkCommandPoolCreateInfo pci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                 VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = hd->queue_family,
+    };
+    VkResult r = s->CreateCommandPool(hd->device, &pci, NULL, &s->pool);
+
+    VkCommandBuffer cbs[STREAM_SLOTS];
+    if (r == VK_SUCCESS) {
+        VkCommandBufferAllocateInfo cai = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = s->pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = STREAM_SLOTS,
+        };
+        r = s->AllocateCommandBuffers(hd->device, &cai, cbs);
+    }
+    if (r == VK_SUCCESS) {
+        for (int i = 0; i < STREAM_SLOTS; i++)
+            s->slots[i].cb = cbs[i];
+        r = slots_fill(hd, s);
+    }
+
+    if (r != VK_SUCCESS) {
+        LOG("创建 staging 环失败: %d\n", r);
+        stream_free(hd, s);
+        return NULL;
+    }
+
+    LOG("device %p: staging 环 %d x %u KB\n", (void*)hd->device,
+        STREAM_SLOTS, STREAM_SLOT_SIZE / 1024);
+    hd->stream = s;
+    return s;
+}
+
+static VkResult slot_wait(HVkDevice* hd, HVkStream* s, HVkStreamSlot* slot)
+{
+    if (!slot->busy) return VK_SUCCESS;
+    VkResult r = s->WaitForFences(hd->device, 1, &slot->fence, VK_TRUE, UINT64_MAX);
+    if (r != VK_SUCCESS) return r;
+    slot->busy = 0;
+    return s->ResetFences(hd->device, 1, &slot->fence);
+}
+
+/* 轮转取下一个槽；它还在途就等它（反压） */
+static HVkStreamSlot* slot_acquire(HVkDevice* hd, HVkStream* s, VkResult* r)
+{
+    HVkStreamSlot* slot = &s->slots[s->next];
+    s->next = (s->next + 1) % STREAM_SLOTS;
+    *r = slot_wait(hd, s, slot);
+    return *r == VK_SUCCESS ? slot : NULL;
+}
+
+static void cmd_barrier(HVkStream* s, VkCommandBuffer cb,
+                        VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+                        VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+    VkMemoryBarrier mb = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+    };
+    s->CmdPipelineBarrier(cb, src_stage, dst_stage, 0, 1, &mb, 0, NULL, 0, NULL);
+}
+
+/*
+ * 一个槽一次拷贝。开头的 barrier 把之前各次提交里的传输写排在前面，
+ * 同一段被 guest 连续 flush 两次时不会乱序；读回时末尾再让 host 可见。
+ */
+static VkResult slot_submit_copy(HVkDevice* hd, HVkStream* s, HVkStreamSlot* slot,
+                                 VkBuffer src, VkBuffer dst, const VkBufferCopy* region,
+                                 int to_host)
+{
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VkResult r = s->BeginCommandBuffer(slot->cb, &bi);
+    if (r != VK_SUCCESS) return r;
+
+    cmd_barrier(s, slot->cb,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+    s->CmdCopyBuffer(slot->cb, src, dst, 1, region);
+    if (to_host)
+        cmd_barrier(s, slot->cb,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+    r = s->EndCommandBuffer(slot->cb);
+    if (r != VK_SUCCESS) return r;
+
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &slot->cb,
+    };
+    pthread_mutex_lock(&hd->queue_lock);
+    r = s->QueueSubmit(hd->queue, 1, &si, slot->fence);
+    pthread_mutex_unlock(&hd->queue_lock);
+    if (r == VK_SUCCESS) slot->busy = 1;
+    return r;
+}
+
+/* 覆盖整段分配的 buffer，绑定在 guest 的内存上；调度模板也拿它当 storage buffer */
+static VkResult ensure_alias(HVkStream* s, HVkMemory* hm)
+{
+    if (hm->alias) return VK_SUCCESS;
+    HVkDevice* hd = hm->dev;
+
+    /* 可导出 / 导入的内存上只能绑声明了同一种句柄类型的 buffer */
+    VkExternalMemoryBufferCreateInfo ext = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkBufferCreateInfo bci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = hostvk_memory_exportable(hm) ? &ext : NULL,
+        .size = hm->size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBuffer buf;
+    VkResult r = s->CreateBuffer(hd->device, &bci, NULL, &buf);
+    if (r != VK_SUCCESS) return r;
+
+    VkMemoryRequirements req;
+    s->GetBufferMemoryRequirements(hd->device, buf, &req);
+    if (!(req.memoryTypeBits & (1u << hm->type_index)) || req.size > hm->size) {
+        LOG("内存类型 %u 不能绑定 transfer buffer\n", hm->type_index);
+        s->DestroyBuffer(hd->device, buf, NULL);
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+    r = s->BindBufferMemory(hd->device, buf, hm->memory, 0);
+    if (r != VK_SUCCESS) {
+        s->DestroyBuffer(hd->device, buf, NULL);
+        return r;
+    }
+    hm->alias = buf;
+    return VK_SUCCESS;
+}
+
+/* ----------------------------------------------
+ * 对外接口
+ * ---------------------------------------------- */
+
+VkResult hostvk_stream_write(HVkMemory* hm, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    HVkDevice* hd = hm->dev;
+    pthread_mutex_lock(&hd->stream_lock);
+    HVkStream* s  = stream_get(hd);
+    if (!s) {
+        pthread_mutex_unlock(&hd->stream_lock);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    VkResult r = ensure_alias(s, hm);
+    const uint8_t* src = data;
+    while (r == VK_SUCCESS && size > 0) {
+        VkDeviceSize n = size < STREAM_SLOT_SIZE ? size : STREAM_SLOT_SIZE;
+        HVkStreamSlot* slot = slot_acquire(hd, s, &r);
+        if (!slot) break;
+
+        memcpy(slot->ptr, src, n);
+        VkBufferCopy region = { .srcOffset = 0, .dstOffset = offset, .size = n };
+        r = slot_submit_copy(hd, s, slot, slot->buf, hm->alias, &region, 0);
+
+        src    += n;
+        offset += n;
+        size   -= n;
+    }
+    pthread_mutex_unlock(&hd->stream_lock);
+    return r;
+}
+
+VkResult hostvk_stream_read(HVkMemory* hm, VkDeviceSize offset, void* out, VkDeviceSize size)
+{
+    HVkDevice* hd = hm->dev;
+    pthread_mutex_lock(&hd->stream_lock);
+    HVkStream* s  = stream_get(hd);
+    if (!s) {
+        pthread_mutex_unlock(&hd->stream_lock);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    VkResult r = ensure_alias(s, hm);
+    uint8_t* dst = out;
+    while (r == VK_SUCCESS && size > 0) {
+        VkDeviceSize n = size < STREAM_SLOT_SIZE ? size : STREAM_SLOT_SIZE;
+        HVkStreamSlot* slot = slot_acquire(hd, s, &r);
+        if (!slot) break;
+
+        VkBufferCopy region = { .srcOffset = offset, .dstOffset = 0, .size = n };
+        r = slot_submit_copy(hd, s, slot, hm->alias, slot->buf, &region, 1);
+        if (r == VK_SUCCESS)
+            r = slot_wait(hd, s, slot);
+        if (r == VK_SUCCESS)
+            memcpy(dst, slot->ptr, n);
+
+        dst    += n;
+        offset += n;
+        size   -= n;
+    }
+    pthread_mutex_unlock(&hd->stream_lock);
+    return r;
+}
+
+static void stream_drain_locked(HVkDevice* hd)
+{
+    HVkStream* s = hd->stream;
+    if (!s) return;
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        if (slot_wait(hd, s, &s->slots[i]) != VK_SUCCESS)
+            LOG("等待 staging 槽 %d 失败\n", i);
+    }
+}
+
+void hostvk_stream_drain(HVkDevice* hd)
+{
+    pthread_mutex_lock(&hd->stream_lock);
+    stream_drain_locked(hd);
+    pthread_mutex_unlock(&hd->stream_lock);
+}
+
+VkResult hostvk_memory_buffer(HVkMemory* hm, VkBuffer* out)
+{
+    HVkDevice* hd = hm->dev;
+    pthread_mutex_lock(&hd->stream_lock);
+    HVkStream* s = stream_get(hd);
+    VkResult r = s ? ensure_alias(s, hm) : VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    if (r == VK_SUCCESS) *out = hm->alias;
+    pthread_mutex_unlock(&hd->stream_lock);
+    return r;
+}
+
+void hostvk_stream_release_memory(HVkMemory* hm)
+{
+    if (!hm->alias) return;
+    HVkDevice* hd = hm->dev;
+    pthread_mutex_lock(&hd->stream_lock);
+    /* 在途的拷贝可能还引用着它 */
+    stream_drain_locked(hd);
+    hd->stream->DestroyBuffer(hd->device, hm->alias, NULL);
+    hm->alias = VK_NULL_HANDLE;
+    pthread_mutex_unlock(&hd->stream_lock);
+}
+
+void hostvk_stream_trim(HVkDevice* hd)
+{
+    pthread_mutex_lock(&hd->stream_lock);
+    HVkStream* s = hd->stream;
+    if (s && s->filled) {
+        /* 槽释放前等在途的拷贝做完 */
+        stream_drain_locked(hd);
+        slots_free(hd, s);
+        LOG("device %p: 释放 staging 环\n", (void*)hd->device);
+    }
+    pthread_mutex_unlock(&hd->stream_lock);
+}
+
+void hostvk_stream_destroy(HVkDevice* hd)
+{
+    pthread_mutex_lock(&hd->stream_lock);
+    if (hd->stream) {
+        stream_drain_locked(hd);
+        stream_free(hd, hd->stream);
+        hd->stream = NULL;
+    }
+    pthread_mutex_unlock(&hd->stream_lock);
+}
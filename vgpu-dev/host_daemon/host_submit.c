@@ -0,0 +1,187 @@
+// host_submit.c
+// guest 的队列提交：前后各夹一个写时间戳的命令缓冲，完成后读回两次时间戳，
+// 得到这次提交实际占用的 GPU 时间，给跨 VM 的 GPU 调度记账（vgpu_gpusched.c）。
+#include "host_vulkan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) printf("[submit] " __VA_ARGS__)
+
+struct HVkSubmit {
+    VkCommandPool   pool;
+    VkQueryPool     queries;            // 每个槽两个：开始 / 结束
+    VkCommandBuffer begin[HVK_SUBMIT_SLOTS];
+    VkCommandBuffer end[HVK_SUBMIT_SLOTS];
+    int             timestamps;         // 队列支持时间戳
+    double          period_ns;          // 一个 tick 的纳秒数
+    uint64_t        mask;               // timestampValidBits 对应的掩码
+
+    PFN_vkCreateCommandPool      CreateCommandPool;
+    PFN_vkDestroyCommandPool     DestroyCommandPool;
+    PFN_vkAllocateCommandBuffers AllocateCommandBuffers;
+    PFN_vkBeginCommandBuffer     BeginCommandBuffer;
+    PFN_vkEndCommandBuffer       EndCommandBuffer;
+    PFN_vkCmdPipelineBarrier     CmdPipelineBarrier;
+    PFN_vkCmdResetQueryPool      CmdResetQueryPool;
+    PFN_vkCmdWriteTimestamp      CmdWriteTimestamp;
+    PFN_vkCreateQueryPool        CreateQueryPool;
+    PFN_vkDestroyQueryPool       DestroyQueryPool;
+    PFN_vkGetQueryPoolResults    GetQueryPoolResults;
+    PFN_vkQueueSubmit            QueueSubmit;
+};
+
+#define SUBMIT_PROC(s, hi, name) \
+    ((s)->name = (PFN_vk##name)hostvk_instance_proc((hi), "vk" #name))
+
+static void submit_free(HVkDevice* hd, HVkSubmit* s)
+{
+    if (s->queries) s->DestroyQueryPool(hd->device, s->queries, NULL);
+    if (s->pool)    s->DestroyCommandPool(hd->device, s->pool, NULL);
+    free(s);
+}
+
+/*
+ * 槽的两个命令缓冲只录一次，之后反复提交。开始那个顺带一个全局 barrier：
+ * 流式上传的拷贝提交在前面，guest 的工作要看到它们写的数据。
+ */
+static VkResult record_slot(HVkSubmit* s, uint32_t i)
+{
+    VkCommandBufferBeginInfo bi = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+
+    VkResult r = s->BeginCommandBuffer(s->begin[i], &bi);
+    if (r != VK_SUCCESS) return r;
+    VkMemoryBarrier mb = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+    };
+    s->CmdPipelineBarrier(s->begin[i],
+                          VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &mb, 0, NULL, 0, NULL);
+    if (s->timestamps) {
+        s->CmdResetQueryPool(s->begin[i], s->queries, 2 * i, 2);
+        s->CmdWriteTimestamp(s->begin[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, s->queries, 2 * i);
+    }
+    r = s->EndCommandBuffer(s->begin[i]);
+    if (r != VK_SUCCESS) return r;
+
+    r = s->BeginCommandBuffer(s->end[i], &bi);
+    if (r != VK_SUCCESS) return r;
+    if (s->timestamps)
+        s->CmdWriteTimestamp(s->end[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, s->queries, 2 * i + 1);
+    return s->EndCommandBuffer(s->end[i]);
+}
+
+static HVkSubmit* submit_get(HVkDevice* hd)
+{
+    if (hd->submit) return hd->submit;
+
+    HVkSubmit* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+
+    HVkInstance* hi = hd->inst;
+    SUBMIT_PROC(s, hi, CreateCommandPool);
+    SUBMIT_PROC(s, hi, DestroyCommandPool);
+    SUBMIT_PROC(s, hi, AllocateCommandBuffers);
+    SUBMIT_PROC(s, hi, BeginCommandBuffer);
+    SUBMIT_PROC(s, hi, EndCommandBuffer);
+    SUBMIT_PROC(s, hi, CmdPipelineBarrier);
+    SUBMIT_PROC(s, hi, CmdResetQueryPool);
+    SUBMIT_PROC(s, hi, CmdWriteTimestamp);
+    SUBMIT_PROC(s, hi, CreateQueryPool);
+    SUBMIT_PROC(s, hi, DestroyQueryPool);
+    SUBMIT_PROC(s, hi, GetQueryPoolResults);
+    SUBMIT_PROC(s, hi, QueueSubmit);
+
+    s->timestamps = hd->timestamp_bits != 0 && hd->timestamp_period > 0.0f;
+    s->period_ns  = hd->timestamp_period;
+    s->mask       = hd->timestamp_bits >= 64 ? UINT64_MAX : (1ull << hd->timestamp_bits) - 1;
+
+    VkResult r = VK_SUCCESS;
+    if (s->timestamps) {
+        VkQueryPoolCreateInfo qci = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * HVK_SUBMIT_SLOTS,
+        };
+        r = s->CreateQueryPool(hd->device, &qci, NULL, &s->queries);
+    }
+
+    if (r == VK_SUCCESS) {
+        VkCommandPoolCreateInfo pci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .queueFamilyIndex = hd->queue_family,
+        };
+        r = s->CreateCommandPool(hd->device, &pci, NULL, &s->pool);
+    }
+    if (r == VK_SUCCESS) {
+        VkCommandBuffer cbs[2 * HVK_SUBMIT_SLOTS];
+        VkCommandBufferAllocateInfo cai = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = s->pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 2 * HVK_SUBMIT_SLOTS,
+        };
+        r = s->AllocateCommandBuffers(hd->device, &cai, cbs);
+        for (uint32_t i = 0; r == VK_SUCCESS && i < HVK_SUBMIT_SLOTS; i++) {
+            s->begin[i] = cbs[2 * i];
+            s->end[i]   = cbs[2 * i + 1];
+            r = record_slot(s, i);
+        }
+    }
+
+    if (r != VK_SUCCESS) {
+        LOG("创建提交计时失败: %d\n", r);
+        submit_free(hd, s);
+        return NULL;
+    }
+    if (!s->timestamps)
+        LOG("device %p: 队列不支持时间戳，按墙钟时间记账\n", (void*)hd->device);
+    hd->submit = s;
+    return s;
+}
+
+VkResult hostvk_queue_submit(HVkDevice* hd, uint32_t slot, VkCommandBuffer cb, VkFence fence)
+{
+    HVkSubmit* s = submit_get(hd);
+    if (!s) return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    /* guest 的工作夹在两个计时命令缓冲中间 */
+    VkCommandBuffer cbs[3];
+    uint32_t n = 0;
+    cbs[n++] = s->begin[slot];
+    if (cb) cbs[n++] = cb;
+    cbs[n++] = s->end[slot];
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = n,
+        .pCommandBuffers = cbs,
+    };
+    pthread_mutex_lock(&hd->queue_lock);
+    VkResult r = s->QueueSubmit(hd->queue, 1, &si, fence);
+    pthread_mutex_unlock(&hd->queue_lock);
+    return r;
+}
+
+int hostvk_submit_gpu_time(HVkDevice* hd, uint32_t slot, uint64_t* out_ns)
+{
+    HVkSubmit* s = hd->submit;
+    if (!s || !s->timestamps) return -1;
+
+    uint64_t ts[2];
+    VkResult r = s->GetQueryPoolResults(hd->device, s->queries, 2 * slot, 2, sizeof(ts), ts,
+                                        sizeof(ts[0]), VK_QUERY_RESULT_64_BIT);
+    if (r != VK_SUCCESS) return -1;
+
+    uint64_t ticks = (ts[1] - ts[0]) & s->mask;
+    *out_ns = (uint64_t)((double)ticks * s->period_ns);
+    return 0;
+}
+
+void hostvk_submit_destroy(HVkDevice* hd)
+{
+    if (!hd->submit) return;
+    submit_free(hd, hd->submit);
+    hd->submit = NULL;
+}
@@ -0,0 +1,403 @@
+// host_template.c
+// compute 调度模板：pipeline、描述符布局只建一次，HVK_TEMPLATE_SLOTS 个槽各有一个
+// 描述符集和一个录好的命令缓冲（bind pipeline / bind set / push constant / dispatch）。
+// pipeline 编译单独一步（hostvk_template_compile），调用者可以放到后台做。
+// 同一组参数的调用直接再提交槽里的命令缓冲；参数变了只重写变了的描述符、重录这一个槽。
+#include "host_vulkan.h"
+#include "../guest_icd/vk_virtio_proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) printf("[tmpl] " __VA_ARGS__)
+
+typedef struct {
+    HVkMemory*   hm;
+    uint32_t     generation;    // 写描述符时 hm 的 generation，换出换回后不再有效
+    VkDeviceSize offset;
+    VkDeviceSize range;
+} HVkSlotBinding;
+
+typedef struct {
+    VkDescriptorSet set;
+    VkCommandBuffer cb;
+    int             busy;
+    int             recorded;
+    HVkSlotBinding  bindings[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    uint8_t         push[VKVGPU_TEMPLATE_MAX_PUSH];
+    uint32_t        group_count[3];
+} HVkTemplateSlot;
+
+struct HVkTemplate {
+    HVkDevice*            hd;
+    uint32_t              binding_count;
+    uint32_t              push_size;
+    VkShaderModule        module;
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout      layout;
+    VkPipeline            pipeline;
+    VkDescriptorPool      desc_pool;
+    VkCommandPool         cmd_pool;
+
+    pthread_mutex_t       lock;     // busy 由等待线程 retire，其余只在所属上下文的 worker 里改
+    pthread_cond_t        cond;
+    HVkTemplateSlot       slots[HVK_TEMPLATE_SLOTS];
+    uint32_t              rerecords;
+
+    PFN_vkDestroyShaderModule        DestroyShaderModule;
+    PFN_vkDestroyDescriptorSetLayout DestroyDescriptorSetLayout;
+    PFN_vkDestroyPipelineLayout      DestroyPipelineLayout;
+    PFN_vkDestroyPipeline            DestroyPipeline;
+    PFN_vkDestroyDescriptorPool      DestroyDescriptorPool;
+    PFN_vkDestroyCommandPool         DestroyCommandPool;
+    PFN_vkUpdateDescriptorSets       UpdateDescriptorSets;
+    PFN_vkBeginCommandBuffer         BeginCommandBuffer;
+    PFN_vkEndCommandBuffer           EndCommandBuffer;
+    PFN_vkCmdBindPipeline            CmdBindPipeline;
+    PFN_vkCmdBindDescriptorSets      CmdBindDescriptorSets;
+    PFN_vkCmdPushConstants           CmdPushConstants;
+    PFN_vkCmdDispatch                CmdDispatch;
+    PFN_vkCmdPipelineBarrier         CmdPipelineBarrier;
+};
+
+#define TMPL_PROC(t, hi, name) \
+    ((t)->name = (PFN_vk##name)hostvk_instance_proc((hi), "vk" #name))
+
+/* ----------------------------------------------
+ * 创建 / 销毁
+ * ---------------------------------------------- */
+
+/* shader module 和布局，都很快；真正慢的 pipeline 编译留给 hostvk_template_compile */
+static VkResult build_layout(HVkTemplate* t, const uint32_t* code, size_t code_size)
+{
+    HVkDevice*   hd = t->hd;
+    HVkInstance* hi = hd->inst;
+    PFN_vkCreateShaderModule CreateShaderModule =
+        (PFN_vkCreateShaderModule)hostvk_instance_proc(hi, "vkCreateShaderModule");
+    PFN_vkCreateDescriptorSetLayout CreateDescriptorSetLayout =
+        (PFN_vkCreateDescriptorSetLayout)hostvk_instance_proc(hi, "vkCreateDescriptorSetLayout");
+    PFN_vkCreatePipelineLayout CreatePipelineLayout =
+        (PFN_vkCreatePipelineLayout)hostvk_instance_proc(hi, "vkCreatePipelineLayout");
+
+    VkShaderModuleCreateInfo smci = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = code_size,
+        .pCode = code,
+    };
+    VkResult r = CreateShaderModule(hd->device, &smci, NULL, &t->module);
+    if (r != VK_SUCCESS) return r;
+
+    VkDescriptorSetLayoutBinding b[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    for (uint32_t i = 0; i < t->binding_count; i++) {
+        b[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+    VkDescriptorSetLayoutCreateInfo dslci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = t->binding_count,
+        .pBindings = b,
+    };
+    r = CreateDescriptorSetLayout(hd->device, &dslci, NULL, &t->set_layout);
+    if (r != VK_SUCCESS) return r;
+
+    VkPushConstantRange pcr = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = t->push_size,
+    };
+    VkPipelineLayoutCreateInfo plci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &t->set_layout,
+        .pushConstantRangeCount = t->push_size ? 1 : 0,
+        .pPushConstantRanges = &pcr,
+    };
+    return CreatePipelineLayout(hd->device, &plci, NULL, &t->layout);
+}
+
+static VkResult build_slots(HVkTemplate* t)
+{
+    HVkDevice*   hd = t->hd;
+    HVkInstance* hi = hd->inst;
+    PFN_vkCreateDescriptorPool CreateDescriptorPool =
+        (PFN_vkCreateDescriptorPool)hostvk_instance_proc(hi, "vkCreateDescriptorPool");
+    PFN_vkAllocateDescriptorSets AllocateDescriptorSets =
+        (PFN_vkAllocateDescriptorSets)hostvk_instance_proc(hi, "vkAllocateDescriptorSets");
+    PFN_vkCreateCommandPool CreateCommandPool =
+        (PFN_vkCreateCommandPool)hostvk_instance_proc(hi, "vkCreateCommandPool");
+    PFN_vkAllocateCommandBuffers AllocateCommandBuffers =
+        (PFN_vkAllocateCommandBuffers)hostvk_instance_proc(hi, "vkAllocateCommandBuffers");
+
+    /* binding_count 为 0 时描述符集是空的，池里至少要有一种描述符 */
+    VkDescriptorPoolSize ps = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = HVK_TEMPLATE_SLOTS * (t->binding_count ? t->binding_count : 1),
+    };
+    VkDescriptorPoolCreateInfo dpci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = HVK_TEMPLATE_SLOTS,
+        .poolSizeCount = 1,
+        .pPoolSizes = &ps,
+    };
+    VkResult r = CreateDescriptorPool(hd->device, &dpci, NULL, &t->desc_pool);
+    if (r != VK_SUCCESS) return r;
+
+    VkDescriptorSetLayout layouts[HVK_TEMPLATE_SLOTS];
+    VkDescriptorSet sets[HVK_TEMPLATE_SLOTS];
+    for (uint32_t i = 0; i < HVK_TEMPLATE_SLOTS; i++) layouts[i] = t->set_layout;
+    VkDescriptorSetAllocateInfo dsai = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = t->desc_pool,
+        .descriptorSetCount = HVK_TEMPLATE_SLOTS,
+        .pSetLayouts = layouts,
+    };
+    r = AllocateDescriptorSets(hd->device, &dsai, sets);
+    if (r != VK_SUCCESS) return r;
+
+    /* 槽的命令缓冲要单独重录 */
+    VkCommandPoolCreateInfo cpci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = hd->queue_family,
+    };
+    r = CreateCommandPool(hd->device, &cpci, NULL, &t->cmd_pool);
+    if (r != VK_SUCCESS) return r;
+
+    VkCommandBuffer cbs[HVK_TEMPLATE_SLOTS];
+    VkCommandBufferAllocateInfo cai = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = t->cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = HVK_TEMPLATE_SLOTS,
+    };
+    r = AllocateCommandBuffers(hd->device, &cai, cbs);
+    if (r != VK_SUCCESS) return r;
+
+    for (uint32_t i = 0; i < HVK_TEMPLATE_SLOTS; i++) {
+        t->slots[i].set = sets[i];
+        t->slots[i].cb  = cbs[i];
+    }
+    return VK_SUCCESS;
+}
+
+VkResult hostvk_template_create(HVkDevice* hd, const uint32_t* code, size_t code_size,
+                                uint32_t binding_count, uint32_t push_size, HVkTemplate** out)
+{
+    if (binding_count > VKVGPU_TEMPLATE_MAX_BINDINGS || push_size > VKVGPU_TEMPLATE_MAX_PUSH)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    HVkTemplate* t = calloc(1, sizeof(*t));
+    if (!t) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    t->hd            = hd;
+    t->binding_count = binding_count;
+    t->push_size     = push_size;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+
+    HVkInstance* hi = hd->inst;
+    TMPL_PROC(t, hi, DestroyShaderModule);
+    TMPL_PROC(t, hi, DestroyDescriptorSetLayout);
+    TMPL_PROC(t, hi, DestroyPipelineLayout);
+    TMPL_PROC(t, hi, DestroyPipeline);
+    TMPL_PROC(t, hi, DestroyDescriptorPool);
+    TMPL_PROC(t, hi, DestroyCommandPool);
+    TMPL_PROC(t, hi, UpdateDescriptorSets);
+    TMPL_PROC(t, hi, BeginCommandBuffer);
+    TMPL_PROC(t, hi, EndCommandBuffer);
+    TMPL_PROC(t, hi, CmdBindPipeline);
+    TMPL_PROC(t, hi, CmdBindDescriptorSets);
+    TMPL_PROC(t, hi, CmdPushConstants);
+    TMPL_PROC(t, hi, CmdDispatch);
+    TMPL_PROC(t, hi, CmdPipelineBarrier);
+
+    VkResult r = build_layout(t, code, code_size);
+    if (r == VK_SUCCESS) r = build_slots(t);
+    if (r != VK_SUCCESS) {
+        LOG("创建模板失败: %d\n", r);
+        hostvk_template_destroy(t);
+        return r;
+    }
+    *out = t;
+    return VK_SUCCESS;
+}
+
+VkResult hostvk_template_compile(HVkTemplate* t)
+{
+    HVkDevice* hd = t->hd;
+    PFN_vkCreateComputePipelines CreateComputePipelines =
+        (PFN_vkCreateComputePipelines)hostvk_instance_proc(hd->inst, "vkCreateComputePipelines");
+
+    VkComputePipelineCreateInfo cpci = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = t->module,
+            .pName = "main",
+        },
+        .layout = t->layout,
+    };
+    VkResult r = CreateComputePipelines(hd->device, VK_NULL_HANDLE, 1, &cpci, NULL, &t->pipeline);
+    if (r != VK_SUCCESS) {
+        LOG("编译 pipeline 失败: %d\n", r);
+        t->pipeline = VK_NULL_HANDLE;
+        return r;
+    }
+    /* 建好后 module 不再需要 */
+    t->DestroyShaderModule(hd->device, t->module, NULL);
+    t->module = VK_NULL_HANDLE;
+    return VK_SUCCESS;
+}
+
+void hostvk_template_destroy(HVkTemplate* t)
+{
+    if (!t) return;
+    VkDevice dev = t->hd->device;
+    /* 命令缓冲、描述符集随各自的池释放 */
+    if (t->cmd_pool)   t->DestroyCommandPool(dev, t->cmd_pool, NULL);
+    if (t->desc_pool)  t->DestroyDescriptorPool(dev, t->desc_pool, NULL);
+    if (t->pipeline)   t->DestroyPipeline(dev, t->pipeline, NULL);
+    if (t->layout)     t->DestroyPipelineLayout(dev, t->layout, NULL);
+    if (t->set_layout) t->DestroyDescriptorSetLayout(dev, t->set_layout, NULL);
+    if (t->module)     t->DestroyShaderModule(dev, t->module, NULL);
+    if (t->rerecords)
+        LOG("模板 %p: 共录制 %u 次\n", (void*)t, t->rerecords);
+    pthread_cond_destroy(&t->cond);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+/* ----------------------------------------------
+ * 调用
+ * ---------------------------------------------- */
+
+static int binding_same(const HVkSlotBinding* sb, const HVkTemplateBinding* b)
+{
+    return sb->hm == b->hm && sb->generation == b->hm->generation &&
+           sb->offset == b->offset && sb->range == b->range;
+}
+
+static int slot_matches(const HVkTemplate* t, const HVkTemplateSlot* slot, const HVkTemplateArgs* args)
+{
+    if (!slot->recorded) return 0;
+    for (uint32_t i = 0; i < t->binding_count; i++)
+        if (!binding_same(&slot->bindings[i], &args->bindings[i])) return 0;
+    return memcmp(slot->push, args->push, t->push_size) == 0 &&
+           memcmp(slot->group_count, args->group_count, sizeof(slot->group_count)) == 0;
+}
+
+/* 只写变了的绑定；描述符改了，录过的命令缓冲也随之失效 */
+static VkResult slot_write_bindings(HVkTemplate* t, HVkTemplateSlot* slot, const HVkTemplateArgs* args)
+{
+    VkDescriptorBufferInfo infos[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    VkWriteDescriptorSet   writes[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < t->binding_count; i++) {
+        const HVkTemplateBinding* b = &args->bindings[i];
+        if (slot->recorded && binding_same(&slot->bindings[i], b)) continue;
+
+        VkBuffer buf;
+        VkResult r = hostvk_memory_buffer(b->hm, &buf);
+        if (r != VK_SUCCESS) return r;
+        infos[n] = (VkDescriptorBufferInfo){ .buffer = buf, .offset = b->offset, .range = b->range };
+        writes[n] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = slot->set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &infos[n],
+        };
+        n++;
+        slot->bindings[i] = (HVkSlotBinding){ b->hm, b->hm->generation, b->offset, b->range };
+    }
+    if (n) t->UpdateDescriptorSets(t->hd->device, n, writes, 0, NULL);
+    return VK_SUCCESS;
+}
+
+static VkResult slot_record(HVkTemplate* t, HVkTemplateSlot* slot, const HVkTemplateArgs* args)
+{
+    VkCommandBufferBeginInfo bi = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    VkResult r = t->BeginCommandBuffer(slot->cb, &bi);
+    if (r != VK_SUCCESS) return r;
+
+    t->CmdBindPipeline(slot->cb, VK_PIPELINE_BIND_POINT_COMPUTE, t->pipeline);
+    t->CmdBindDescriptorSets(slot->cb, VK_PIPELINE_BIND_POINT_COMPUTE, t->layout,
+                             0, 1, &slot->set, 0, NULL);
+    if (t->push_size)
+        t->CmdPushConstants(slot->cb, t->layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                            0, t->push_size, args->push);
+    t->CmdDispatch(slot->cb, args->group_count[0], args->group_count[1], args->group_count[2]);
+
+    /* 结果可能马上被读回（host 映射或拷贝），也可能被下一次调度读 */
+    VkMemoryBarrier mb = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+                         VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    t->CmdPipelineBarrier(slot->cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          0, 1, &mb, 0, NULL, 0, NULL);
+    r = t->EndCommandBuffer(slot->cb);
+    if (r != VK_SUCCESS) return r;
+
+    memcpy(slot->push, args->push, t->push_size);
+    memcpy(slot->group_count, args->group_count, sizeof(slot->group_count));
+    slot->recorded = 1;
+    t->rerecords++;
+    return VK_SUCCESS;
+}
+
+VkResult hostvk_template_prepare(HVkTemplate* t, const HVkTemplateArgs* args,
+                                 uint32_t* out_slot, VkCommandBuffer* out_cb)
+{
+    HVkTemplateSlot* slot = NULL;
+    if (!t->pipeline) return VK_ERROR_INITIALIZATION_FAILED;   // 还没编译或编译失败
+
+    /* 优先用参数完全一样的空闲槽，省掉重录 */
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        HVkTemplateSlot* idle = NULL;
+        for (uint32_t i = 0; i < HVK_TEMPLATE_SLOTS && !slot; i++) {
+            HVkTemplateSlot* s = &t->slots[i];
+            if (s->busy) continue;
+            if (slot_matches(t, s, args)) slot = s;
+            else if (!idle) idle = s;
+        }
+        if (!slot) slot = idle;
+        if (slot) break;
+        pthread_cond_wait(&t->cond, &t->lock);
+    }
+    slot->busy = 1;
+    pthread_mutex_unlock(&t->lock);
+
+    VkResult r = VK_SUCCESS;
+    if (!slot_matches(t, slot, args)) {
+        r = slot_write_bindings(t, slot, args);
+        if (r == VK_SUCCESS) r = slot_record(t, slot, args);
+        if (r != VK_SUCCESS) slot->recorded = 0;
+    }
+    uint32_t index = (uint32_t)(slot - t->slots);
+    if (r != VK_SUCCESS) {
+        hostvk_template_retire(t, index);
+        return r;
+    }
+    *out_slot = index;
+    *out_cb   = slot->cb;
+    return VK_SUCCESS;
+}
+
+void hostvk_template_retire(HVkTemplate* t, uint32_t slot)
+{
+    pthread_mutex_lock(&t->lock);
+    t->slots[slot].busy = 0;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
@@ -1,16 +1,21 @@
+#define _GNU_SOURCE
 #include "host_vulkan.h"
+#include "vgpu_numa.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
 
 static PFN_vkGetInstanceProcAddr pfnGetInstanceProcAddr = NULL;
 
-static HVkInstance instances[128];
-static HVkDevice   devices[128];
+/* device-local 但不可映射的内存类型是否对 guest 显示为 host-visible */
+static int g_emulate_host_visible = 1;
 
-static uint64_t inst_count = 1;
-static uint64_t dev_count  = 1;
+/* device-local 内存分配成可导出的 opaque fd，跨 VM 去重要用（VGPU_MEM_DEDUP=1） */
+static int g_export_memory = 0;
 
 #define LOG(...) printf("[hostvk] " __VA_ARGS__)
 
@@ -33,14 +38,45 @@ int hostvk_init()
         return -1;
     }
 
+    const char* env = getenv("VGPU_EMULATE_HOST_VISIBLE");
+    if (env && atoi(env) == 0)
+        g_emulate_host_visible = 0;
+
+    env = getenv("VGPU_MEM_DEDUP");
+    g_export_memory = env && atoi(env) != 0;
+
     LOG("Host Vulkan 已加载\n");
     return 0;
 }
 
+PFN_vkVoidFunction hostvk_instance_proc(HVkInstance* hi, const char* name)
+{
+    return pfnGetInstanceProcAddr(hi ? hi->instance : NULL, name);
+}
+
 /* ----------------------------------------------
  * 创建 Vulkan Instance
  * ---------------------------------------------- */
-uint64_t hostvk_create_instance()
+static int instance_has_extension(const char* name)
+{
+    PFN_vkEnumerateInstanceExtensionProperties pfn =
+        (PFN_vkEnumerateInstanceExtensionProperties)
+        pfnGetInstanceProcAddr(NULL, "vkEnumerateInstanceExtensionProperties");
+    uint32_t count = 0;
+    if (!pfn || pfn(NULL, &count, NULL) != VK_SUCCESS || count == 0) return 0;
+
+    VkExtensionProperties* props = calloc(count, sizeof(*props));
+    if (!props) return 0;
+    int found = 0;
+    if (pfn(NULL, &count, props) == VK_SUCCESS) {
+        for (uint32_t i = 0; i < count && !found; i++)
+            found = strcmp(props[i].extensionName, name) == 0;
+    }
+    free(props);
+    return found;
+}
+
+VkResult hostvk_create_instance(HVkInstance** out)
 {
     VkApplicationInfo app = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -51,34 +87,58 @@ uint64_t hostvk_create_instance()
         .apiVersion = VK_API_VERSION_1_0,
     };
 
+    /* 查 GPU 的 PCI 地址（NUMA 放置）要用 vkGetPhysicalDeviceProperties2 */
+    const char* exts[2];
+    uint32_t next = 0;
+    int props2 = instance_has_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (props2) exts[next++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+    /* Vulkan 1.0 上 device 的 VK_KHR_external_memory 依赖它 */
+    int ext_mem = g_export_memory && props2 &&
+                  instance_has_extension(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    if (ext_mem) exts[next++] = VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME;
+
     VkInstanceCreateInfo ci = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
         .pApplicationInfo = &app,
+        .enabledExtensionCount = next,
+        .ppEnabledExtensionNames = next ? exts : NULL,
     };
 
     PFN_vkCreateInstance pfn =
         (PFN_vkCreateInstance)pfnGetInstanceProcAddr(NULL, "vkCreateInstance");
 
-    VkInstance inst;
-    if (pfn(&ci, NULL, &inst) != VK_SUCCESS) {
-        LOG("vkCreateInstance 失败\n");
-        return 0;
+    HVkInstance* hi = calloc(1, sizeof(*hi));
+    if (!hi) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    hi->props2 = props2;
+    hi->external_memory = ext_mem;
+
+    VkResult r = pfn(&ci, NULL, &hi->instance);
+    if (r != VK_SUCCESS) {
+        LOG("vkCreateInstance 失败: %d\n", r);
+        free(hi);
+        return r;
     }
 
-    uint64_t h = inst_count++;
-    instances[h].instance = inst;
+    LOG("hostvk_create_instance: %p\n", (void*)hi->instance);
+    *out = hi;
+    return VK_SUCCESS;
+}
 
-    LOG("hostvk_create_instance: handle=%lu\n", h);
-    return h;
+void hostvk_destroy_instance(HVkInstance* hi)
+{
+    if (!hi) return;
+    PFN_vkDestroyInstance pfnDestroy =
+        (PFN_vkDestroyInstance)pfnGetInstanceProcAddr(hi->instance, "vkDestroyInstance");
+    pfnDestroy(hi->instance, NULL);
+    LOG("hostvk_destroy_instance: %p\n", (void*)hi->instance);
+    free(hi);
 }
 
 /* ----------------------------------------------
  * 枚举物理设备
  * ---------------------------------------------- */
-uint32_t hostvk_enum_physical_devices(uint64_t inst_handle)
+uint32_t hostvk_enum_physical_devices(HVkInstance* hi)
 {
-    HVkInstance* hi = &instances[inst_handle];
-
     PFN_vkEnumeratePhysicalDevices pfnEnum =
         (PFN_vkEnumeratePhysicalDevices)
         pfnGetInstanceProcAddr(hi->instance, "vkEnumeratePhysicalDevices");
@@ -86,17 +146,12 @@ uint32_t hostvk_enum_physical_devices(uint64_t inst_handle)
     uint32_t count = 0;
     pfnEnum(hi->instance, &count, NULL);
 
-    LOG("hostvk_enum_phys: inst=%lu count=%u\n", inst_handle, count);
+    LOG("hostvk_enum_phys: inst=%p count=%u\n", (void*)hi->instance, count);
     return count;
 }
 
-/* ----------------------------------------------
- * 创建 Device（选第 0 个物理设备）
- * ---------------------------------------------- */
-uint64_t hostvk_create_device(uint64_t inst_handle)
+static VkPhysicalDevice get_physical_device(HVkInstance* hi, uint32_t phys_index)
 {
-    HVkInstance* hi = &instances[inst_handle];
-
     PFN_vkEnumeratePhysicalDevices pfnEnum =
         (PFN_vkEnumeratePhysicalDevices)
         pfnGetInstanceProcAddr(hi->instance, "vkEnumeratePhysicalDevices");
@@ -106,15 +161,116 @@ uint64_t hostvk_create_device(uint64_t inst_handle)
 
     if (count == 0) {
         LOG("没有找到物理设备\n");
-        return 0;
+        return NULL;
     }
 
     VkPhysicalDevice devs[8];
+    if (count > 8) count = 8;
     pfnEnum(hi->instance, &count, devs);
 
-    VkPhysicalDevice phys = devs[0]; // 固定选择第一个
+    if (phys_index >= count) {
+        LOG("物理设备序号越界: %u/%u\n", phys_index, count);
+        return NULL;
+    }
+    return devs[phys_index];
+}
+
+/* 可以用 GPU 拷贝模拟映射的内存类型 */
+static int is_emulated_type(VkMemoryPropertyFlags flags)
+{
+    return g_emulate_host_visible &&
+           (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) &&
+           !(flags & (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+                      VK_MEMORY_PROPERTY_PROTECTED_BIT));
+}
+
+/* host 属性 → guest 属性；type_host 记下每个 guest 类型背后的 host 类型，可为 NULL */
+static void guest_memory_properties(const VkPhysicalDeviceMemoryProperties* host,
+                                    VkPhysicalDeviceMemoryProperties* out, uint32_t* type_host)
+{
+    *out = *host;
+    for (uint32_t i = 0; i < host->memoryTypeCount; i++) {
+        if (type_host) type_host[i] = i;
+    }
+    for (uint32_t i = 0; i < host->memoryTypeCount && out->memoryTypeCount < VK_MAX_MEMORY_TYPES; i++) {
+        if (!is_emulated_type(host->memoryTypes[i].propertyFlags)) continue;
+        VkMemoryType* t = &out->memoryTypes[out->memoryTypeCount];
+        *t = host->memoryTypes[i];
+        t->propertyFlags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if (type_host) type_host[out->memoryTypeCount] = i;
+        out->memoryTypeCount++;
+    }
+}
+
+VkResult hostvk_get_memory_properties(HVkInstance* hi, uint32_t phys_index,
+                                      VkPhysicalDeviceMemoryProperties* out)
+{
+    VkPhysicalDevice phys = get_physical_device(hi, phys_index);
+    if (!phys) return VK_ERROR_INITIALIZATION_FAILED;
+
+    PFN_vkGetPhysicalDeviceMemoryProperties pfn =
+        (PFN_vkGetPhysicalDeviceMemoryProperties)
+        pfnGetInstanceProcAddr(hi->instance, "vkGetPhysicalDeviceMemoryProperties");
+    VkPhysicalDeviceMemoryProperties host;
+    pfn(phys, &host);
+    guest_memory_properties(&host, out, NULL);
+    return VK_SUCCESS;
+}
+
+/* ----------------------------------------------
+ * 创建 Device（guest 指定第几个物理设备）
+ * ---------------------------------------------- */
+static int device_has_extension(HVkInstance* hi, VkPhysicalDevice phys, const char* name)
+{
+    PFN_vkEnumerateDeviceExtensionProperties pfn =
+        (PFN_vkEnumerateDeviceExtensionProperties)
+        pfnGetInstanceProcAddr(hi->instance, "vkEnumerateDeviceExtensionProperties");
+    uint32_t count = 0;
+    if (pfn(phys, NULL, &count, NULL) != VK_SUCCESS || count == 0) return 0;
+
+    VkExtensionProperties* props = calloc(count, sizeof(*props));
+    if (!props) return 0;
+    int found = 0;
+    if (pfn(phys, NULL, &count, props) == VK_SUCCESS) {
+        for (uint32_t i = 0; i < count && !found; i++)
+            found = strcmp(props[i].extensionName, name) == 0;
+    }
+    free(props);
+    return found;
+}
+
+/* VK_EXT_pci_bus_info 给出的 PCI 地址，sysfs 里按它找设备所在的 NUMA 节点 */
+static void device_pci_address(HVkInstance* hi, VkPhysicalDevice phys, char* out, size_t size)
+{
+    out[0] = '\0';
+    if (!hi->props2 || !device_has_extension(hi, phys, VK_EXT_PCI_BUS_INFO_EXTENSION_NAME))
+        return;
+
+    PFN_vkGetPhysicalDeviceProperties2KHR pfn =
+        (PFN_vkGetPhysicalDeviceProperties2KHR)
+        pfnGetInstanceProcAddr(hi->instance, "vkGetPhysicalDeviceProperties2KHR");
+    if (!pfn) return;
+
+    VkPhysicalDevicePCIBusInfoPropertiesEXT pci = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PCI_BUS_INFO_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &pci,
+    };
+    pfn(phys, &props);
+    snprintf(out, size, "%04x:%02x:%02x.%x",
+             pci.pciDomain, pci.pciBus, pci.pciDevice, pci.pciFunction);
+}
 
-    float prio = 1.0f;
+VkResult hostvk_create_device(HVkInstance* hi, uint32_t phys_index, float priority,
+                              int global_priority, HVkDevice** out)
+{
+    VkPhysicalDevice phys = get_physical_device(hi, phys_index);
+    if (!phys) return VK_ERROR_INITIALIZATION_FAILED;
+
+    float prio = priority;
     VkDeviceQueueCreateInfo qci = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = 0,
@@ -122,28 +278,469 @@ uint64_t hostvk_create_device(uint64_t inst_handle)
         .pQueuePriorities = &prio,
     };
 
+    /* 跨 VM 去重：内存以 opaque fd 导出，再导入到别的 VM 的 device 上 */
+    const char* exts[3];
+    uint32_t next = 0;
+    int external_fd = hi->external_memory &&
+                      device_has_extension(hi, phys, VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME) &&
+                      device_has_extension(hi, phys, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
+    if (external_fd) {
+        exts[next++] = VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME;
+        exts[next++] = VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME;
+    }
+
+    /* 驱动支持时把优先级带到整个 GPU 的调度上，而不只是本 device 的几个队列之间 */
+    VkDeviceQueueGlobalPriorityCreateInfoEXT gp = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_EXT,
+        .globalPriority = (VkQueueGlobalPriorityEXT)global_priority,
+    };
+    int use_global = global_priority != 0 &&
+                     device_has_extension(hi, phys, VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME);
+    if (use_global) {
+        qci.pNext = &gp;
+        exts[next++] = VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME;   // 放最后，退回时直接去掉
+    }
+
     VkDeviceCreateInfo dci = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &qci,
+        .enabledExtensionCount = next,
+        .ppEnabledExtensionNames = next ? exts : NULL,
     };
 
     PFN_vkCreateDevice pfnCreateDev =
         (PFN_vkCreateDevice)
         pfnGetInstanceProcAddr(hi->instance, "vkCreateDevice");
 
-    VkDevice dev;
-    if (pfnCreateDev(phys, &dci, NULL, &dev) != VK_SUCCESS) {
-        LOG("vkCreateDevice 失败\n");
-        return 0;
+    HVkDevice* hd = calloc(1, sizeof(*hd));
+    if (!hd) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    VkResult r = pfnCreateDev(phys, &dci, NULL, &hd->device);
+    if (r == VK_ERROR_NOT_PERMITTED_EXT) {
+        /* 高优先级需要权限（如 CAP_SYS_NICE），没有就只用队列优先级 */
+        LOG("global priority %d 不被允许，退回普通队列优先级\n", global_priority);
+        qci.pNext = NULL;
+        dci.enabledExtensionCount = --next;
+        dci.ppEnabledExtensionNames = next ? exts : NULL;
+        r = pfnCreateDev(phys, &dci, NULL, &hd->device);
+    }
+    if (r != VK_SUCCESS) {
+        LOG("vkCreateDevice 失败: %d\n", r);
+        free(hd);
+        return r;
+    }
+    hd->phys = phys;
+    hd->phys_index = phys_index;
+    hd->inst = hi;
+    hd->queue_family = qci.queueFamilyIndex;
+    hd->external_fd = external_fd;
+
+    PFN_vkGetDeviceQueue pfnGetQueue =
+        (PFN_vkGetDeviceQueue)pfnGetInstanceProcAddr(hi->instance, "vkGetDeviceQueue");
+    pfnGetQueue(hd->device, hd->queue_family, 0, &hd->queue);
+    pthread_mutex_init(&hd->queue_lock, NULL);
+    pthread_mutex_init(&hd->stream_lock, NULL);
+
+    VkPhysicalDeviceProperties props;
+    PFN_vkGetPhysicalDeviceProperties pfnProps =
+        (PFN_vkGetPhysicalDeviceProperties)
+        pfnGetInstanceProcAddr(hi->instance, "vkGetPhysicalDeviceProperties");
+    pfnProps(phys, &props);
+    hd->atom_size = props.limits.nonCoherentAtomSize ? props.limits.nonCoherentAtomSize : 1;
+    hd->storage_align = props.limits.minStorageBufferOffsetAlignment ?
+                        props.limits.minStorageBufferOffsetAlignment : 1;
+    hd->timestamp_period = props.limits.timestampPeriod;
+
+    PFN_vkGetPhysicalDeviceQueueFamilyProperties pfnQueueProps =
+        (PFN_vkGetPhysicalDeviceQueueFamilyProperties)
+        pfnGetInstanceProcAddr(hi->instance, "vkGetPhysicalDeviceQueueFamilyProperties");
+    uint32_t nfam = 0;
+    pfnQueueProps(phys, &nfam, NULL);
+    VkQueueFamilyProperties fam[nfam ? nfam : 1];
+    pfnQueueProps(phys, &nfam, fam);
+    if (hd->queue_family < nfam)
+        hd->timestamp_bits = fam[hd->queue_family].timestampValidBits;
+
+    PFN_vkGetPhysicalDeviceMemoryProperties pfnMemProps =
+        (PFN_vkGetPhysicalDeviceMemoryProperties)
+        pfnGetInstanceProcAddr(hi->instance, "vkGetPhysicalDeviceMemoryProperties");
+    pfnMemProps(phys, &hd->mem_props);
+    guest_memory_properties(&hd->mem_props, &hd->guest_props, hd->guest_type_host);
+
+    device_pci_address(hi, phys, hd->pci, sizeof(hd->pci));
+    hd->numa_node = vgpu_numa_node_of_pci(hd->pci);
+    vgpu_numa_set_gpu(phys_index, hd->numa_node);
+
+    LOG("hostvk_create_device: %p\n", (void*)hd->device);
+    *out = hd;
+    return VK_SUCCESS;
+}
+
+void hostvk_destroy_device(HVkDevice* hd)
+{
+    if (!hd) return;
+    hostvk_stream_destroy(hd);
+    hostvk_submit_destroy(hd);
+    PFN_vkDestroyDevice pfnDestroyDev =
+        (PFN_vkDestroyDevice)pfnGetInstanceProcAddr(hd->inst->instance, "vkDestroyDevice");
+    pfnDestroyDev(hd->device, NULL);
+    LOG("hostvk_destroy_device: %p\n", (void*)hd->device);
+    pthread_mutex_destroy(&hd->queue_lock);
+    pthread_mutex_destroy(&hd->stream_lock);
+    free(hd);
+}
+
+/* ----------------------------------------------
+ * 设备内存
+ * ---------------------------------------------- */
+static void device_memory_release(HVkMemory* hm)
+{
+    if (!hm->memory) return;
+    hostvk_stream_release_memory(hm);
+    PFN_vkFreeMemory pfnFree =
+        (PFN_vkFreeMemory)pfnGetInstanceProcAddr(hm->dev->inst->instance, "vkFreeMemory");
+    /* 释放会隐式解除映射 */
+    pfnFree(hm->dev->device, hm->memory, NULL);
+    hm->memory = VK_NULL_HANDLE;
+    hm->mapped = NULL;
+    hm->shared = 0;
+}
+
+/* 开了去重的 device 上，device-local 内存都分配成可导出的，之后不用再搬一次 */
+static int memory_exportable(HVkMemory* hm)
+{
+    return hm->dev->external_fd && (hm->flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+/* 按 hm 里已填好的大小和类型分配 VkDeviceMemory；pnext 是导入信息等，可以为 NULL */
+static VkResult device_memory_alloc(HVkMemory* hm, const void* pnext)
+{
+    HVkDevice* hd = hm->dev;
+    VkExportMemoryAllocateInfo export_info = {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkMemoryAllocateInfo ai = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = pnext ? pnext : (memory_exportable(hm) ? &export_info : NULL),
+        .allocationSize = hm->size,
+        .memoryTypeIndex = hm->type_index,
+    };
+
+    PFN_vkAllocateMemory pfnAlloc =
+        (PFN_vkAllocateMemory)pfnGetInstanceProcAddr(hd->inst->instance, "vkAllocateMemory");
+    VkResult r = pfnAlloc(hd->device, &ai, NULL, &hm->memory);
+    hm->generation++;
+    if (r != VK_SUCCESS) {
+        LOG("vkAllocateMemory 失败: %d\n", r);
+        hm->memory = VK_NULL_HANDLE;
+    }
+    return r;
+}
+
+/* host-visible 的常驻映射 */
+static VkResult device_memory_map(HVkMemory* hm)
+{
+    HVkDevice* hd = hm->dev;
+    VkResult r = VK_SUCCESS;
+    if (hm->flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        PFN_vkMapMemory pfnMap =
+            (PFN_vkMapMemory)pfnGetInstanceProcAddr(hd->inst->instance, "vkMapMemory");
+        void* p = NULL;
+        r = pfnMap(hd->device, hm->memory, 0, VK_WHOLE_SIZE, 0, &p);
+        if (r != VK_SUCCESS) {
+            LOG("vkMapMemory 失败: %d\n", r);
+            device_memory_release(hm);
+            return r;
+        }
+        hm->mapped = p;
+    }
+    return r;
+}
+
+static VkResult device_memory_create(HVkMemory* hm)
+{
+    VkResult r = device_memory_alloc(hm, NULL);
+    return r == VK_SUCCESS ? device_memory_map(hm) : r;
+}
+
+VkResult hostvk_allocate_memory(HVkDevice* hd, VkDeviceSize size, uint32_t type_index,
+                                HVkMemory** out)
+{
+    if (type_index >= hd->guest_props.memoryTypeCount) {
+        LOG("内存类型越界: %u/%u\n", type_index, hd->guest_props.memoryTypeCount);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    HVkMemory* hm = calloc(1, sizeof(*hm));
+    if (!hm) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    hm->dev        = hd;
+    hm->size       = size;
+    hm->type_index = hd->guest_type_host[type_index];
+    hm->flags      = hd->mem_props.memoryTypes[hm->type_index].propertyFlags;
+    /* 追加在 host 类型后面的才是模拟的；同一 host 类型的原样条目照常是不可映射的 */
+    hm->emulated   = type_index >= hd->mem_props.memoryTypeCount;
+
+    VkResult r = device_memory_create(hm);
+    if (r != VK_SUCCESS) {
+        free(hm);
+        return r;
+    }
+    *out = hm;
+    return VK_SUCCESS;
+}
+
+static void evicted_free(HVkMemory* hm)
+{
+    if (hm->evicted_on_disk) munmap(hm->evicted, hm->size);
+    else                     free(hm->evicted);
+    hm->evicted = NULL;
+    hm->evicted_on_disk = 0;
+}
+
+void hostvk_free_memory(HVkMemory* hm)
+{
+    if (!hm) return;
+    device_memory_release(hm);
+    evicted_free(hm);
+    free(hm);
+}
+
+/* 不可映射的内存要经 GPU 拷出来 */
+VkResult hostvk_memory_read_all(HVkMemory* hm, void* out)
+{
+    if (hm->mapped) return hostvk_read_memory(hm, 0, out, hm->size);
+    return hostvk_stream_read(hm, 0, out, hm->size);
+}
+
+VkResult hostvk_memory_evict(HVkMemory* hm)
+{
+    if (hm->evicted) return VK_SUCCESS;
+    uint8_t* copy = malloc(hm->size ? hm->size : 1);
+    if (!copy) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    VkResult r = hostvk_memory_read_all(hm, copy);
+    if (r != VK_SUCCESS) {
+        free(copy);
+        return r;
+    }
+    device_memory_release(hm);
+    hm->evicted = copy;
+    return VK_SUCCESS;
+}
+
+VkResult hostvk_memory_restore(HVkMemory* hm)
+{
+    if (!hm->evicted) return VK_SUCCESS;
+    VkResult r = device_memory_create(hm);
+    if (r != VK_SUCCESS) return r;
+
+    r = hm->mapped ? hostvk_write_memory(hm, 0, hm->evicted, hm->size)
+                   : hostvk_stream_write(hm, 0, hm->evicted, hm->size);
+    /* 拷贝是异步提交的，staging 环里已经有一份，host 副本可以马上丢掉 */
+    evicted_free(hm);
+    return r;
+}
+
+VkResult hostvk_memory_spill(HVkMemory* hm, const char* dir)
+{
+    if (!hm->evicted || hm->evicted_on_disk || hm->size == 0) return VK_SUCCESS;
+
+    /* 匿名文件，进程退出或 munmap 后自动回收，不会在目录里留下东西 */
+    int fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+    if (fd < 0) {
+        LOG("在 %s 建临时文件失败\n", dir);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for (VkDeviceSize off = 0; off < hm->size; ) {
+        ssize_t n = write(fd, hm->evicted + off, hm->size - off);
+        if (n <= 0) {
+            LOG("写临时文件失败\n");
+            close(fd);
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        off += (VkDeviceSize)n;
+    }
+    void* p = mmap(NULL, hm->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    /* 落盘后丢掉页缓存，内存真正还回去；换回时按页从盘上读 */
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    free(hm->evicted);
+    hm->evicted = p;
+    hm->evicted_on_disk = 1;
+    return VK_SUCCESS;
+}
+
+/* ----------------------------------------------
+ * 跨 device 共享（VK_KHR_external_memory_fd）
+ * ---------------------------------------------- */
+
+/* 导入后逐块比对用的缓冲 */
+#define SHARE_VERIFY_CHUNK (1u << 20)
+
+int hostvk_memory_exportable(HVkMemory* hm)
+{
+    return hm->memory && memory_exportable(hm);
+}
+
+VkResult hostvk_memory_export_fd(HVkMemory* hm, int* out_fd)
+{
+    if (!hostvk_memory_exportable(hm)) return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    PFN_vkGetMemoryFdKHR pfn =
+        (PFN_vkGetMemoryFdKHR)pfnGetInstanceProcAddr(hm->dev->inst->instance, "vkGetMemoryFdKHR");
+    if (!pfn) return VK_ERROR_FEATURE_NOT_PRESENT;
+    VkMemoryGetFdInfoKHR gi = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+        .memory = hm->memory,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+    };
+    VkResult r = pfn(hm->dev->device, &gi, out_fd);
+    if (r == VK_SUCCESS) hm->shared = 1;
+    return r;
+}
+
+VkResult hostvk_memory_import_fd(HVkMemory* hm, int fd, const void* expect)
+{
+    if (!hostvk_memory_exportable(hm)) return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    /* 导入成功后 fd 归驱动所有，调用者手里的那个留着给别人用 */
+    int own = dup(fd);
+    if (own < 0) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    HVkMemory tmp = *hm;
+    tmp.memory = VK_NULL_HANDLE;
+    tmp.mapped = NULL;
+    tmp.alias  = VK_NULL_HANDLE;
+    VkImportMemoryFdInfoKHR imp = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+        .fd = own,
+    };
+    VkResult r = device_memory_alloc(&tmp, &imp);
+    if (r != VK_SUCCESS) {
+        close(own);
+        return r;
+    }
+    r = device_memory_map(&tmp);
+    if (r != VK_SUCCESS) return r;
+
+    /* 哈希相同不等于内容相同，认错了就是把别的 VM 的数据给了这个 VM：逐字节比对 */
+    uint8_t* buf = malloc(SHARE_VERIFY_CHUNK);
+    const uint8_t* want = expect;
+    int same = buf != NULL;
+    for (VkDeviceSize off = 0; same && off < hm->size; off += SHARE_VERIFY_CHUNK) {
+        VkDeviceSize n = hm->size - off < SHARE_VERIFY_CHUNK ? hm->size - off : SHARE_VERIFY_CHUNK;
+        r = hostvk_read_memory(&tmp, off, buf, n);
+        same = r == VK_SUCCESS && memcmp(buf, want + off, n) == 0;
+    }
+    free(buf);
+    if (!same) {
+        device_memory_release(&tmp);
+        return r != VK_SUCCESS ? r : VK_INCOMPLETE;
+    }
+
+    /* 换上导入的那份；alias 已经建在它上面，一起拿过来 */
+    device_memory_release(hm);
+    hm->memory = tmp.memory;
+    hm->mapped = tmp.mapped;
+    hm->alias  = tmp.alias;
+    hm->shared = 1;
+    hm->generation++;
+    return VK_SUCCESS;
+}
+
+/* 非 coherent 内存：把范围扩到 nonCoherentAtomSize 对齐 */
+static VkMappedMemoryRange atom_range(HVkMemory* hm, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkDeviceSize atom = hm->dev->atom_size;
+    VkDeviceSize lo = offset / atom * atom;
+    VkDeviceSize hi = (offset + size + atom - 1) / atom * atom;
+
+    VkMappedMemoryRange range = {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = hm->memory,
+        .offset = lo,
+        .size = hi >= hm->size ? VK_WHOLE_SIZE : hi - lo,
+    };
+    return range;
+}
+
+VkResult hostvk_write_memory(HVkMemory* hm, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    if (offset > hm->size || size > hm->size - offset)
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    if (hm->emulated)
+        return hostvk_stream_write(hm, offset, data, size);
+    if (!hm->mapped)
+        return VK_ERROR_MEMORY_MAP_FAILED;
+
+    memcpy(hm->mapped + offset, data, size);
+    if (hm->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        return VK_SUCCESS;
+
+    VkMappedMemoryRange range = atom_range(hm, offset, size);
+    PFN_vkFlushMappedMemoryRanges pfnFlush =
+        (PFN_vkFlushMappedMemoryRanges)
+        pfnGetInstanceProcAddr(hm->dev->inst->instance, "vkFlushMappedMemoryRanges");
+    return pfnFlush(hm->dev->device, 1, &range);
+}
+
+VkResult hostvk_read_memory(HVkMemory* hm, VkDeviceSize offset, void* out, VkDeviceSize size)
+{
+    if (offset > hm->size || size > hm->size - offset)
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    if (hm->emulated)
+        return hostvk_stream_read(hm, offset, out, size);
+    if (!hm->mapped)
+        return VK_ERROR_MEMORY_MAP_FAILED;
+
+    if (!(hm->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        VkMappedMemoryRange range = atom_range(hm, offset, size);
+        PFN_vkInvalidateMappedMemoryRanges pfnInv =
+            (PFN_vkInvalidateMappedMemoryRanges)
+            pfnGetInstanceProcAddr(hm->dev->inst->instance, "vkInvalidateMappedMemoryRanges");
+        VkResult r = pfnInv(hm->dev->device, 1, &range);
+        if (r != VK_SUCCESS) return r;
     }
+    memcpy(out, hm->mapped + offset, size);
+    return VK_SUCCESS;
+}
 
-    uint64_t h = dev_count++;
-    devices[h].device = dev;
+/* ----------------------------------------------
+ * fence
+ * ---------------------------------------------- */
+VkResult hostvk_create_fence(HVkDevice* hd, VkFence* out)
+{
+    PFN_vkCreateFence pfn =
+        (PFN_vkCreateFence)pfnGetInstanceProcAddr(hd->inst->instance, "vkCreateFence");
+    VkFenceCreateInfo fci = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    return pfn(hd->device, &fci, NULL, out);
+}
 
-    LOG("hostvk_create_device: handle=%lu\n", h);
-    return h;
+void hostvk_destroy_fence(HVkDevice* hd, VkFence fence)
+{
+    if (!fence) return;
+    PFN_vkDestroyFence pfn =
+        (PFN_vkDestroyFence)pfnGetInstanceProcAddr(hd->inst->instance, "vkDestroyFence");
+    pfn(hd->device, fence, NULL);
 }
 
-HVkInstance* hostvk_get_instance(uint64_t h) { return &instances[h]; }
-HVkDevice*   hostvk_get_device(uint64_t h) { return &devices[h]; }
+VkResult hostvk_wait_and_reset_fence(HVkDevice* hd, VkFence fence, uint64_t timeout_ns)
+{
+    PFN_vkWaitForFences pfnWait =
+        (PFN_vkWaitForFences)pfnGetInstanceProcAddr(hd->inst->instance, "vkWaitForFences");
+    VkResult r = pfnWait(hd->device, 1, &fence, VK_TRUE, timeout_ns);
+    if (r != VK_SUCCESS) return r;
+
+    PFN_vkResetFences pfnReset =
+        (PFN_vkResetFences)pfnGetInstanceProcAddr(hd->inst->instance, "vkResetFences");
+    return pfnReset(hd->device, 1, &fence);
+}
@@ -2,19 +2,193 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <stdint.h>
+#include <pthread.h>
 
 typedef struct {
     VkInstance instance;
+    int        props2;    // 开了 VK_KHR_get_physical_device_properties2
+    int        external_memory;   // 开了 VK_KHR_external_memory_capabilities（VGPU_MEM_DEDUP）
 } HVkInstance;
 
+typedef struct HVkStream HVkStream;
+typedef struct HVkSwapchain HVkSwapchain;
+typedef struct HVkSubmit HVkSubmit;
+typedef struct HVkTemplate HVkTemplate;
+
 typedef struct {
-    VkDevice device;
+    VkDevice         device;
+    VkPhysicalDevice phys;
+    uint32_t         phys_index;  // 同一块 GPU 上的 device 共用一个调度器
+    HVkInstance*     inst;
+    VkQueue          queue;       // queue family 0 的第 0 个队列
+    pthread_mutex_t  queue_lock;  // 上下文 worker 和 present 线程都往 queue 提交
+    uint32_t         queue_family;
+    VkDeviceSize     atom_size;   // nonCoherentAtomSize，flush/invalidate 按它对齐
+    VkDeviceSize     storage_align;     // minStorageBufferOffsetAlignment
+    VkPhysicalDeviceMemoryProperties mem_props;   // host 真实属性
+    VkPhysicalDeviceMemoryProperties guest_props; // 给 guest 的，见 hostvk_get_memory_properties
+    uint32_t         guest_type_host[VK_MAX_MEMORY_TYPES];   // guest 内存类型 → host 内存类型
+    HVkStream*       stream;      // 分块上传/读回，第一次用到时创建
+    pthread_mutex_t  stream_lock; // staging 环：所属 worker、超分换出（别的 VM 的 worker）都会用
+    HVkSubmit*       submit;      // guest 提交的计时命令缓冲，第一次提交时创建
+    uint32_t         timestamp_bits;    // 队列的 timestampValidBits，0 = 不支持
+    float            timestamp_period;  // 每 tick 纳秒数
+    char             pci[16];     // "dddd:bb:dd.f"，驱动不支持 VK_EXT_pci_bus_info 时为空
+    int              numa_node;   // GPU 所在 NUMA 节点，VGPU_NUMA_ANY = 不知道
+    int              external_fd; // 开了 VK_KHR_external_memory_fd，device-local 内存可导出
 } HVkDevice;
 
+/*
+ * host-visible 内存创建后常驻映射，guest 的脏页直接拷进来。
+ * emulated：host 上不可映射的 device-local 内存，guest 看到的是 host-visible，
+ * 读写经 alias buffer + staging 环由 GPU 拷贝（host_stream.c）。
+ */
+typedef struct {
+    VkDeviceMemory        memory;
+    HVkDevice*            dev;
+    VkDeviceSize          size;
+    uint32_t              type_index;
+    VkMemoryPropertyFlags flags;       // host 真实属性
+    uint8_t*              mapped;
+    int                   emulated;
+    VkBuffer              alias;       // 覆盖整段分配的 transfer buffer，按需创建
+    uint8_t*              evicted;     // 非 NULL：已换出到这份 host 副本，memory 已释放
+    int                   evicted_on_disk;   // evicted 是落盘临时文件的只读映射
+    uint32_t              generation;  // 每次（重新）分配 memory +1，引用 alias 的描述符据此判断失效
+    int                   shared;      // memory 导出过或是导入的，别的 device 上可能还有引用
+} HVkMemory;
+
 int hostvk_init();
 
-uint64_t hostvk_create_instance();
-uint32_t hostvk_enum_physical_devices(uint64_t inst_handle);
-uint64_t hostvk_create_device(uint64_t inst_handle);
-HVkInstance* hostvk_get_instance(uint64_t h);
-HVkDevice*   hostvk_get_device(uint64_t h);
+/* 对象由 daemon 按 guest ID 映射保存，这里只负责创建/销毁 host 对象 */
+VkResult hostvk_create_instance(HVkInstance** out);
+void     hostvk_destroy_instance(HVkInstance* hi);
+uint32_t hostvk_enum_physical_devices(HVkInstance* hi);
+/* priority：唯一队列的 pQueuePriorities；global_priority 为 VkQueueGlobalPriorityEXT，0 = 不用 */
+VkResult hostvk_create_device(HVkInstance* hi, uint32_t phys_index, float priority,
+                              int global_priority, HVkDevice** out);
+void     hostvk_destroy_device(HVkDevice* hd);
+
+/*
+ * 给 guest 的内存属性：host 的类型原样排在前面，不可映射的 device-local 类型
+ * 再各追加一个 HOST_VISIBLE | HOST_COHERENT 的模拟类型，不打乱规范要求的类型顺序。
+ */
+VkResult hostvk_get_memory_properties(HVkInstance* hi, uint32_t phys_index,
+                                      VkPhysicalDeviceMemoryProperties* out);
+/* type_index 是 guest 的内存类型（hd->guest_props） */
+VkResult hostvk_allocate_memory(HVkDevice* hd, VkDeviceSize size, uint32_t type_index,
+                                HVkMemory** out);
+void     hostvk_free_memory(HVkMemory* hm);
+/* 只对 host-visible 内存有效；非 coherent 内存会自动 flush / invalidate */
+VkResult hostvk_write_memory(HVkMemory* hm, VkDeviceSize offset, const void* data, VkDeviceSize size);
+VkResult hostvk_read_memory(HVkMemory* hm, VkDeviceSize offset, void* out, VkDeviceSize size);
+
+/*
+ * 换出：内容拷到 host 内存并释放 VkDeviceMemory，给别的分配腾显存；
+ * 换回：重新分配并把内容写回。换出期间不能对它做任何读写。
+ */
+VkResult hostvk_memory_evict(HVkMemory* hm);
+VkResult hostvk_memory_restore(HVkMemory* hm);
+/* 已换出的 host 副本写到 dir 下的匿名临时文件并换成它的只读映射，不再占内存；换回时从盘上读 */
+VkResult hostvk_memory_spill(HVkMemory* hm, const char* dir);
+/* 整段内容读到 out（hm->size 字节） */
+VkResult hostvk_memory_read_all(HVkMemory* hm, void* out);
+
+/*
+ * 跨 device 共享同一份显存（VGPU_MEM_DEDUP=1 且驱动支持 VK_KHR_external_memory_fd）：
+ * export 取 opaque fd，调用者负责 close；import 把 hm 换成 fd 指向的那份，
+ * 换之前逐字节核对内容等于 expect，不等返回 VK_INCOMPLETE、hm 不变。
+ * 两边的大小、内存类型和物理设备必须相同。共享后 hm->shared 置位，
+ * 要写时先换出再换回，得到自己的一份（写时复制）。
+ */
+int      hostvk_memory_exportable(HVkMemory* hm);
+VkResult hostvk_memory_export_fd(HVkMemory* hm, int* out_fd);
+VkResult hostvk_memory_import_fd(HVkMemory* hm, int fd, const void* expect);
+
+PFN_vkVoidFunction hostvk_instance_proc(HVkInstance* hi, const char* name);
+
+/* fence */
+VkResult hostvk_create_fence(HVkDevice* hd, VkFence* out);
+void     hostvk_destroy_fence(HVkDevice* hd, VkFence fence);
+/* 返回 VK_SUCCESS / VK_TIMEOUT / 错误；成功后 fence 已被重置，可以再用 */
+VkResult hostvk_wait_and_reset_fence(HVkDevice* hd, VkFence fence, uint64_t timeout_ns);
+
+/* ----------------------------------------------
+ * guest 队列提交与 GPU 计时（host_submit.c）
+ * ---------------------------------------------- */
+
+#define HVK_SUBMIT_SLOTS 8
+
+/*
+ * slot 是计时槽（< HVK_SUBMIT_SLOTS），上一次用它的提交完成前不能再用；持有 queue_lock。
+ * cb 是夹在计时命令缓冲中间的工作，可以为 VK_NULL_HANDLE。
+ */
+VkResult hostvk_queue_submit(HVkDevice* hd, uint32_t slot, VkCommandBuffer cb, VkFence fence);
+/* fence 完成后取这次提交占用的 GPU 时间；队列不支持时间戳返回 -1 */
+int      hostvk_submit_gpu_time(HVkDevice* hd, uint32_t slot, uint64_t* out_ns);
+void     hostvk_submit_destroy(HVkDevice* hd);
+
+/* ----------------------------------------------
+ * 分块流式传输（host_stream.c）
+ * ---------------------------------------------- */
+
+/* 每个分块进 staging 环的一个槽并提交一次 vkCmdCopyBuffer；槽不够时等最旧的一个 */
+VkResult hostvk_stream_write(HVkMemory* hm, VkDeviceSize offset, const void* data, VkDeviceSize size);
+VkResult hostvk_stream_read(HVkMemory* hm, VkDeviceSize offset, void* out, VkDeviceSize size);
+/* 等设备上所有在途的流式拷贝完成；guest 之后的 GPU 工作依赖这些数据 */
+void     hostvk_stream_drain(HVkDevice* hd);
+void     hostvk_stream_release_memory(HVkMemory* hm);
+/* 释放 staging 环的槽（上下文休眠），下次传输时重建 */
+void     hostvk_stream_trim(HVkDevice* hd);
+/* 覆盖整段分配的 buffer（transfer + storage），换出时随 memory 一起释放 */
+VkResult hostvk_memory_buffer(HVkMemory* hm, VkBuffer* out);
+void     hostvk_stream_destroy(HVkDevice* hd);
+
+/* ----------------------------------------------
+ * compute 调度模板（host_template.c）
+ * ---------------------------------------------- */
+
+#define HVK_TEMPLATE_SLOTS 4   // 同一模板同时在途的调用数
+
+typedef struct {
+    HVkMemory*   hm;           // 调用者已经 acquire，不会被换出
+    VkDeviceSize offset;
+    VkDeviceSize range;
+} HVkTemplateBinding;
+
+/* 一次调用的完整参数 */
+typedef struct {
+    const HVkTemplateBinding* bindings;   // 模板的 binding_count 个
+    const uint8_t*            push;       // 模板的 push_size 字节
+    uint32_t                  group_count[3];
+} HVkTemplateArgs;
+
+/* 建 shader module、布局和槽，不编译 pipeline；SPIR-V 不合法在这里就报错 */
+VkResult hostvk_template_create(HVkDevice* hd, const uint32_t* code, size_t code_size,
+                                uint32_t binding_count, uint32_t push_size, HVkTemplate** out);
+/*
+ * 编译 pipeline（慢，可以在任意线程做），prepare 之前必须完成；
+ * 与同一模板的其他调用不能并发
+ */
+VkResult hostvk_template_compile(HVkTemplate* t);
+/* 调用者保证已经没有在途的调用 */
+void     hostvk_template_destroy(HVkTemplate* t);
+/*
+ * 取一个空闲槽，参数和槽里录好的不一样才重写描述符、重录命令缓冲；
+ * 槽都在途时等一个被 retire。返回的命令缓冲在 retire 之前不会再被改。
+ */
+VkResult hostvk_template_prepare(HVkTemplate* t, const HVkTemplateArgs* args,
+                                 uint32_t* out_slot, VkCommandBuffer* out_cb);
+void     hostvk_template_retire(HVkTemplate* t, uint32_t slot);
+
+/* ----------------------------------------------
+ * 无头 swapchain（host_present.c）
+ * ---------------------------------------------- */
+
+/* 只支持每像素 4 字节的 RGBA / BGRA 格式 */
+int      hostvk_swapchain_format_supported(VkFormat format);
+VkResult hostvk_create_swapchain(HVkDevice* hd, uint32_t width, uint32_t height, VkFormat format,
+                                 VkImageUsageFlags usage, uint32_t image_count, HVkSwapchain** out);
+void     hostvk_destroy_swapchain(HVkSwapchain* sc);
+/* 把图像整张拷进常驻映射的读回 buffer，返回紧密排列的像素（每行 width * 4 字节） */
+VkResult hostvk_swapchain_readback(HVkSwapchain* sc, uint32_t index, const uint8_t** out_pixels);
@@ -0,0 +1,84 @@
+// vgpu_arena.c
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vgpu_arena.h"
+
+#define LOG(...) printf("[arena] " __VA_ARGS__)
+
+/* 主块最多放大到这么大，更大的命令一直走溢出块（稀少：大块读写本来就少） */
+#define ARENA_MAX_CAP (4u << 20)
+
+struct VgpuArenaChunk {
+    VgpuArenaChunk* next;
+    size_t          pad;     // 让 data 16 字节对齐
+    uint8_t         data[];
+};
+
+void vgpu_arena_init(VgpuArena* a, size_t cap)
+{
+    a->base     = malloc(cap);
+    a->cap      = a->base ? cap : 0;
+    a->used     = 0;
+    a->spilled  = 0;
+    a->overflow = NULL;
+    a->resets = a->overflows = 0;
+}
+
+static void free_overflow(VgpuArena* a)
+{
+    while (a->overflow) {
+        VgpuArenaChunk* c = a->overflow;
+        a->overflow = c->next;
+        free(c);
+    }
+}
+
+void vgpu_arena_destroy(VgpuArena* a)
+{
+    free_overflow(a);
+    free(a->base);
+    a->base = NULL;
+    a->cap = a->used = 0;
+}
+
+void* vgpu_arena_alloc(VgpuArena* a, size_t size, size_t align)
+{
+    size_t off = (a->used + align - 1) & ~(align - 1);
+    if (off <= a->cap && size <= a->cap - off) {
+        a->used = off + size;
+        return a->base + off;
+    }
+
+    /* 主块放不下：单独要一块，本轮结束时还掉 */
+    VgpuArenaChunk* c = malloc(sizeof(*c) + size + align);
+    if (!c) return NULL;
+    c->next = a->overflow;
+    a->overflow = c;
+    a->overflows++;
+    a->spilled += size + align;
+    return (void*)(((uintptr_t)c->data + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void vgpu_arena_reset(VgpuArena* a)
+{
+    a->resets++;
+    if (a->overflow) {
+        free_overflow(a);
+        /* 放大到这一轮的用量，下次同样的命令就不用再溢出 */
+        size_t want = a->cap + a->spilled;
+        if (want > ARENA_MAX_CAP) want = ARENA_MAX_CAP;
+        if (want > a->cap) {
+            uint8_t* p = malloc(want);
+            if (p) {
+                free(a->base);
+                a->base = p;
+                a->cap  = want;
+                LOG("放大到 %zu KB（%llu 次溢出 / %llu 条命令）\n", want >> 10,
+                    (unsigned long long)a->overflows, (unsigned long long)a->resets);
+            }
+        }
+    }
+    a->used    = 0;
+    a->spilled = 0;
+}
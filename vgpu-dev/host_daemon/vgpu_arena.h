@@ -0,0 +1,30 @@
+// vgpu_arena.h
+// 命令解码用的 bump 分配器：每个调度 worker 一块，命令处理函数里解出来的结构、
+// 数组、临时缓冲都从这里分，命令返回后整体复位，不逐个释放。
+// 稳定后一条命令不做任何 malloc/free；某条命令超出容量时临时向系统要一块，
+// 复位时还掉，并把主块放大到见过的峰值（有上限），之后同样大小的命令不再溢出。
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct VgpuArenaChunk VgpuArenaChunk;
+
+typedef struct {
+    uint8_t*        base;
+    size_t          cap;
+    size_t          used;
+    size_t          spilled;    // 本轮溢出块的总大小，复位时按它放大主块
+    VgpuArenaChunk* overflow;   // 主块放不下时的临时块
+    /* 统计 */
+    uint64_t        resets;
+    uint64_t        overflows;
+} VgpuArena;
+
+void  vgpu_arena_init(VgpuArena* a, size_t cap);
+void  vgpu_arena_destroy(VgpuArena* a);
+
+/* align 必须是 2 的幂；只有系统内存耗尽时返回 NULL */
+void* vgpu_arena_alloc(VgpuArena* a, size_t size, size_t align);
+
+/* 本轮分出去的全部作废 */
+void  vgpu_arena_reset(VgpuArena* a);
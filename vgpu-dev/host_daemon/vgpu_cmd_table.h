@@ -0,0 +1,33 @@
+// vgpu_cmd_table.h
+// 由 tools/gen_dispatch.py 生成，不要手改。
+// 只能被 vgpu_daemon.c 包含：处理函数 cmd_xxx 都在那里定义。
+#pragma once
+
+typedef void (*VgpuCmdHandler)(VgpuContext *ctx, VgpuCmd *cmd);
+
+#define VGPU_CMD_TABLE_SIZE 26u
+
+static const VgpuCmdHandler vgpu_cmd_table[VGPU_CMD_TABLE_SIZE] = {
+    [VKVGPU_CMD_CREATE_INSTANCE] = cmd_create_instance,
+    [VKVGPU_CMD_ENUM_PHYSICAL_DEVICES] = cmd_enum_physical_devices,
+    [VKVGPU_CMD_CREATE_DEVICE] = cmd_create_device,
+    [VKVGPU_CMD_DESTROY_CONTEXT] = cmd_destroy_context,
+    [VKVGPU_CMD_DESTROY_DEVICE] = cmd_destroy_device,
+    [VKVGPU_CMD_SYNC] = cmd_sync,
+    [VKVGPU_CMD_GET_MEMORY_PROPERTIES] = cmd_get_memory_properties,
+    [VKVGPU_CMD_ALLOCATE_MEMORY] = cmd_allocate_memory,
+    [VKVGPU_CMD_FREE_MEMORY] = cmd_free_memory,
+    [VKVGPU_CMD_WRITE_MEMORY] = cmd_write_memory,
+    [VKVGPU_CMD_READ_MEMORY] = cmd_read_memory,
+    [VKVGPU_CMD_CREATE_SHARED_REGION] = cmd_create_shared_region,
+    [VKVGPU_CMD_READBACK_MEMORY] = cmd_readback_memory,
+    [VKVGPU_CMD_CREATE_SWAPCHAIN] = cmd_create_swapchain,
+    [VKVGPU_CMD_DESTROY_SWAPCHAIN] = cmd_destroy_swapchain,
+    [VKVGPU_CMD_QUEUE_PRESENT] = cmd_queue_present,
+    [VKVGPU_CMD_CREATE_SYNC_PAGE] = cmd_create_sync_page,
+    [VKVGPU_CMD_DESTROY_SYNC_PAGE] = cmd_destroy_sync_page,
+    [VKVGPU_CMD_QUEUE_SUBMIT] = cmd_queue_submit,
+    [VKVGPU_CMD_CREATE_DISPATCH_TEMPLATE] = cmd_create_dispatch_template,
+    [VKVGPU_CMD_DESTROY_DISPATCH_TEMPLATE] = cmd_destroy_dispatch_template,
+    [VKVGPU_CMD_DISPATCH_TEMPLATE] = cmd_dispatch_template,
+};
@@ -0,0 +1,165 @@
+// vgpu_compile.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "vgpu_compile.h"
+#include "vgpu_qos.h"
+
+#define LOG(...) printf("[compile] " __VA_ARGS__)
+
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE };
+
+struct VgpuCompileJob {
+    VgpuCompileJob* next;       // 排队时所在等级的链表
+    VgpuCompileFn   fn;
+    void*           arg;
+    int             priority;
+    int             state;
+    VkResult        result;
+};
+
+/* 每个等级一条 FIFO */
+typedef struct {
+    VgpuCompileJob* head;
+    VgpuCompileJob* tail;
+} JobQueue;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_work = PTHREAD_COND_INITIALIZER;   // 有任务排队
+static pthread_cond_t  g_done = PTHREAD_COND_INITIALIZER;   // 有任务编完
+static JobQueue        g_queues[VGPU_QOS_COUNT];
+static int             g_started;
+static uint64_t        g_background;   // 编译线程编的
+static uint64_t        g_inline;       // 等的线程自己编的
+
+static void push_locked(VgpuCompileJob* job)
+{
+    JobQueue* q = &g_queues[job->priority];
+    job->next = NULL;
+    if (q->tail) q->tail->next = job;
+    else         q->head = job;
+    q->tail = job;
+}
+
+static VgpuCompileJob* pop_locked(void)
+{
+    for (int p = 0; p < VGPU_QOS_COUNT; p++) {
+        JobQueue* q = &g_queues[p];
+        VgpuCompileJob* job = q->head;
+        if (!job) continue;
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+        return job;
+    }
+    return NULL;
+}
+
+static void unlink_locked(VgpuCompileJob* job)
+{
+    JobQueue* q = &g_queues[job->priority];
+    VgpuCompileJob* prev = NULL;
+    for (VgpuCompileJob* j = q->head; j; prev = j, j = j->next) {
+        if (j != job) continue;
+        if (prev) prev->next = j->next;
+        else      q->head = j->next;
+        if (q->tail == j) q->tail = prev;
+        return;
+    }
+}
+
+/* 锁外执行 fn，回到锁内时记下结果；job 的状态已由调用者置为 RUNNING */
+static void run_locked(VgpuCompileJob* job)
+{
+    pthread_mutex_unlock(&g_lock);
+    VkResult r = job->fn(job->arg);
+    pthread_mutex_lock(&g_lock);
+    job->result = r;
+    job->state  = JOB_DONE;
+    pthread_cond_broadcast(&g_done);
+}
+
+static void* compile_thread(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        VgpuCompileJob* job = pop_locked();
+        if (!job) {
+            pthread_cond_wait(&g_work, &g_lock);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        run_locked(job);
+        g_background++;
+    }
+    return NULL;
+}
+
+int vgpu_compile_start(unsigned nthreads)
+{
+    for (unsigned i = 0; i < nthreads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, compile_thread, NULL) != 0) {
+            perror("[compile] pthread_create");
+            break;
+        }
+        pthread_detach(tid);
+        g_started = 1;
+    }
+    if (!g_started) return -1;
+    LOG("编译池 %u 个线程\n", nthreads);
+    return 0;
+}
+
+VgpuCompileJob* vgpu_compile_submit(VgpuCompileFn fn, void* arg, int priority)
+{
+    if (!g_started) return NULL;
+    VgpuCompileJob* job = calloc(1, sizeof(*job));
+    if (!job) return NULL;
+    if (priority < 0) priority = 0;
+    if (priority >= VGPU_QOS_COUNT) priority = VGPU_QOS_COUNT - 1;
+    job->fn       = fn;
+    job->arg      = arg;
+    job->priority = priority;
+    job->state    = JOB_QUEUED;
+
+    pthread_mutex_lock(&g_lock);
+    push_locked(job);
+    pthread_cond_signal(&g_work);
+    pthread_mutex_unlock(&g_lock);
+    return job;
+}
+
+VkResult vgpu_compile_wait(VgpuCompileJob* job)
+{
+    pthread_mutex_lock(&g_lock);
+    /* 还没轮到：排在前面的任务没人在等，不如自己编 */
+    if (job->state == JOB_QUEUED) {
+        unlink_locked(job);
+        job->state = JOB_RUNNING;
+        run_locked(job);
+        if ((++g_inline & 63) == 1)
+            LOG("后台编完 %llu 个，等不及当场编 %llu 个\n",
+                (unsigned long long)g_background, (unsigned long long)g_inline);
+    }
+    while (job->state != JOB_DONE)
+        pthread_cond_wait(&g_done, &g_lock);
+    VkResult r = job->result;
+    pthread_mutex_unlock(&g_lock);
+    return r;
+}
+
+void vgpu_compile_release(VgpuCompileJob* job)
+{
+    if (!job) return;
+    pthread_mutex_lock(&g_lock);
+    if (job->state == JOB_QUEUED) {
+        unlink_locked(job);
+    } else {
+        while (job->state != JOB_DONE)
+            pthread_cond_wait(&g_done, &g_lock);
+    }
+    pthread_mutex_unlock(&g_lock);
+    free(job);
+}
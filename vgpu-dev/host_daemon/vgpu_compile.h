@@ -0,0 +1,24 @@
+// vgpu_compile.h
+// 后台编译池：pipeline 编译一次几十毫秒到几秒，放在上下文 worker 里做会卡住同一 worker 上
+// 其他 VM 的命令。创建命令只登记一个编译任务就回包，第一次真正用到 pipeline 时才等它。
+// 任务按 guest 的 QoS 等级排队（interactive 先编），同级先来先编；
+// 有人在等、还没开始编的任务不再排队，由等的线程当场编。
+#pragma once
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+typedef struct VgpuCompileJob VgpuCompileJob;
+typedef VkResult (*VgpuCompileFn)(void* arg);
+
+/* 启动 nthreads 个编译线程；没启动时 submit 返回 NULL，调用者自己同步编 */
+int             vgpu_compile_start(unsigned nthreads);
+
+/* 登记一个任务，priority 是 VgpuQosClass；只在池没启动或内存不够时返回 NULL */
+VgpuCompileJob* vgpu_compile_submit(VgpuCompileFn fn, void* arg, int priority);
+
+/* 等任务完成，返回 fn 的结果；还在排队的在调用线程里当场执行。可以重复调用 */
+VkResult        vgpu_compile_wait(VgpuCompileJob* job);
+
+/* 不再需要这个任务：还在排队的直接撤掉（fn 不会执行），正在编的等它编完，然后释放 job */
+void            vgpu_compile_release(VgpuCompileJob* job);
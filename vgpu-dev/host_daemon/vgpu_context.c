@@ -0,0 +1,865 @@
+// vgpu_context.c
+#define _GNU_SOURCE
+#include "vgpu_context.h"
+#include "vgpu_arena.h"
+#include "../guest_icd/vk_virtio_spin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define LOG(...) printf("[ctx] " __VA_ARGS__)
+
+#define VGPU_CTX_BUCKETS    256
+#define VGPU_SCHED_QUANTUM  (64 * 1024)   // 每轮每个上下文可执行的字节数
+#define VGPU_ARENA_SIZE     (256 * 1024)  // 每个 worker 的解码 arena 初始大小
+
+/*
+ * 信用窗口 = 服务速率 × 目标排队时延：guest 在 daemon 里积压的命令大约这么久能执行完。
+ * 下限要装得下一条最大的命令，上限限制单条连接能占的 daemon 内存。
+ */
+#define VGPU_CREDIT_TARGET_NS  (20ull * 1000000ull)
+#define VGPU_CREDIT_SAMPLE_NS  (50ull * 1000000ull)
+#define VGPU_CREDIT_MIN_BYTES  (2ull * 1024 * 1024)
+#define VGPU_CREDIT_MAX_BYTES  (64ull * 1024 * 1024)
+#define VGPU_CREDIT_MIN_CMDS   32ull
+#define VGPU_CREDIT_MAX_CMDS   4096ull
+
+/* ============================================================
+ *                           连接
+ * ============================================================ */
+
+/* 按进程统计存活连接数：进程的最后一条连接断开时回收它的上下文 */
+typedef struct PidRef {
+    pid_t          pid;
+    uint32_t       conns;
+    struct PidRef* next;
+} PidRef;
+
+static pthread_mutex_t g_ctx_lock = PTHREAD_MUTEX_INITIALIZER;  // 注册表 + PidRef
+static VgpuContext*    g_ctx_hash[VGPU_CTX_BUCKETS];
+static uint32_t        g_next_ctx_id = 1;
+static PidRef*         g_pids = NULL;
+
+static PidRef* pid_find_locked(pid_t pid)
+{
+    PidRef* pr = g_pids;
+    while (pr && pr->pid != pid) pr = pr->next;
+    return pr;
+}
+
+VgpuConn* vgpu_conn_open(int fd)
+{
+    VgpuConn* conn = calloc(1, sizeof(*conn));
+    if (!conn) return NULL;
+
+    conn->fd   = fd;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->write_lock, NULL);
+    pthread_mutex_init(&conn->credit_lock, NULL);
+    pthread_cond_init(&conn->credit_cond, NULL);
+    conn->window_bytes = conn->grant_bytes = VKVGPU_CREDIT_INIT_BYTES;
+    conn->window_cmds  = conn->grant_cmds  = VKVGPU_CREDIT_INIT_CMDS;
+
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+        conn->peer_pid = cred.pid;
+
+    pthread_mutex_lock(&g_ctx_lock);
+    PidRef* pr = pid_find_locked(conn->peer_pid);
+    if (!pr) {
+        pr = calloc(1, sizeof(*pr));
+        if (pr) {
+            pr->pid  = conn->peer_pid;
+            pr->next = g_pids;
+            g_pids   = pr;
+        }
+    }
+    if (pr) pr->conns++;
+    pthread_mutex_unlock(&g_ctx_lock);
+
+    return conn;
+}
+
+void vgpu_conn_get(VgpuConn* conn)
+{
+    __atomic_add_fetch(&conn->refs, 1, __ATOMIC_RELAXED);
+}
+
+void vgpu_conn_put(VgpuConn* conn)
+{
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->write_lock);
+    pthread_mutex_destroy(&conn->credit_lock);
+    pthread_cond_destroy(&conn->credit_cond);
+    free(conn);
+}
+
+/* 收集 pid 名下至多 max 个上下文；pid 又有了新连接（pid 被复用）就不再回收 */
+static uint32_t collect_victims(pid_t pid, uint32_t* victims, uint32_t max)
+{
+    uint32_t n = 0;
+    pthread_mutex_lock(&g_ctx_lock);
+    if (!pid_find_locked(pid)) {
+        for (int b = 0; b < VGPU_CTX_BUCKETS && n < max; b++)
+            for (VgpuContext* c = g_ctx_hash[b]; c && n < max; c = c->next_hash)
+                if (c->owner_pid == pid)
+                    victims[n++] = c->id;
+    }
+    pthread_mutex_unlock(&g_ctx_lock);
+    return n;
+}
+
+void vgpu_conn_closed(VgpuConn* conn)
+{
+    int last = 0;
+
+    pthread_mutex_lock(&g_ctx_lock);
+    PidRef** pp = &g_pids;
+    while (*pp && (*pp)->pid != conn->peer_pid) pp = &(*pp)->next;
+    if (*pp && --(*pp)->conns == 0) {
+        PidRef* dead = *pp;
+        *pp = dead->next;
+        free(dead);
+        last = 1;
+    }
+    pthread_mutex_unlock(&g_ctx_lock);
+
+    pthread_mutex_lock(&conn->credit_lock);
+    LOG("pid %d 连接关闭：信用窗口 %llu KB / %llu 条，服务速率 %.1f MB/s\n",
+        (int)conn->peer_pid, (unsigned long long)(conn->window_bytes >> 10),
+        (unsigned long long)conn->window_cmds, conn->rate_bytes / (1024.0 * 1024.0));
+    pthread_mutex_unlock(&conn->credit_lock);
+
+    /* 一批批回收，destroy 会把上下文摘出注册表，直到一个不剩 */
+    while (last) {
+        uint32_t victims[64];
+        uint32_t nvictims = collect_victims(conn->peer_pid, victims, 64);
+        if (!nvictims) break;
+        for (uint32_t i = 0; i < nvictims; i++) {
+            LOG("pid %d 已断开，回收 ctx=%u\n", (int)conn->peer_pid, victims[i]);
+            vgpu_ctx_destroy(victims[i]);
+        }
+    }
+}
+
+/* ------------------------------------------------------------
+ * 信用流控
+ * ------------------------------------------------------------ */
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t clamp_u64(double v, uint64_t lo, uint64_t hi)
+{
+    if (v <= (double)lo) return lo;
+    if (v >= (double)hi) return hi;
+    return (uint64_t)v;
+}
+
+/* 计数变化前调用：上一段有命令在途就计入服务时间 */
+static void credit_tick_locked(VgpuConn* conn, uint64_t now)
+{
+    if (conn->recv_cmds != conn->done_cmds)
+        conn->sample_ns += now - conn->last_event_ns;
+    conn->last_event_ns = now;
+}
+
+/* 攒够一段服务时间就更新速率和窗口 */
+static void credit_resize_locked(VgpuConn* conn)
+{
+    if (conn->sample_ns < VGPU_CREDIT_SAMPLE_NS) return;
+
+    double secs  = (double)conn->sample_ns / 1e9;
+    double bytes = (double)conn->sample_bytes / secs;
+    double cmds  = (double)conn->sample_cmds / secs;
+    conn->rate_bytes = conn->rate_bytes > 0 ? (conn->rate_bytes * 3 + bytes) / 4 : bytes;
+    conn->rate_cmds  = conn->rate_cmds  > 0 ? (conn->rate_cmds  * 3 + cmds)  / 4 : cmds;
+    conn->sample_ns = conn->sample_bytes = conn->sample_cmds = 0;
+
+    double target = (double)VGPU_CREDIT_TARGET_NS / 1e9;
+    conn->window_bytes = clamp_u64(conn->rate_bytes * target,
+                                   VGPU_CREDIT_MIN_BYTES, VGPU_CREDIT_MAX_BYTES);
+    conn->window_cmds  = clamp_u64(conn->rate_cmds * target,
+                                   VGPU_CREDIT_MIN_CMDS, VGPU_CREDIT_MAX_CMDS);
+}
+
+/* 当前上限；给出去的上限不收回，窗口缩小只是暂时不再涨 */
+static void credit_limit_locked(VgpuConn* conn, uint64_t* bytes, uint64_t* cmds)
+{
+    if (conn->done_bytes + conn->window_bytes > conn->grant_bytes)
+        conn->grant_bytes = conn->done_bytes + conn->window_bytes;
+    if (conn->done_cmds + conn->window_cmds > conn->grant_cmds)
+        conn->grant_cmds = conn->done_cmds + conn->window_cmds;
+    *bytes = conn->grant_bytes;
+    *cmds  = conn->grant_cmds;
+}
+
+void vgpu_conn_credit_wait(VgpuConn* conn, uint64_t bytes, uint64_t cmds)
+{
+    /* 没有命令在途时至少能放进最小窗口，要求更多也只等到这么多 */
+    if (bytes > VGPU_CREDIT_MIN_BYTES) bytes = VGPU_CREDIT_MIN_BYTES;
+    if (cmds > VGPU_CREDIT_MIN_CMDS)   cmds  = VGPU_CREDIT_MIN_CMDS;
+
+    pthread_mutex_lock(&conn->credit_lock);
+    for (;;) {
+        uint64_t lim_bytes, lim_cmds;
+        credit_limit_locked(conn, &lim_bytes, &lim_cmds);
+        if (conn->recv_bytes + bytes <= lim_bytes && conn->recv_cmds + cmds <= lim_cmds)
+            break;
+        pthread_cond_wait(&conn->credit_cond, &conn->credit_lock);
+    }
+    pthread_mutex_unlock(&conn->credit_lock);
+}
+
+static void credit_recv(VgpuConn* conn, uint64_t cost)
+{
+    pthread_mutex_lock(&conn->credit_lock);
+    credit_tick_locked(conn, monotonic_ns());
+    conn->recv_bytes += cost;
+    conn->recv_cmds++;
+    pthread_mutex_unlock(&conn->credit_lock);
+}
+
+static void credit_done(VgpuConn* conn, uint64_t cost)
+{
+    pthread_mutex_lock(&conn->credit_lock);
+    credit_tick_locked(conn, monotonic_ns());
+    conn->done_bytes += cost;
+    conn->done_cmds++;
+    conn->sample_bytes += cost;
+    conn->sample_cmds++;
+    credit_resize_locked(conn);
+    pthread_cond_broadcast(&conn->credit_cond);
+    pthread_mutex_unlock(&conn->credit_lock);
+}
+
+/* pass_fd >= 0 时随第一段数据用 SCM_RIGHTS 一起发出 */
+static int conn_send_reply(VgpuConn* conn, uint32_t ctx_id, int32_t status,
+                           int32_t deferred_status,
+                           const void* payload, uint32_t payload_size, int pass_fd)
+{
+    VkvgpuReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.status          = status;
+    reply.payload_size    = payload_size;
+    reply.ctx_id          = ctx_id;
+    reply.deferred_status = deferred_status;
+
+    pthread_mutex_lock(&conn->credit_lock);
+    credit_limit_locked(conn, &reply.credit_bytes, &reply.credit_cmds);
+    pthread_mutex_unlock(&conn->credit_lock);
+
+    struct iovec iov[2] = {
+        { .iov_base = &reply,          .iov_len = sizeof(reply) },
+        { .iov_base = (void*)payload,  .iov_len = payload_size  },
+    };
+    struct iovec* v = iov;
+    int cnt = payload_size ? 2 : 1;
+    int rc = 0;
+
+    union {
+        char           buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+
+    pthread_mutex_lock(&conn->write_lock);
+    while (cnt > 0) {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov    = v;
+        mh.msg_iovlen = cnt;
+
+        if (pass_fd >= 0) {
+            memset(&ctrl, 0, sizeof(ctrl));
+            mh.msg_control    = ctrl.buf;
+            mh.msg_controllen = sizeof(ctrl.buf);
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type  = SCM_RIGHTS;
+            cm->cmsg_len   = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cm), &pass_fd, sizeof(int));
+        }
+
+        ssize_t n = sendmsg(conn->fd, &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[ctx] send");
+            rc = -1;
+            break;
+        }
+        pass_fd = -1;   // 已经随第一个字节发出去了
+        while (n > 0 && cnt > 0) {
+            if ((size_t)n >= v->iov_len) {
+                n -= (ssize_t)v->iov_len;
+                v++;
+                cnt--;
+            } else {
+                v->iov_base = (char*)v->iov_base + n;
+                v->iov_len -= (size_t)n;
+                n = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&conn->write_lock);
+    return rc;
+}
+
+int vgpu_conn_reply(VgpuConn* conn, uint32_t ctx_id, int32_t status,
+                    const void* payload, uint32_t payload_size)
+{
+    return conn_send_reply(conn, ctx_id, status, 0, payload, payload_size, -1);
+}
+
+/* ============================================================
+ *                           命令
+ * ============================================================ */
+
+/* 调度额度和信用都按这个算，和 guest 那边的计数一致 */
+static int64_t cmd_cost(const VgpuCmd* cmd)
+{
+    return (int64_t)sizeof(VkvgpuHeader) + cmd->hdr.payload_size;
+}
+
+VgpuCmd* vgpu_cmd_alloc(VgpuConn* conn, const VkvgpuHeader* hdr)
+{
+    VgpuCmd* cmd = malloc(sizeof(*cmd) + hdr->payload_size);
+    if (!cmd) return NULL;
+    cmd->next = NULL;
+    cmd->conn = conn;
+    cmd->hdr  = *hdr;
+    vgpu_conn_get(conn);
+    if (hdr->ctx_id != VKVGPU_CTX_NONE)
+        credit_recv(conn, cmd_cost(cmd));
+    return cmd;
+}
+
+/* 每个 worker 一块，执行命令期间有效 */
+static __thread VgpuArena* t_arena;
+
+void* vgpu_cmd_scratch(size_t size)
+{
+    return vgpu_arena_alloc(t_arena, size, 16);
+}
+
+const void* vgpu_cmd_view(VgpuCmd* cmd, size_t off, size_t size, size_t align)
+{
+    if (off > cmd->hdr.payload_size || size > cmd->hdr.payload_size - off) return NULL;
+    const uint8_t* p = cmd->payload + off;
+    if (((uintptr_t)p & (align - 1)) == 0) return p;
+
+    void* copy = vgpu_cmd_scratch(size);
+    if (copy) memcpy(copy, p, size);
+    return copy;
+}
+
+void vgpu_cmd_free(VgpuCmd* cmd)
+{
+    if (!cmd) return;
+    if (cmd->hdr.ctx_id != VKVGPU_CTX_NONE)
+        credit_done(cmd->conn, cmd_cost(cmd));
+    vgpu_conn_put(cmd->conn);
+    free(cmd);
+}
+
+/* ============================================================
+ *                        guest 对象表
+ * ============================================================ */
+
+static VgpuObjDestroyFn g_obj_destroy[VGPU_OBJ_TYPE_COUNT];
+
+void vgpu_obj_register_type(VgpuObjType type, VgpuObjDestroyFn destroy)
+{
+    g_obj_destroy[type] = destroy;
+}
+
+static uint32_t obj_hash(VkvgpuHandle id, uint32_t cap)
+{
+    return (uint32_t)((id * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+static int obj_rehash(VgpuContext* ctx, uint32_t new_cap)
+{
+    VgpuObjEntry* n = calloc(new_cap, sizeof(*n));
+    if (!n) return -1;
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < ctx->obj_cap; i++) {
+        VgpuObjEntry* e = &ctx->objs[i];
+        if (e->id == 0 || e->type == VGPU_OBJ_NONE) continue;
+        uint32_t j = obj_hash(e->id, new_cap);
+        while (n[j].id != 0) j = (j + 1) & (new_cap - 1);
+        n[j] = *e;
+        used++;
+    }
+    free(ctx->objs);
+    ctx->objs     = n;
+    ctx->obj_cap  = new_cap;
+    ctx->obj_used = used;
+    return 0;
+}
+
+static VgpuObjEntry* obj_find(VgpuContext* ctx, VkvgpuHandle id)
+{
+    if (!ctx->objs || id == 0) return NULL;
+    uint32_t i = obj_hash(id, ctx->obj_cap);
+    while (ctx->objs[i].id != 0) {
+        if (ctx->objs[i].id == id && ctx->objs[i].type != VGPU_OBJ_NONE)
+            return &ctx->objs[i];
+        i = (i + 1) & (ctx->obj_cap - 1);
+    }
+    return NULL;
+}
+
+int vgpu_ctx_obj_insert(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type, void* obj)
+{
+    if (id == 0 || obj_find(ctx, id)) return -1;   // guest 重复使用了 ID
+
+    if ((ctx->obj_used + 1) * 2 > ctx->obj_cap) {
+        /* 删除槽太多时原地重建，否则翻倍 */
+        uint32_t cap = ctx->obj_cap ? ctx->obj_cap : 64;
+        if ((ctx->obj_live + 1) * 4 > cap) cap *= 2;
+        if (obj_rehash(ctx, cap) != 0) return -1;
+    }
+
+    uint32_t i = obj_hash(id, ctx->obj_cap);
+    while (ctx->objs[i].id != 0 && ctx->objs[i].type != VGPU_OBJ_NONE)
+        i = (i + 1) & (ctx->obj_cap - 1);
+    if (ctx->objs[i].id == 0) ctx->obj_used++;
+    ctx->obj_live++;
+
+    ctx->objs[i].id   = id;
+    ctx->objs[i].type = type;
+    ctx->objs[i].obj  = obj;
+    return 0;
+}
+
+void* vgpu_ctx_obj_lookup(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type)
+{
+    VgpuObjEntry* e = obj_find(ctx, id);
+    return (e && e->type == (uint32_t)type) ? e->obj : NULL;
+}
+
+void* vgpu_ctx_obj_remove(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type)
+{
+    VgpuObjEntry* e = obj_find(ctx, id);
+    if (!e || e->type != (uint32_t)type) return NULL;
+    void* obj = e->obj;
+    e->type = VGPU_OBJ_NONE;   // 留作删除标记，id 不清零
+    e->obj  = NULL;
+    ctx->obj_live--;
+    return obj;
+}
+
+void vgpu_ctx_obj_foreach(VgpuContext* ctx, VgpuObjType type,
+                          void (*fn)(void* obj, void* arg), void* arg)
+{
+    for (uint32_t i = 0; i < ctx->obj_cap; i++) {
+        VgpuObjEntry* e = &ctx->objs[i];
+        if (e->id != 0 && e->type == (uint32_t)type) fn(e->obj, arg);
+    }
+}
+
+/* 上下文释放：子对象先于父对象销毁 */
+static void obj_destroy_all(VgpuContext* ctx)
+{
+    for (int t = VGPU_OBJ_TYPE_COUNT - 1; t > VGPU_OBJ_NONE; t--) {
+        for (uint32_t i = 0; i < ctx->obj_cap; i++) {
+            VgpuObjEntry* e = &ctx->objs[i];
+            if (e->id == 0 || e->type != (uint32_t)t) continue;
+            if (g_obj_destroy[t]) g_obj_destroy[t](e->obj);
+            e->type = VGPU_OBJ_NONE;
+        }
+    }
+    free(ctx->objs);
+    ctx->objs = NULL;
+    ctx->obj_cap = ctx->obj_used = ctx->obj_live = 0;
+}
+
+/* ============================================================
+ *                          上下文
+ * ============================================================ */
+
+static pthread_mutex_t g_sched_lock = PTHREAD_MUTEX_INITIALIZER;  // 所有队列 + run queue
+static pthread_cond_t  g_sched_cond = PTHREAD_COND_INITIALIZER;
+static VgpuContext*    g_runq_head = NULL;
+static VgpuContext*    g_runq_tail = NULL;
+static VgpuExecFn      g_exec = NULL;
+
+/*
+ * 空闲 worker 里至多一个先忙等新命令（VGPU_SPIN_US 设上限，0 关闭）：
+ * 命令一条接一条来的时候省掉条件变量的唤醒延迟，真正空闲时很快退回阻塞。
+ * 下面几个都在 g_sched_lock 下访问。
+ */
+static VkvgpuSpin      g_idle_spin;
+static int             g_spinning = 0;
+static uint64_t        g_idle_since = 0;    // run queue 变空的时刻，0 = 不空
+
+/* 空闲上下文回调（休眠），g_idle_fn 为 NULL 时不检查 */
+static uint64_t        g_ctx_idle_ns = 0;
+static VgpuIdleFn      g_idle_fn = NULL;
+
+VgpuContext* vgpu_ctx_create(pid_t owner_pid)
+{
+    VgpuContext* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) return NULL;
+
+    ctx->owner_pid = owner_pid;
+    ctx->qos       = vgpu_qos_class_of(owner_pid);
+    ctx->refs      = 2;   // 注册表一份，调用者一份
+    ctx->next_seq  = 1;
+    ctx->last_cmd_ns = monotonic_ns();
+
+    pthread_mutex_lock(&g_ctx_lock);
+    ctx->id = g_next_ctx_id++;
+    if (g_next_ctx_id == VKVGPU_CTX_NONE) g_next_ctx_id = 1;
+    uint32_t b = ctx->id % VGPU_CTX_BUCKETS;
+    ctx->next_hash = g_ctx_hash[b];
+    g_ctx_hash[b]  = ctx;
+    pthread_mutex_unlock(&g_ctx_lock);
+
+    LOG("create ctx=%u owner pid=%d qos=%s\n", ctx->id, (int)owner_pid,
+        vgpu_qos_name(ctx->qos));
+    return ctx;
+}
+
+VgpuContext* vgpu_ctx_get(uint32_t id)
+{
+    pthread_mutex_lock(&g_ctx_lock);
+    VgpuContext* ctx = g_ctx_hash[id % VGPU_CTX_BUCKETS];
+    while (ctx && ctx->id != id) ctx = ctx->next_hash;
+    if (ctx) __atomic_add_fetch(&ctx->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_ctx_lock);
+    return ctx;
+}
+
+void vgpu_ctx_put(VgpuContext* ctx)
+{
+    if (__atomic_sub_fetch(&ctx->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    /* 不在 run queue 上才会走到这里，队列里剩下的命令直接丢弃 */
+    VgpuCmd* lists[2] = { ctx->head, ctx->held };
+    for (int i = 0; i < 2; i++) {
+        VgpuCmd* cmd = lists[i];
+        while (cmd) {
+            VgpuCmd* next = cmd->next;
+            vgpu_cmd_free(cmd);
+            cmd = next;
+        }
+    }
+    obj_destroy_all(ctx);
+    LOG("free ctx=%u\n", ctx->id);
+    free(ctx);
+}
+
+void vgpu_ctx_destroy(uint32_t id)
+{
+    VgpuContext* ctx = NULL;
+
+    pthread_mutex_lock(&g_ctx_lock);
+    VgpuContext** pp = &g_ctx_hash[id % VGPU_CTX_BUCKETS];
+    while (*pp && (*pp)->id != id) pp = &(*pp)->next_hash;
+    if (*pp) {
+        ctx = *pp;
+        *pp = ctx->next_hash;
+    }
+    pthread_mutex_unlock(&g_ctx_lock);
+
+    if (!ctx) return;
+    __atomic_store_n(&ctx->dead, 1, __ATOMIC_RELEASE);
+    vgpu_ctx_put(ctx);
+}
+
+/* 调用者持有 g_sched_lock */
+static void runq_push(VgpuContext* ctx)
+{
+    ctx->on_runq  = 1;
+    ctx->next_run = NULL;
+    if (g_runq_tail) g_runq_tail->next_run = ctx;
+    else             __atomic_store_n(&g_runq_head, ctx, __ATOMIC_RELEASE);  // 自旋的 worker 不持锁读
+    g_runq_tail = ctx;
+
+    /* 空闲间隔计入自旋统计，窗口随命令到达的疏密调整 */
+    if (g_idle_since) {
+        uint64_t gap = monotonic_ns() - g_idle_since;
+        g_idle_since = 0;
+        vkvgpu_spin_record(&g_idle_spin, gap,
+                           g_spinning ? (gap < g_idle_spin.spin_ns ? gap : g_idle_spin.spin_ns) : 0,
+                           g_spinning);
+        if ((g_idle_spin.waits & 0xffff) == 0)
+            LOG("worker idle: %llu waits, %llu spin hits, avg gap %llu us\n",
+                (unsigned long long)g_idle_spin.waits, (unsigned long long)g_idle_spin.spin_hits,
+                (unsigned long long)(g_idle_spin.avg_ns / 1000));
+    }
+    /* 有 worker 在自旋就不用叫醒睡着的 */
+    if (!g_spinning) pthread_cond_signal(&g_sched_cond);
+}
+
+int vgpu_ctx_reply(VgpuContext* ctx, VgpuCmd* cmd, int32_t status,
+                   const void* payload, uint32_t payload_size)
+{
+    return vgpu_ctx_reply_fd(ctx, cmd, status, payload, payload_size, -1);
+}
+
+int vgpu_ctx_reply_fd(VgpuContext* ctx, VgpuCmd* cmd, int32_t status,
+                      const void* payload, uint32_t payload_size, int pass_fd)
+{
+    if (vgpu_cmd_is_async(cmd)) {
+        if (status != 0 && ctx->deferred_status == 0) {
+            LOG("ctx=%u async cmd=%u failed status=%d, deferred\n",
+                ctx->id, VKVGPU_CMD_ID(cmd->hdr.cmd), status);
+            ctx->deferred_status = status;
+        }
+        return 0;
+    }
+
+    int32_t deferred = ctx->deferred_status;
+    ctx->deferred_status = 0;
+    return conn_send_reply(cmd->conn, ctx->id, status, deferred,
+                           payload, payload_size, status == 0 ? pass_fd : -1);
+}
+
+/* 序号比较，考虑回绕 */
+static int seq_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static void seq_advance(VgpuContext* ctx)
+{
+    if (++ctx->next_seq == 0) ctx->next_seq = 1;
+}
+
+static void queue_append_locked(VgpuContext* ctx, VgpuCmd* cmd)
+{
+    cmd->next = NULL;
+    if (ctx->tail) ctx->tail->next = cmd;
+    else           ctx->head = cmd;
+    ctx->tail = cmd;
+}
+
+/* 先到的命令按序号插进扣留链表；同一通道的命令序号递增，多数直接接在尾上 */
+static void held_insert_locked(VgpuContext* ctx, VgpuCmd* cmd)
+{
+    uint32_t seq = cmd->hdr.seq;
+    if (!ctx->held_tail || seq_before(ctx->held_tail->hdr.seq, seq)) {
+        cmd->next = NULL;
+        if (ctx->held_tail) ctx->held_tail->next = cmd;
+        else                ctx->held = cmd;
+        ctx->held_tail = cmd;
+        return;
+    }
+    VgpuCmd** pp = &ctx->held;
+    while (seq_before((*pp)->hdr.seq, seq)) pp = &(*pp)->next;
+    cmd->next = *pp;
+    *pp = cmd;
+}
+
+/* 按序号该执行的命令移进执行队列，接着把扣留链表里接得上的也移过去 */
+static void seq_accept_locked(VgpuContext* ctx, VgpuCmd* cmd)
+{
+    uint32_t seq = cmd->hdr.seq;
+    if (seq && seq != ctx->next_seq) {
+        if (seq_before(ctx->next_seq, seq)) {
+            held_insert_locked(ctx, cmd);
+            return;
+        }
+        /* 已经过去的序号：guest 不守协议，只保证它自己还能执行 */
+        LOG("ctx=%u stale seq %u (expect %u)\n", ctx->id, seq, ctx->next_seq);
+    }
+    queue_append_locked(ctx, cmd);
+    if (seq == ctx->next_seq) seq_advance(ctx);
+
+    /* 重复的序号也一并放出去，不让它堵住后面的 */
+    while (ctx->held && !seq_before(ctx->next_seq, ctx->held->hdr.seq)) {
+        VgpuCmd* next = ctx->held;
+        ctx->held = next->next;
+        if (!ctx->held) ctx->held_tail = NULL;
+        queue_append_locked(ctx, next);
+        if (next->hdr.seq == ctx->next_seq) seq_advance(ctx);
+    }
+}
+
+void vgpu_ctx_submit(VgpuContext* ctx, VgpuCmd* cmd)
+{
+    pthread_mutex_lock(&g_sched_lock);
+    seq_accept_locked(ctx, cmd);
+    ctx->last_cmd_ns = monotonic_ns();
+    if (!ctx->head) {
+        pthread_mutex_unlock(&g_sched_lock);
+        return;
+    }
+
+    if (!ctx->on_runq && !ctx->running) {
+        __atomic_add_fetch(&ctx->refs, 1, __ATOMIC_RELAXED);  // run queue 持有
+        runq_push(ctx);
+    }
+    pthread_mutex_unlock(&g_sched_lock);
+}
+
+/* ============================================================
+ *                        调度 worker
+ * ============================================================ */
+
+/* 调用者持有 g_sched_lock；自旋期间放开锁，返回时重新持有 */
+static void worker_spin_locked(void)
+{
+    uint64_t budget = g_idle_spin.spin_ns;
+    g_spinning = 1;
+    pthread_mutex_unlock(&g_sched_lock);
+
+    uint64_t start = monotonic_ns();
+    while (!__atomic_load_n(&g_runq_head, __ATOMIC_ACQUIRE) && monotonic_ns() - start < budget)
+        vkvgpu_cpu_relax();
+
+    pthread_mutex_lock(&g_sched_lock);
+    g_spinning = 0;
+}
+
+static void* sched_worker(void* arg)
+{
+    (void)arg;
+    VgpuArena arena;
+    vgpu_arena_init(&arena, VGPU_ARENA_SIZE);
+    t_arena = &arena;
+
+    pthread_mutex_lock(&g_sched_lock);
+    for (;;) {
+        int spun = 0;
+        while (!g_runq_head) {
+            if (!g_idle_since) g_idle_since = monotonic_ns();
+            if (!spun && !g_spinning && g_idle_spin.spin_ns) {
+                worker_spin_locked();
+                spun = 1;
+                continue;
+            }
+            pthread_cond_wait(&g_sched_cond, &g_sched_lock);
+        }
+
+        VgpuContext* ctx = g_runq_head;
+        g_runq_head = ctx->next_run;
+        if (!g_runq_head) g_runq_tail = NULL;
+        /* 自旋期间 runq_push 不叫醒睡着的 worker：还有别的上下文排着，传给下一个 */
+        else              pthread_cond_signal(&g_sched_cond);
+        ctx->on_runq = 0;
+        ctx->running = 1;
+        ctx->deficit += VGPU_SCHED_QUANTUM;
+
+        if (ctx->idle_pending) {
+            ctx->idle_pending = 0;
+            /* 排队期间来了命令就不用了 */
+            if (!ctx->head && !__atomic_load_n(&ctx->dead, __ATOMIC_ACQUIRE)) {
+                pthread_mutex_unlock(&g_sched_lock);
+                g_idle_fn(ctx);
+                vgpu_arena_reset(&arena);
+                pthread_mutex_lock(&g_sched_lock);
+                ctx->hibernated_ns = monotonic_ns();
+            }
+        } else if (ctx->hibernated_ns && ctx->head) {
+            LOG("ctx=%u 空闲 %llu 秒后恢复\n", ctx->id,
+                (unsigned long long)((monotonic_ns() - ctx->hibernated_ns) / 1000000000ull));
+            ctx->hibernated_ns = 0;
+        }
+
+        while (ctx->head && ctx->deficit >= cmd_cost(ctx->head)) {
+            VgpuCmd* cmd = ctx->head;
+            ctx->head = cmd->next;
+            if (!ctx->head) ctx->tail = NULL;
+            ctx->deficit -= cmd_cost(cmd);
+
+            pthread_mutex_unlock(&g_sched_lock);
+            if (__atomic_load_n(&ctx->dead, __ATOMIC_ACQUIRE))
+                vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+            else
+                g_exec(ctx, cmd);
+            vgpu_arena_reset(&arena);
+            vgpu_cmd_free(cmd);
+            pthread_mutex_lock(&g_sched_lock);
+        }
+
+        ctx->running = 0;
+        if (ctx->head) {
+            runq_push(ctx);          // 本轮额度用完，排到队尾，引用随之转移
+        } else {
+            ctx->deficit = 0;        // 空闲上下文不累积额度
+            pthread_mutex_unlock(&g_sched_lock);
+            vgpu_ctx_put(ctx);       // 可能触发 host 对象销毁，不能持锁
+            pthread_mutex_lock(&g_sched_lock);
+        }
+    }
+    return NULL;
+}
+
+/* 定期找出空闲够久的上下文，排进 run queue 让 worker 执行空闲回调 */
+static void* idle_scanner(void* arg)
+{
+    (void)arg;
+    /* 扫描间隔取空闲阈值的四分之一，最多 1 秒 */
+    uint64_t period = g_ctx_idle_ns / 4 < 1000000000ull ? g_ctx_idle_ns / 4 : 1000000000ull;
+    struct timespec ts = { (time_t)(period / 1000000000ull), (long)(period % 1000000000ull) };
+    for (;;) {
+        nanosleep(&ts, NULL);
+        uint64_t now = monotonic_ns();
+
+        /* 锁顺序：注册表在前，调度锁在后 */
+        pthread_mutex_lock(&g_ctx_lock);
+        pthread_mutex_lock(&g_sched_lock);
+        for (int b = 0; b < VGPU_CTX_BUCKETS; b++) {
+            for (VgpuContext* ctx = g_ctx_hash[b]; ctx; ctx = ctx->next_hash) {
+                if (ctx->hibernated_ns || ctx->idle_pending || ctx->on_runq || ctx->running ||
+                    ctx->head || now - ctx->last_cmd_ns < g_ctx_idle_ns)
+                    continue;
+                ctx->idle_pending = 1;
+                __atomic_add_fetch(&ctx->refs, 1, __ATOMIC_RELAXED);  // run queue 持有
+                runq_push(ctx);
+            }
+        }
+        pthread_mutex_unlock(&g_sched_lock);
+        pthread_mutex_unlock(&g_ctx_lock);
+    }
+    return NULL;
+}
+
+void vgpu_sched_set_idle(uint64_t idle_ns, VgpuIdleFn fn)
+{
+    g_ctx_idle_ns = idle_ns;
+    g_idle_fn     = fn;
+}
+
+int vgpu_sched_start(unsigned nworkers, VgpuExecFn exec)
+{
+    g_exec = exec;
+    vkvgpu_spin_init(&g_idle_spin, "VGPU_SPIN_US");
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, sched_worker, NULL) != 0) {
+            perror("[ctx] pthread_create");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    if (g_idle_fn && g_ctx_idle_ns) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, idle_scanner, NULL) != 0) {
+            perror("[ctx] pthread_create");
+            return -1;
+        }
+        pthread_detach(tid);
+        LOG("空闲 %llu 秒的上下文将休眠\n", (unsigned long long)(g_ctx_idle_ns / 1000000000ull));
+    }
+    LOG("scheduler started with %u workers\n", nworkers);
+    return 0;
+}
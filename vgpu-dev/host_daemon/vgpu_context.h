@@ -0,0 +1,188 @@
+// vgpu_context.h
+// 连接与上下文：一条连接可以承载多个 guest 上下文，
+// daemon 按 header.ctx_id 把命令分到各上下文自己的队列，再由 worker 公平调度。
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "../guest_icd/vk_virtio_proto.h"
+#include "vgpu_qos.h"
+
+/* ------------------------------------------------------------
+ * 连接
+ * ------------------------------------------------------------ */
+
+typedef struct VgpuConn {
+    int             fd;
+    pid_t           peer_pid;    // SO_PEERCRED，上下文归属
+    pthread_mutex_t write_lock;  // 多个 worker 可能同时往同一连接回包
+    uint32_t        refs;
+
+    /* 信用流控（见 vk_virtio_proto.h）：计数都是累计值，由 credit_lock 保护 */
+    pthread_mutex_t credit_lock;
+    pthread_cond_t  credit_cond;
+    uint64_t        recv_bytes;      // 已收进上下文队列的命令
+    uint64_t        recv_cmds;
+    uint64_t        done_bytes;      // 已执行完（或丢弃）的
+    uint64_t        done_cmds;
+    uint64_t        grant_bytes;     // 给过 guest 的上限，只增不减
+    uint64_t        grant_cmds;
+    uint64_t        window_bytes;    // 按服务速率调整
+    uint64_t        window_cmds;
+    uint64_t        last_event_ns;   // 服务速率采样：只算有命令在途的时间
+    uint64_t        sample_ns;
+    uint64_t        sample_bytes;
+    uint64_t        sample_cmds;
+    double          rate_bytes;      // 每秒，EWMA
+    double          rate_cmds;
+} VgpuConn;
+
+VgpuConn* vgpu_conn_open(int fd);
+void      vgpu_conn_get(VgpuConn* conn);
+void      vgpu_conn_put(VgpuConn* conn);   // 最后一个引用时关闭 fd
+
+/* 读线程退出时调用：该进程已没有任何连接时回收它的上下文 */
+void      vgpu_conn_closed(VgpuConn* conn);
+
+int vgpu_conn_reply(VgpuConn* conn, uint32_t ctx_id, int32_t status,
+                    const void* payload, uint32_t payload_size);
+
+/*
+ * 读线程收下一条上下文命令前调用：这条连接的信用还容不下 bytes 字节、cmds 条命令时
+ * 阻塞到 worker 执行完足够多的命令（guest 不再被读，socket 写满后它自己也会阻塞）。
+ * CREDIT 命令也用它等。
+ */
+void vgpu_conn_credit_wait(VgpuConn* conn, uint64_t bytes, uint64_t cmds);
+
+/* ------------------------------------------------------------
+ * 命令与上下文
+ * ------------------------------------------------------------ */
+
+typedef struct VgpuCmd {
+    struct VgpuCmd* next;
+    VgpuConn*       conn;        // 回包走命令来的那条连接
+    VkvgpuHeader    hdr;
+    uint8_t         payload[] __attribute__((aligned(16)));  // 协议结构可以就地读
+} VgpuCmd;
+
+VgpuCmd* vgpu_cmd_alloc(VgpuConn* conn, const VkvgpuHeader* hdr);
+void     vgpu_cmd_free(VgpuCmd* cmd);
+
+static inline int vgpu_cmd_is_async(const VgpuCmd* cmd)
+{
+    return (cmd->hdr.cmd & VKVGPU_CMD_FLAG_ASYNC) != 0;
+}
+
+/*
+ * 解码当前命令用的临时内存，从执行它的 worker 的 arena 里分（16 字节对齐），
+ * 命令处理函数返回后整体回收，不要 free，也不要留到命令之后。
+ * 只在处理函数里调用；只有系统内存耗尽时返回 NULL。
+ */
+void* vgpu_cmd_scratch(size_t size);
+
+/*
+ * payload 里 [off, off + size) 的只读视图。协议结构按自然对齐排布，payload 本身
+ * 16 字节对齐，通常直接返回指向收包缓冲的指针，不拷贝；起点没对齐到 align 时
+ * 才拷到 scratch 里。越界（或拷贝时内存耗尽）返回 NULL。有效期同 scratch。
+ */
+const void* vgpu_cmd_view(VgpuCmd* cmd, size_t off, size_t size, size_t align);
+
+/* ------------------------------------------------------------
+ * guest 对象表：guest 分配的 ID -> host 对象
+ * 子对象的类型值必须大于父对象，上下文销毁时按类型从大到小回收。
+ * ------------------------------------------------------------ */
+
+typedef enum {
+    VGPU_OBJ_NONE     = 0,
+    VGPU_OBJ_INSTANCE = 1,
+    VGPU_OBJ_DEVICE   = 2,
+    VGPU_OBJ_MEMORY   = 3,
+    VGPU_OBJ_SHM      = 4,      // 共享内存区
+    VGPU_OBJ_SWAPCHAIN = 5,
+    VGPU_OBJ_SYNC_PAGE = 6,
+    VGPU_OBJ_TEMPLATE  = 7,     // 调度模板，在途调用靠 sync page 销毁时等完
+    VGPU_OBJ_TYPE_COUNT
+} VgpuObjType;
+
+typedef void (*VgpuObjDestroyFn)(void* host_obj);
+
+void vgpu_obj_register_type(VgpuObjType type, VgpuObjDestroyFn destroy);
+
+typedef struct {
+    VkvgpuHandle id;     // 0 = 空槽
+    uint32_t     type;   // VGPU_OBJ_NONE 且 id != 0 表示已删除
+    void*        obj;
+} VgpuObjEntry;
+
+typedef struct VgpuContext {
+    uint32_t id;
+    pid_t    owner_pid;          // 创建它的 guest 进程（VM），只接受这个进程连接上的命令
+    VgpuQosClass qos;            // 创建时按 daemon 配置确定，之后不变
+    uint32_t refs;
+    int      dead;
+
+    /* 只在执行该上下文命令的 worker 里访问，不需要加锁 */
+    VgpuObjEntry* objs;
+    uint32_t      obj_cap;       // 2 的幂
+    uint32_t      obj_used;      // 含已删除槽
+    uint32_t      obj_live;
+    int32_t       deferred_status;
+
+    /* 以下字段由调度锁保护 */
+    VgpuCmd* head;
+    VgpuCmd* tail;
+    uint32_t next_seq;           // 下一条该执行的序号（header.seq）
+    VgpuCmd* held;               // 序号跳过了 next_seq、先到的命令，按序号排
+    VgpuCmd* held_tail;
+    int64_t  deficit;            // DRR 欠额（字节）
+    int      on_runq;
+    int      running;            // 同一时刻只有一个 worker 执行该上下文
+    uint64_t last_cmd_ns;        // 最后一条命令到达的时刻
+    int      idle_pending;       // 排进 run queue 是为了执行空闲回调
+    uint64_t hibernated_ns;      // 空闲回调执行过的时刻，0 = 没休眠
+    struct VgpuContext* next_run;
+    struct VgpuContext* next_hash;
+} VgpuContext;
+
+VgpuContext* vgpu_ctx_create(pid_t owner_pid);
+VgpuContext* vgpu_ctx_get(uint32_t id);      // 返回带引用的上下文，找不到返回 NULL
+void         vgpu_ctx_put(VgpuContext* ctx);
+void         vgpu_ctx_destroy(uint32_t id);
+
+/* 命令入队，所有权转交调度器；带序号的命令等前面的序号都到了才进执行队列 */
+void vgpu_ctx_submit(VgpuContext* ctx, VgpuCmd* cmd);
+
+/*
+ * 命令执行结果：同步命令回包（并带上积压的 deferred_status），
+ * 异步命令不回包，失败时记到 deferred_status 里。
+ */
+int vgpu_ctx_reply(VgpuContext* ctx, VgpuCmd* cmd, int32_t status,
+                   const void* payload, uint32_t payload_size);
+
+/* 同上，成功时把 pass_fd 随回复一起交给 guest（SCM_RIGHTS），fd 仍归调用者 */
+int vgpu_ctx_reply_fd(VgpuContext* ctx, VgpuCmd* cmd, int32_t status,
+                      const void* payload, uint32_t payload_size, int pass_fd);
+
+int   vgpu_ctx_obj_insert(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type, void* obj);
+void* vgpu_ctx_obj_lookup(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type);
+void* vgpu_ctx_obj_remove(VgpuContext* ctx, VkvgpuHandle id, VgpuObjType type);
+/* 对 ctx 里每个 type 类型的对象调用 fn；只在执行该上下文的 worker 里调用 */
+void  vgpu_ctx_obj_foreach(VgpuContext* ctx, VgpuObjType type,
+                           void (*fn)(void* obj, void* arg), void* arg);
+
+/* ------------------------------------------------------------
+ * 调度：多个 worker，上下文之间按字节做 deficit round robin
+ * ------------------------------------------------------------ */
+
+typedef void (*VgpuExecFn)(VgpuContext* ctx, VgpuCmd* cmd);
+
+int vgpu_sched_start(unsigned nworkers, VgpuExecFn exec);
+
+/*
+ * 上下文超过 idle_ns 没有命令时，在一个 worker 里对它调用一次 fn（和它的命令互斥），
+ * 之后再来命令前不会重复调用。在 vgpu_sched_start 之前设置，不设置就不检查。
+ */
+typedef void (*VgpuIdleFn)(VgpuContext* ctx);
+
+void vgpu_sched_set_idle(uint64_t idle_ns, VgpuIdleFn fn);
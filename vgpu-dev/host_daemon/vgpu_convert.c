@@ -0,0 +1,379 @@
+// vgpu_convert.c
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vgpu_convert.h"
+
+#define LOG(...) printf("[convert] " __VA_ARGS__)
+
+/* ----------------------------------------------
+ * 标量版本：SIMD 版本的尾巴也用它
+ * 4 字节像素按内存里的字节顺序 c0 c1 c2 a 处理，不关心是 RGBA 还是 BGRA：
+ * 通道顺序由 host 格式的选择保证（见下面的格式表）。
+ * ---------------------------------------------- */
+
+/* c0 c1 c2 a -> c0 c1 c2 */
+static void pack888_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++, dst += 3, src += 4) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+/* c0 c1 c2 -> c0 c1 c2 0xff */
+static void expand888_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++, dst += 4, src += 3) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xff;
+    }
+}
+
+/* c0 c1 c2 a -> 16 位 (c2 >> 3) << 11 | (c1 >> 2) << 5 | c0 >> 3，截断不做舍入 */
+static inline uint16_t to565(uint32_t x)
+{
+    return (uint16_t)(((x >> 8) & 0xF800) | ((x >> 5) & 0x07E0) | ((x >> 3) & 0x001F));
+}
+
+/* 5/6 位扩到 8 位时高位复制到低位，0x1F -> 0xFF */
+static inline uint32_t from565(uint32_t v)
+{
+    uint32_t b = v & 0x1F, g = (v >> 5) & 0x3F, r = v >> 11;
+    return ((b << 3) | (b >> 2)) | ((g << 2) | (g >> 4)) << 8 |
+           ((r << 3) | (r >> 2)) << 16 | 0xFF000000u;
+}
+
+static void pack565_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint32_t x;
+        memcpy(&x, src + i * 4, 4);
+        uint16_t v = to565(x);
+        memcpy(dst + i * 2, &v, 2);
+    }
+}
+
+static void expand565_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint16_t v;
+        memcpy(&v, src + i * 2, 2);
+        uint32_t x = from565(v);
+        memcpy(dst + i * 4, &x, 4);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* ----------------------------------------------
+ * SSE4.1：一次 16 个像素（888）/ 8 个像素（565）
+ * ---------------------------------------------- */
+
+#define PACK888_MASK   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+#define EXPAND888_MASK 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+
+/* 4 个寄存器各压成 12 字节，再拼成 3 个整寄存器，不写越界 */
+__attribute__((target("sse4.1")))
+static void pack888_sse41(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m128i m = _mm_setr_epi8(PACK888_MASK);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16, src += 64, dst += 48) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), m);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 16)), m);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 32)), m);
+        __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 48)), m);
+        _mm_storeu_si128((__m128i*)dst,        _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    pack888_scalar(dst, src, pixels - i);
+}
+
+/* 48 字节三个寄存器，用 alignr 错开成 4 组 12 字节再各自展开 */
+__attribute__((target("sse4.1")))
+static void expand888_sse41(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m128i m     = _mm_setr_epi8(EXPAND888_MASK);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16, src += 48, dst += 64) {
+        __m128i in0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i in1 = _mm_loadu_si128((const __m128i*)(src + 16));
+        __m128i in2 = _mm_loadu_si128((const __m128i*)(src + 32));
+        __m128i o0 = _mm_shuffle_epi8(in0, m);
+        __m128i o1 = _mm_shuffle_epi8(_mm_alignr_epi8(in1, in0, 12), m);
+        __m128i o2 = _mm_shuffle_epi8(_mm_alignr_epi8(in2, in1, 8), m);
+        __m128i o3 = _mm_shuffle_epi8(_mm_srli_si128(in2, 4), m);
+        _mm_storeu_si128((__m128i*)dst,        _mm_or_si128(o0, alpha));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(o1, alpha));
+        _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(o2, alpha));
+        _mm_storeu_si128((__m128i*)(dst + 48), _mm_or_si128(o3, alpha));
+    }
+    expand888_scalar(dst, src, pixels - i);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i to565_sse41(__m128i x)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0xF800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(x, 5), _mm_set1_epi32(0x07E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(x, 3), _mm_set1_epi32(0x001F));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i from565_sse41(__m128i v)
+{
+    __m128i b = _mm_and_si128(v, _mm_set1_epi32(0x1F));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(v, 5), _mm_set1_epi32(0x3F));
+    __m128i r = _mm_srli_epi32(v, 11);
+    __m128i c0 = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+    __m128i c1 = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+    __m128i c2 = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+    __m128i x = _mm_or_si128(c0, _mm_or_si128(_mm_slli_epi32(c1, 8), _mm_slli_epi32(c2, 16)));
+    return _mm_or_si128(x, _mm_set1_epi32((int)0xFF000000u));
+}
+
+__attribute__((target("sse4.1")))
+static void pack565_sse41(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8, src += 32, dst += 16) {
+        __m128i lo = to565_sse41(_mm_loadu_si128((const __m128i*)src));
+        __m128i hi = to565_sse41(_mm_loadu_si128((const __m128i*)(src + 16)));
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi32(lo, hi));
+    }
+    pack565_scalar(dst, src, pixels - i);
+}
+
+__attribute__((target("sse4.1")))
+static void expand565_sse41(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8, src += 16, dst += 32) {
+        __m128i v = _mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst,        from565_sse41(_mm_cvtepu16_epi32(v)));
+        _mm_storeu_si128((__m128i*)(dst + 16), from565_sse41(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8))));
+    }
+    expand565_scalar(dst, src, pixels - i);
+}
+
+/* ----------------------------------------------
+ * AVX2：shuffle / alignr 都在 128 位 lane 内，
+ * 所以两个 lane 各装一段连续的输入，算完再用 permute2x128 拼回顺序。
+ * ---------------------------------------------- */
+
+__attribute__((target("avx2")))
+static inline __m256i load2x128(const uint8_t* lo, const uint8_t* hi)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lo)),
+                                   _mm_loadu_si128((const __m128i*)hi), 1);
+}
+
+/* 一次 32 个像素：lane 0 管前 64 字节输入，lane 1 管后 64 字节 */
+__attribute__((target("avx2")))
+static void pack888_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m256i m = _mm256_setr_epi8(PACK888_MASK, PACK888_MASK);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32, src += 128, dst += 96) {
+        __m256i a = _mm256_shuffle_epi8(load2x128(src,      src + 64), m);
+        __m256i b = _mm256_shuffle_epi8(load2x128(src + 16, src + 80), m);
+        __m256i c = _mm256_shuffle_epi8(load2x128(src + 32, src + 96), m);
+        __m256i d = _mm256_shuffle_epi8(load2x128(src + 48, src + 112), m);
+        __m256i o0 = _mm256_or_si256(a, _mm256_bslli_epi128(b, 12));
+        __m256i o1 = _mm256_or_si256(_mm256_bsrli_epi128(b, 4), _mm256_bslli_epi128(c, 8));
+        __m256i o2 = _mm256_or_si256(_mm256_bsrli_epi128(c, 8), _mm256_bslli_epi128(d, 4));
+        _mm256_storeu_si256((__m256i*)dst,        _mm256_permute2x128_si256(o0, o1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+        _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+    }
+    pack888_sse41(dst, src, pixels - i);
+}
+
+/* 一次 32 个像素：lane 0 管前 48 字节输入，lane 1 管后 48 字节 */
+__attribute__((target("avx2")))
+static void expand888_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m256i m     = _mm256_setr_epi8(EXPAND888_MASK, EXPAND888_MASK);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32, src += 96, dst += 128) {
+        __m256i in0 = load2x128(src,      src + 48);
+        __m256i in1 = load2x128(src + 16, src + 64);
+        __m256i in2 = load2x128(src + 32, src + 80);
+        __m256i o0 = _mm256_or_si256(_mm256_shuffle_epi8(in0, m), alpha);
+        __m256i o1 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_alignr_epi8(in1, in0, 12), m), alpha);
+        __m256i o2 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_alignr_epi8(in2, in1, 8), m), alpha);
+        __m256i o3 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_bsrli_epi128(in2, 4), m), alpha);
+        _mm256_storeu_si256((__m256i*)dst,         _mm256_permute2x128_si256(o0, o1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 32),  _mm256_permute2x128_si256(o2, o3, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 64),  _mm256_permute2x128_si256(o0, o1, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 96),  _mm256_permute2x128_si256(o2, o3, 0x31));
+    }
+    expand888_sse41(dst, src, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i to565_avx2(__m256i x)
+{
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(x, 8), _mm256_set1_epi32(0xF800));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(x, 5), _mm256_set1_epi32(0x07E0));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(x, 3), _mm256_set1_epi32(0x001F));
+    return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i from565_avx2(__m256i v)
+{
+    __m256i b = _mm256_and_si256(v, _mm256_set1_epi32(0x1F));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 5), _mm256_set1_epi32(0x3F));
+    __m256i r = _mm256_srli_epi32(v, 11);
+    __m256i c0 = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+    __m256i c1 = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4));
+    __m256i c2 = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+    __m256i x = _mm256_or_si256(c0, _mm256_or_si256(_mm256_slli_epi32(c1, 8), _mm256_slli_epi32(c2, 16)));
+    return _mm256_or_si256(x, _mm256_set1_epi32((int)0xFF000000u));
+}
+
+/* packus 按 lane 交错，permute4x64 换回顺序 */
+__attribute__((target("avx2")))
+static void pack565_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16, src += 64, dst += 32) {
+        __m256i lo = to565_avx2(_mm256_loadu_si256((const __m256i*)src));
+        __m256i hi = to565_avx2(_mm256_loadu_si256((const __m256i*)(src + 32)));
+        __m256i p  = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)dst, p);
+    }
+    pack565_sse41(dst, src, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void expand565_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16, src += 32, dst += 64) {
+        __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + 16)));
+        _mm256_storeu_si256((__m256i*)dst,        from565_avx2(lo));
+        _mm256_storeu_si256((__m256i*)(dst + 32), from565_avx2(hi));
+    }
+    expand565_sse41(dst, src, pixels - i);
+}
+#endif
+
+/* ----------------------------------------------
+ * 选择
+ * ---------------------------------------------- */
+
+enum { K_PACK888, K_EXPAND888, K_PACK565, K_EXPAND565, K_COUNT };
+
+static const VgpuConvertKernel g_all_kernels[] = {
+    { "pack888",   "scalar", 4, 3, pack888_scalar },
+    { "expand888", "scalar", 3, 4, expand888_scalar },
+    { "pack565",   "scalar", 4, 2, pack565_scalar },
+    { "expand565", "scalar", 2, 4, expand565_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+    { "pack888",   "sse4.1", 4, 3, pack888_sse41 },
+    { "expand888", "sse4.1", 3, 4, expand888_sse41 },
+    { "pack565",   "sse4.1", 4, 2, pack565_sse41 },
+    { "expand565", "sse4.1", 2, 4, expand565_sse41 },
+    { "pack888",   "avx2",   4, 3, pack888_avx2 },
+    { "expand888", "avx2",   3, 4, expand888_avx2 },
+    { "pack565",   "avx2",   4, 2, pack565_avx2 },
+    { "expand565", "avx2",   2, 4, expand565_avx2 },
+#endif
+};
+#define ALL_KERNEL_COUNT (sizeof(g_all_kernels) / sizeof(g_all_kernels[0]))
+
+static pthread_once_t    g_once = PTHREAD_ONCE_INIT;
+static VgpuConvertKernel g_kernels[ALL_KERNEL_COUNT];
+static uint32_t          g_kernel_count;
+static VgpuConvertFn     g_best[K_COUNT];   // 每种转换本机最快的一个
+
+/*
+ * host 图像的字节顺序按 guest 格式的通道顺序选，转换只丢 / 补 alpha 或截位，不换通道：
+ * 24 位 RGB 用 RGBA8，BGR 用 BGRA8；R5G6B5 的 R 在高位，对应 BGRA8 的第 2 字节，B5G6R5 反之。
+ * A8B8G8R8_PACK32 在小端上和 RGBA8 字节相同，不用转换。
+ */
+static VgpuFormatEmu g_formats[] = {
+    { VK_FORMAT_B8G8R8A8_UNORM,        VK_FORMAT_B8G8R8A8_UNORM, 4, NULL, NULL },
+    { VK_FORMAT_B8G8R8A8_SRGB,         VK_FORMAT_B8G8R8A8_SRGB,  4, NULL, NULL },
+    { VK_FORMAT_R8G8B8A8_UNORM,        VK_FORMAT_R8G8B8A8_UNORM, 4, NULL, NULL },
+    { VK_FORMAT_R8G8B8A8_SRGB,         VK_FORMAT_R8G8B8A8_SRGB,  4, NULL, NULL },
+    { VK_FORMAT_A8B8G8R8_UNORM_PACK32, VK_FORMAT_R8G8B8A8_UNORM, 4, NULL, NULL },
+    { VK_FORMAT_A8B8G8R8_SRGB_PACK32,  VK_FORMAT_R8G8B8A8_SRGB,  4, NULL, NULL },
+    { VK_FORMAT_R8G8B8_UNORM,          VK_FORMAT_R8G8B8A8_UNORM, 3, NULL, NULL },
+    { VK_FORMAT_R8G8B8_SRGB,           VK_FORMAT_R8G8B8A8_SRGB,  3, NULL, NULL },
+    { VK_FORMAT_B8G8R8_UNORM,          VK_FORMAT_B8G8R8A8_UNORM, 3, NULL, NULL },
+    { VK_FORMAT_B8G8R8_SRGB,           VK_FORMAT_B8G8R8A8_SRGB,  3, NULL, NULL },
+    { VK_FORMAT_R5G6B5_UNORM_PACK16,   VK_FORMAT_B8G8R8A8_UNORM, 2, NULL, NULL },
+    { VK_FORMAT_B5G6R5_UNORM_PACK16,   VK_FORMAT_R8G8B8A8_UNORM, 2, NULL, NULL },
+};
+#define FORMAT_COUNT (sizeof(g_formats) / sizeof(g_formats[0]))
+
+static int isa_supported(const char* isa)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (strcmp(isa, "avx2") == 0)   return __builtin_cpu_supports("avx2");
+    if (strcmp(isa, "sse4.1") == 0) return __builtin_cpu_supports("sse4.1");
+#endif
+    return strcmp(isa, "scalar") == 0;
+}
+
+static void convert_init(void)
+{
+    static const char* names[K_COUNT] = { "pack888", "expand888", "pack565", "expand565" };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#endif
+    /* 表里同名的按 scalar、sse4.1、avx2 排，后面能用的覆盖前面的 */
+    const char* isa = "scalar";
+    for (uint32_t i = 0; i < ALL_KERNEL_COUNT; i++) {
+        const VgpuConvertKernel* k = &g_all_kernels[i];
+        if (!isa_supported(k->isa)) continue;
+        g_kernels[g_kernel_count++] = *k;
+        for (int n = 0; n < K_COUNT; n++) {
+            if (strcmp(k->name, names[n]) == 0) g_best[n] = k->fn;
+        }
+        isa = k->isa;
+    }
+
+    for (uint32_t i = 0; i < FORMAT_COUNT; i++) {
+        VgpuFormatEmu* f = &g_formats[i];
+        if (f->guest_bpp == 3) {
+            f->readback = g_best[K_PACK888];
+            f->upload   = g_best[K_EXPAND888];
+        } else if (f->guest_bpp == 2) {
+            f->readback = g_best[K_PACK565];
+            f->upload   = g_best[K_EXPAND565];
+        }
+    }
+    LOG("格式转换: %s\n", isa);
+}
+
+const VgpuFormatEmu* vgpu_format_lookup(VkFormat guest_format)
+{
+    pthread_once(&g_once, convert_init);
+    for (uint32_t i = 0; i < FORMAT_COUNT; i++) {
+        if (g_formats[i].guest_format == guest_format)
+            return &g_formats[i];
+    }
+    return NULL;
+}
+
+uint32_t vgpu_convert_kernels(const VgpuConvertKernel** out)
+{
+    pthread_once(&g_once, convert_init);
+    *out = g_kernels;
+    return g_kernel_count;
+}
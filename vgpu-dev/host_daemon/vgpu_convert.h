@@ -0,0 +1,38 @@
+// vgpu_convert.h
+// host GPU 没有的像素格式：host 上用相近的 4 字节格式建图像，
+// 读回（present 写帧缓冲）和上传时逐行转换。
+// 转换核有 AVX2 / SSE4.1 / 标量三个版本，结果逐字节相同，启动时按 CPU 选一次。
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/* 转换 pixels 个像素；dst 与 src 不重叠，都不要求对齐 */
+typedef void (*VgpuConvertFn)(uint8_t* dst, const uint8_t* src, size_t pixels);
+
+typedef struct {
+    VkFormat      guest_format;   // guest 看到的
+    VkFormat      host_format;    // host 上实际建的
+    uint32_t      guest_bpp;
+    VgpuConvertFn readback;       // host -> guest，NULL = 字节相同，直接拷
+    VgpuConvertFn upload;         // guest -> host
+} VgpuFormatEmu;
+
+/*
+ * guest 格式怎么落到 host 上；host 原生支持的 host_format == guest_format、两个转换都是 NULL。
+ * 既不支持也模拟不了的返回 NULL。
+ */
+const VgpuFormatEmu* vgpu_format_lookup(VkFormat guest_format);
+
+/* 单个转换核，给基准测试逐个跑 */
+typedef struct {
+    const char*   name;
+    const char*   isa;        // "avx2" / "sse4.1" / "scalar"
+    uint32_t      src_bpp;
+    uint32_t      dst_bpp;
+    VgpuConvertFn fn;
+} VgpuConvertKernel;
+
+/* 本机能跑的全部转换核（不支持的指令集不列出），返回个数 */
+uint32_t vgpu_convert_kernels(const VgpuConvertKernel** out);
@@ -1,5 +1,8 @@
 // vgpu_daemon.c 
 // 简单的 vGPU host 端守护进程，配合 guest 侧 virtio Vulkan ICD 使用。
+// 编译：gcc -O2 -o vgpu_daemon vgpu_daemon.c host_vulkan.c host_stream.c vgpu_context.c vgpu_shm.c host_present.c vgpu_frame.c vgpu_present.c vgpu_sync.c vgpu_gpusched.c host_submit.c vgpu_qos.c vgpu_memquota.c vgpu_numa.c host_template.c vgpu_template.c vgpu_arena.c vgpu_convert.c vgpu_dedup.c vgpu_compile.c -ldl -lpthread
+// guest ICD 每个线程一条连接，每条连接一个读线程；
+// 命令按 ctx_id 进入各上下文队列，由调度 worker 公平执行。
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -8,13 +11,30 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include "../guest_icd/vk_virtio_proto.h"
+#include "host_vulkan.h"
+#include "vgpu_context.h"
+#include "vgpu_shm.h"
+#include "vgpu_present.h"
+#include "vgpu_sync.h"
+#include "vgpu_memquota.h"
+#include "vgpu_numa.h"
+#include "vgpu_template.h"
+#include "vgpu_compile.h"
+
+/* 单条命令 payload 上限，防止坏包让 daemon 分配大内存 */
+#define VKVGPU_MAX_PAYLOAD (1u << 20)
+
+/* 逐条命令的跟踪日志（VGPU_TRACE=1），默认关：热路径上每条命令写一次 stdout 会拖慢延迟 */
+static int g_trace;
+#define TRACE(...) do { if (g_trace) printf(__VA_ARGS__); } while (0)
 
 /* ============================================================
- *                    简单工具函数：完整收发
+ *                    简单工具函数：完整接收
  * ============================================================ */
 
 static ssize_t read_full(int fd, void *buf, size_t size)
@@ -40,30 +60,6 @@ static ssize_t read_full(int fd, void *buf, size_t size)
     return (ssize_t)off;
 }
 
-static ssize_t write_full(int fd, const void *buf, size_t size)
-{
-    size_t off = 0;
-    while (off < size)
-    {
-        ssize_t n = send(fd, (const char *)buf + off, size - off, 0);
-        if (n < 0)
-        {
-            if (errno == EINTR)
-                continue;
-            perror("[daemon] send");
-            return -1;
-        }
-        off += (size_t)n;
-    }
-    return (ssize_t)off;
-}
-
-/* ============================================================
- *                         句柄分配（旧逻辑）
- * ============================================================ */
-
-static VkvgpuHandle g_next_handle = 1; // 简单递增 ID，当作 host-side 句柄
-
 /* ============================================================
  *                       服务器 socket
  * ============================================================ */
@@ -92,7 +88,7 @@ static int setup_server_socket(void)
         exit(1);
     }
 
-    if (listen(fd, 4) < 0)
+    if (listen(fd, 64) < 0)
     {
         perror("[daemon] listen");
         close(fd);
@@ -105,251 +101,914 @@ static int setup_server_socket(void)
 }
 
 /* ============================================================
- *                     命令处理函数（旧版，暂未使用）
+ *                      客户端循环处理（新版）
  * ============================================================ */
 
-static int handle_enum_physical_devices(int cfd)
+/* ctx_id = 0 的全局命令，直接在读线程里处理（都是同步命令） */
+static int dispatch_global(VgpuConn *conn, const VgpuCmd *cmd)
 {
-    printf("[daemon] handle ENUM_PHYSICAL_DEVICES (legacy)\n");
+    const VkvgpuHeader *hdr = &cmd->hdr;
+    switch (VKVGPU_CMD_ID(hdr->cmd))
+    {
+    case VKVGPU_CMD_PING:
+        return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, 0, NULL, 0);
 
-    VkvgpuEnumPhysDevsPayload payload;
-    memset(&payload, 0, sizeof(payload));
-    payload.count = 1; // 先写死只有 1 个虚拟 GPU
+    case VKVGPU_CMD_CREATE_CONTEXT:
+    {
+        printf("[daemon] handle CREATE_CONTEXT from pid=%d\n", (int)conn->peer_pid);
 
-    VkvgpuReply reply;
-    memset(&reply, 0, sizeof(reply));
-    reply.status = 0;
-    reply.payload_size = sizeof(payload);
+        VgpuContext *ctx = vgpu_ctx_create(conn->peer_pid);
+        if (!ctx)
+        {
+            return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, -1, NULL, 0);
+        }
 
-    if (write_full(cfd, &reply, sizeof(reply)) < 0)
-    {
-        return -1;
+        VkvgpuCreateContextReplyPayload reply = {
+            .ctx_id = ctx->id};
+        vgpu_ctx_put(ctx);
+        return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, 0, &reply, sizeof(reply));
     }
-    if (write_full(cfd, &payload, sizeof(payload)) < 0)
+
+    case VKVGPU_CMD_CREDIT:
     {
-        return -1;
+        /* guest 信用用完：等 worker 执行完足够多的命令，回复里带上新的上限 */
+        VkvgpuCreditRequestPayload req;
+        if (hdr->payload_size != sizeof(req))
+        {
+            return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, -1, NULL, 0);
+        }
+        memcpy(&req, cmd->payload, sizeof(req));
+        vgpu_conn_credit_wait(conn, req.bytes, req.cmds);
+        return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, 0, NULL, 0);
     }
 
-    return 0;
+    default:
+        printf("[daemon] unknown global cmd=%u, reply status=-1\n", hdr->cmd);
+        return vgpu_conn_reply(conn, VKVGPU_CTX_NONE, -1, NULL, 0);
+    }
 }
 
-static int handle_create_instance(int cfd)
+/* ------------------------------------------------------------
+ * 上下文内的命令：guest 对象 ID 经 ctx 对象表映射到 host 对象
+ * ------------------------------------------------------------ */
+
+static void destroy_instance_obj(void *obj) { hostvk_destroy_instance(obj); }
+static void destroy_device_obj(void *obj)   { hostvk_destroy_device(obj); }
+static void destroy_memory_obj(void *obj)   { vgpu_mem_free(obj); }
+static void destroy_shm_obj(void *obj)      { vgpu_shm_destroy(obj); }
+
+static void cmd_enum_physical_devices(VgpuContext *ctx, VgpuCmd *cmd)
 {
-    printf("[daemon] handle CREATE_INSTANCE (legacy)\n");
+    VkvgpuEnumPhysDevsRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-    VkvgpuCreateInstanceReplyPayload payload;
-    payload.instance_handle = g_next_handle++;
+    HVkInstance *hi = vgpu_ctx_obj_lookup(ctx, req.instance_id, VGPU_OBJ_INSTANCE);
+    if (!hi)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_INITIALIZATION_FAILED, NULL, 0);
+        return;
+    }
 
-    printf("[daemon] allocate instance handle=%lu\n",
-           (unsigned long)payload.instance_handle);
+    VkvgpuEnumPhysDevsPayload reply = {0};
+    reply.count = hostvk_enum_physical_devices(hi);
+    vgpu_ctx_reply(ctx, cmd, 0, &reply, sizeof(reply));
+}
 
-    VkvgpuReply reply;
-    memset(&reply, 0, sizeof(reply));
-    reply.status = 0;
-    reply.payload_size = sizeof(payload);
+static void cmd_create_instance(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuCreateInstanceRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-    if (write_full(cfd, &reply, sizeof(reply)) < 0)
+    HVkInstance *hi = NULL;
+    VkResult r = hostvk_create_instance(&hi);
+    if (r == VK_SUCCESS &&
+        vgpu_ctx_obj_insert(ctx, req.instance_id, VGPU_OBJ_INSTANCE, hi) != 0)
     {
-        return -1;
+        hostvk_destroy_instance(hi);
+        r = VK_ERROR_INITIALIZATION_FAILED;
     }
-    if (write_full(cfd, &payload, sizeof(payload)) < 0)
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+}
+
+static void cmd_create_device(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuCreateDeviceRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
     {
-        return -1;
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
     }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-    return 0;
+    HVkInstance *hi = vgpu_ctx_obj_lookup(ctx, req.instance_id, VGPU_OBJ_INSTANCE);
+    if (!hi)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_INITIALIZATION_FAILED, NULL, 0);
+        return;
+    }
+
+    HVkDevice *hd = NULL;
+    VkResult r = hostvk_create_device(hi, req.phys_index,
+                                      vgpu_qos_queue_priority(ctx->qos),
+                                      vgpu_qos_global_priority(ctx->qos), &hd);
+    if (r == VK_SUCCESS &&
+        vgpu_ctx_obj_insert(ctx, req.device_id, VGPU_OBJ_DEVICE, hd) != 0)
+    {
+        hostvk_destroy_device(hd);
+        r = VK_ERROR_INITIALIZATION_FAILED;
+    }
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
 }
 
-static int handle_create_device(int cfd, const VkvgpuMessage *msg)
+static void cmd_destroy_device(VgpuContext *ctx, VgpuCmd *cmd)
 {
-    printf("[daemon] handle CREATE_DEVICE (legacy), expect payload_size=%zu, got=%u\n",
-           sizeof(VkvgpuCreateDeviceRequestPayload),
-           msg->header.payload_size);
+    VkvgpuDestroyDeviceRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    HVkDevice *hd = vgpu_ctx_obj_remove(ctx, req.device_id, VGPU_OBJ_DEVICE);
+    hostvk_destroy_device(hd);
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
+
+/* ------------------------------------------------------------
+ * 设备内存：guest 只发脏页（WRITE_MEMORY），invalidate 时读回（READ_MEMORY）
+ * ------------------------------------------------------------ */
 
-    if (msg->header.payload_size != sizeof(VkvgpuCreateDeviceRequestPayload))
+static void cmd_get_memory_properties(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuGetMemoryPropertiesRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
     {
-        printf("[daemon] bad payload_size for CREATE_DEVICE: %u\n",
-               msg->header.payload_size);
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-        VkvgpuReply reply;
-        memset(&reply, 0, sizeof(reply));
-        reply.status = -1;
-        reply.payload_size = 0;
-        (void)write_full(cfd, &reply, sizeof(reply));
-        return 0; // 协议错误但连接继续
+    HVkInstance *hi = vgpu_ctx_obj_lookup(ctx, req.instance_id, VGPU_OBJ_INSTANCE);
+    VkPhysicalDeviceMemoryProperties props;
+    VkResult r = hi ? hostvk_get_memory_properties(hi, req.phys_index, &props)
+                    : VK_ERROR_INITIALIZATION_FAILED;
+    if (r != VK_SUCCESS)
+    {
+        vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+        return;
     }
 
-    // 读取请求 payload
-    VkvgpuCreateDeviceRequestPayload req;
-    ssize_t n = read_full(cfd, &req, sizeof(req));
-    if (n <= 0)
+    VkvgpuMemoryPropertiesPayload reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type_count = props.memoryTypeCount;
+    reply.heap_count = props.memoryHeapCount;
+    for (uint32_t i = 0; i < props.memoryTypeCount && i < VKVGPU_MAX_MEMORY_TYPES; i++)
     {
-        if (n == 0)
+        reply.types[i].property_flags = props.memoryTypes[i].propertyFlags;
+        reply.types[i].heap_index     = props.memoryTypes[i].heapIndex;
+    }
+    /* device-local 堆按该 VM 的显存配额报 */
+    for (uint32_t i = 0; i < props.memoryHeapCount && i < VKVGPU_MAX_MEMORY_HEAPS; i++)
+    {
+        reply.heaps[i].size  = props.memoryHeaps[i].size;
+        reply.heaps[i].flags = props.memoryHeaps[i].flags;
+        if (props.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
         {
-            printf("[daemon] client closed while reading create_device req\n");
+            reply.heaps[i].size = vgpu_mem_heap_size(ctx->owner_pid, props.memoryHeaps[i].size);
         }
-        return -1;
     }
+    vgpu_ctx_reply(ctx, cmd, 0, &reply, sizeof(reply));
+}
 
-    printf("[daemon] create device for instance_handle=%lu\n",
-           (unsigned long)req.instance_handle);
+static void cmd_allocate_memory(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuAllocateMemoryRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-    VkvgpuCreateDeviceReplyPayload payload;
-    payload.device_handle = g_next_handle++;
+    HVkDevice *hd = vgpu_ctx_obj_lookup(ctx, req.device_id, VGPU_OBJ_DEVICE);
+    if (!hd)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_DEVICE_LOST, NULL, 0);
+        return;
+    }
+
+    VgpuMem *mem = NULL;
+    VkResult r = vgpu_mem_allocate(hd, ctx->owner_pid, req.size, req.type_index, &mem);
+    if (r == VK_SUCCESS &&
+        vgpu_ctx_obj_insert(ctx, req.memory_id, VGPU_OBJ_MEMORY, mem) != 0)
+    {
+        vgpu_mem_free(mem);
+        r = VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+}
 
-    printf("[daemon] allocate device handle=%lu\n",
-           (unsigned long)payload.device_handle);
+static void cmd_free_memory(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuFreeMemoryRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
 
-    VkvgpuReply reply;
-    memset(&reply, 0, sizeof(reply));
-    reply.status = 0;
-    reply.payload_size = sizeof(payload);
+    vgpu_mem_free(vgpu_ctx_obj_remove(ctx, req.memory_id, VGPU_OBJ_MEMORY));
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
 
-    if (write_full(cfd, &reply, sizeof(reply)) < 0)
+/*
+ * emulated 内存经 staging 环由 GPU 拷贝，直接提交给 host 队列；
+ * 先等这个 VM 排在 GPU 调度器里的提交都交出去，拷贝才排在它们后面。
+ */
+static void stream_order(VgpuContext *ctx, HVkMemory *hm)
+{
+    if (hm->emulated)
     {
-        return -1;
+        vgpu_gpusched_flush_vm(hm->dev->phys_index, ctx->owner_pid);
     }
-    if (write_full(cfd, &payload, sizeof(payload)) < 0)
+}
+
+/* payload = VkvgpuMemoryRangePayload + size 字节数据 */
+static void cmd_write_memory(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuMemoryRangePayload req;
+    if (cmd->hdr.payload_size < sizeof(req))
     {
-        return -1;
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    if (req.size != cmd->hdr.payload_size - sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
     }
 
-    return 0;
+    VgpuMem *mem = vgpu_ctx_obj_lookup(ctx, req.memory_id, VGPU_OBJ_MEMORY);
+    VkResult r = VK_ERROR_MEMORY_MAP_FAILED;
+    HVkMemory *hm = mem ? vgpu_mem_acquire(mem, 1, &r) : NULL;
+    if (hm)
+    {
+        stream_order(ctx, hm);
+        r = hostvk_write_memory(hm, req.offset, cmd->payload + sizeof(req), req.size);
+        vgpu_mem_release(mem);
+    }
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
 }
 
-/* ============================================================
- *                      客户端循环处理（新版）
- * ============================================================ */
+static void cmd_read_memory(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuMemoryRangePayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    if (req.size > VKVGPU_MAX_TRANSFER_CHUNK)
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+
+    VgpuMem *mem = vgpu_ctx_obj_lookup(ctx, req.memory_id, VGPU_OBJ_MEMORY);
+    void *buf = vgpu_cmd_scratch(req.size ? req.size : 1);
+    VkResult r = VK_ERROR_MEMORY_MAP_FAILED;
+    HVkMemory *hm = mem && buf ? vgpu_mem_acquire(mem, 0, &r) : NULL;
+    if (hm)
+    {
+        stream_order(ctx, hm);
+        r = hostvk_read_memory(hm, req.offset, buf, req.size);
+        vgpu_mem_release(mem);
+    }
+    if (r == VK_SUCCESS)
+    {
+        vgpu_ctx_reply(ctx, cmd, 0, buf, (uint32_t)req.size);
+    }
+    else
+    {
+        vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+    }
+}
+
+/* ------------------------------------------------------------
+ * 共享内存区 / 流式读回
+ * ------------------------------------------------------------ */
 
-extern int hostvk_init();
-extern uint64_t hostvk_create_instance();
-extern uint32_t hostvk_enum_physical_devices(uint64_t);
-extern uint64_t hostvk_create_device(uint64_t);
+/* daemon 等 guest 取走分块的总时长上限，guest 卡死时不能一直占着 worker */
+#define READBACK_WAIT_MS 10000
 
-static void handle_client(int cfd)
+static void cmd_create_shared_region(VgpuContext *ctx, VgpuCmd *cmd)
 {
-    while (1)
+    VkvgpuCreateSharedRegionRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
     {
-        VkvgpuMessage msg;
-        memset(&msg, 0, sizeof(msg));
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    if (req.size == 0 || req.size > VKVGPU_MAX_SHARED_REGION)
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
 
-        // guest 侧是 send(sizeof(VkvgpuMessage))，这里也按同样大小收；
-        // 为安全起见，至少要收够 header。
-        ssize_t n = recv(cfd, &msg, sizeof(msg), 0);
-        if (n == 0)
+    /* guest 在这里轮询分块，放在 guest 内存所在的节点 */
+    VgpuShm *shm = vgpu_shm_create("vgpu-region", req.size, vgpu_numa_node_of_pid(ctx->owner_pid));
+    if (!shm)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+    if (vgpu_ctx_obj_insert(ctx, req.region_id, VGPU_OBJ_SHM, shm) != 0)
+    {
+        vgpu_shm_destroy(shm);
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+
+    vgpu_ctx_reply_fd(ctx, cmd, 0, NULL, 0, shm->fd);
+    /* guest 已经拿到 fd，这边只留映射 */
+    vgpu_shm_close_fd(shm);
+}
+
+/* 数据直接写进共享区的槽里，写好一块通知一块，guest 边收边拷 */
+static void cmd_readback_memory(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuReadbackRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    VgpuShm   *shm = vgpu_ctx_obj_lookup(ctx, req.region_id, VGPU_OBJ_SHM);
+    VgpuMem   *mem = vgpu_ctx_obj_lookup(ctx, req.memory_id, VGPU_OBJ_MEMORY);
+    if (!shm || shm->size < VKVGPU_READBACK_REGION_SIZE || !mem)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_MEMORY_MAP_FAILED, NULL, 0);
+        return;
+    }
+    VkResult r = VK_SUCCESS;
+    HVkMemory *hm = vgpu_mem_acquire(mem, 0, &r);
+    if (!hm)
+    {
+        vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+        return;
+    }
+
+    stream_order(ctx, hm);
+    VkvgpuReadbackCtl *ctl = shm->ptr;
+    uint8_t *slots = (uint8_t *)shm->ptr + VKVGPU_READBACK_CTL_SIZE;
+    uint32_t produced = __atomic_load_n(&ctl->produced, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ctl->error, 0, __ATOMIC_RELAXED);
+
+    uint64_t off = req.offset, left = req.size;
+    while (r == VK_SUCCESS && left > 0)
+    {
+        /* 槽全被占着：等 guest 取走（反压） */
+        int waited = 0;
+        uint32_t consumed;
+        while (produced - (consumed = __atomic_load_n(&ctl->consumed, __ATOMIC_ACQUIRE))
+               >= VKVGPU_READBACK_SLOTS)
         {
-            printf("[daemon] client disconnected\n");
-            break;
+            if (vgpu_futex_wait(&ctl->consumed, consumed, 100) != 0 &&
+                (waited += 100) >= READBACK_WAIT_MS)
+            {
+                printf("[daemon] ctx=%u readback: guest stopped consuming\n", ctx->id);
+                r = VK_ERROR_DEVICE_LOST;
+                break;
+            }
         }
-        else if (n < 0)
+        if (r != VK_SUCCESS)
         {
-            perror("[daemon] recv");
             break;
         }
 
-        if (n < (ssize_t)sizeof(VkvgpuHeader))
+        uint64_t n = left < VKVGPU_MAX_TRANSFER_CHUNK ? left : VKVGPU_MAX_TRANSFER_CHUNK;
+        uint8_t *slot = slots + (size_t)(produced % VKVGPU_READBACK_SLOTS) * VKVGPU_MAX_TRANSFER_CHUNK;
+        r = hostvk_read_memory(hm, off, slot, n);
+        if (r != VK_SUCCESS)
         {
-            printf("[daemon] short header (%zd bytes)\n", n);
             break;
         }
 
-        if (msg.header.magic != VKVGPU_MAGIC)
+        produced++;
+        __atomic_store_n(&ctl->produced, produced, __ATOMIC_RELEASE);
+        vgpu_futex_wake(&ctl->produced);
+        off  += n;
+        left -= n;
+    }
+    vgpu_mem_release(mem);
+
+    if (r != VK_SUCCESS)
+    {
+        __atomic_store_n(&ctl->error, r, __ATOMIC_RELEASE);
+        vgpu_futex_wake(&ctl->produced);
+    }
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+}
+
+/* ------------------------------------------------------------
+ * 无头 swapchain：present 线程读回图像，按 tile 只更新变了的部分
+ * ------------------------------------------------------------ */
+
+static void destroy_swapchain_obj(void *obj) { vgpu_swapchain_destroy(obj); }
+
+static void cmd_create_swapchain(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuCreateSwapchainRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    HVkDevice *hd = vgpu_ctx_obj_lookup(ctx, req.device_id, VGPU_OBJ_DEVICE);
+    if (!hd)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_DEVICE_LOST, NULL, 0);
+        return;
+    }
+
+    VkResult r;
+    VgpuSwapchain *sc = vgpu_swapchain_create(hd, ctx->owner_pid, &req, &r);
+    if (sc && vgpu_ctx_obj_insert(ctx, req.swapchain_id, VGPU_OBJ_SWAPCHAIN, sc) != 0)
+    {
+        vgpu_swapchain_destroy(sc);
+        sc = NULL;
+        r = VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if (!sc)
+    {
+        vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+        return;
+    }
+
+    vgpu_ctx_reply_fd(ctx, cmd, 0, NULL, 0, sc->frame->shm->fd);
+    vgpu_shm_close_fd(sc->frame->shm);
+}
+
+static void cmd_destroy_swapchain(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuDestroySwapchainRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    vgpu_swapchain_destroy(vgpu_ctx_obj_remove(ctx, req.swapchain_id, VGPU_OBJ_SWAPCHAIN));
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
+
+/* 只排队：先排在这个 VM 之前的提交后面，读回和 damage 检测在 swapchain 自己的 present 线程里做 */
+static void cmd_queue_present(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuQueuePresentRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    VgpuSwapchain *sc = vgpu_ctx_obj_lookup(ctx, req.swapchain_id, VGPU_OBJ_SWAPCHAIN);
+    int rc = sc ? vgpu_swapchain_queue(sc, req.image_index) : -1;
+    vgpu_ctx_reply(ctx, cmd, rc == 0 ? 0 : VK_ERROR_OUT_OF_DATE_KHR, NULL, 0);
+}
+
+/* ------------------------------------------------------------
+ * 完成通知：每个 device 一页 sync page，等待线程把完成值推给 guest
+ * ------------------------------------------------------------ */
+
+static void destroy_sync_page_obj(void *obj) { vgpu_sync_destroy(obj); }
+
+static void cmd_create_sync_page(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuCreateSyncPageRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    HVkDevice *hd = vgpu_ctx_obj_lookup(ctx, req.device_id, VGPU_OBJ_DEVICE);
+    if (!hd)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_DEVICE_LOST, NULL, 0);
+        return;
+    }
+
+    VgpuSyncPage *sp = vgpu_sync_create(hd, ctx->owner_pid);
+    if (sp)
+    {
+        vgpu_tenant_set_qos(sp->tenant, ctx->qos, vgpu_qos_weight(ctx->qos));
+    }
+    if (sp && vgpu_ctx_obj_insert(ctx, req.page_id, VGPU_OBJ_SYNC_PAGE, sp) != 0)
+    {
+        vgpu_sync_destroy(sp);
+        sp = NULL;
+    }
+    if (!sp)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+
+    vgpu_ctx_reply_fd(ctx, cmd, 0, NULL, 0, sp->shm->fd);
+    vgpu_shm_close_fd(sp->shm);
+}
+
+static void cmd_destroy_sync_page(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuDestroySyncPageRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    vgpu_sync_destroy(vgpu_ctx_obj_remove(ctx, req.page_id, VGPU_OBJ_SYNC_PAGE));
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
+
+/* 提交后立即返回，完成由 sync page 的等待线程推给 guest */
+static void cmd_queue_submit(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuQueueSubmitRequestPayload req;
+    if (cmd->hdr.payload_size < sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    uint32_t npairs = req.signal_count + req.wait_count;
+    if (req.signal_count > VKVGPU_MAX_SUBMIT_SIGNALS || req.wait_count > VKVGPU_MAX_SUBMIT_WAITS ||
+        cmd->hdr.payload_size != sizeof(req) + npairs * sizeof(VkvgpuSyncSignal))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+
+    /* signal 后面紧跟 wait，格式一样，一起检查 slot */
+    const VkvgpuSyncSignal *signals =
+        vgpu_cmd_view(cmd, sizeof(req), npairs * sizeof(VkvgpuSyncSignal), 8);
+    if (!signals)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+    for (uint32_t i = 0; i < npairs; i++)
+    {
+        if (signals[i].slot >= VKVGPU_SYNC_SLOTS)
         {
-            printf("[daemon] bad magic: 0x%x\n", msg.header.magic);
-            break;
+            vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+            return;
         }
+    }
 
-        printf("[daemon] received cmd=%u payload=%u\n",
-               msg.header.cmd, msg.header.payload_size);
+    VgpuSyncPage *sp = vgpu_ctx_obj_lookup(ctx, req.page_id, VGPU_OBJ_SYNC_PAGE);
+    if (sp)
+    {
+        vgpu_mem_touch(sp->hd->phys_index, ctx->owner_pid);
+    }
+    VkResult r = sp ? vgpu_sync_submit(sp, signals, req.signal_count,
+                                       signals + req.signal_count, req.wait_count, NULL)
+                    : VK_ERROR_DEVICE_LOST;
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+}
 
-        int rc = 0;
+/* ------------------------------------------------------------
+ * compute 调度模板：建一次，之后每次调用只带变化
+ * ------------------------------------------------------------ */
 
-        switch (msg.header.cmd)
-        {
-        case VKVGPU_CMD_ENUM_PHYSICAL_DEVICES:
-        {
-            printf("[daemon] handle ENUM_PHYSICAL_DEVICES (hostvk)\n");
+static void destroy_template_obj(void *obj) { vgpu_template_put(obj); }
 
-            VkvgpuEnumPhysicalDevicesReplyPayload reply = {0};
-            uint64_t inst = msg.pl.enum_phys_devices.instance_handle;
+/* payload = 请求 + binding_count 个绑定 + code_size 字节 SPIR-V */
+static void cmd_create_dispatch_template(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuCreateTemplateRequestPayload req;
+    if (cmd->hdr.payload_size < sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    size_t bsize = (size_t)req.binding_count * sizeof(VkvgpuTemplateBinding);
+    if (req.binding_count > VKVGPU_TEMPLATE_MAX_BINDINGS || req.push_size > VKVGPU_TEMPLATE_MAX_PUSH ||
+        req.code_size == 0 || req.code_size % 4 != 0 || req.code_size > VKVGPU_TEMPLATE_MAX_CODE ||
+        cmd->hdr.payload_size != sizeof(req) + bsize + req.code_size)
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
 
-            reply.count = hostvk_enum_physical_devices(inst);
+    HVkDevice *hd = vgpu_ctx_obj_lookup(ctx, req.device_id, VGPU_OBJ_DEVICE);
+    if (!hd)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_DEVICE_LOST, NULL, 0);
+        return;
+    }
 
-            msg.header.payload_size = (uint32_t)sizeof(reply);
-            memcpy(&msg.payload, &reply, sizeof(reply));
+    /* SPIR-V 直接交给驱动，要 4 字节对齐；按协议布局本来就是对齐的，不用拷 */
+    const VkvgpuTemplateBinding *bindings = vgpu_cmd_view(cmd, sizeof(req), bsize, 8);
+    const uint32_t *code = vgpu_cmd_view(cmd, sizeof(req) + bsize, req.code_size, 4);
+    if (!bindings || !code)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
 
-            if (write_full(cfd,
-                           &msg,
-                           sizeof(msg.header) + msg.header.payload_size) < 0)
-            {
-                rc = -1;
-            }
-        }
-        break;
+    VgpuTemplate *t = NULL;
+    VkResult r = vgpu_template_create(hd, &req, bindings, code, (int)ctx->qos, &t);
+    if (r != VK_SUCCESS)
+    {
+        vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+        return;
+    }
+
+    VkvgpuCreateTemplateReplyPayload reply;
+    reply.writable = ~t->readonly & ((1u << req.binding_count) - 1);
+    reply.reserved = 0;
+    if (vgpu_ctx_obj_insert(ctx, req.template_id, VGPU_OBJ_TEMPLATE, t) != 0)
+    {
+        vgpu_template_put(t);
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+    vgpu_ctx_reply(ctx, cmd, 0, &reply, sizeof(reply));
+}
+
+static void cmd_destroy_dispatch_template(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuDestroyTemplateRequestPayload req;
+    if (cmd->hdr.payload_size != sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+
+    vgpu_template_put(vgpu_ctx_obj_remove(ctx, req.template_id, VGPU_OBJ_TEMPLATE));
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
+
+/* payload = 请求 + signal_count 个 signal + binding_count 个改了的绑定 + push_size 字节 */
+static void cmd_dispatch_template(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    VkvgpuDispatchTemplateRequestPayload req;
+    if (cmd->hdr.payload_size < sizeof(req))
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    memcpy(&req, cmd->payload, sizeof(req));
+    size_t ssize = (size_t)req.signal_count * sizeof(VkvgpuSyncSignal);
+    size_t bsize = (size_t)req.binding_count * sizeof(VkvgpuTemplateBinding);
+    if (req.signal_count > VKVGPU_MAX_SUBMIT_SIGNALS ||
+        req.binding_count > VKVGPU_TEMPLATE_MAX_BINDINGS || req.push_size > VKVGPU_TEMPLATE_MAX_PUSH ||
+        cmd->hdr.payload_size != sizeof(req) + ssize + bsize + req.push_size)
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
 
-        case VKVGPU_CMD_CREATE_INSTANCE:
+    const VkvgpuSyncSignal *signals = vgpu_cmd_view(cmd, sizeof(req), ssize, 8);
+    const VkvgpuTemplateBinding *bindings = vgpu_cmd_view(cmd, sizeof(req) + ssize, bsize, 8);
+    const uint8_t *push = cmd->payload + sizeof(req) + ssize + bsize;
+    if (!signals || !bindings)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_OUT_OF_HOST_MEMORY, NULL, 0);
+        return;
+    }
+    for (uint32_t i = 0; i < req.signal_count; i++)
+    {
+        if (signals[i].slot >= VKVGPU_SYNC_SLOTS)
         {
-            printf("[daemon] handle CREATE_INSTANCE (hostvk)\n");
+            vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+            return;
+        }
+    }
+
+    VgpuTemplate *t = vgpu_ctx_obj_lookup(ctx, req.template_id, VGPU_OBJ_TEMPLATE);
+    VgpuSyncPage *sp = vgpu_ctx_obj_lookup(ctx, req.page_id, VGPU_OBJ_SYNC_PAGE);
+    if (!t || !sp)
+    {
+        vgpu_ctx_reply(ctx, cmd, VK_ERROR_DEVICE_LOST, NULL, 0);
+        return;
+    }
+    if (vgpu_template_update(t, &req, bindings, push) != 0)
+    {
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
 
-            uint64_t h = hostvk_create_instance();
+    vgpu_mem_touch(sp->hd->phys_index, ctx->owner_pid);
+    VkResult r = vgpu_template_dispatch(t, ctx, sp, signals, req.signal_count);
+    vgpu_ctx_reply(ctx, cmd, r, NULL, 0);
+}
 
-            VkvgpuCreateInstanceReplyPayload reply = {
-                .instance_handle = h};
+/* 之前的命令都已按顺序执行完，回包里带上积压的异步错误 */
+static void cmd_sync(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+}
 
-            msg.header.payload_size = (uint32_t)sizeof(reply);
-            memcpy(&msg.payload, &reply, sizeof(reply));
+static void cmd_destroy_context(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    vgpu_ctx_reply(ctx, cmd, 0, NULL, 0);
+    vgpu_ctx_destroy(ctx->id);
+}
 
-            if (write_full(cfd,
-                           &msg,
-                           sizeof(msg.header) + msg.header.payload_size) < 0)
-            {
-                rc = -1;
-            }
+/* 命令 ID -> cmd_xxx，由 tools/gen_dispatch.py 生成 */
+#include "vgpu_cmd_table.h"
+
+/* 上下文内的命令，由调度 worker 按上下文顺序执行 */
+static void exec_ctx_cmd(VgpuContext *ctx, VgpuCmd *cmd)
+{
+    uint32_t id = VKVGPU_CMD_ID(cmd->hdr.cmd);
+
+    TRACE("[daemon] ctx=%u exec cmd=%u%s\n", ctx->id, id,
+          vgpu_cmd_is_async(cmd) ? " (async)" : "");
+
+    VgpuCmdHandler fn = id < VGPU_CMD_TABLE_SIZE ? vgpu_cmd_table[id] : NULL;
+    if (!fn)
+    {
+        printf("[daemon] ctx=%u unknown cmd=%u, reply status=-1\n", ctx->id, id);
+        vgpu_ctx_reply(ctx, cmd, -1, NULL, 0);
+        return;
+    }
+    fn(ctx, cmd);
+}
+
+/* 读线程：只负责收包，按 ctx_id 分发到各上下文队列 */
+static void handle_client(VgpuConn *conn)
+{
+    while (1)
+    {
+        VkvgpuHeader hdr;
+        ssize_t n = read_full(conn->fd, &hdr, sizeof(hdr));
+        if (n == 0)
+        {
+            printf("[daemon] client disconnected\n");
+            break;
+        }
+        else if (n < 0)
+        {
+            break;
+        }
+
+        if (hdr.magic != VKVGPU_MAGIC)
+        {
+            printf("[daemon] bad magic: 0x%x\n", hdr.magic);
+            break;
+        }
+
+        if (hdr.payload_size > VKVGPU_MAX_PAYLOAD)
+        {
+            printf("[daemon] payload too large: %u\n", hdr.payload_size);
+            break;
         }
-        break;
 
-        case VKVGPU_CMD_CREATE_DEVICE:
+        /* 超出给过的信用：先不读，等积压的命令执行掉 */
+        if (hdr.ctx_id != VKVGPU_CTX_NONE)
         {
-            printf("[daemon] handle CREATE_DEVICE (hostvk)\n");
+            vgpu_conn_credit_wait(conn, sizeof(hdr) + (uint64_t)hdr.payload_size, 1);
+        }
 
-            uint64_t inst = msg.pl.create_device.instance_handle;
-            uint64_t devh = hostvk_create_device(inst);
+        VgpuCmd *cmd = vgpu_cmd_alloc(conn, &hdr);
+        if (!cmd)
+        {
+            break;
+        }
 
-            VkvgpuCreateDeviceReplyPayload reply = {
-                .device_handle = devh};
+        if (hdr.payload_size &&
+            read_full(conn->fd, cmd->payload, hdr.payload_size) <= 0)
+        {
+            printf("[daemon] client closed while reading payload\n");
+            vgpu_cmd_free(cmd);
+            break;
+        }
 
-            msg.header.payload_size = (uint32_t)sizeof(reply);
-            memcpy(&msg.payload, &reply, sizeof(reply));
+        TRACE("[daemon] received ctx=%u cmd=%u payload=%u\n",
+              hdr.ctx_id, hdr.cmd, hdr.payload_size);
 
-            if (write_full(cfd,
-                           &msg,
-                           sizeof(msg.header) + msg.header.payload_size) < 0)
+        if (hdr.ctx_id == VKVGPU_CTX_NONE)
+        {
+            int rc = dispatch_global(conn, cmd);
+            vgpu_cmd_free(cmd);
+            if (rc < 0)
             {
-                rc = -1;
+                printf("[daemon] error while handling cmd, closing client\n");
+                break;
             }
+            continue;
         }
-        break;
 
-        default:
+        /* 上下文 ID 是连续分配的，只认创建它的进程：别人的上下文当作不存在 */
+        VgpuContext *ctx = vgpu_ctx_get(hdr.ctx_id);
+        if (ctx && ctx->owner_pid != conn->peer_pid)
         {
-            printf("[daemon] unknown cmd=%u, reply status=-1\n", msg.header.cmd);
-            VkvgpuReply reply;
-            memset(&reply, 0, sizeof(reply));
-            reply.status = -1;
-            reply.payload_size = 0;
-            if (write_full(cfd, &reply, sizeof(reply)) < 0)
+            printf("[daemon] pid=%d rejected: ctx=%u belongs to pid=%d\n",
+                   (int)conn->peer_pid, hdr.ctx_id, (int)ctx->owner_pid);
+            vgpu_ctx_put(ctx);
+            ctx = NULL;
+        }
+        if (!ctx)
+        {
+            printf("[daemon] unknown ctx=%u\n", hdr.ctx_id);
+            int async = vgpu_cmd_is_async(cmd);
+            vgpu_cmd_free(cmd);
+            if (!async && vgpu_conn_reply(conn, hdr.ctx_id, -1, NULL, 0) < 0)
             {
-                rc = -1;
+                break;
             }
-            break;
-        }
+            continue;
         }
 
-        if (rc < 0)
-        {
-            printf("[daemon] error while handling cmd, closing client\n");
-            break;
-        }
+        vgpu_ctx_submit(ctx, cmd);
+        vgpu_ctx_put(ctx);
+    }
+}
+
+static void *client_thread(void *arg)
+{
+    VgpuConn *conn = (VgpuConn *)arg;
+    /* 命令缓冲在这个线程里分配并写入，跟 guest 放在同一个节点 */
+    vgpu_numa_bind_thread(vgpu_numa_node_of_pid(conn->peer_pid));
+    handle_client(conn);
+    vgpu_conn_closed(conn);
+    vgpu_conn_put(conn);
+    return NULL;
+}
+
+/* ============================================================
+ *                空闲上下文休眠（VGPU_HIBERNATE_SEC）
+ * ============================================================ */
+
+static void hibernate_memory(void *obj, void *arg)
+{
+    uint64_t *freed = arg;
+    *freed += vgpu_mem_hibernate(obj);
+}
+
+static void hibernate_device(void *obj, void *arg)
+{
+    (void)arg;
+    hostvk_stream_trim(obj);
+}
+
+static void hold_memory(void *obj, void *arg)
+{
+    (void)arg;
+    vgpu_mem_hold(obj);
+}
+
+static void unhold_memory(void *obj, void *arg)
+{
+    (void)arg;
+    vgpu_mem_unhold(obj);
+}
+
+/*
+ * 在该上下文的 worker 里执行，不会和它的命令并发。内存先换出（要用 staging 环读回），
+ * 再释放 staging 环；下次读写时内存换回、环重建，guest 看不出来。
+ * 整个过程 hold 住这个 VM，别的 VM 的超分换出不会同时来换它的内存。
+ */
+static void hibernate_ctx(VgpuContext *ctx)
+{
+    uint64_t freed = 0;
+    vgpu_ctx_obj_foreach(ctx, VGPU_OBJ_MEMORY, hold_memory, NULL);
+    vgpu_ctx_obj_foreach(ctx, VGPU_OBJ_MEMORY, hibernate_memory, &freed);
+    vgpu_ctx_obj_foreach(ctx, VGPU_OBJ_DEVICE, hibernate_device, NULL);
+    vgpu_ctx_obj_foreach(ctx, VGPU_OBJ_MEMORY, unhold_memory, NULL);
+    if (freed)
+    {
+        printf("[daemon] ctx=%u idle, hibernated %llu MB of device memory\n",
+               ctx->id, (unsigned long long)(freed >> 20));
     }
 }
 
@@ -359,12 +1018,52 @@ static void handle_client(int cfd)
 
 int main(void)
 {
+    const char *trace = getenv("VGPU_TRACE");
+    g_trace = trace && atoi(trace) > 0;
+
     if (hostvk_init() != 0)
     {
         printf("Host Vulkan 初始化失败！\n");
         return -1;
     }
 
+    vgpu_obj_register_type(VGPU_OBJ_INSTANCE, destroy_instance_obj);
+    vgpu_obj_register_type(VGPU_OBJ_DEVICE, destroy_device_obj);
+    vgpu_obj_register_type(VGPU_OBJ_MEMORY, destroy_memory_obj);
+    vgpu_obj_register_type(VGPU_OBJ_SHM, destroy_shm_obj);
+    vgpu_obj_register_type(VGPU_OBJ_SWAPCHAIN, destroy_swapchain_obj);
+    vgpu_obj_register_type(VGPU_OBJ_SYNC_PAGE, destroy_sync_page_obj);
+    vgpu_obj_register_type(VGPU_OBJ_TEMPLATE, destroy_template_obj);
+
+    const char *idle = getenv("VGPU_HIBERNATE_SEC");
+    if (idle && atoi(idle) > 0)
+    {
+        vgpu_sched_set_idle((uint64_t)atoi(idle) * 1000000000ull, hibernate_ctx);
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpu < 2 ? 2 : (ncpu > 16 ? 16 : (unsigned)ncpu);
+    if (vgpu_sched_start(nworkers, exec_ctx_cmd) != 0)
+    {
+        return -1;
+    }
+
+    /* pipeline 编译吃 CPU，默认只占四分之一的核；起不来就在 worker 里同步编 */
+    const char *cthreads = getenv("VGPU_COMPILE_THREADS");
+    unsigned ncompile = cthreads ? (unsigned)atoi(cthreads) : (unsigned)(ncpu / 4);
+    if (ncompile == 0 && !cthreads)
+    {
+        ncompile = 1;
+    }
+    if (ncompile > 16)
+    {
+        ncompile = 16;
+    }
+    if (ncompile && vgpu_compile_start(ncompile) != 0)
+    {
+        printf("[daemon] compile pool unavailable, compiling pipelines inline\n");
+    }
+
     int sfd = setup_server_socket();
 
     while (1)
@@ -376,9 +1075,24 @@ int main(void)
             continue;
         }
 
-        printf("[daemon] client connected\n");
-        handle_client(cfd);
-        close(cfd);
+        VgpuConn *conn = vgpu_conn_open(cfd);
+        if (!conn)
+        {
+            close(cfd);
+            continue;
+        }
+
+        printf("[daemon] client connected, pid=%d\n", (int)conn->peer_pid);
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, client_thread, conn) != 0)
+        {
+            perror("[daemon] pthread_create");
+            vgpu_conn_closed(conn);
+            vgpu_conn_put(conn);
+            continue;
+        }
+        pthread_detach(tid);
     }
 
     close(sfd);
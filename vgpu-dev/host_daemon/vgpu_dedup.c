@@ -0,0 +1,203 @@
+// vgpu_dedup.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vgpu_dedup.h"
+
+#define LOG(...) printf("[dedup] " __VA_ARGS__)
+
+#define DEDUP_BUCKETS 256
+
+/* 一份共享的显存：fd 开着，后来的 VM 从它导入；最后一个引用放掉时关闭 */
+struct VgpuDedup {
+    VgpuDedup*   next;
+    uint32_t     gpu;
+    uint32_t     type_index;
+    VkDeviceSize size;
+    uint64_t     hash;
+    int          fd;
+    uint32_t     refs;          // 共用它的分配数，含最初导出的那个
+    uint32_t     pending;       // 其中正在导入、还没真正共用上的，不算进 g_saved
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static VgpuDedup*      g_buckets[DEDUP_BUCKETS];
+static uint64_t        g_saved;        // 各项 saved_locked() 之和
+
+/* 只用来找候选，命中后还要逐字节核对，不需要抗碰撞 */
+static uint64_t content_hash(const uint8_t* p, size_t n)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    for (; i < n; i++)
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    return h ^ (h >> 29);
+}
+
+static VgpuDedup** bucket(uint64_t hash)
+{
+    return &g_buckets[hash % DEDUP_BUCKETS];
+}
+
+static VgpuDedup* find_locked(uint32_t gpu, const HVkMemory* hm, uint64_t hash)
+{
+    for (VgpuDedup* d = *bucket(hash); d; d = d->next) {
+        if (d->hash == hash && d->gpu == gpu && d->size == hm->size &&
+            d->type_index == hm->type_index)
+            return d;
+    }
+    return NULL;
+}
+
+static void remove_locked(VgpuDedup* d)
+{
+    for (VgpuDedup** pp = bucket(d->hash); *pp; pp = &(*pp)->next) {
+        if (*pp == d) {
+            *pp = d->next;
+            break;
+        }
+    }
+}
+
+/* 这一份省下的显存：真正共用上的 n 个分配只占一份 */
+static uint64_t saved_locked(const VgpuDedup* d)
+{
+    uint32_t n = d->refs - d->pending;
+    return n > 1 ? (uint64_t)(n - 1) * d->size : 0;
+}
+
+/*
+ * 放掉一个引用（pending：导入失败的那个，从没算进 g_saved）；
+ * 最后一个时从表里摘下，返回 1，由调用者在锁外关 fd、释放
+ */
+static int put_locked(VgpuDedup* d, int pending)
+{
+    g_saved -= saved_locked(d);
+    d->refs--;
+    if (pending) d->pending--;
+    if (!d->refs) {
+        remove_locked(d);
+        return 1;
+    }
+    g_saved += saved_locked(d);
+    return 0;
+}
+
+static void entry_free(VgpuDedup* d)
+{
+    close(d->fd);
+    free(d);
+}
+
+/* 表里没有：导出自己，登记成别人可以导入的那份 */
+static VgpuDedup* share_new(HVkMemory* hm, uint32_t gpu, uint64_t hash)
+{
+    VgpuDedup* d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    VkResult r = hostvk_memory_export_fd(hm, &d->fd);
+    if (r != VK_SUCCESS) {
+        LOG("导出失败: %d\n", r);
+        free(d);
+        return NULL;
+    }
+    d->gpu        = gpu;
+    d->type_index = hm->type_index;
+    d->size       = hm->size;
+    d->hash       = hash;
+    d->refs       = 1;
+
+    /* 同一内容并发登记了两份也无妨，后来的只会找到其中一份 */
+    pthread_mutex_lock(&g_lock);
+    d->next = *bucket(hash);
+    *bucket(hash) = d;
+    pthread_mutex_unlock(&g_lock);
+    return d;
+}
+
+VgpuDedup* vgpu_dedup_share(HVkMemory* hm, uint32_t gpu)
+{
+    if (!hostvk_memory_exportable(hm) || hm->shared) return NULL;
+
+    uint8_t* data = malloc(hm->size ? hm->size : 1);
+    if (!data) return NULL;
+    VkResult r = hostvk_memory_read_all(hm, data);
+    if (r != VK_SUCCESS) {
+        free(data);
+        return NULL;
+    }
+    uint64_t hash = content_hash(data, hm->size);
+
+    /* 先占一个引用，导入期间它不会被关掉 */
+    pthread_mutex_lock(&g_lock);
+    VgpuDedup* d = find_locked(gpu, hm, hash);
+    if (d) {
+        d->refs++;
+        d->pending++;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (!d) {
+        d = share_new(hm, gpu, hash);
+        free(data);
+        return d;
+    }
+
+    r = hostvk_memory_import_fd(hm, d->fd, data);
+    free(data);
+
+    pthread_mutex_lock(&g_lock);
+    if (r == VK_SUCCESS) {
+        g_saved -= saved_locked(d);
+        d->pending--;
+        g_saved += saved_locked(d);
+        LOG("gpu %u: 共用 %llu KB（%u 份），共省下 %llu MB\n", gpu,
+            (unsigned long long)(d->size >> 10), d->refs, (unsigned long long)(g_saved >> 20));
+        pthread_mutex_unlock(&g_lock);
+        return d;
+    }
+    int last = put_locked(d, 1);
+    pthread_mutex_unlock(&g_lock);
+    if (last) entry_free(d);
+
+    if (r == VK_INCOMPLETE) LOG("哈希相同但内容不同，不共享\n");
+    else                    LOG("导入失败: %d\n", r);
+    return NULL;
+}
+
+VkResult vgpu_dedup_unshare(VgpuDedup* d, HVkMemory* hm)
+{
+    /* 只剩自己：摘掉登记就没人能再导入，原地写即可 */
+    pthread_mutex_lock(&g_lock);
+    int alone = d->refs == 1;
+    if (alone) remove_locked(d);
+    pthread_mutex_unlock(&g_lock);
+    if (alone) {
+        entry_free(d);
+        hm->shared = 0;
+        return VK_SUCCESS;
+    }
+
+    /* 还有别人在用：内容拷到 host 副本，放掉这边的引用 */
+    VkResult r = hostvk_memory_evict(hm);
+    if (r != VK_SUCCESS) return r;
+    vgpu_dedup_put(d);
+    return VK_SUCCESS;
+}
+
+void vgpu_dedup_put(VgpuDedup* d)
+{
+    if (!d) return;
+    pthread_mutex_lock(&g_lock);
+    int last = put_locked(d, 0);
+    pthread_mutex_unlock(&g_lock);
+    if (last) entry_free(d);
+}
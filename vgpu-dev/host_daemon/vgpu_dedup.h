@@ -0,0 +1,29 @@
+// vgpu_dedup.h
+// 跨 VM 去重：很多 VM 跑同一个程序，上传同样的纹理/网格/权重。
+// 上传完不再写、又被只读使用的 device-local 内存按内容哈希登记，
+// 同一块 GPU 上内容相同的分配共用一份显存（opaque fd 导出再导入到各 VM 的 device）。
+// 哈希命中后逐字节核对才共享；共享的内存一旦要写，先换成自己的一份（写时复制）。
+// 默认关闭，VGPU_MEM_DEDUP=1 打开（host_vulkan.c 据此给 device 开 external memory）。
+#pragma once
+#include <stdint.h>
+
+#include "host_vulkan.h"
+
+typedef struct VgpuDedup VgpuDedup;
+
+/*
+ * 读出 hm 的内容查重：有相同内容的就换成那一份，没有就登记自己，都返回登记项；
+ * 不能共享（device 没开导出、内容不同、出错）返回 NULL，hm 不变。
+ * hm 上不能有在途的 GPU 工作。
+ */
+VgpuDedup* vgpu_dedup_share(HVkMemory* hm, uint32_t gpu);
+
+/*
+ * 要写之前调用，让 hm 不再和别人共用：只剩自己时直接注销登记，
+ * 否则把 hm 换出（内容留在 host 副本里），调用者换回时得到自己的一份。
+ * 失败时 d 仍然有效。hm 上不能有在途的 GPU 工作。
+ */
+VkResult   vgpu_dedup_unshare(VgpuDedup* d, HVkMemory* hm);
+
+/* hm 已经释放，放掉它对登记项的引用 */
+void       vgpu_dedup_put(VgpuDedup* d);
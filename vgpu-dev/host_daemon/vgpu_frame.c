@@ -0,0 +1,248 @@
+// vgpu_frame.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vgpu_frame.h"
+
+#define LOG(...) printf("[frame] " __VA_ARGS__)
+
+/* ----------------------------------------------
+ * tile 哈希
+ * 8 条 32 位 lane 的 xxh32 轮函数，每 32 字节一轮，行尾不足 32 字节的
+ * 字按下标落到对应 lane。AVX2 / SSE4.1 / 标量三个版本结果相同，启动时选一次。
+ * ---------------------------------------------- */
+
+#define H_PRIME1 0x9E3779B1u
+#define H_PRIME2 0x85EBCA77u
+#define H_LANES  8
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static void lanes_init(uint32_t acc[H_LANES])
+{
+    for (int l = 0; l < H_LANES; l++)
+        acc[l] = H_PRIME1 * (uint32_t)(l + 1);
+}
+
+/* 整块以外的尾巴，以及标量版本的全部 */
+static void lanes_tail(uint32_t acc[H_LANES], const uint8_t* p, size_t words)
+{
+    for (size_t i = 0; i < words; i++) {
+        uint32_t v;
+        memcpy(&v, p + i * 4, 4);
+        uint32_t* a = &acc[i % H_LANES];
+        *a = rotl32(*a + v * H_PRIME2, 13) * H_PRIME1;
+    }
+}
+
+static uint64_t lanes_final(const uint32_t acc[H_LANES])
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int l = 0; l < H_LANES; l++)
+        h = (h ^ acc[l]) * 0x100000001b3ull;
+    return h;
+}
+
+typedef uint64_t (*TileHashFn)(const uint8_t* p, size_t stride, size_t row_bytes, uint32_t rows);
+
+static uint64_t tile_hash_scalar(const uint8_t* p, size_t stride, size_t row_bytes, uint32_t rows)
+{
+    uint32_t acc[H_LANES];
+    lanes_init(acc);
+    for (uint32_t y = 0; y < rows; y++, p += stride) {
+        size_t blocks = row_bytes / 32;
+        lanes_tail(acc, p, blocks * H_LANES);
+        lanes_tail(acc, p + blocks * 32, (row_bytes % 32) / 4);
+    }
+    return lanes_final(acc);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static uint64_t tile_hash_avx2(const uint8_t* p, size_t stride, size_t row_bytes, uint32_t rows)
+{
+    uint32_t acc[H_LANES];
+    lanes_init(acc);
+    __m256i a  = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i p1 = _mm256_set1_epi32((int)H_PRIME1);
+    __m256i p2 = _mm256_set1_epi32((int)H_PRIME2);
+    size_t blocks = row_bytes / 32;
+
+    for (uint32_t y = 0; y < rows; y++, p += stride) {
+        for (size_t b = 0; b < blocks; b++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + b * 32));
+            a = _mm256_add_epi32(a, _mm256_mullo_epi32(v, p2));
+            a = _mm256_or_si256(_mm256_slli_epi32(a, 13), _mm256_srli_epi32(a, 19));
+            a = _mm256_mullo_epi32(a, p1);
+        }
+        if (row_bytes % 32) {
+            _mm256_storeu_si256((__m256i*)acc, a);
+            lanes_tail(acc, p + blocks * 32, (row_bytes % 32) / 4);
+            a = _mm256_loadu_si256((const __m256i*)acc);
+        }
+    }
+    _mm256_storeu_si256((__m256i*)acc, a);
+    return lanes_final(acc);
+}
+
+/* 两个 128 位寄存器拼成 8 条 lane */
+__attribute__((target("sse4.1")))
+static uint64_t tile_hash_sse41(const uint8_t* p, size_t stride, size_t row_bytes, uint32_t rows)
+{
+    uint32_t acc[H_LANES];
+    lanes_init(acc);
+    __m128i lo = _mm_loadu_si128((const __m128i*)acc);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(acc + 4));
+    __m128i p1 = _mm_set1_epi32((int)H_PRIME1);
+    __m128i p2 = _mm_set1_epi32((int)H_PRIME2);
+    size_t blocks = row_bytes / 32;
+
+    for (uint32_t y = 0; y < rows; y++, p += stride) {
+        for (size_t b = 0; b < blocks; b++) {
+            __m128i v0 = _mm_loadu_si128((const __m128i*)(p + b * 32));
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(p + b * 32 + 16));
+            lo = _mm_add_epi32(lo, _mm_mullo_epi32(v0, p2));
+            hi = _mm_add_epi32(hi, _mm_mullo_epi32(v1, p2));
+            lo = _mm_or_si128(_mm_slli_epi32(lo, 13), _mm_srli_epi32(lo, 19));
+            hi = _mm_or_si128(_mm_slli_epi32(hi, 13), _mm_srli_epi32(hi, 19));
+            lo = _mm_mullo_epi32(lo, p1);
+            hi = _mm_mullo_epi32(hi, p1);
+        }
+        if (row_bytes % 32) {
+            _mm_storeu_si128((__m128i*)acc, lo);
+            _mm_storeu_si128((__m128i*)(acc + 4), hi);
+            lanes_tail(acc, p + blocks * 32, (row_bytes % 32) / 4);
+            lo = _mm_loadu_si128((const __m128i*)acc);
+            hi = _mm_loadu_si128((const __m128i*)(acc + 4));
+        }
+    }
+    _mm_storeu_si128((__m128i*)acc, lo);
+    _mm_storeu_si128((__m128i*)(acc + 4), hi);
+    return lanes_final(acc);
+}
+#endif
+
+static TileHashFn g_tile_hash;
+
+static TileHashFn tile_hash_select(void)
+{
+    if (g_tile_hash) return g_tile_hash;
+
+    TileHashFn fn = tile_hash_scalar;
+    const char* name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fn = tile_hash_avx2;
+        name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        fn = tile_hash_sse41;
+        name = "sse4.1";
+    }
+#endif
+    /* 几个 worker 同时初始化也只是重复选一次，结果一样 */
+    __atomic_store_n(&g_tile_hash, fn, __ATOMIC_RELEASE);
+    LOG("tile hash: %s\n", name);
+    return fn;
+}
+
+/* ----------------------------------------------
+ * 帧缓冲
+ * ---------------------------------------------- */
+
+VgpuFrame* vgpu_frame_create(uint32_t width, uint32_t height, uint32_t format, int node)
+{
+    if (width == 0 || height == 0 ||
+        width > VKVGPU_MAX_SWAPCHAIN_EXTENT || height > VKVGPU_MAX_SWAPCHAIN_EXTENT)
+        return NULL;
+
+    const VgpuFormatEmu* fmt = vgpu_format_lookup((VkFormat)format);
+    if (!fmt) return NULL;
+    tile_hash_select();
+
+    VgpuFrame* frame = calloc(1, sizeof(*frame));
+    if (!frame) return NULL;
+    frame->convert = fmt->readback;
+
+    uint32_t tiles_x = (width  + VKVGPU_FRAME_TILE - 1) / VKVGPU_FRAME_TILE;
+    uint32_t tiles_y = (height + VKVGPU_FRAME_TILE - 1) / VKVGPU_FRAME_TILE;
+    frame->hashes = calloc((size_t)tiles_x * tiles_y, sizeof(uint64_t));
+    frame->shm = vgpu_shm_create("vgpu-frame",
+                                 VKVGPU_FRAME_HEADER_SIZE + (size_t)width * fmt->guest_bpp * height, node);
+    if (!frame->hashes || !frame->shm) {
+        vgpu_frame_destroy(frame);
+        return NULL;
+    }
+
+    frame->hdr    = frame->shm->ptr;
+    frame->pixels = (uint8_t*)frame->shm->ptr + VKVGPU_FRAME_HEADER_SIZE;
+
+    VkvgpuFrameHeader* hdr = frame->hdr;
+    hdr->width     = width;
+    hdr->height    = height;
+    hdr->stride    = width * fmt->guest_bpp;
+    hdr->format    = format;
+    hdr->tile_size = VKVGPU_FRAME_TILE;
+    hdr->tiles_x   = tiles_x;
+    hdr->tiles_y   = tiles_y;
+    return frame;
+}
+
+void vgpu_frame_destroy(VgpuFrame* frame)
+{
+    if (!frame) return;
+    vgpu_shm_destroy(frame->shm);
+    free(frame->hashes);
+    free(frame);
+}
+
+uint32_t vgpu_frame_update(VgpuFrame* frame, uint32_t image_index, const uint8_t* src)
+{
+    VkvgpuFrameHeader* hdr = frame->hdr;
+    TileHashFn hash = g_tile_hash;
+    size_t stride = (size_t)hdr->width * 4;   // 读回的 host 图像
+    size_t dst_stride = hdr->stride;
+    size_t bpp = dst_stride / hdr->width;
+    uint32_t damaged = 0;
+
+    for (uint32_t ty = 0; ty < hdr->tiles_y; ty++) {
+        uint32_t y0   = ty * VKVGPU_FRAME_TILE;
+        uint32_t rows = hdr->height - y0 < VKVGPU_FRAME_TILE ? hdr->height - y0 : VKVGPU_FRAME_TILE;
+
+        for (uint32_t tx = 0; tx < hdr->tiles_x; tx++) {
+            uint32_t x0    = tx * VKVGPU_FRAME_TILE;
+            uint32_t cols  = hdr->width - x0 < VKVGPU_FRAME_TILE ? hdr->width - x0 : VKVGPU_FRAME_TILE;
+            size_t   off   = (size_t)y0 * stride + (size_t)x0 * 4;
+            size_t   doff  = (size_t)y0 * dst_stride + (size_t)x0 * bpp;
+            uint32_t tile  = ty * hdr->tiles_x + tx;
+
+            uint64_t h = hash(src + off, stride, (size_t)cols * 4, rows);
+            if (frame->valid && h == frame->hashes[tile])
+                continue;
+            frame->hashes[tile] = h;
+
+            for (uint32_t y = 0; y < rows; y++) {
+                uint8_t*       d = frame->pixels + doff + y * dst_stride;
+                const uint8_t* s = src + off + y * stride;
+                if (frame->convert) frame->convert(d, s, cols);
+                else                memcpy(d, s, (size_t)cols * 4);
+            }
+            __atomic_fetch_or(&hdr->damage[tile / 64], 1ull << (tile % 64), __ATOMIC_RELAXED);
+            damaged++;
+        }
+    }
+    frame->valid = 1;
+
+    hdr->image_index = image_index;
+    hdr->damaged     = damaged;
+    /* 像素和位图在 seq 之前可见 */
+    __atomic_add_fetch(&hdr->seq, 1, __ATOMIC_RELEASE);
+    vgpu_futex_wake(&hdr->seq);
+    return damaged;
+}
@@ -0,0 +1,28 @@
+// vgpu_frame.h
+// 无头 swapchain 的共享帧缓冲：present 的图像按 tile 算哈希，
+// 只有哈希变了的 tile 才拷进帧缓冲并记进 damage 位图（布局见 VkvgpuFrameHeader）。
+#pragma once
+#include <stdint.h>
+
+#include "../guest_icd/vk_virtio_proto.h"
+#include "vgpu_shm.h"
+#include "vgpu_convert.h"
+
+typedef struct {
+    VgpuShm*           shm;
+    VkvgpuFrameHeader* hdr;
+    uint8_t*           pixels;
+    uint64_t*          hashes;    // 每个 tile 上一帧的哈希（按 host 图像的像素算）
+    VgpuConvertFn      convert;   // host 像素 -> 帧缓冲格式，NULL = 直接拷
+    int                valid;     // 第一帧之前 hashes 无意义，整帧都算 damage
+} VgpuFrame;
+
+/* format 是 guest 的格式，帧缓冲按它排列；模拟不了的格式返回 NULL */
+VgpuFrame* vgpu_frame_create(uint32_t width, uint32_t height, uint32_t format, int node);
+void       vgpu_frame_destroy(VgpuFrame* frame);
+
+/*
+ * src 是 host 图像读回的一帧，紧密排列（每行 width * 4 字节）。
+ * 变了的 tile 拷进帧缓冲，seq++ 并唤醒消费者；返回变了的 tile 数。
+ */
+uint32_t vgpu_frame_update(VgpuFrame* frame, uint32_t image_index, const uint8_t* src);
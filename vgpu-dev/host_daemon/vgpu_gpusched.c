@@ -0,0 +1,260 @@
+// vgpu_gpusched.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vgpu_gpusched.h"
+#include "vgpu_numa.h"
+
+#define LOG(...) printf("[sched] " __VA_ARGS__)
+
+#define SCHED_MAX_GPUS     8
+/* GPU 上同时在途的提交数；太多则调度失去意义，太少则 GPU 会在两次提交之间空转 */
+#define SCHED_MAX_INFLIGHT 2
+/* 每次提交至少记这么多，空提交也有开销，也避免 0 成本的 VM 永远排在最前 */
+#define SCHED_MIN_COST_NS  20000ull
+#define SCHED_MAX_LEVELS   4
+/* 有 VM 的队头在等 semaphore 时调度线程的轮询间隔：guest 的 vkSignalSemaphore 直接写页，不通知 daemon */
+#define SCHED_POLL_NS      500000ull
+
+struct VgpuTenant {
+    struct VgpuTenant* next;
+    uint32_t    gpu;
+    pid_t       vm;
+    uint32_t    refs;
+    uint32_t    level;         // QoS 优先级，0 最高
+    uint32_t    weight;
+    uint64_t    vtime;         // 虚拟时间：累计 GPU 时间 / 权重
+    uint64_t    gpu_ns;        // 累计 GPU 时间，退出时打印
+    uint64_t    submits;
+    uint64_t    queued;        // 排进来的提交数
+    uint64_t    popped;        // 调度线程取走的提交数，flush 据此判断
+    VgpuGpuJob* head;
+    VgpuGpuJob* tail;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  flushed;   // 一次 dispatch 做完，flush_vm 在等
+    int             started;
+    pthread_t       thread;
+    uint32_t        id;
+    VgpuTenant*     tenants;
+    VgpuTenant*     current;   // 调度线程正在锁外 dispatch 的提交属于谁
+    uint32_t        inflight;
+    uint64_t        vclock[SCHED_MAX_LEVELS];   // 各优先级最近一次被选中的 VM 的虚拟时间
+} VgpuGpuSched;
+
+static VgpuGpuSched g_gpus[SCHED_MAX_GPUS];
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static void sched_init(void)
+{
+    for (uint32_t i = 0; i < SCHED_MAX_GPUS; i++) {
+        pthread_mutex_init(&g_gpus[i].lock, NULL);
+        pthread_cond_init(&g_gpus[i].cond, NULL);
+        pthread_cond_init(&g_gpus[i].flushed, NULL);
+        g_gpus[i].id = i;
+    }
+}
+
+static VgpuGpuSched* sched_of(uint32_t gpu)
+{
+    pthread_once(&g_once, sched_init);
+    return &g_gpus[gpu % SCHED_MAX_GPUS];
+}
+
+static int head_blocked(const VgpuTenant* t)
+{
+    return t->head && t->head->ready && !t->head->ready(t->head);
+}
+
+/* 有提交可以开始的 VM 里优先级最高的，同级里虚拟时间最小的；*blocked 置上表示有 VM 在等 */
+static VgpuTenant* pick_locked(VgpuGpuSched* s, int* blocked)
+{
+    VgpuTenant* best = NULL;
+    *blocked = 0;
+    for (VgpuTenant* t = s->tenants; t; t = t->next) {
+        if (!t->head) continue;
+        if (head_blocked(t)) {
+            *blocked = 1;
+            continue;
+        }
+        if (!best || t->level < best->level ||
+            (t->level == best->level && t->vtime < best->vtime))
+            best = t;
+    }
+    return best;
+}
+
+static void* sched_thread(void* arg)
+{
+    VgpuGpuSched* s = arg;
+    vgpu_numa_bind_thread(vgpu_numa_gpu_node(s->id));
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        VgpuTenant* t = NULL;
+        int blocked = 0;
+        while (s->inflight >= SCHED_MAX_INFLIGHT || !(t = pick_locked(s, &blocked))) {
+            if (!blocked || s->inflight >= SCHED_MAX_INFLIGHT) {
+                pthread_cond_wait(&s->cond, &s->lock);
+                continue;
+            }
+            /* 等的值大多由本 GPU 上的提交完成时写，complete 会唤醒；guest 直接写的靠轮询 */
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += SCHED_POLL_NS;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_nsec -= 1000000000L;
+                ts.tv_sec++;
+            }
+            pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+        }
+
+        VgpuGpuJob* job = t->head;
+        t->head = job->next;
+        if (!t->head) t->tail = NULL;
+        t->popped++;
+        s->vclock[t->level] = t->vtime;
+        s->inflight++;
+        s->current = t;
+        pthread_mutex_unlock(&s->lock);
+
+        /* dispatch 之后 t 可能已被释放（提交完成、sync page 销毁），只清指针不再碰它 */
+        job->dispatch(job);
+
+        pthread_mutex_lock(&s->lock);
+        s->current = NULL;
+        pthread_cond_broadcast(&s->flushed);
+    }
+    return NULL;
+}
+
+VgpuTenant* vgpu_tenant_get(uint32_t gpu, pid_t vm)
+{
+    VgpuGpuSched* s = sched_of(gpu);
+
+    pthread_mutex_lock(&s->lock);
+    VgpuTenant* t;
+    for (t = s->tenants; t; t = t->next)
+        if (t->vm == vm) break;
+    if (t) {
+        t->refs++;
+        pthread_mutex_unlock(&s->lock);
+        return t;
+    }
+
+    if (!s->started) {
+        if (pthread_create(&s->thread, NULL, sched_thread, s) != 0) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        pthread_detach(s->thread);
+        s->started = 1;
+    }
+    t = calloc(1, sizeof(*t));
+    if (t) {
+        t->gpu    = s->id;
+        t->vm     = vm;
+        t->refs   = 1;
+        t->weight = VGPU_SCHED_DEFAULT_WEIGHT;
+        t->next   = s->tenants;
+        s->tenants = t;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return t;
+}
+
+/* 调用者保证该 VM 已没有排队或在途的提交 */
+void vgpu_tenant_put(VgpuTenant* t)
+{
+    if (!t) return;
+    VgpuGpuSched* s = sched_of(t->gpu);
+
+    pthread_mutex_lock(&s->lock);
+    if (--t->refs > 0) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    for (VgpuTenant** pp = &s->tenants; *pp; pp = &(*pp)->next) {
+        if (*pp == t) {
+            *pp = t->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    LOG("gpu %u vm %d: %llu 次提交, GPU 时间 %.1f ms\n", t->gpu, (int)t->vm,
+        (unsigned long long)t->submits, (double)t->gpu_ns / 1e6);
+    free(t);
+}
+
+void vgpu_tenant_set_qos(VgpuTenant* t, uint32_t level, uint32_t weight)
+{
+    VgpuGpuSched* s = sched_of(t->gpu);
+    pthread_mutex_lock(&s->lock);
+    t->level  = level < SCHED_MAX_LEVELS ? level : SCHED_MAX_LEVELS - 1;
+    t->weight = weight ? weight : 1;
+    if (t->vtime < s->vclock[t->level]) t->vtime = s->vclock[t->level];
+    pthread_mutex_unlock(&s->lock);
+}
+
+void vgpu_gpusched_enqueue(VgpuGpuJob* job)
+{
+    VgpuTenant*   t = job->tenant;
+    VgpuGpuSched* s = sched_of(t->gpu);
+    job->next = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (t->tail) {
+        t->tail->next = job;
+    } else {
+        /* 闲了一阵重新有活的 VM 从当前虚拟时钟开始，不能拿空闲时攒下的额度插队 */
+        if (t->vtime < s->vclock[t->level]) t->vtime = s->vclock[t->level];
+        t->head = job;
+    }
+    t->tail = job;
+    t->queued++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void vgpu_gpusched_complete(VgpuTenant* t, uint64_t gpu_ns)
+{
+    VgpuGpuSched* s = sched_of(t->gpu);
+    uint64_t cost = gpu_ns > SCHED_MIN_COST_NS ? gpu_ns : SCHED_MIN_COST_NS;
+
+    pthread_mutex_lock(&s->lock);
+    t->vtime  += cost * VGPU_SCHED_DEFAULT_WEIGHT / t->weight;
+    t->gpu_ns += gpu_ns;
+    t->submits++;
+    s->inflight--;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void vgpu_gpusched_flush_vm(uint32_t gpu, pid_t vm)
+{
+    VgpuGpuSched* s = sched_of(gpu);
+
+    pthread_mutex_lock(&s->lock);
+    VgpuTenant* t;
+    for (t = s->tenants; t; t = t->next)
+        if (t->vm == vm) break;
+    if (!t) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    /* 同一 VM 的提交按顺序 dispatch：取走的数追上 target、且没有正在 dispatch 的就齐了 */
+    uint64_t target = t->queued;
+    t->refs++;
+    while ((t->popped < target && !head_blocked(t)) || s->current == t)
+        pthread_cond_wait(&s->flushed, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    vgpu_tenant_put(t);
+}
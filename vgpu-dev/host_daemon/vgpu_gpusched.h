@@ -0,0 +1,42 @@
+// vgpu_gpusched.h
+// 跨 VM 的 GPU 时间片调度：guest 的队列提交按 VM 排队，每块物理 GPU 一个调度线程，
+// 先按 QoS 优先级、同级内按加权公平排队（WFQ）挑下一个提交；记账用提交完成后读回的 GPU 时间戳，
+// 而不是命令字节数，一个重负载的 VM 不会把同一块 GPU 上的其他 VM 饿死。
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct VgpuTenant VgpuTenant;
+
+/*
+ * 一次待调度的提交；dispatch 在调度线程里调用，负责真正提交给 host 队列。
+ * ready 可为 NULL；返回 0 时（在等 semaphore）这个 VM 的队列停在这里，调度线程隔一会儿再看。
+ */
+typedef struct VgpuGpuJob {
+    struct VgpuGpuJob* next;
+    VgpuTenant*        tenant;
+    void             (*dispatch)(struct VgpuGpuJob* job);
+    int              (*ready)(struct VgpuGpuJob* job);
+} VgpuGpuJob;
+
+#define VGPU_SCHED_DEFAULT_WEIGHT 100
+
+/* (GPU, VM) 对应的调度实体，带引用；VM 以 guest 进程的 pid 区分 */
+VgpuTenant* vgpu_tenant_get(uint32_t gpu, pid_t vm);
+void        vgpu_tenant_put(VgpuTenant* t);
+/*
+ * level 越小越优先：有更高 level 的提交在排队时低 level 的不会被 dispatch；
+ * 同一 level 内按 weight 分 GPU 时间。
+ */
+void        vgpu_tenant_set_qos(VgpuTenant* t, uint32_t level, uint32_t weight);
+
+/* 提交排进 VM 自己的队列，同一 VM 的提交按顺序 dispatch */
+void vgpu_gpusched_enqueue(VgpuGpuJob* job);
+/* dispatch 出去的提交完成（或提交失败）后调用，gpu_ns 记到 VM 的账上 */
+void vgpu_gpusched_complete(VgpuTenant* t, uint64_t gpu_ns);
+/*
+ * 等该 VM 在这块 GPU 上已经排队的提交都 dispatch 给 host 队列：之后直接提交到同一
+ * host 队列的拷贝（staging 环读写、换出）排在它们后面。VM 在这块 GPU 上没有提交时立即返回；
+ * 队头在等 semaphore 时也返回，guest 还没让它开始，不能依赖它的结果。
+ */
+void vgpu_gpusched_flush_vm(uint32_t gpu, pid_t vm);
@@ -0,0 +1,398 @@
+// vgpu_memquota.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vgpu_memquota.h"
+#include "vgpu_qos.h"
+#include "vgpu_gpusched.h"
+
+#define LOG(...) printf("[memq] " __VA_ARGS__)
+
+/* 这么久没有读写、没有提交的 VM 才算空闲，才会被换出 */
+#define EVICT_IDLE_NS (2000ull * 1000000ull)
+
+/* 写完这么久没再写才算上传完了，才去查重；太小的不值得读一遍 */
+#define DEDUP_SETTLE_NS (1000ull * 1000000ull)
+#define DEDUP_MIN_SIZE  (64u << 10)
+
+struct VgpuVmMem {
+    struct VgpuVmMem* next;
+    uint32_t  gpu;
+    pid_t     vm;
+    uint32_t  refs;          // 每个分配一个
+    uint64_t  quota;         // 0 = 不限
+    uint64_t  used;          // 已记账的 device-local 字节，含已换出的
+    uint32_t  busy;          // 各分配 busy 之和
+    uint32_t  hold;          // 正在休眠的上下文数，见 vgpu_mem_hold
+    uint64_t  last_use_ns;
+    VgpuMem*  mems;
+};
+
+/* 分配表、记账都在这把锁下；换出、换回在锁外做（分配已标 busy） */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static VgpuVmMem*      g_vms;
+static int             g_overcommit;
+static const char*     g_spill_dir;     // 休眠换出的内容落盘到这里，NULL = 留在内存
+static pthread_once_t  g_once = PTHREAD_ONCE_INIT;
+/* 共享内存上的在途调用做完了（写时复制在等）、超分换出完了（acquire / free 在等） */
+static pthread_cond_t  g_unpinned = PTHREAD_COND_INITIALIZER;
+
+static void memquota_init(void)
+{
+    const char* env = getenv("VGPU_MEM_OVERCOMMIT");
+    g_overcommit = env && atoi(env) != 0;
+    if (g_overcommit) LOG("显存超分已开启，空闲 VM 的内存可被换出\n");
+    g_spill_dir = getenv("VGPU_HIBERNATE_DIR");
+    if (g_spill_dir && !*g_spill_dir) g_spill_dir = NULL;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static VgpuVmMem* vm_find_locked(uint32_t gpu, pid_t vm)
+{
+    for (VgpuVmMem* v = g_vms; v; v = v->next)
+        if (v->gpu == gpu && v->vm == vm) return v;
+    return NULL;
+}
+
+static VgpuVmMem* vm_get_locked(uint32_t gpu, pid_t vm)
+{
+    VgpuVmMem* v = vm_find_locked(gpu, vm);
+    if (!v) {
+        v = calloc(1, sizeof(*v));
+        if (!v) return NULL;
+        v->gpu   = gpu;
+        v->vm    = vm;
+        v->quota = vgpu_qos_mem_quota(vm);
+        v->next  = g_vms;
+        g_vms    = v;
+    }
+    v->refs++;
+    return v;
+}
+
+static void vm_put_locked(VgpuVmMem* v)
+{
+    if (--v->refs) return;
+    for (VgpuVmMem** pp = &g_vms; *pp; pp = &(*pp)->next) {
+        if (*pp == v) {
+            *pp = v->next;
+            break;
+        }
+    }
+    free(v);
+}
+
+/* 最久没用过、还有常驻 device-local 内存的空闲 VM */
+static VgpuVmMem* pick_victim_locked(uint32_t gpu, const VgpuVmMem* self, uint64_t now)
+{
+    VgpuVmMem* best = NULL;
+    for (VgpuVmMem* v = g_vms; v; v = v->next) {
+        if (v->gpu != gpu || v == self || v->busy || v->hold) continue;
+        if (now - v->last_use_ns < EVICT_IDLE_NS) continue;
+        int resident = 0;
+        for (VgpuMem* m = v->mems; m && !resident; m = m->next)
+            resident = m->charged && !m->hm->evicted && !m->dedup;
+        if (resident && (!best || v->last_use_ns < best->last_use_ns))
+            best = v;
+    }
+    return best;
+}
+
+#define EVICT_BATCH 16
+
+/*
+ * 换出别的 VM 的内存，直到腾出 need 字节或没有可换的；返回腾出的字节数。
+ * 在锁内选一批标上 evicting 并占住，锁外读回：读回要等 GPU，不能让所有 VM 的
+ * 分配、acquire 都卡在 g_lock 上。受害 VM 自己的 acquire / free 等 evicting 清掉。
+ */
+static uint64_t make_room(uint32_t gpu, uint64_t need, const VgpuVmMem* self)
+{
+    if (!g_overcommit) return 0;
+
+    uint64_t freed = 0;
+    pthread_mutex_lock(&g_lock);
+    uint64_t now = monotonic_ns();
+    VgpuVmMem* v;
+    while (freed < need && (v = pick_victim_locked(gpu, self, now))) {
+        VgpuMem* batch[EVICT_BATCH];
+        uint32_t n = 0;
+        uint64_t want = 0;
+        for (VgpuMem* m = v->mems; m && n < EVICT_BATCH && freed + want < need; m = m->next) {
+            /* 共享的换出也腾不出显存，别的 VM 还引用着 */
+            if (!m->charged || m->hm->evicted || m->dedup || m->busy) continue;
+            m->busy++;
+            m->evicting = 1;
+            v->busy++;
+            batch[n++] = m;
+            want += m->charged;
+        }
+        if (!n) break;
+        pthread_mutex_unlock(&g_lock);
+
+        /* 读回直接提交给 host 队列，要排在受害 VM 还在 GPU 调度器里的提交后面 */
+        vgpu_gpusched_flush_vm(gpu, v->vm);
+
+        uint64_t done = 0;
+        VkResult r = VK_SUCCESS;
+        for (uint32_t i = 0; i < n && r == VK_SUCCESS; i++) {
+            r = hostvk_memory_evict(batch[i]->hm);
+            if (r == VK_SUCCESS) done += batch[i]->charged;
+        }
+
+        pthread_mutex_lock(&g_lock);
+        for (uint32_t i = 0; i < n; i++) {
+            batch[i]->busy--;
+            batch[i]->evicting = 0;
+            v->busy--;
+        }
+        pthread_cond_broadcast(&g_unpinned);
+        freed += done;
+        LOG("gpu %u: 换出 vm %d 的 %llu KB 给 vm %d\n", gpu, v->vm,
+            (unsigned long long)(done >> 10), self ? self->vm : 0);
+        if (r != VK_SUCCESS) {
+            LOG("vm %d: 换出失败: %d\n", v->vm, r);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return freed;
+}
+
+VkResult vgpu_mem_allocate(HVkDevice* hd, pid_t vm, VkDeviceSize size, uint32_t type_index,
+                           VgpuMem** out)
+{
+    pthread_once(&g_once, memquota_init);
+
+    /* type_index 是给 guest 看的编号，按建设备时缓存的那份查 */
+    const VkPhysicalDeviceMemoryProperties* props = &hd->guest_props;
+    int local = type_index < props->memoryTypeCount &&
+                (props->memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VgpuMem* m = calloc(1, sizeof(*m));
+    if (!m) return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    /* 先占配额再分配，同一 VM 并发的分配不会一起越过配额 */
+    pthread_mutex_lock(&g_lock);
+    VgpuVmMem* v = vm_get_locked(hd->phys_index, vm);
+    if (!v) {
+        pthread_mutex_unlock(&g_lock);
+        free(m);
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if (local && v->quota && (size > v->quota || v->used > v->quota - size)) {
+        LOG("vm %d: 超出显存配额 (%llu + %llu > %llu MB)\n", vm,
+            (unsigned long long)(v->used >> 20), (unsigned long long)(size >> 20),
+            (unsigned long long)(v->quota >> 20));
+        vm_put_locked(v);
+        pthread_mutex_unlock(&g_lock);
+        free(m);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    m->vm = v;
+    m->charged = local ? size : 0;
+    v->used += m->charged;
+    v->last_use_ns = monotonic_ns();
+    pthread_mutex_unlock(&g_lock);
+
+    VkResult r = hostvk_allocate_memory(hd, size, type_index, &m->hm);
+    if (r == VK_ERROR_OUT_OF_DEVICE_MEMORY && local && g_overcommit) {
+        if (make_room(hd->phys_index, size, v))
+            r = hostvk_allocate_memory(hd, size, type_index, &m->hm);
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (r != VK_SUCCESS) {
+        v->used -= m->charged;
+        vm_put_locked(v);
+        pthread_mutex_unlock(&g_lock);
+        free(m);
+        return r;
+    }
+    m->next = v->mems;
+    if (v->mems) v->mems->prev = m;
+    v->mems = m;
+    pthread_mutex_unlock(&g_lock);
+
+    *out = m;
+    return VK_SUCCESS;
+}
+
+void vgpu_mem_free(VgpuMem* m)
+{
+    if (!m) return;
+    VgpuVmMem* v = m->vm;
+
+    /* 先摘下来，之后换出就看不到它了；正在被换出的等换完 */
+    pthread_mutex_lock(&g_lock);
+    while (m->evicting)
+        pthread_cond_wait(&g_unpinned, &g_lock);
+    if (m->prev) m->prev->next = m->next;
+    else         v->mems = m->next;
+    if (m->next) m->next->prev = m->prev;
+    v->used -= m->charged;
+    vm_put_locked(v);
+    pthread_mutex_unlock(&g_lock);
+
+    hostvk_free_memory(m->hm);
+    vgpu_dedup_put(m->dedup);
+    free(m);
+}
+
+/* 写完静置够久、现在被只读使用、没有在途调用（换 memory 要求）的才查重 */
+static int dedup_due_locked(const VgpuMem* m, uint64_t now)
+{
+    return m->hm->dev->external_fd && m->charged >= DEDUP_MIN_SIZE && m->busy == 1 &&
+           !m->dedup && !m->dedup_broken && !m->dedup_checked &&
+           m->write_ns && now - m->write_ns >= DEDUP_SETTLE_NS;
+}
+
+/* 写之前：不再和别的 VM 共用，要换出的留给下面换回 */
+static VkResult dedup_break(VgpuMem* m)
+{
+    pthread_mutex_lock(&g_lock);
+    VgpuDedup* d = m->dedup;
+    /* 要换掉 memory：等这块内存上在途的调用先做完 */
+    while (d && m->busy > 1)
+        pthread_cond_wait(&g_unpinned, &g_lock);
+    pthread_mutex_unlock(&g_lock);
+    if (!d) return VK_SUCCESS;
+
+    VkResult r = vgpu_dedup_unshare(d, m->hm);
+    if (r != VK_SUCCESS) return r;
+    pthread_mutex_lock(&g_lock);
+    m->dedup = NULL;
+    m->dedup_broken = 1;
+    pthread_mutex_unlock(&g_lock);
+    return VK_SUCCESS;
+}
+
+HVkMemory* vgpu_mem_acquire(VgpuMem* m, int write, VkResult* result)
+{
+    VgpuVmMem* v = m->vm;
+
+    pthread_mutex_lock(&g_lock);
+    m->busy++;
+    v->busy++;
+    /* 别的 VM 的 worker 正在把它换出：等换完再照常换回 */
+    while (m->evicting)
+        pthread_cond_wait(&g_unpinned, &g_lock);
+    uint64_t now = monotonic_ns();
+    v->last_use_ns = now;
+    int check = !write && dedup_due_locked(m, now);
+    if (write) {
+        m->write_ns = now;
+        m->dedup_checked = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (write) {
+        VkResult r = dedup_break(m);
+        if (r != VK_SUCCESS) {
+            LOG("vm %d: 写时复制失败: %d\n", v->vm, r);
+            vgpu_mem_release(m);
+            *result = r;
+            return NULL;
+        }
+    }
+    pthread_mutex_lock(&g_lock);
+    int evicted = m->hm->evicted != NULL;
+    pthread_mutex_unlock(&g_lock);
+    if (!evicted) {
+        if (check) {
+            VgpuDedup* d = vgpu_dedup_share(m->hm, v->gpu);
+            pthread_mutex_lock(&g_lock);
+            m->dedup = d;
+            m->dedup_checked = 1;
+            pthread_mutex_unlock(&g_lock);
+        }
+        return m->hm;
+    }
+
+    /* 一个对象只在它所属上下文的 worker 里用，换回不会并发 */
+    VkResult r = hostvk_memory_restore(m->hm);
+    if (r == VK_ERROR_OUT_OF_DEVICE_MEMORY && make_room(v->gpu, m->hm->size, v))
+        r = hostvk_memory_restore(m->hm);
+    if (r != VK_SUCCESS) {
+        LOG("vm %d: 换回失败: %d\n", v->vm, r);
+        vgpu_mem_release(m);
+        *result = r;
+        return NULL;
+    }
+    return m->hm;
+}
+
+void vgpu_mem_release(VgpuMem* m)
+{
+    pthread_mutex_lock(&g_lock);
+    m->busy--;
+    m->vm->busy--;
+    if (m->dedup) pthread_cond_broadcast(&g_unpinned);
+    pthread_mutex_unlock(&g_lock);
+}
+
+uint64_t vgpu_mem_hibernate(VgpuMem* m)
+{
+    pthread_once(&g_once, memquota_init);
+    VgpuVmMem* v = m->vm;
+
+    /* 占住它，换出期间超分的换出不会同时动它 */
+    pthread_mutex_lock(&g_lock);
+    int skip = m->busy || m->evicting || !m->charged || m->dedup || m->hm->evicted;
+    if (!skip) {
+        m->busy++;
+        v->busy++;
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (skip) return 0;
+
+    VkResult r = hostvk_memory_evict(m->hm);
+    if (r == VK_SUCCESS && g_spill_dir) {
+        /* 落盘失败就留在内存里，一样能换回 */
+        hostvk_memory_spill(m->hm, g_spill_dir);
+    }
+    if (r != VK_SUCCESS) LOG("vm %d: 休眠换出失败: %d\n", v->vm, r);
+
+    pthread_mutex_lock(&g_lock);
+    m->busy--;
+    v->busy--;
+    pthread_mutex_unlock(&g_lock);
+    return r == VK_SUCCESS ? m->charged : 0;
+}
+
+void vgpu_mem_hold(VgpuMem* m)
+{
+    pthread_mutex_lock(&g_lock);
+    m->vm->hold++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void vgpu_mem_unhold(VgpuMem* m)
+{
+    pthread_mutex_lock(&g_lock);
+    m->vm->hold--;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void vgpu_mem_touch(uint32_t gpu, pid_t vm)
+{
+    pthread_mutex_lock(&g_lock);
+    VgpuVmMem* v = vm_find_locked(gpu, vm);
+    if (v) v->last_use_ns = monotonic_ns();
+    pthread_mutex_unlock(&g_lock);
+}
+
+uint64_t vgpu_mem_heap_size(pid_t vm, uint64_t host_size)
+{
+    uint64_t quota = vgpu_qos_mem_quota(vm);
+    return quota && quota < host_size ? quota : host_size;
+}
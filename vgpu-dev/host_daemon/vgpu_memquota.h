@@ -0,0 +1,63 @@
+// vgpu_memquota.h
+// 每个 VM 在每块 GPU 上的显存配额：device-local 内存按 VM 记账，超了直接报
+// VK_ERROR_OUT_OF_DEVICE_MEMORY；guest 查询内存属性时 device-local 堆按配额报，
+// 应用自己就会按这个大小做预算。
+// 可选超分（VGPU_MEM_OVERCOMMIT=1）：host 显存不够时，把空闲 VM 的内存换出到
+// host 内存，腾出显存给当前分配；被换出的 VM 下次读写时再换回来。
+// 可选去重（VGPU_MEM_DEDUP=1）：写完静置一段时间后被只读使用的内存交给 vgpu_dedup.c 查重，
+// 和别的 VM 内容相同的共用一份显存，要写时再分开。
+// 上下文长时间空闲时（VGPU_HIBERNATE_SEC）主动换出它的内存，可选落盘（VGPU_HIBERNATE_DIR）。
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "host_vulkan.h"
+#include "vgpu_dedup.h"
+
+typedef struct VgpuVmMem VgpuVmMem;
+
+/* daemon 对象表里存的是它，不直接存 HVkMemory */
+typedef struct VgpuMem {
+    HVkMemory*      hm;
+    VgpuVmMem*      vm;
+    uint64_t        charged;     // 记到配额上的字节，非 device-local 为 0
+    uint32_t        busy;        // 正在读写，不能换出
+    int             evicting;    // 超分换出正在锁外读回它，acquire / free 要等
+    VgpuDedup*      dedup;       // 非 NULL：和别的 VM 共用显存
+    uint64_t        write_ns;    // 最后一次写的时间，0 = 没写过
+    int             dedup_checked;   // 上次写之后查过重了
+    int             dedup_broken;    // 共享后又被写过，不再尝试
+    struct VgpuMem* prev;
+    struct VgpuMem* next;
+} VgpuMem;
+
+VkResult vgpu_mem_allocate(HVkDevice* hd, pid_t vm, VkDeviceSize size, uint32_t type_index,
+                           VgpuMem** out);
+void     vgpu_mem_free(VgpuMem* m);
+
+/*
+ * 读写 hm 前后成对调用：已换出的先换回，acquire 到 release 之间不会被换出。
+ * write：会写它（guest 写入、绑给可写的 shader），共享的先分开。
+ * 返回 NULL 时 *result 是失败原因。
+ */
+HVkMemory* vgpu_mem_acquire(VgpuMem* m, int write, VkResult* result);
+void       vgpu_mem_release(VgpuMem* m);
+
+/*
+ * 上下文休眠：没在用的 device-local 内存换出，设了 VGPU_HIBERNATE_DIR 的再落盘；
+ * 下次 acquire 时照常换回。只在所属上下文的 worker 里调用，返回腾出的显存字节数。
+ */
+uint64_t vgpu_mem_hibernate(VgpuMem* m);
+
+/*
+ * 休眠整个上下文前后成对调用（对它的每个分配各一次）：期间这个 VM 不会被
+ * 超分换出选中，不会和休眠同时读回同一块 GPU 上它的内存。
+ */
+void     vgpu_mem_hold(VgpuMem* m);
+void     vgpu_mem_unhold(VgpuMem* m);
+
+/* VM 在这块 GPU 上有活动（提交等），空闲计时从头算 */
+void     vgpu_mem_touch(uint32_t gpu, pid_t vm);
+
+/* 报给 guest 的 device-local 堆大小 */
+uint64_t vgpu_mem_heap_size(pid_t vm, uint64_t host_size);
@@ -0,0 +1,244 @@
+// vgpu_numa.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "vgpu_numa.h"
+
+#define LOG(...) printf("[numa] " __VA_ARGS__)
+
+#define NUMA_MAX_NODES  64            // 节点掩码用一个 unsigned long
+#define NUMA_MAX_GPUS   8
+#define NUMA_PID_CACHE  32
+#define NUMA_PID_TTL_NS (10ull * 1000000000ull)
+
+/* <linux/mempolicy.h> 里的值，不拉 libnuma 的头文件 */
+#define VGPU_MPOL_DEFAULT   0
+#define VGPU_MPOL_PREFERRED 1
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static int            g_nodes = 1;
+static int            g_gpu_node[NUMA_MAX_GPUS];   // 节点 + 1，0 = 不知道
+
+static struct {
+    pid_t    pid;
+    int      node;
+    uint64_t when_ns;
+} g_pid_cache[NUMA_PID_CACHE];
+static uint32_t        g_pid_next;
+static pthread_mutex_t g_pid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void numa_init(void)
+{
+    DIR* d = opendir("/sys/devices/system/node");
+    if (!d) return;
+    int max = -1, n;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        if (sscanf(e->d_name, "node%d", &n) == 1 && n > max)
+            max = n;
+    }
+    closedir(d);
+    if (max >= NUMA_MAX_NODES) max = NUMA_MAX_NODES - 1;
+    if (max >= 1) {
+        g_nodes = max + 1;
+        LOG("%d 个 NUMA 节点\n", g_nodes);
+    }
+}
+
+int vgpu_numa_node_count(void)
+{
+    pthread_once(&g_once, numa_init);
+    return g_nodes;
+}
+
+static int valid_node(int node)
+{
+    return node >= 0 && node < vgpu_numa_node_count() && vgpu_numa_node_count() > 1;
+}
+
+static int read_int_file(const char* path, int* out)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fscanf(f, "%d", out) == 1;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+int vgpu_numa_node_of_pci(const char* pci)
+{
+    if (!pci || !pci[0] || vgpu_numa_node_count() <= 1) return VGPU_NUMA_ANY;
+
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/numa_node", pci);
+    int node;
+    if (read_int_file(path, &node) != 0 || !valid_node(node)) return VGPU_NUMA_ANY;
+    return node;
+}
+
+/* VM 用 cpuset / numactl 绑在单个节点上是最常见的部署，直接看允许的节点 */
+static int pid_mems_allowed(pid_t pid)
+{
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return VGPU_NUMA_ANY;
+
+    int node = VGPU_NUMA_ANY;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "Mems_allowed_list:", 18) != 0) continue;
+        char* v = line + 18;
+        while (*v == ' ' || *v == '\t') v++;
+        if (!strpbrk(v, ",-")) node = atoi(v);
+        break;
+    }
+    fclose(f);
+    return node;
+}
+
+/* 否则按 numa_maps 里各节点的页数取最多的 */
+static int pid_numa_maps(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/numa_maps", (int)pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return VGPU_NUMA_ANY;
+
+    unsigned long pages[NUMA_MAX_NODES] = {0};
+    char tok[128];
+    while (fscanf(f, "%127s", tok) == 1) {
+        int n;
+        unsigned long cnt;
+        if (sscanf(tok, "N%d=%lu", &n, &cnt) == 2 && n >= 0 && n < NUMA_MAX_NODES)
+            pages[n] += cnt;
+    }
+    fclose(f);
+
+    int best = VGPU_NUMA_ANY;
+    for (int n = 0; n < NUMA_MAX_NODES; n++) {
+        if (pages[n] && (best < 0 || pages[n] > pages[best]))
+            best = n;
+    }
+    return best;
+}
+
+int vgpu_numa_node_of_pid(pid_t pid)
+{
+    if (vgpu_numa_node_count() <= 1 || pid <= 0) return VGPU_NUMA_ANY;
+
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&g_pid_lock);
+    for (uint32_t i = 0; i < NUMA_PID_CACHE; i++) {
+        if (g_pid_cache[i].pid == pid && now - g_pid_cache[i].when_ns < NUMA_PID_TTL_NS) {
+            int node = g_pid_cache[i].node;
+            pthread_mutex_unlock(&g_pid_lock);
+            return node;
+        }
+    }
+    pthread_mutex_unlock(&g_pid_lock);
+
+    /* numa_maps 要走一遍页表，不在锁里读 */
+    int node = pid_mems_allowed(pid);
+    if (!valid_node(node)) node = pid_numa_maps(pid);
+    if (!valid_node(node)) node = VGPU_NUMA_ANY;
+
+    pthread_mutex_lock(&g_pid_lock);
+    uint32_t slot = g_pid_next++ % NUMA_PID_CACHE;
+    for (uint32_t i = 0; i < NUMA_PID_CACHE; i++) {
+        if (g_pid_cache[i].pid == pid) {
+            slot = i;
+            break;
+        }
+    }
+    g_pid_cache[slot].pid     = pid;
+    g_pid_cache[slot].node    = node;
+    g_pid_cache[slot].when_ns = now;
+    pthread_mutex_unlock(&g_pid_lock);
+    return node;
+}
+
+void vgpu_numa_set_gpu(uint32_t gpu, int node)
+{
+    if (gpu >= NUMA_MAX_GPUS) return;
+    int v = valid_node(node) ? node + 1 : 0;
+    if (__atomic_exchange_n(&g_gpu_node[gpu], v, __ATOMIC_RELAXED) != v && v)
+        LOG("gpu %u 在节点 %d\n", gpu, node);
+}
+
+int vgpu_numa_gpu_node(uint32_t gpu)
+{
+    if (gpu >= NUMA_MAX_GPUS) return VGPU_NUMA_ANY;
+    return __atomic_load_n(&g_gpu_node[gpu], __ATOMIC_RELAXED) - 1;
+}
+
+/* cpulist 形如 "0-15,32-47" */
+static int node_cpus(int node, cpu_set_t* set)
+{
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+
+    CPU_ZERO(set);
+    int count = 0;
+    for (char* p = buf; *p && *p != '\n'; ) {
+        char* end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) break;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+            CPU_SET((int)c, set);
+            count++;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count ? 0 : -1;
+}
+
+void vgpu_numa_bind_thread(int node)
+{
+    if (!valid_node(node)) return;
+    cpu_set_t set;
+    if (node_cpus(node, &set) != 0) return;
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+        LOG("绑定线程到节点 %d 失败: %s\n", node, strerror(rc));
+}
+
+void vgpu_numa_bind_memory(void* p, size_t size, int node)
+{
+    if (!valid_node(node) || !p || !size) return;
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_mbind, p, size, VGPU_MPOL_PREFERRED, &mask, NUMA_MAX_NODES + 1, 0) != 0)
+        perror("[numa] mbind");
+}
+
+void vgpu_numa_prefer(int node)
+{
+    if (vgpu_numa_node_count() <= 1) return;
+    if (!valid_node(node)) {
+        syscall(SYS_set_mempolicy, VGPU_MPOL_DEFAULT, NULL, 0);
+        return;
+    }
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_set_mempolicy, VGPU_MPOL_PREFERRED, &mask, NUMA_MAX_NODES + 1) != 0)
+        perror("[numa] set_mempolicy");
+}
@@ -0,0 +1,30 @@
+// vgpu_numa.h
+// NUMA 放置：GPU 所在节点从 sysfs 的 PCI 设备读，guest 内存所在节点从 /proc/<pid> 读。
+// 每块 GPU 的线程（调度、完成等待、present）绑到 GPU 所在节点，staging 环和帧缓冲
+// 也放在那个节点；每条连接的读线程绑到 guest 所在节点，收包的命令缓冲随之落在 guest 那边，
+// guest 频繁轮询的共享区（sync page、读回区）也放在 guest 那边。
+// 单节点机器上全部是空操作。不依赖 libnuma，直接用 mbind / set_mempolicy 系统调用。
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define VGPU_NUMA_ANY (-1)
+
+int  vgpu_numa_node_count(void);
+
+/* pci："dddd:bb:dd.f"；不知道时返回 VGPU_NUMA_ANY */
+int  vgpu_numa_node_of_pci(const char* pci);
+/* guest 内存主要落在哪个节点，结果缓存一会儿 */
+int  vgpu_numa_node_of_pid(pid_t pid);
+
+/* 物理 GPU 序号 -> 节点，创建 device 时登记 */
+void vgpu_numa_set_gpu(uint32_t gpu, int node);
+int  vgpu_numa_gpu_node(uint32_t gpu);
+
+/* 当前线程只在该节点的 CPU 上跑；node 为 VGPU_NUMA_ANY 时什么都不做 */
+void vgpu_numa_bind_thread(int node);
+/* [p, p+size) 的页优先从该节点分配，要在第一次写之前调用 */
+void vgpu_numa_bind_memory(void* p, size_t size, int node);
+/* 当前线程之后分配的内存（包括驱动替它分配的）优先放在该节点；VGPU_NUMA_ANY 恢复默认 */
+void vgpu_numa_prefer(int node);
@@ -0,0 +1,255 @@
+// vgpu_present.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vgpu_present.h"
+#include "vgpu_numa.h"
+
+#define LOG(...) printf("[present] " __VA_ARGS__)
+
+/* 排在 VM 的 GPU 调度队列里的一次 present */
+typedef struct {
+    VgpuGpuJob     job;           // 必须是第一个成员
+    VgpuSwapchain* sc;
+    uint32_t       index;
+} PresentJob;
+
+/* 模拟的刷新率，VGPU_PRESENT_HZ=0 表示不限速 */
+#define PRESENT_DEFAULT_HZ 60
+
+static long g_interval_ns = -1;
+
+static long present_interval_ns(void)
+{
+    long ns = __atomic_load_n(&g_interval_ns, __ATOMIC_RELAXED);
+    if (ns >= 0) return ns;
+
+    const char* env = getenv("VGPU_PRESENT_HZ");
+    int hz = env ? atoi(env) : PRESENT_DEFAULT_HZ;
+    ns = hz > 0 ? 1000000000L / hz : 0;
+    __atomic_store_n(&g_interval_ns, ns, __ATOMIC_RELAXED);
+    return ns;
+}
+
+static void timespec_add_ns(struct timespec* t, long ns)
+{
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+static int timespec_before(const struct timespec* a, const struct timespec* b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* 睡到下一个“vblank”；落后了就对齐到现在之后的第一个 */
+static void pace_wait(struct timespec* next, long interval)
+{
+    if (interval == 0) return;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    do {
+        timespec_add_ns(next, interval);
+    } while (timespec_before(next, &now));
+}
+
+/* 图像还给 guest：置可用位，唤醒等在 acquire 上的线程 */
+static void image_release(VgpuSwapchain* sc, uint32_t index)
+{
+    VkvgpuFrameHeader* hdr = sc->frame->hdr;
+    __atomic_fetch_or(&hdr->avail_mask, 1u << index, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&hdr->release_seq, 1, __ATOMIC_RELEASE);
+    vgpu_futex_wake(&hdr->release_seq);
+}
+
+static void image_present(VgpuSwapchain* sc, uint32_t index)
+{
+    const uint8_t* pixels = NULL;
+    VkResult r = hostvk_swapchain_readback(sc->hsc, index, &pixels);
+    if (r == VK_SUCCESS) {
+        vgpu_frame_update(sc->frame, index, pixels);
+    } else {
+        LOG("读回图像 %u 失败: %d\n", index, r);
+        __atomic_store_n(&sc->frame->hdr->status, (int32_t)r, __ATOMIC_RELEASE);
+    }
+    image_release(sc, index);
+}
+
+/*
+ * FIFO：每个刷新周期取最早的一张；guest 把图像都交上来之后 acquire 会等，
+ * 自然被限到刷新率。MAILBOX：每个周期只显示最新的一张，其余立即还给 guest。
+ */
+static void* present_thread(void* arg)
+{
+    VgpuSwapchain* sc = arg;
+    long interval = present_interval_ns();
+    vgpu_numa_bind_thread(sc->numa_node);
+    uint32_t dropped[VKVGPU_MAX_SWAPCHAIN_IMAGES];
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    pthread_mutex_lock(&sc->lock);
+    for (;;) {
+        while (!sc->quit && sc->count == 0)
+            pthread_cond_wait(&sc->cond, &sc->lock);
+        if (sc->quit) break;
+
+        pthread_mutex_unlock(&sc->lock);
+        pace_wait(&next, interval);
+        pthread_mutex_lock(&sc->lock);
+        if (sc->quit) break;
+
+        uint32_t index, ndropped = 0;
+        if (sc->mailbox) {
+            index = sc->queue[(sc->head + sc->count - 1) % VKVGPU_MAX_SWAPCHAIN_IMAGES];
+            for (uint32_t i = 0; i + 1 < sc->count; i++)
+                dropped[ndropped++] = sc->queue[(sc->head + i) % VKVGPU_MAX_SWAPCHAIN_IMAGES];
+            sc->head  = (sc->head + sc->count) % VKVGPU_MAX_SWAPCHAIN_IMAGES;
+            sc->count = 0;
+        } else {
+            index = sc->queue[sc->head];
+            sc->head = (sc->head + 1) % VKVGPU_MAX_SWAPCHAIN_IMAGES;
+            sc->count--;
+        }
+        pthread_mutex_unlock(&sc->lock);
+
+        for (uint32_t i = 0; i < ndropped; i++)
+            image_release(sc, dropped[i]);
+        image_present(sc, index);
+
+        pthread_mutex_lock(&sc->lock);
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return NULL;
+}
+
+VgpuSwapchain* vgpu_swapchain_create(HVkDevice* hd, pid_t vm,
+                                     const VkvgpuCreateSwapchainRequestPayload* req,
+                                     VkResult* out_result)
+{
+    VgpuSwapchain* sc = calloc(1, sizeof(*sc));
+    if (!sc) {
+        *out_result = VK_ERROR_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    sc->image_count = req->image_count;
+    sc->mailbox     = req->present_mode == VK_PRESENT_MODE_MAILBOX_KHR;
+    sc->numa_node   = hd->numa_node;
+    pthread_mutex_init(&sc->lock, NULL);
+    pthread_cond_init(&sc->cond, NULL);
+
+    /* host 没有的格式换成相近的 4 字节格式建图像，帧缓冲里再转回来 */
+    const VgpuFormatEmu* fmt = vgpu_format_lookup((VkFormat)req->format);
+    VkResult r = fmt ? hostvk_create_swapchain(hd, req->width, req->height, fmt->host_format,
+                                               req->usage, req->image_count, &sc->hsc)
+                     : VK_ERROR_INITIALIZATION_FAILED;
+    if (r == VK_SUCCESS) {
+        sc->tenant = vgpu_tenant_get(hd->phys_index, vm);
+        if (!sc->tenant) r = VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if (r == VK_SUCCESS) {
+        sc->frame = vgpu_frame_create(req->width, req->height, req->format, sc->numa_node);
+        if (!sc->frame) r = VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    if (r == VK_SUCCESS) {
+        sc->frame->hdr->avail_mask = (1u << sc->image_count) - 1;
+        if (pthread_create(&sc->thread, NULL, present_thread, sc) != 0)
+            r = VK_ERROR_INITIALIZATION_FAILED;
+        else
+            sc->thread_started = 1;
+    }
+    if (r != VK_SUCCESS) {
+        vgpu_swapchain_destroy(sc);
+        *out_result = r;
+        return NULL;
+    }
+    *out_result = VK_SUCCESS;
+    return sc;
+}
+
+/* present 线程已停、调度器里也没有它的 present 了 */
+static void swapchain_free(VgpuSwapchain* sc)
+{
+    vgpu_tenant_put(sc->tenant);
+    pthread_cond_destroy(&sc->cond);
+    pthread_mutex_destroy(&sc->lock);
+    free(sc);
+}
+
+void vgpu_swapchain_destroy(VgpuSwapchain* sc)
+{
+    if (!sc) return;
+    pthread_mutex_lock(&sc->lock);
+    sc->quit = 1;
+    pthread_cond_signal(&sc->cond);
+    pthread_mutex_unlock(&sc->lock);
+    if (sc->thread_started)
+        pthread_join(sc->thread, NULL);
+    hostvk_destroy_swapchain(sc->hsc);
+    vgpu_frame_destroy(sc->frame);
+
+    /* 还排在调度器里的 present（可能在等 semaphore）不等了，最后一个出来的负责释放 */
+    pthread_mutex_lock(&sc->lock);
+    sc->detached = 1;
+    int last = sc->scheduled == 0;
+    pthread_mutex_unlock(&sc->lock);
+    if (last) swapchain_free(sc);
+}
+
+/* 调度线程里：这个 VM 之前的提交都已交给 host 队列，图像可以读回了 */
+static void present_dispatch(VgpuGpuJob* job)
+{
+    PresentJob*    pj = (PresentJob*)job;
+    VgpuSwapchain* sc = pj->sc;
+    uint32_t index = pj->index;
+    free(pj);
+    /* 不占 GPU，读回的时间不记账 */
+    vgpu_gpusched_complete(sc->tenant, 0);
+
+    pthread_mutex_lock(&sc->lock);
+    sc->scheduled--;
+    if (sc->quit) {
+        /* swapchain 已在销毁，图像和帧缓冲都不能再碰 */
+        int last = sc->detached && sc->scheduled == 0;
+        pthread_mutex_unlock(&sc->lock);
+        if (last) swapchain_free(sc);
+        return;
+    }
+    /* 每张图像最多在队列里一次，队列容量等于图像数，正常不会满 */
+    if (sc->count < sc->image_count) {
+        sc->queue[(sc->head + sc->count) % VKVGPU_MAX_SWAPCHAIN_IMAGES] = index;
+        sc->count++;
+        pthread_cond_signal(&sc->cond);
+    } else {
+        LOG("present 队列满，丢弃图像 %u\n", index);
+        image_release(sc, index);
+    }
+    pthread_mutex_unlock(&sc->lock);
+}
+
+int vgpu_swapchain_queue(VgpuSwapchain* sc, uint32_t image_index)
+{
+    if (image_index >= sc->image_count) return -1;
+    PresentJob* pj = malloc(sizeof(*pj));
+    if (!pj) return -1;
+    pj->sc    = sc;
+    pj->index = image_index;
+    pj->job.tenant   = sc->tenant;
+    pj->job.dispatch = present_dispatch;
+    pj->job.ready    = NULL;
+
+    pthread_mutex_lock(&sc->lock);
+    sc->scheduled++;
+    pthread_mutex_unlock(&sc->lock);
+    vgpu_gpusched_enqueue(&pj->job);
+    return 0;
+}
@@ -0,0 +1,42 @@
+// vgpu_present.h
+// 每个 swapchain 一个 present 线程：QUEUE_PRESENT 只把图像排进有界队列就返回，
+// 读回、damage 检测都在这个线程里按模拟的刷新率做，guest 的提交不被帧传输卡住。
+// 图像先排进 VM 的 GPU 调度队列（vgpu_gpusched.c），轮到时才进 present 队列：
+// 读回直接提交给 host 队列，必须排在这次 present 之前 guest 交的提交后面。
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "host_vulkan.h"
+#include "vgpu_frame.h"
+#include "vgpu_gpusched.h"
+
+typedef struct {
+    HVkSwapchain*   hsc;
+    VgpuFrame*      frame;
+    uint32_t        image_count;
+    int             mailbox;      // 0 = FIFO：按顺序每个刷新周期显示一张
+    int             numa_node;    // GPU 所在节点，present 线程和帧缓冲都放这里
+    VgpuTenant*     tenant;       // 所属 VM 在这块 GPU 上的调度实体
+
+    pthread_t       thread;
+    int             thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             quit;
+    uint32_t        queue[VKVGPU_MAX_SWAPCHAIN_IMAGES];   // 等待显示的图像，环形
+    uint32_t        head;
+    uint32_t        count;
+    uint32_t        scheduled;    // 还在 GPU 调度队列里的 present
+    int             detached;     // destroy 做完了，最后一个出调度队列的 present 释放结构体
+} VgpuSwapchain;
+
+/* vm：guest 进程 pid，present 排在这个 VM 的提交后面 */
+VgpuSwapchain* vgpu_swapchain_create(HVkDevice* hd, pid_t vm,
+                                     const VkvgpuCreateSwapchainRequestPayload* req,
+                                     VkResult* out_result);
+/* 停掉 present 线程，丢弃还没显示的图像 */
+void           vgpu_swapchain_destroy(VgpuSwapchain* sc);
+/* 排进 VM 的 GPU 调度队列，轮到时进 present 队列；返回 0 = 成功 */
+int            vgpu_swapchain_queue(VgpuSwapchain* sc, uint32_t image_index);
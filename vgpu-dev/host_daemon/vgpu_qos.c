@@ -0,0 +1,155 @@
+// vgpu_qos.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vgpu_qos.h"
+#include "vgpu_gpusched.h"
+
+#define LOG(...) printf("[qos] " __VA_ARGS__)
+
+#define QOS_MAX_RULES 64
+#define QOS_NAME_MAX  16      // 和 /proc/<pid>/comm 一样长
+
+typedef struct {
+    char         name[QOS_NAME_MAX];   // 进程名；全是数字时按 pid 匹配
+    pid_t        pid;
+    VgpuQosClass cls;
+    int          has_quota;
+    uint64_t     quota;                // 字节
+} QosRule;
+
+static const struct {
+    const char* name;
+    float       queue_priority;
+    int         global_priority;
+    uint32_t    weight;
+} g_classes[VGPU_QOS_COUNT] = {
+    [VGPU_QOS_INTERACTIVE] = { "interactive", 1.0f, VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT,
+                               VGPU_SCHED_DEFAULT_WEIGHT * 4 },
+    [VGPU_QOS_STANDARD]    = { "standard",    0.5f, VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_EXT,
+                               VGPU_SCHED_DEFAULT_WEIGHT },
+    [VGPU_QOS_BATCH]       = { "batch",       0.0f, VK_QUEUE_GLOBAL_PRIORITY_LOW_EXT,
+                               VGPU_SCHED_DEFAULT_WEIGHT / 4 },
+};
+
+static QosRule        g_rules[QOS_MAX_RULES];
+static uint32_t       g_rule_count;
+static VgpuQosClass   g_default = VGPU_QOS_STANDARD;
+static uint64_t       g_default_quota;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static int parse_class(const char* s, VgpuQosClass* out)
+{
+    for (int i = 0; i < VGPU_QOS_COUNT; i++) {
+        if (strcmp(s, g_classes[i].name) == 0) {
+            *out = (VgpuQosClass)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void qos_load(void)
+{
+    const char* def = getenv("VGPU_QOS_DEFAULT");
+    if (def && parse_class(def, &g_default) != 0)
+        LOG("未知的默认等级 \"%s\"，用 standard\n", def);
+
+    const char* quota = getenv("VGPU_MEM_QUOTA_MB");
+    if (quota) g_default_quota = strtoull(quota, NULL, 10) << 20;
+
+    const char* env = getenv("VGPU_QOS");
+    if (!env) return;
+    char* conf = strdup(env);
+    if (!conf) return;
+
+    char* save = NULL;
+    for (char* tok = strtok_r(conf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char* eq = strchr(tok, '=');
+        char* colon = eq ? strchr(eq, ':') : NULL;
+        QosRule rule;
+        memset(&rule, 0, sizeof(rule));
+        if (colon) {
+            *colon = '\0';
+            rule.has_quota = 1;
+            rule.quota = strtoull(colon + 1, NULL, 10) << 20;
+        }
+        if (!eq || eq == tok || g_rule_count >= QOS_MAX_RULES ||
+            parse_class(eq + 1, &rule.cls) != 0) {
+            LOG("忽略配置项 \"%s\"\n", tok);
+            continue;
+        }
+        *eq = '\0';
+        char* end = NULL;
+        long pid = strtol(tok, &end, 10);
+        if (*end == '\0') rule.pid = (pid_t)pid;
+        else              snprintf(rule.name, sizeof(rule.name), "%s", tok);
+        g_rules[g_rule_count++] = rule;
+        LOG("%s -> %s\n", tok, g_classes[rule.cls].name);
+    }
+    free(conf);
+}
+
+static void read_comm(pid_t pid, char* out, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/comm", (int)pid);
+    out[0] = '\0';
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+    if (fgets(out, (int)size, f))
+        out[strcspn(out, "\n")] = '\0';
+    fclose(f);
+}
+
+static const QosRule* rule_for(pid_t vm)
+{
+    pthread_once(&g_once, qos_load);
+    if (g_rule_count == 0) return NULL;
+
+    char comm[QOS_NAME_MAX];
+    read_comm(vm, comm, sizeof(comm));
+    for (uint32_t i = 0; i < g_rule_count; i++) {
+        const QosRule* r = &g_rules[i];
+        if (r->pid ? r->pid == vm : (comm[0] && strcmp(r->name, comm) == 0))
+            return r;
+    }
+    return NULL;
+}
+
+VgpuQosClass vgpu_qos_class_of(pid_t vm)
+{
+    const QosRule* r = rule_for(vm);
+    return r ? r->cls : g_default;
+}
+
+uint64_t vgpu_qos_mem_quota(pid_t vm)
+{
+    const QosRule* r = rule_for(vm);
+    return r && r->has_quota ? r->quota : g_default_quota;
+}
+
+const char* vgpu_qos_name(VgpuQosClass cls)
+{
+    return g_classes[cls].name;
+}
+
+float vgpu_qos_queue_priority(VgpuQosClass cls)
+{
+    return g_classes[cls].queue_priority;
+}
+
+int vgpu_qos_global_priority(VgpuQosClass cls)
+{
+    return g_classes[cls].global_priority;
+}
+
+uint32_t vgpu_qos_weight(VgpuQosClass cls)
+{
+    return g_classes[cls].weight;
+}
@@ -0,0 +1,30 @@
+// vgpu_qos.h
+// 每个 VM 的 QoS 等级：决定 host 队列优先级（以及支持时的 VK_EXT_global_priority）
+// 和 GPU 调度器里的优先级与权重。等级由 daemon 的配置决定，guest 不能自己选。
+//
+// 配置：VGPU_QOS="qemu-desk1=interactive:4096,4242=batch"，按 guest 进程名（/proc/<pid>/comm）
+// 或 pid 匹配；没配的用 VGPU_QOS_DEFAULT（缺省 standard）。
+// 冒号后是该 VM 的显存配额（MB），不写用 VGPU_MEM_QUOTA_MB（缺省 0 = 不限）。
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+    VGPU_QOS_INTERACTIVE = 0,   // 交互桌面：总是先于其他等级提交
+    VGPU_QOS_STANDARD    = 1,
+    VGPU_QOS_BATCH       = 2,   // 离线计算：只用别人剩下的 GPU 时间
+    VGPU_QOS_COUNT
+} VgpuQosClass;
+
+VgpuQosClass vgpu_qos_class_of(pid_t vm);
+const char*  vgpu_qos_name(VgpuQosClass cls);
+
+/* host 队列的 pQueuePriorities 值 */
+float        vgpu_qos_queue_priority(VgpuQosClass cls);
+/* VkQueueGlobalPriorityEXT 的值 */
+int          vgpu_qos_global_priority(VgpuQosClass cls);
+/* 同一等级内 WFQ 的权重 */
+uint32_t     vgpu_qos_weight(VgpuQosClass cls);
+
+/* 每块 GPU 上 device-local 堆的配额（字节），0 = 不限 */
+uint64_t     vgpu_qos_mem_quota(pid_t vm);
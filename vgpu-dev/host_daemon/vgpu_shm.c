@@ -0,0 +1,122 @@
+// vgpu_shm.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "vgpu_shm.h"
+#include "vgpu_numa.h"
+
+#define LOG(...) printf("[shm] " __VA_ARGS__)
+
+/* 小于一个大页的区（sync page 等）不值得占一整个大页 */
+#define SHM_HUGE_MIN (2u * 1024u * 1024u)
+
+static int shm_hugepages_enabled(void)
+{
+    static int enabled = -1;
+    if (enabled < 0) {
+        const char* env = getenv("VGPU_SHM_HUGEPAGES");
+        enabled = !env || atoi(env) != 0;
+    }
+    return enabled;
+}
+
+/*
+ * 建 memfd 并映射；hugetlb 的长度要是大页的整数倍，按 fstat 报的大页大小向上取整。
+ * 大页池不够时 mmap（预留）失败，返回 -1 由调用者退回普通页。
+ */
+static int shm_map(VgpuShm* shm, const char* name, size_t size, unsigned int flags)
+{
+    shm->fd = memfd_create(name, MFD_CLOEXEC | flags);
+    if (shm->fd < 0) return -1;
+
+    if (flags & MFD_HUGETLB) {
+        struct stat st;
+        if (fstat(shm->fd, &st) != 0 || st.st_blksize <= 0) {
+            close(shm->fd);
+            return -1;
+        }
+        size_t huge = (size_t)st.st_blksize;
+        size = (size + huge - 1) / huge * huge;
+    }
+
+    if (ftruncate(shm->fd, (off_t)size) != 0) {
+        close(shm->fd);
+        return -1;
+    }
+    shm->ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (shm->ptr == MAP_FAILED) {
+        close(shm->fd);
+        return -1;
+    }
+    shm->size = size;
+    return 0;
+}
+
+VgpuShm* vgpu_shm_create(const char* name, size_t size, int node)
+{
+    VgpuShm* shm = calloc(1, sizeof(*shm));
+    if (!shm) return NULL;
+
+    /* 大块传输区优先用 hugetlb，两边批量拷贝时少很多 TLB miss */
+    static int warned;
+    int want_huge = size >= SHM_HUGE_MIN && shm_hugepages_enabled();
+    if (want_huge && shm_map(shm, name, size, MFD_HUGETLB) == 0) {
+        shm->hugetlb = 1;
+    } else {
+        if (want_huge && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+            LOG("hugetlb 不可用（大页池为空？），共享区退回普通页\n");
+        if (shm_map(shm, name, size, 0) != 0) {
+            perror("[shm] memfd");
+            free(shm);
+            return NULL;
+        }
+        /* 没有大页池：shmem_enabled=advise 时还能用透明大页 */
+        if (size >= SHM_HUGE_MIN)
+            madvise(shm->ptr, shm->size, MADV_HUGEPAGE);
+    }
+
+    /* memfd 的页在第一次写时才分配，策略跟着共享对象走，guest 那边映射也一样 */
+    vgpu_numa_bind_memory(shm->ptr, shm->size, node);
+    return shm;
+}
+
+void vgpu_shm_close_fd(VgpuShm* shm)
+{
+    if (shm && shm->fd >= 0) {
+        close(shm->fd);
+        shm->fd = -1;
+    }
+}
+
+void vgpu_shm_destroy(VgpuShm* shm)
+{
+    if (!shm) return;
+    vgpu_shm_close_fd(shm);
+    munmap(shm->ptr, shm->size);
+    free(shm);
+}
+
+/* 共享映射跨进程，不能用 FUTEX_PRIVATE_FLAG */
+int vgpu_futex_wait(uint32_t* addr, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = (long)(timeout_ms % 1000) * 1000000L,
+    };
+    long rc = syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+    if (rc == 0 || errno == EAGAIN || errno == EINTR) return 0;
+    return -1;
+}
+
+void vgpu_futex_wake(uint32_t* addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
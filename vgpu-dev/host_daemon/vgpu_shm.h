@@ -0,0 +1,24 @@
+// vgpu_shm.h
+// 与 guest 共享的内存区（memfd）以及跨进程 futex 等待/唤醒。
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int    fd;      // 交给 guest 之后就可以关掉，映射仍然有效
+    void*  ptr;
+    size_t size;    // 映射长度，hugetlb 时向上取整到大页，可能比申请的大
+    int    hugetlb;
+} VgpuShm;
+
+/*
+ * node：页优先放在哪个 NUMA 节点，VGPU_NUMA_ANY = 不管。
+ * 2MB 以上的区用 hugetlb 大页（VGPU_SHM_HUGEPAGES=0 关掉），没有大页池时退回普通页 + THP。
+ */
+VgpuShm* vgpu_shm_create(const char* name, size_t size, int node);
+void     vgpu_shm_close_fd(VgpuShm* shm);
+void     vgpu_shm_destroy(VgpuShm* shm);
+
+/* *addr == val 时睡眠，最多 timeout_ms；返回 0 = 被唤醒或值已变，-1 = 超时 */
+int  vgpu_futex_wait(uint32_t* addr, uint32_t val, int timeout_ms);
+void vgpu_futex_wake(uint32_t* addr);
@@ -0,0 +1,256 @@
+// vgpu_sync.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vgpu_sync.h"
+#include "vgpu_numa.h"
+
+#define LOG(...) printf("[sync] " __VA_ARGS__)
+
+/* 等待线程单次等 fence 的时长，到点检查一下是否要退出 */
+#define SYNC_WAIT_SLICE_NS 100000000ull
+
+struct VgpuSyncBatch {
+    VgpuGpuJob       job;         // 必须是第一个成员
+    VgpuSyncBatch*   next;
+    VgpuSyncPage*    sp;
+    VkFence          fence;
+    uint32_t         slot;        // 计时槽
+    uint64_t         dispatch_ns; // 队列不支持时间戳时按墙钟记账
+    VgpuSyncWork     work;
+    uint32_t         count;
+    uint32_t         wait_count;
+    const VkvgpuSyncSignal* waits;   // 紧跟在 signals 后面
+    VkvgpuSyncSignal signals[];
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static VkFence fence_get(VgpuSyncPage* sp)
+{
+    VkFence fence = VK_NULL_HANDLE;
+    pthread_mutex_lock(&sp->lock);
+    if (sp->free_count > 0)
+        fence = sp->free_fences[--sp->free_count];
+    pthread_mutex_unlock(&sp->lock);
+
+    if (!fence && hostvk_create_fence(sp->hd, &fence) != VK_SUCCESS)
+        return VK_NULL_HANDLE;
+    return fence;
+}
+
+/* 调用者持有 sp->lock */
+static void fence_put_locked(VgpuSyncPage* sp, VkFence fence)
+{
+    if (sp->free_count < VGPU_SYNC_FENCE_CACHE)
+        sp->free_fences[sp->free_count++] = fence;
+    else
+        hostvk_destroy_fence(sp->hd, fence);
+}
+
+/* slot 只增不减：同一个 timeline 可能被先后多个 batch signal */
+static void signals_publish(VgpuSyncPage* sp, const VkvgpuSyncSignal* s, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t* v = &sp->page->values[s[i].slot];
+        uint64_t old = __atomic_load_n(v, __ATOMIC_RELAXED);
+        while (old < s[i].value &&
+               !__atomic_compare_exchange_n(v, &old, s[i].value, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    __atomic_add_fetch(&sp->page->seq, 1, __ATOMIC_RELEASE);
+    vgpu_futex_wake(&sp->page->seq);
+}
+
+static void page_fail(VgpuSyncPage* sp, VkResult r)
+{
+    __atomic_store_n(&sp->page->status, (int32_t)r, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&sp->page->seq, 1, __ATOMIC_RELEASE);
+    vgpu_futex_wake(&sp->page->seq);
+}
+
+/* 调用者持有 sp->lock；batch 离开调度器和 GPU，destroy 可能在等 outstanding 归零 */
+static void batch_retire_locked(VgpuSyncPage* sp, VgpuSyncBatch* b)
+{
+    if (b->work.done) b->work.done(b->work.arg);
+    sp->outstanding--;
+    pthread_cond_broadcast(&sp->cond);
+    free(b);
+}
+
+/*
+ * 调度线程里（持有调度器的锁）：等的 slot 都到了才能开始。设备出错或 sync page 要销毁时
+ * 不再等，照常提交，销毁不会卡在一个永远等不到的值上。
+ */
+static int batch_ready(VgpuGpuJob* job)
+{
+    const VgpuSyncBatch* b  = (const VgpuSyncBatch*)job;
+    VgpuSyncPage*        sp = b->sp;
+
+    if (__atomic_load_n(&sp->quit, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&sp->page->status, __ATOMIC_ACQUIRE) != 0)
+        return 1;
+    for (uint32_t i = 0; i < b->wait_count; i++) {
+        if (__atomic_load_n(&sp->page->values[b->waits[i].slot], __ATOMIC_ACQUIRE) < b->waits[i].value)
+            return 0;
+    }
+    return 1;
+}
+
+/* 调度线程里：轮到这个 VM 了，真正提交给 host 队列，交给等待线程 */
+static void batch_dispatch(VgpuGpuJob* job)
+{
+    VgpuSyncBatch* b  = (VgpuSyncBatch*)job;
+    VgpuSyncPage*  sp = b->sp;
+
+    b->slot = sp->next_slot++ % HVK_SUBMIT_SLOTS;
+    b->dispatch_ns = monotonic_ns();
+    VkResult r = hostvk_queue_submit(sp->hd, b->slot, b->work.cb, b->fence);
+    if (r != VK_SUCCESS) {
+        LOG("提交失败: %d\n", r);
+        page_fail(sp, r);
+        vgpu_gpusched_complete(sp->tenant, 0);
+        pthread_mutex_lock(&sp->lock);
+        hostvk_destroy_fence(sp->hd, b->fence);
+        batch_retire_locked(sp, b);
+        pthread_mutex_unlock(&sp->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&sp->lock);
+    if (sp->tail) sp->tail->next = b;
+    else          sp->head = b;
+    sp->tail = b;
+    pthread_cond_broadcast(&sp->cond);
+    pthread_mutex_unlock(&sp->lock);
+}
+
+/* 单队列上提交按顺序完成，只需要等最早的那个 fence */
+static void* sync_thread(void* arg)
+{
+    VgpuSyncPage* sp = arg;
+    vgpu_numa_bind_thread(sp->hd->numa_node);
+
+    pthread_mutex_lock(&sp->lock);
+    for (;;) {
+        while (!sp->head && !(sp->quit && sp->outstanding == 0))
+            pthread_cond_wait(&sp->cond, &sp->lock);
+        if (!sp->head) break;           // quit 且已经没有未完成的提交
+        VgpuSyncBatch* b = sp->head;
+        pthread_mutex_unlock(&sp->lock);
+
+        VkResult r = hostvk_wait_and_reset_fence(sp->hd, b->fence, SYNC_WAIT_SLICE_NS);
+        if (r == VK_TIMEOUT) {
+            pthread_mutex_lock(&sp->lock);
+            continue;
+        }
+        uint64_t gpu_ns = 0;
+        if (r == VK_SUCCESS) {
+            if (hostvk_submit_gpu_time(sp->hd, b->slot, &gpu_ns) != 0)
+                gpu_ns = monotonic_ns() - b->dispatch_ns;
+            signals_publish(sp, b->signals, b->count);
+        } else {
+            LOG("等待 host fence 失败: %d\n", r);
+            page_fail(sp, r);
+        }
+        vgpu_gpusched_complete(sp->tenant, gpu_ns);
+
+        pthread_mutex_lock(&sp->lock);
+        sp->head = b->next;
+        if (!sp->head) sp->tail = NULL;
+        if (r == VK_SUCCESS)
+            fence_put_locked(sp, b->fence);
+        else
+            hostvk_destroy_fence(sp->hd, b->fence);
+        batch_retire_locked(sp, b);
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return NULL;
+}
+
+VgpuSyncPage* vgpu_sync_create(HVkDevice* hd, pid_t vm)
+{
+    VgpuSyncPage* sp = calloc(1, sizeof(*sp));
+    if (!sp) return NULL;
+    sp->hd = hd;
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_cond_init(&sp->cond, NULL);
+
+    sp->tenant = vgpu_tenant_get(hd->phys_index, vm);
+    /* guest 轮询这页，放在 guest 内存那边；等待线程在 GPU 那边，只偶尔写一下 */
+    sp->shm    = vgpu_shm_create("vgpu-sync", sizeof(VkvgpuSyncPage), vgpu_numa_node_of_pid(vm));
+    if (!sp->tenant || !sp->shm) {
+        vgpu_sync_destroy(sp);
+        return NULL;
+    }
+    sp->page = sp->shm->ptr;
+
+    if (pthread_create(&sp->thread, NULL, sync_thread, sp) != 0) {
+        vgpu_sync_destroy(sp);
+        return NULL;
+    }
+    sp->thread_started = 1;
+    return sp;
+}
+
+void vgpu_sync_destroy(VgpuSyncPage* sp)
+{
+    if (!sp) return;
+    if (sp->thread_started) {
+        pthread_mutex_lock(&sp->lock);
+        /* 调度器里还在等 semaphore 的 batch 看到它就不再等 */
+        __atomic_store_n(&sp->quit, 1, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&sp->cond);
+        pthread_mutex_unlock(&sp->lock);
+        pthread_join(sp->thread, NULL);
+    }
+    for (uint32_t i = 0; i < sp->free_count; i++)
+        hostvk_destroy_fence(sp->hd, sp->free_fences[i]);
+    vgpu_tenant_put(sp->tenant);
+    vgpu_shm_destroy(sp->shm);
+    pthread_cond_destroy(&sp->cond);
+    pthread_mutex_destroy(&sp->lock);
+    free(sp);
+}
+
+VkResult vgpu_sync_submit(VgpuSyncPage* sp, const VkvgpuSyncSignal* signals, uint32_t count,
+                          const VkvgpuSyncSignal* waits, uint32_t wait_count,
+                          const VgpuSyncWork* work)
+{
+    VgpuSyncBatch* b = malloc(sizeof(*b) + (size_t)(count + wait_count) * sizeof(*signals));
+    if (!b) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    b->next  = NULL;
+    b->sp    = sp;
+    b->count = count;
+    b->wait_count = wait_count;
+    b->waits = b->signals + count;
+    if (work) b->work = *work;
+    else      memset(&b->work, 0, sizeof(b->work));
+    memcpy(b->signals, signals, (size_t)count * sizeof(*signals));
+    if (wait_count) memcpy(b->signals + count, waits, (size_t)wait_count * sizeof(*waits));
+
+    b->fence = fence_get(sp);
+    if (!b->fence) {
+        free(b);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    pthread_mutex_lock(&sp->lock);
+    sp->outstanding++;
+    pthread_mutex_unlock(&sp->lock);
+
+    b->job.tenant   = sp->tenant;
+    b->job.dispatch = batch_dispatch;
+    b->job.ready    = wait_count ? batch_ready : NULL;
+    vgpu_gpusched_enqueue(&b->job);
+    return VK_SUCCESS;
+}
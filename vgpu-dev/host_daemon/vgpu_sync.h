@@ -0,0 +1,59 @@
+// vgpu_sync.h
+// 完成通知：每个 guest device 一页 sync page 和一个等待线程。
+// 提交先交给 GPU 调度器（vgpu_gpusched.c），等的 semaphore 值都到了、轮到时挂一个 fence
+// 提交给 host 队列；
+// 等待线程按顺序等这些 fence，完成后把这次提交要 signal 的 slot 值写进共享页并唤醒 guest，
+// guest 不必轮询 daemon；同时把这次提交的 GPU 时间报给调度器记账。
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../guest_icd/vk_virtio_proto.h"
+#include "host_vulkan.h"
+#include "vgpu_shm.h"
+#include "vgpu_gpusched.h"
+
+typedef struct VgpuSyncBatch VgpuSyncBatch;
+
+#define VGPU_SYNC_FENCE_CACHE 16
+
+typedef struct {
+    HVkDevice*       hd;
+    VgpuTenant*      tenant;
+    VgpuShm*         shm;
+    VkvgpuSyncPage*  page;
+
+    pthread_t        thread;
+    int              thread_started;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    int              quit;
+    VgpuSyncBatch*   head;        // 已提交给 host 未完成，按提交顺序
+    VgpuSyncBatch*   tail;
+    uint32_t         outstanding; // 还在调度器里排队或在 GPU 上的
+    uint32_t         next_slot;   // 计时槽，只在调度线程里用
+
+    VkFence          free_fences[VGPU_SYNC_FENCE_CACHE];   // 已重置可复用的 host fence
+    uint32_t         free_count;
+} VgpuSyncPage;
+
+/* vm：guest 进程 pid，决定提交归到哪个 VM 的调度队列 */
+VgpuSyncPage* vgpu_sync_create(HVkDevice* hd, pid_t vm);
+/* 等所有已提交的 batch 完成后停掉等待线程 */
+void          vgpu_sync_destroy(VgpuSyncPage* sp);
+
+/* 提交里要执行的命令缓冲；done 在它执行完（或提交失败）后在等待线程里调用 */
+typedef struct {
+    VkCommandBuffer cb;
+    void          (*done)(void* arg);
+    void*           arg;
+} VgpuSyncWork;
+
+/*
+ * 提交一个完成点：排进调度器即返回，完成时把 signals 写进共享页；signals、waits 会被拷走。
+ * waits 里每个 slot 都到了 value 才交给 GPU，之前这个 VM 后面的提交也排着。
+ * work 为 NULL 时只有同步操作。返回错误时 work->done 不会被调用。
+ */
+VkResult      vgpu_sync_submit(VgpuSyncPage* sp, const VkvgpuSyncSignal* signals, uint32_t count,
+                               const VkvgpuSyncSignal* waits, uint32_t wait_count,
+                               const VgpuSyncWork* work);
@@ -0,0 +1,268 @@
+// vgpu_template.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vgpu_template.h"
+
+#define LOG(...) printf("[tmpl] " __VA_ARGS__)
+
+/* SPIR-V 里用到的几个操作码和修饰 */
+#define SPV_MAGIC             0x07230203u
+#define SPV_OP_TYPE_STRUCT    30
+#define SPV_OP_TYPE_POINTER   32
+#define SPV_OP_VARIABLE       59
+#define SPV_OP_DECORATE       71
+#define SPV_OP_MEMBER_DECORATE 72
+#define SPV_DEC_NON_WRITABLE  24
+#define SPV_DEC_BINDING       33
+#define SPV_DEC_DESCRIPTOR_SET 34
+
+/* 只跟踪这么多个 id，超了的按可写算 */
+#define SPV_TRACK 64
+
+typedef struct {
+    uint32_t id;
+    uint32_t value;     // 变量：binding 号；结构体：成员数；指针：指向的类型
+    uint64_t members;   // 结构体：带 NonWritable 的成员位图
+    int      flag;      // 变量：NonWritable；结构体：已见到定义
+} SpvEntry;
+
+static SpvEntry* spv_get(SpvEntry* tab, uint32_t* n, uint32_t id, int add)
+{
+    for (uint32_t i = 0; i < *n; i++)
+        if (tab[i].id == id) return &tab[i];
+    if (!add || *n == SPV_TRACK) return NULL;
+    tab[*n] = (SpvEntry){ .id = id };
+    return &tab[(*n)++];
+}
+
+/*
+ * set 0 上 shader 只读的 binding：变量带 NonWritable，或者 block 的每个成员都带
+ * （GLSL 的 readonly buffer）。只读的内存可以和别的 VM 共用（vgpu_dedup.c），
+ * 所以按 daemon 自己的解析来，不信 guest 的说法；看不懂的一律按可写算。
+ */
+static uint32_t spirv_readonly_bindings(const uint32_t* code, uint32_t size)
+{
+    uint32_t words = size / 4;
+    if (words < 5 || code[0] != SPV_MAGIC) return 0;
+
+    SpvEntry vars[SPV_TRACK], structs[SPV_TRACK], ptrs[SPV_TRACK];
+    uint32_t nvars = 0, nstructs = 0, nptrs = 0;
+    uint32_t set_nonzero[SPV_TRACK], nset = 0;
+
+    /* 修饰都在类型和变量之前，一遍扫完；同一个 binding 上有多个变量时要全都只读 */
+    uint32_t ro = 0, rw = 0;
+    for (uint32_t i = 5; i < words; ) {
+        uint32_t op = code[i] & 0xFFFFu, len = code[i] >> 16;
+        if (len == 0 || len > words - i) return 0;
+        const uint32_t* a = code + i + 1;
+        SpvEntry* e;
+
+        if (op == SPV_OP_DECORATE && len >= 3) {
+            if (a[1] == SPV_DEC_BINDING && len >= 4 && (e = spv_get(vars, &nvars, a[0], 1)))
+                e->value = a[2] + 1;
+            else if (a[1] == SPV_DEC_NON_WRITABLE && (e = spv_get(vars, &nvars, a[0], 1)))
+                e->flag = 1;
+            else if (a[1] == SPV_DEC_DESCRIPTOR_SET && len >= 4 && a[2] != 0 && nset < SPV_TRACK)
+                set_nonzero[nset++] = a[0];
+        } else if (op == SPV_OP_MEMBER_DECORATE && len >= 4 && a[2] == SPV_DEC_NON_WRITABLE) {
+            if (a[1] < 64 && (e = spv_get(structs, &nstructs, a[0], 1)))
+                e->members |= 1ull << a[1];
+        } else if (op == SPV_OP_TYPE_STRUCT && len >= 2) {
+            if ((e = spv_get(structs, &nstructs, a[0], 0))) {
+                e->value = len - 2;
+                e->flag  = 1;
+            }
+        } else if (op == SPV_OP_TYPE_POINTER && len >= 4) {
+            if ((e = spv_get(ptrs, &nptrs, a[0], 1)))
+                e->value = a[2];
+        } else if (op == SPV_OP_VARIABLE && len >= 4) {
+            SpvEntry* v = spv_get(vars, &nvars, a[1], 0);
+            if (v && v->value) {
+                int other_set = 0;
+                for (uint32_t k = 0; k < nset; k++)
+                    other_set |= set_nonzero[k] == a[1];
+                SpvEntry* p = spv_get(ptrs, &nptrs, a[0], 0);
+                SpvEntry* st = p ? spv_get(structs, &nstructs, p->value, 0) : NULL;
+                int readonly = v->flag ||
+                               (st && st->flag && st->value > 0 && st->value <= 64 &&
+                                st->members == (st->value == 64 ? ~0ull : (1ull << st->value) - 1));
+                uint32_t b = v->value - 1;
+                if (!other_set && b < VKVGPU_TEMPLATE_MAX_BINDINGS) {
+                    if (readonly) ro |= 1u << b;
+                    else          rw |= 1u << b;
+                }
+            }
+        }
+        i += len;
+    }
+    return ro & ~rw;
+}
+
+static VkResult compile_pipeline(void* arg)
+{
+    return hostvk_template_compile(arg);
+}
+
+VkResult vgpu_template_create(HVkDevice* hd, const VkvgpuCreateTemplateRequestPayload* req,
+                              const VkvgpuTemplateBinding* bindings, const uint32_t* code,
+                              int priority, VgpuTemplate** out)
+{
+    if (req->binding_count > VKVGPU_TEMPLATE_MAX_BINDINGS || req->push_size > VKVGPU_TEMPLATE_MAX_PUSH)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+    VgpuTemplate* t = calloc(1, sizeof(*t));
+    if (!t) return VK_ERROR_OUT_OF_HOST_MEMORY;
+    t->hd            = hd;
+    t->refs          = 1;
+    t->binding_count = req->binding_count;
+    t->push_size     = req->push_size;
+    memcpy(t->group_count, req->group_count, sizeof(t->group_count));
+
+    /* 每个 binding 号正好一个 */
+    for (uint32_t i = 0; i < req->binding_count; i++) {
+        uint32_t b = bindings[i].binding;
+        if (b >= req->binding_count || !bindings[i].memory_id || t->bindings[b].memory_id) {
+            free(t);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        t->bindings[b] = bindings[i];
+    }
+    for (uint32_t i = 0; i < HVK_TEMPLATE_SLOTS; i++) {
+        t->runs[i].t    = t;
+        t->runs[i].slot = i;
+    }
+
+    VkResult r = hostvk_template_create(hd, code, req->code_size, req->binding_count,
+                                        req->push_size, &t->ht);
+    if (r != VK_SUCCESS) {
+        free(t);
+        return r;
+    }
+    t->readonly = spirv_readonly_bindings(code, req->code_size);
+
+    /* 编译池没开就当场编，失败马上报 */
+    t->compile = vgpu_compile_submit(compile_pipeline, t->ht, priority);
+    if (!t->compile) {
+        r = hostvk_template_compile(t->ht);
+        if (r != VK_SUCCESS) {
+            hostvk_template_destroy(t->ht);
+            free(t);
+            return r;
+        }
+    }
+    *out = t;
+    return VK_SUCCESS;
+}
+
+void vgpu_template_put(VgpuTemplate* t)
+{
+    if (!t || __atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    if (t->dispatches)
+        LOG("模板 %p: 调用 %llu 次\n", (void*)t, (unsigned long long)t->dispatches);
+    vgpu_compile_release(t->compile);   // 没调用过就销毁：排队的撤掉，在编的等编完
+    hostvk_template_destroy(t->ht);
+    free(t);
+}
+
+int vgpu_template_update(VgpuTemplate* t, const VkvgpuDispatchTemplateRequestPayload* req,
+                         const VkvgpuTemplateBinding* bindings, const uint8_t* push)
+{
+    if (req->binding_count > t->binding_count ||
+        req->push_offset > t->push_size || req->push_size > t->push_size - req->push_offset)
+        return -1;
+    for (uint32_t i = 0; i < req->binding_count; i++)
+        if (bindings[i].binding >= t->binding_count || !bindings[i].memory_id) return -1;
+
+    for (uint32_t i = 0; i < req->binding_count; i++)
+        t->bindings[bindings[i].binding] = bindings[i];
+    memcpy(t->push + req->push_offset, push, req->push_size);
+    for (int d = 0; d < 3; d++)
+        if (req->group_count[d]) t->group_count[d] = req->group_count[d];
+    return 0;
+}
+
+static void run_release(VgpuTemplateRun* run)
+{
+    for (uint32_t i = 0; i < run->pinned; i++)
+        vgpu_mem_release(run->mems[i]);
+    run->pinned = 0;
+}
+
+/* 等待线程里：这次调用执行完了 */
+static void run_done(void* arg)
+{
+    VgpuTemplateRun* run = arg;
+    VgpuTemplate*    t   = run->t;
+    run_release(run);
+    hostvk_template_retire(t->ht, run->slot);
+    vgpu_template_put(t);
+}
+
+VkResult vgpu_template_dispatch(VgpuTemplate* t, VgpuContext* ctx, VgpuSyncPage* sp,
+                                const VkvgpuSyncSignal* signals, uint32_t count)
+{
+    if (sp->hd != t->hd) return VK_ERROR_DEVICE_LOST;
+
+    /* 第一次调用：pipeline 要编好才能录命令缓冲，先于 acquire，等的时候不占着内存 */
+    if (t->compile) {
+        t->compiled = vgpu_compile_wait(t->compile);
+        vgpu_compile_release(t->compile);
+        t->compile = NULL;
+    }
+    if (t->compiled != VK_SUCCESS) return t->compiled;
+
+    /* 绑定的内存这次调用执行完之前不能被换出 */
+    VgpuMem* mems[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    HVkTemplateBinding hb[VKVGPU_TEMPLATE_MAX_BINDINGS];
+    uint32_t pinned = 0;
+    VkResult r = VK_SUCCESS;
+    /* 可写的先 acquire：写时复制要等内存上别的引用都放掉，包括本次只读绑定的那一份 */
+    for (int pass = 0; pass < 2 && r == VK_SUCCESS; pass++) {
+        for (uint32_t i = 0; i < t->binding_count && r == VK_SUCCESS; i++) {
+            int write = !(t->readonly & (1u << i));
+            if (write != (pass == 0)) continue;
+            const VkvgpuTemplateBinding* b = &t->bindings[i];
+            VgpuMem* m = vgpu_ctx_obj_lookup(ctx, b->memory_id, VGPU_OBJ_MEMORY);
+            HVkMemory* hm = m ? vgpu_mem_acquire(m, write, &r) : NULL;
+            if (!hm) {
+                if (!m) r = VK_ERROR_MEMORY_MAP_FAILED;
+                break;
+            }
+            mems[pinned++] = m;
+            if (hm->dev != t->hd || b->range == 0 || b->offset % t->hd->storage_align != 0 ||
+                b->offset > hm->size || b->range > hm->size - b->offset) {
+                LOG("binding %u 超出内存范围或没对齐\n", i);
+                r = VK_ERROR_MEMORY_MAP_FAILED;
+                break;
+            }
+            hb[i] = (HVkTemplateBinding){ hm, b->offset, b->range };
+        }
+    }
+
+    uint32_t slot = 0;
+    VkCommandBuffer cb = VK_NULL_HANDLE;
+    if (r == VK_SUCCESS) {
+        HVkTemplateArgs args = { hb, t->push, { t->group_count[0], t->group_count[1], t->group_count[2] } };
+        r = hostvk_template_prepare(t->ht, &args, &slot, &cb);
+    }
+    if (r != VK_SUCCESS) {
+        for (uint32_t i = 0; i < pinned; i++) vgpu_mem_release(mems[i]);
+        return r;
+    }
+
+    VgpuTemplateRun* run = &t->runs[slot];
+    memcpy(run->mems, mems, pinned * sizeof(mems[0]));
+    run->pinned = pinned;
+    __atomic_add_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+
+    VgpuSyncWork work = { cb, run_done, run };
+    r = vgpu_sync_submit(sp, signals, count, NULL, 0, &work);
+    if (r != VK_SUCCESS) {
+        run_done(run);
+        return r;
+    }
+    t->dispatches++;
+    return VK_SUCCESS;
+}
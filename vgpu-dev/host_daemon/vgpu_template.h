@@ -0,0 +1,56 @@
+// vgpu_template.h
+// guest 的 compute 调度模板（VK_VGPU_dispatch_template）：当前的绑定 / push constant / 组数
+// 按 guest 的 ID 存在这里，每次调用只把 guest 带来的变化合进来，再交给 host_template.c
+// 取一个录好的命令缓冲提交。调用在途期间模板和绑定的内存都被引用住。
+#pragma once
+#include <stdint.h>
+
+#include "../guest_icd/vk_virtio_proto.h"
+#include "host_vulkan.h"
+#include "vgpu_compile.h"
+#include "vgpu_context.h"
+#include "vgpu_memquota.h"
+#include "vgpu_sync.h"
+
+typedef struct VgpuTemplate VgpuTemplate;
+
+/* 每个在途调用一份，和 host 模板的槽一一对应 */
+typedef struct {
+    VgpuTemplate* t;
+    uint32_t      slot;
+    uint32_t      pinned;
+    VgpuMem*      mems[VKVGPU_TEMPLATE_MAX_BINDINGS];
+} VgpuTemplateRun;
+
+struct VgpuTemplate {
+    HVkTemplate*          ht;
+    HVkDevice*            hd;
+    uint32_t              refs;          // 对象表一份，每个在途调用一份
+    uint32_t              binding_count;
+    uint32_t              push_size;
+    uint32_t              readonly;      // shader 里只读的 binding 位掩码，daemon 自己从 SPIR-V 解析
+    VkvgpuTemplateBinding bindings[VKVGPU_TEMPLATE_MAX_BINDINGS];   // 下标 = binding 号
+    uint8_t               push[VKVGPU_TEMPLATE_MAX_PUSH];
+    uint32_t              group_count[3];
+    VgpuTemplateRun       runs[HVK_TEMPLATE_SLOTS];
+    uint64_t              dispatches;
+    VgpuCompileJob*       compile;       // pipeline 还在后台编译，第一次调用时等它
+    VkResult              compiled;      // 编译结果，compile 为 NULL 后有效
+};
+
+/*
+ * req 后面的绑定和 SPIR-V 已由调用者按 payload 长度核对过。
+ * pipeline 按 priority（VgpuQosClass）排进后台编译，编译失败在第一次调用时才报出来。
+ */
+VkResult vgpu_template_create(HVkDevice* hd, const VkvgpuCreateTemplateRequestPayload* req,
+                              const VkvgpuTemplateBinding* bindings, const uint32_t* code,
+                              int priority, VgpuTemplate** out);
+/* 对象表放手；最后一个在途调用完成时才真正销毁 */
+void     vgpu_template_put(VgpuTemplate* t);
+
+/* 把一次调用带来的变化合进模板；参数不合法返回 -1，模板不变 */
+int      vgpu_template_update(VgpuTemplate* t, const VkvgpuDispatchTemplateRequestPayload* req,
+                              const VkvgpuTemplateBinding* bindings, const uint8_t* push);
+/* 按模板当前状态提交一次，内存 ID 在 ctx 里解析 */
+VkResult vgpu_template_dispatch(VgpuTemplate* t, VgpuContext* ctx, VgpuSyncPage* sp,
+                                const VkvgpuSyncSignal* signals, uint32_t count);
@@ -0,0 +1,130 @@
+// convert_bench.c
+// daemon 格式转换核的正确性检查 + 吞吐基准。
+// 编译：gcc -O2 -o convert_bench convert_bench.c ../host_daemon/vgpu_convert.c -lpthread
+// 用法：./convert_bench [MB]   （每个核的输入大小，默认 64MB）
+// 每个核先和同名的标量版本逐字节比对（长度不是整块、起点不对齐），再测吞吐；
+// memcpy 的带宽一起打出来作参照，上传/读回路径上的核应当接近它。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../host_daemon/vgpu_convert.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(uint8_t* p, size_t n)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        p[i] = (uint8_t)x;
+    }
+}
+
+static const VgpuConvertKernel* find_scalar(const VgpuConvertKernel* ks, uint32_t n, const char* name)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (strcmp(ks[i].name, name) == 0 && strcmp(ks[i].isa, "scalar") == 0)
+            return &ks[i];
+    }
+    return NULL;
+}
+
+/* 各种长度和错位下与标量版本比对 */
+static int check(const VgpuConvertKernel* k, const VgpuConvertKernel* ref)
+{
+    static const size_t lens[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000, 4099 };
+    size_t max = 4099 + 64;
+    uint8_t* src = malloc(max * 4 + 64);
+    uint8_t* a   = malloc(max * 4 + 64);
+    uint8_t* b   = malloc(max * 4 + 64);
+    fill_random(src, max * 4 + 64);
+
+    int bad = 0;
+    for (size_t li = 0; li < sizeof(lens) / sizeof(lens[0]) && !bad; li++) {
+        for (size_t mis = 0; mis < 4 && !bad; mis++) {
+            size_t n = lens[li];
+            /* 末尾多放一段哨兵，写越界也能看出来 */
+            memset(a, 0xA5, max * 4 + 64);
+            memset(b, 0xA5, max * 4 + 64);
+            k->fn(a + mis, src + mis, n);
+            ref->fn(b + mis, src + mis, n);
+            if (memcmp(a, b, max * 4 + 64) != 0) {
+                printf("  MISMATCH %s/%s n=%zu misalign=%zu\n", k->name, k->isa, n, mis);
+                bad = 1;
+            }
+        }
+    }
+    free(src);
+    free(a);
+    free(b);
+    return bad;
+}
+
+/* 跑满约 0.5 秒，返回每秒处理的像素数 */
+static double bench(VgpuConvertFn fn, uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    fn(dst, src, pixels);   // 预热，页都摸一遍
+    uint32_t iters = 0;
+    double t0 = now_sec(), t;
+    do {
+        fn(dst, src, pixels);
+        iters++;
+        t = now_sec();
+    } while (t - t0 < 0.5);
+    return (double)pixels * iters / (t - t0);
+}
+
+static void memcpy_fn(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    memcpy(dst, src, pixels * 4);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 64;
+    if (mb == 0) mb = 64;
+    size_t pixels = mb * 1024 * 1024 / 4;
+
+    const VgpuConvertKernel* ks;
+    uint32_t n = vgpu_convert_kernels(&ks);
+
+    uint8_t* src = malloc(pixels * 4);
+    uint8_t* dst = malloc(pixels * 4);
+    if (!src || !dst) {
+        printf("out of memory\n");
+        return 1;
+    }
+    fill_random(src, pixels * 4);
+
+    double pps = bench(memcpy_fn, dst, src, pixels);
+    printf("%-10s %-7s %10s %10s\n", "kernel", "isa", "Mpix/s", "GB/s(r+w)");
+    printf("%-10s %-7s %10.0f %10.2f\n", "memcpy", "-", pps / 1e6, pps * 8 / 1e9);
+
+    int failed = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const VgpuConvertKernel* k = &ks[i];
+        const VgpuConvertKernel* ref = find_scalar(ks, n, k->name);
+        if (ref && ref != k && check(k, ref)) {
+            failed = 1;
+            continue;
+        }
+        pps = bench(k->fn, dst, src, pixels);
+        printf("%-10s %-7s %10.0f %10.2f\n", k->name, k->isa, pps / 1e6,
+               pps * (k->src_bpp + k->dst_bpp) / 1e9);
+    }
+
+    free(src);
+    free(dst);
+    printf(failed ? "FAILED\n" : "OK\n");
+    return failed;
+}
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+# gen_dispatch.py
+# 生成 guest ICD 的入口点表（编译期完美哈希）和 daemon 的命令分发表。
+#
+#   python3 tools/gen_dispatch.py [--registry path/to/vk.xml]
+#
+# ICD 入口点：扫描 guest_icd/*.c 里的 "VKAPI_ATTR ... VKAPI_CALL vkXxx(" 定义，
+# 按第一个参数的类型分级（与 loader 的规则一致）。给了 vk.xml 时用注册表里的
+# 原型核对名字和分级，漏写/写错会直接报错。
+# daemon 分发表：扫描 vk_virtio_proto.h 的 VkvgpuCommandType，
+# VKVGPU_CMD_FOO_BAR 对应处理函数 cmd_foo_bar，标了“全局命令”的不进表。
+
+import argparse
+import glob
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+ICD_DIR = os.path.join(ROOT, "guest_icd")
+DAEMON_DIR = os.path.join(ROOT, "host_daemon")
+
+GLOBAL_CMDS = {
+    "vkCreateInstance",
+    "vkEnumerateInstanceExtensionProperties",
+    "vkEnumerateInstanceLayerProperties",
+    "vkEnumerateInstanceVersion",
+    "vkGetInstanceProcAddr",
+}
+
+# 本 ICD 自己的厂商扩展（vk_vgpu_*.h），不在 vk.xml 里
+VENDOR_SUFFIX = "VGPU"
+
+LEVELS = ["VKVGPU_EP_GLOBAL", "VKVGPU_EP_INSTANCE",
+          "VKVGPU_EP_PHYSICAL_DEVICE", "VKVGPU_EP_DEVICE"]
+
+DEF_RE = re.compile(r"VKAPI_ATTR\s+[\w\s\*]+?\s+VKAPI_CALL\s+(vk[A-Z]\w*)\s*\(([^)]*)\)\s*\{",
+                    re.S)
+CMD_RE = re.compile(r"^\s*VKVGPU_CMD_(\w+)\s*=\s*(\d+)\s*,(.*)$", re.M)
+
+
+def level_of(name, first_type):
+    if name in GLOBAL_CMDS:
+        return 0
+    if first_type == "VkInstance":
+        return 1
+    if first_type == "VkPhysicalDevice":
+        return 2
+    if first_type in ("VkDevice", "VkQueue", "VkCommandBuffer"):
+        return 3
+    return None
+
+
+def first_param_type(params):
+    first = params.split(",")[0]
+    first = first.replace("const", " ").replace("*", " ")
+    toks = first.split()
+    return toks[0] if toks else ""
+
+
+def scan_icd():
+    eps = {}
+    for path in sorted(glob.glob(os.path.join(ICD_DIR, "*.c"))):
+        with open(path, encoding="utf-8") as f:
+            src = f.read()
+        for m in DEF_RE.finditer(src):
+            name, params = m.group(1), m.group(2)
+            lvl = level_of(name, first_param_type(params))
+            if lvl is None:
+                sys.exit("%s: cannot classify %s" % (os.path.basename(path), name))
+            eps[name] = lvl
+    return eps
+
+
+def check_registry(eps, registry):
+    root = ET.parse(registry).getroot()
+    proto_types = {}
+    for cmd in root.iter("command"):
+        proto = cmd.find("proto")
+        if proto is None:
+            continue
+        name = proto.findtext("name")
+        params = cmd.findall("param")
+        ptype = params[0].findtext("type") if params else ""
+        proto_types[name] = ptype
+    for cmd in root.iter("command"):
+        alias = cmd.get("alias")
+        if alias and cmd.get("name") and alias in proto_types:
+            proto_types[cmd.get("name")] = proto_types[alias]
+
+    for name, lvl in sorted(eps.items()):
+        if name.endswith(VENDOR_SUFFIX):
+            continue
+        if name not in proto_types:
+            sys.exit("%s is not a Vulkan command in %s" % (name, registry))
+        want = level_of(name, proto_types[name])
+        if want != lvl:
+            sys.exit("%s: level %s in ICD, %s in registry" % (name, LEVELS[lvl], LEVELS[want]))
+
+
+def fnv1a(s, seed):
+    h = (0x811C9DC5 ^ seed) & 0xFFFFFFFF
+    for c in s.encode():
+        h ^= c
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    # 乘法只把低位扩散到高位：不折一下的话低位（槽号）根本不受种子高位影响
+    return h ^ (h >> 16)
+
+
+def perfect_hash(names):
+    min_bits = 1
+    while (1 << min_bits) < 2 * len(names):
+        min_bits += 1
+    # 装载率 1/2 时通常几千个种子内就能找到；找不到就把表放大一倍再试
+    for bits in range(min_bits, min_bits + 3):
+        mask = (1 << bits) - 1
+        for seed in range(1 << 18):
+            slots = {}
+            for n in names:
+                slot = fnv1a(n, seed) & mask
+                if slot in slots:
+                    break
+                slots[slot] = n
+            else:
+                return seed, bits, slots
+    sys.exit("no perfect hash seed found")
+
+
+def write_if_changed(path, text):
+    old = None
+    if os.path.exists(path):
+        with open(path, encoding="utf-8") as f:
+            old = f.read()
+    if old != text:
+        with open(path, "w", encoding="utf-8") as f:
+            f.write(text)
+        print("wrote", os.path.relpath(path, ROOT))
+
+
+def gen_icd(eps):
+    seed, bits, slots = perfect_hash(sorted(eps))
+    out = []
+    out.append("// icd_entrypoints.h")
+    out.append("// 由 tools/gen_dispatch.py 生成，不要手改。")
+    out.append("#pragma once")
+    out.append("")
+    out.append("#include <stdint.h>")
+    out.append("#include <string.h>")
+    out.append("")
+    out.append("#include <vulkan/vulkan.h>")
+    out.append("")
+    out.append("typedef enum {")
+    for i, l in enumerate(LEVELS):
+        out.append("    %s = %d," % (l, i))
+    out.append("} VkvgpuEntrypointLevel;")
+    out.append("")
+    out.append("typedef struct {")
+    out.append("    const char*        name;")
+    out.append("    PFN_vkVoidFunction fn;")
+    out.append("    uint32_t           level;")
+    out.append("} VkvgpuEntrypoint;")
+    out.append("")
+    out.append("#define VKVGPU_EP_COUNT      %du" % len(eps))
+    out.append("#define VKVGPU_EP_HASH_SEED  0x%08xu" % seed)
+    out.append("#define VKVGPU_EP_TABLE_MASK 0x%xu" % ((1 << bits) - 1))
+    out.append("")
+    out.append("static inline uint32_t vkvgpu_ep_hash(const char* s)")
+    out.append("{")
+    out.append("    uint32_t h = 0x811C9DC5u ^ VKVGPU_EP_HASH_SEED;")
+    out.append("    while (*s) {")
+    out.append("        h ^= (uint8_t)*s++;")
+    out.append("        h *= 0x01000193u;")
+    out.append("    }")
+    out.append("    return h ^ (h >> 16);")
+    out.append("}")
+    out.append("")
+    out.append("static const VkvgpuEntrypoint vkvgpu_ep_table[VKVGPU_EP_TABLE_MASK + 1] = {")
+    for slot in sorted(slots):
+        n = slots[slot]
+        out.append("    [%3d] = { \"%s\", (PFN_vkVoidFunction)%s, %s }," % (slot, n, n, LEVELS[eps[n]]))
+    out.append("};")
+    out.append("")
+    out.append("/* 一次哈希 + 一次 strcmp */")
+    out.append("static inline const VkvgpuEntrypoint* vkvgpu_ep_lookup(const char* name)")
+    out.append("{")
+    out.append("    const VkvgpuEntrypoint* ep = &vkvgpu_ep_table[vkvgpu_ep_hash(name) & VKVGPU_EP_TABLE_MASK];")
+    out.append("    if (!ep->name || strcmp(ep->name, name) != 0) return NULL;")
+    out.append("    return ep;")
+    out.append("}")
+    out.append("")
+    write_if_changed(os.path.join(ICD_DIR, "icd_entrypoints.h"), "\n".join(out))
+
+
+def gen_daemon():
+    with open(os.path.join(ICD_DIR, "vk_virtio_proto.h"), encoding="utf-8") as f:
+        src = f.read()
+    cmds = []
+    for m in CMD_RE.finditer(src):
+        suffix, num, rest = m.group(1), int(m.group(2)), m.group(3)
+        cmds.append((num, suffix, "全局命令" in rest))
+    if not cmds:
+        sys.exit("no VKVGPU_CMD_* found")
+    size = max(c[0] for c in cmds) + 1
+
+    out = []
+    out.append("// vgpu_cmd_table.h")
+    out.append("// 由 tools/gen_dispatch.py 生成，不要手改。")
+    out.append("// 只能被 vgpu_daemon.c 包含：处理函数 cmd_xxx 都在那里定义。")
+    out.append("#pragma once")
+    out.append("")
+    out.append("typedef void (*VgpuCmdHandler)(VgpuContext *ctx, VgpuCmd *cmd);")
+    out.append("")
+    out.append("#define VGPU_CMD_TABLE_SIZE %du" % size)
+    out.append("")
+    out.append("static const VgpuCmdHandler vgpu_cmd_table[VGPU_CMD_TABLE_SIZE] = {")
+    for num, suffix, is_global in sorted(cmds):
+        if is_global:
+            continue
+        out.append("    [VKVGPU_CMD_%s] = cmd_%s," % (suffix, suffix.lower()))
+    out.append("};")
+    out.append("")
+    write_if_changed(os.path.join(DAEMON_DIR, "vgpu_cmd_table.h"), "\n".join(out))
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--registry", help="vk.xml，用来核对 ICD 入口点")
+    args = ap.parse_args()
+
+    eps = scan_icd()
+    if args.registry:
+        check_registry(eps, args.registry)
+    gen_icd(eps)
+    gen_daemon()
+
+
+if __name__ == "__main__":
+    main()